@@ -52,6 +52,8 @@ extern "C" {
 #define APIC_TIMER_DIVCODE APIC_TIMER_DIV_16
     
 #define APIC_BASE_MSR        0x0000001b
+
+#define IA32_TSC_DEADLINE_MSR 0x6e0
     
 #define IA32_APIC_BASE_MSR_BSP    0x100 
 #define IA32_APIC_BASE_MSR_ENABLE 0x800
@@ -236,7 +238,9 @@ struct apic_dev {
     uint64_t cycles_per_us;
     uint64_t cycles_per_tick;
     uint8_t  timer_set;
+    uint8_t  tsc_deadline;  // timer is in TSC-deadline mode
     uint32_t current_ticks; // timeout currently being computed
+    uint64_t current_deadline; // same, in TSC-deadline mode
     uint64_t timer_count;
     int      in_timer_interrupt;
     int      in_kick_interrupt;
@@ -365,6 +369,8 @@ uint32_t apic_realtime_to_ticks(struct apic_dev *apic, uint64_t ns);
 uint64_t apic_realtime_to_cycles(struct apic_dev *apic, uint64_t ns);
 // ns
 uint64_t apic_cycles_to_realtime(struct apic_dev *apic, uint64_t cycles);
+// absolute ns (as from apic_cycles_to_realtime(rdtsc())) to TSC
+uint64_t apic_realtime_to_tsc(struct apic_dev *apic, uint64_t ns);
 
 void     apic_set_oneshot_timer(struct apic_dev *apic, uint32_t ticks);
 
@@ -376,6 +382,16 @@ void     apic_set_oneshot_timer(struct apic_dev *apic, uint32_t ticks);
 typedef enum {UNCOND, IF_EARLIER, IF_LATER} nk_timer_condition_t;
 void     apic_update_oneshot_timer(struct apic_dev *apic,  uint32_t ticks, 
 				   nk_timer_condition_t cond);
+
+// TSC-deadline mode equivalents, tsc is an absolute rdtsc() value
+// These may only be used if apic->tsc_deadline is set, in which
+// case the oneshot functions above convert to them
+void     apic_set_deadline_timer(struct apic_dev *apic, uint64_t tsc);
+void     apic_update_deadline_timer(struct apic_dev *apic, uint64_t tsc,
+				    nk_timer_condition_t cond);
+
+// time until the timer fires, in either mode (ns)
+uint64_t apic_timer_remaining_ns(struct apic_dev *apic);
 			       
 
 
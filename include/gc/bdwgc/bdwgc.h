@@ -33,11 +33,24 @@ void nk_gc_bdwgc_deinit();
 // force a GC -r returns 0 if successful
 int  nk_gc_bdwgc_collect();
 
+struct nk_gc_bdwgc_stats {
+    uint64_t num_gcs;         // collections since boot
+    uint64_t num_pauses;      // world stops since the last reset
+    uint64_t pause_ns_total;
+    uint64_t pause_ns_max;
+    uint64_t markers;         // CPUs that mark in a collection
+    uint64_t heap_bytes;
+};
+
+void nk_gc_bdwgc_get_stats(struct nk_gc_bdwgc_stats *stats);
+void nk_gc_bdwgc_reset_stats();
+
 void *nk_gc_bdwgc_thread_state_init(struct nk_thread *thread);
 void  nk_gc_bdwgc_thread_state_deinit(struct nk_thread *thread);
 
 #ifdef NAUT_CONFIG_TEST_BDWGC
 int  nk_gc_bdwgc_test();
+int  nk_gc_bdwgc_bench(int max_threads, uint64_t allocs);
 #endif
 
 #endif
@@ -38,14 +38,72 @@ struct nk_gc_pdsgc_stats
     uint64_t total_bytes;
     uint64_t min_block;
     uint64_t max_block;
+
+    // marking, which runs on all CPUs while the world is stopped
+    uint64_t pause_ns;       // how long the world was stopped
+    uint64_t mark_ns;        // how much of that was marking
+    uint64_t mark_cpus;
+    uint64_t marked_blocks;  // reachable blocks
+    uint64_t marked_bytes;
+    uint64_t scanned_bytes;  // memory examined for pointers
+    uint64_t steals;         // times a CPU took work from another
+
+    // an incremental cycle stops the world more than once, in
+    // which case pause_ns is the total
+    uint64_t slices;
+    uint64_t max_pause_ns;
+    uint64_t budget_ns;      // the last slice's budget
 };
 
 // Note that all the following functions stop the world
-// for the duration.  
+// for the duration.
 
 // Force a GC -r returns 0 if successful
 int  nk_gc_pdsgc_collect(struct nk_gc_pdsgc_stats *stats);
 
+#ifdef NAUT_CONFIG_INCREMENTAL_PDSGC
+// Incremental collection
+//
+// A low priority thread marks in slices, each stopping the world
+// for at most the pause budget, then rescans the roots in one final
+// pause and sweeps while the world runs.  Blocks allocated during
+// a cycle survive it.
+//
+// While a cycle is marking, storing a pointer to a collected block
+// into another one must be followed by the write barrier on the
+// stored pointer, or the block may be freed while still reachable.
+
+// Request a cycle and return without waiting for it
+int  nk_gc_pdsgc_start_incremental();
+
+// Request a cycle and wait for it, returns 0 if successful
+int  nk_gc_pdsgc_collect_incremental(struct nk_gc_pdsgc_stats *stats);
+
+// Change the maximum pause per slice
+void nk_gc_pdsgc_set_max_pause(uint64_t ns);
+
+extern volatile int nk_gc_pdsgc_marking;
+void nk_gc_pdsgc_shade(void *ptr);
+
+static inline void nk_gc_pdsgc_write_barrier(void *ptr)
+{
+    if (nk_gc_pdsgc_marking) {
+	nk_gc_pdsgc_shade(ptr);
+    }
+}
+#else
+static inline void nk_gc_pdsgc_write_barrier(void *ptr)
+{
+}
+#endif
+
+// Store ptr into *slot with the write barrier
+static inline void nk_gc_pdsgc_write(void **slot, void *ptr)
+{
+    *slot = ptr;
+    nk_gc_pdsgc_write_barrier(ptr);
+}
+
 // Do leak detection
 int  nk_gc_pdsgc_leak_detect(struct nk_gc_pdsgc_stats *stats);
 
@@ -57,4 +57,6 @@
 #define EPIPE       32  /* Broken pipe */
 #define EDOM        33  /* Math argument out of domain of func */
 #define ERANGE      34  /* Math result not representable */
+#define EDEADLK     35  /* Resource deadlock would occur */
+#define ETIMEDOUT  110  /* Connection timed out */
 #endif
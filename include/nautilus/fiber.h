@@ -112,6 +112,10 @@ typedef struct nk_fiber {
 // Returns the fiber that is currently running on this CPU
 nk_fiber_t *nk_fiber_current();
 
+// Returns the fiber the caller is running in, or NULL if the caller
+// is an ordinary thread or the idle fiber
+nk_fiber_t *nk_fiber_current_or_null();
+
 // Create a fiber but do not launch it
 int nk_fiber_create(nk_fiber_fun_t fun,
                     void *input,
@@ -165,6 +169,14 @@ nk_fiber_t *nk_fiber_fork();
 // Causes the currently running fiber to wait on the specified fiber's wait queue (waits until that fiber exits) 
 int nk_fiber_join(nk_fiber_t *wait_on);
 
+// Blocks the current fiber; caller holds lock and has queued the fiber's wait_node
+// on a list protected by it. lock is released once the fiber is switched away.
+// returns -1 if not called from a (non-idle) fiber, 0 after being woken
+int nk_fiber_park(spinlock_t *lock);
+
+// Makes a fiber blocked in nk_fiber_park runnable again (on its last CPU)
+int nk_fiber_wake(nk_fiber_t *f);
+
 // Set virtual console of the current fiber
 void nk_fiber_set_vc(struct nk_virtual_console *vc);
 
@@ -0,0 +1,132 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#ifndef __FIBER_SYNC_H__
+#define __FIBER_SYNC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <nautilus/spinlock.h>
+#include <nautilus/list.h>
+#include <nautilus/fiber.h>
+
+/*
+  Fiber-aware blocking primitives
+
+  A fiber that blocks on one of these is parked on the object's waiter
+  list (via its wait_node) and taken off the sched queues entirely.
+  It becomes runnable again only when it is handed the object, so
+  blocked fibers cost nothing and the fiber thread never blocks.
+
+  Blocking calls, and nk_fiber_mutex_try_lock, whose owner is a
+  fiber, must be made from a fiber. Other non-blocking calls (unlock,
+  signal, broadcast, up, done, the other try_*) may also be made from
+  ordinary threads. All objects are caller-allocated and need no
+  memory other than the channel's buffer.
+*/
+
+typedef struct nk_fiber_mutex {
+    spinlock_t        lock;
+    nk_fiber_t       *owner;
+    struct list_head  waiters;
+} nk_fiber_mutex_t;
+
+int  nk_fiber_mutex_init(nk_fiber_mutex_t *m);
+int  nk_fiber_mutex_destroy(nk_fiber_mutex_t *m);
+int  nk_fiber_mutex_lock(nk_fiber_mutex_t *m);
+// 0 return indicates we have the lock
+int  nk_fiber_mutex_try_lock(nk_fiber_mutex_t *m);
+int  nk_fiber_mutex_unlock(nk_fiber_mutex_t *m);
+
+
+typedef struct nk_fiber_condvar {
+    spinlock_t        lock;
+    struct list_head  waiters;
+} nk_fiber_condvar_t;
+
+int  nk_fiber_condvar_init(nk_fiber_condvar_t *c);
+int  nk_fiber_condvar_destroy(nk_fiber_condvar_t *c);
+// m must be held by the caller, and is held again on return
+int  nk_fiber_condvar_wait(nk_fiber_condvar_t *c, nk_fiber_mutex_t *m);
+int  nk_fiber_condvar_signal(nk_fiber_condvar_t *c);
+int  nk_fiber_condvar_broadcast(nk_fiber_condvar_t *c);
+
+
+typedef struct nk_fiber_semaphore {
+    spinlock_t        lock;
+    int               count;
+    struct list_head  waiters;
+} nk_fiber_semaphore_t;
+
+int  nk_fiber_semaphore_init(nk_fiber_semaphore_t *s, int init_count);
+int  nk_fiber_semaphore_destroy(nk_fiber_semaphore_t *s);
+int  nk_fiber_semaphore_down(nk_fiber_semaphore_t *s);
+// 0 return indicates success
+int  nk_fiber_semaphore_try_down(nk_fiber_semaphore_t *s);
+int  nk_fiber_semaphore_up(nk_fiber_semaphore_t *s);
+
+
+typedef struct nk_fiber_waitgroup {
+    spinlock_t        lock;
+    int               count;
+    struct list_head  waiters;
+} nk_fiber_waitgroup_t;
+
+int  nk_fiber_waitgroup_init(nk_fiber_waitgroup_t *w);
+int  nk_fiber_waitgroup_destroy(nk_fiber_waitgroup_t *w);
+// negative resulting count is an error
+int  nk_fiber_waitgroup_add(nk_fiber_waitgroup_t *w, int delta);
+#define nk_fiber_waitgroup_done(w) nk_fiber_waitgroup_add(w,-1)
+// waits until the count drops to zero
+int  nk_fiber_waitgroup_wait(nk_fiber_waitgroup_t *w);
+
+
+// Bounded FIFO channel of pointer-sized values
+typedef struct nk_fiber_channel {
+    spinlock_t        lock;
+    int               closed;
+    uint64_t          capacity;
+    uint64_t          count;
+    uint64_t          head;        // next slot to receive from
+    void            **buf;
+    struct list_head  senders;     // fibers waiting for space
+    struct list_head  receivers;   // fibers waiting for data
+} nk_fiber_channel_t;
+
+// capacity must be at least one
+int  nk_fiber_channel_init(nk_fiber_channel_t *ch, uint64_t capacity);
+int  nk_fiber_channel_destroy(nk_fiber_channel_t *ch);
+// 0 => sent, -1 => channel is closed
+int  nk_fiber_channel_send(nk_fiber_channel_t *ch, void *val);
+// 0 => received, -1 => channel is closed and drained
+int  nk_fiber_channel_recv(nk_fiber_channel_t *ch, void **val);
+// 0 => success, 1 => would block, -1 => closed (and drained for recv)
+int  nk_fiber_channel_try_send(nk_fiber_channel_t *ch, void *val);
+int  nk_fiber_channel_try_recv(nk_fiber_channel_t *ch, void **val);
+// wakes all blocked senders and receivers; later sends fail
+int  nk_fiber_channel_close(nk_fiber_channel_t *ch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
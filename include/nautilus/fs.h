@@ -115,6 +115,9 @@ int        nk_fs_ftruncate(nk_fs_fd_t fd, off_t len);
 off_t      nk_fs_seek(nk_fs_fd_t fd, off_t position, int whence);
 ssize_t    nk_fs_tell(nk_fs_fd_t fd);
 ssize_t    nk_fs_read(nk_fs_fd_t fd, void *buf, size_t len);
+// read at offset, without using or changing the file position,
+// so several threads may read one file at once
+ssize_t    nk_fs_pread(nk_fs_fd_t fd, void *buf, size_t len, off_t offset);
 ssize_t    nk_fs_write(nk_fs_fd_t fd, void *buf, size_t len);
 int        nk_fs_close(nk_fs_fd_t fd);
 
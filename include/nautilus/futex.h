@@ -0,0 +1,98 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#ifndef __FUTEX_H__
+#define __FUTEX_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Futexes
+
+  Any 32 bit word can be slept on.  Sleepers are kept in a fixed
+  table of buckets hashed by the word's address, so unlike a wait
+  queue, nothing is allocated or registered per object.  As with
+  Linux futexes, the kernel knows nothing about what the word means,
+  and waiters must recheck their condition after a return, since
+  wakeups may be spurious.
+
+  These are for threads.  nk_futex_wake may be used from interrupt
+  context.
+*/
+
+#define NK_FUTEX_AGAIN    -1   // *addr was not the expected value
+#define NK_FUTEX_TIMEDOUT -2   // the timeout expired first
+
+// Sleep if *addr == expected, checked atomically with respect to
+// nk_futex_wake on addr.  timeout_ns is relative, 0 means forever.
+// Returns 0 on wakeup, or one of the codes above
+int nk_futex_wait(volatile uint32_t *addr, uint32_t expected, uint64_t timeout_ns);
+
+// Wake up to n threads sleeping on addr, returns how many were woken
+int nk_futex_wake(volatile uint32_t *addr, int n);
+
+#define NK_FUTEX_WAKE_ALL 0x7fffffff
+
+
+//
+// A mutex built on a futex word, which must start as zero
+// 0 = unlocked, 1 = locked, 2 = locked and may have sleepers
+// The fast paths are a single atomic, and unlock only calls
+// into the kernel if someone may be sleeping.
+//
+static inline int nk_futex_mutex_trylock(volatile uint32_t *m)
+{
+    return __sync_bool_compare_and_swap(m, 0, 1) ? 0 : -1;
+}
+
+static inline void nk_futex_mutex_lock(volatile uint32_t *m)
+{
+    uint32_t c;
+
+    if ((c = __sync_val_compare_and_swap(m, 0, 1)) == 0) {
+        return;
+    }
+
+    // contended: mark it as such, and sleep until we take it
+    // while it is marked
+    if (c != 2) {
+        c = __sync_lock_test_and_set(m, 2);
+    }
+    while (c != 0) {
+        nk_futex_wait(m, 2, 0);
+        c = __sync_lock_test_and_set(m, 2);
+    }
+}
+
+static inline void nk_futex_mutex_unlock(volatile uint32_t *m)
+{
+    if (__sync_fetch_and_sub(m, 1) != 1) {
+        *m = 0;
+        __sync_synchronize();
+        nk_futex_wake(m, 1);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
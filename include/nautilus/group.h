@@ -81,4 +81,9 @@ int nk_thread_group_delete(nk_thread_group_t *group);
 // return the size of a group
 uint64_t nk_thread_group_get_size(nk_thread_group_t *group);
 
+// apply fn to each member (under the group lock), a nonzero return stops
+// the walk and is returned
+struct nk_thread;
+int nk_thread_group_for_each(nk_thread_group_t *group, int (*fn)(struct nk_thread *, void *), void *arg);
+
 #endif /* _GROUP_H */
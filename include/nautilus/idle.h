@@ -30,4 +30,44 @@ void screensaver(void * in, void ** out);
 void side_screensaver(void * in, void ** out);
 void idle(void * in, void ** out);
 
+#ifdef NAUT_CONFIG_IDLE_GOVERNOR
+
+/*
+  Idle governor
+
+  The idle thread waits in MWAIT on a per-CPU line that remote CPUs
+  write after enqueueing a thread or an xcall for it, so those do
+  not need an IPI.  The C-state is chosen from the time left on the
+  local timer.  While the governor is usable, the idle thread is not
+  preempted every quantum, only every NAUT_CONFIG_IDLE_MAX_SLEEP_MS,
+  except on CPU 0, which keeps its tick to run timers on time.
+*/
+
+#define NK_IDLE_CSTATES 4   // C1..C4, as MWAIT hints 0x00..0x30
+
+struct nk_idle_state {
+    // the monitored line, written by remote wakers
+    volatile uint64_t wake;        // rdtsc() at the last remote wakeup
+    volatile uint64_t waiting;     // nonzero while in or entering MWAIT
+    uint8_t           pad[48];
+
+    // owner only, except ipis_avoided
+    uint64_t          entries[NK_IDLE_CSTATES];
+    uint64_t          residency[NK_IDLE_CSTATES];   // cycles
+    uint64_t          halts;                        // fallback waits
+    uint64_t          remote_wakeups;
+    uint64_t          wake_latency_sum;             // cycles, write to resume
+    uint64_t          wake_latency_max;
+    uint64_t          ipis_avoided;
+} __attribute__((aligned(64)));
+
+// wait for something to do, called by the idle thread with interrupts on
+void nk_idle_wait(void);
+// true if the idle thread may skip its quantum tick on this CPU
+int  nk_idle_tickless(void);
+// wake cpu if it is waiting in MWAIT, returns nonzero if it was
+int  nk_idle_nudge(int cpu);
+
+#endif
+
 #endif
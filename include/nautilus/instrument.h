@@ -50,48 +50,71 @@ extern "C" {
 #define NK_FREE_PROF_EXIT() 
 #endif
 
-struct nk_hashtable;
+#ifdef NAUT_CONFIG_PROFILE
 
-struct malloc_data {
-    uint64_t count;
-    uint64_t start_count;
-    uint64_t avg_latency;
-    uint64_t max_latency;
-    uint64_t min_latency;
+/*
+  Function profiling
+
+  Probes are keyed by address: the function's address for
+  -finstrument-functions (NAUT_CONFIG_PROFILE_INSTRUMENT_FUNCTIONS),
+  or the address of its __func__ string for NK_PROFILE_ENTRY/EXIT.
+  Each CPU has an open-addressed table of per-function stats,
+  allocated when instrumentation is initialized, so probes never
+  allocate. Each thread has a shadow stack of the probed functions
+  it is in, which gives inclusive and exclusive times even for
+  nested and recursive calls.  Times are in TSC cycles, with the
+  calibrated cost of the probes inside a function subtracted.
+  Interrupt handlers that run while a function is on the shadow
+  stack count toward its inclusive time.
+*/
+
+#define NK_INSTR_TABLE_SIZE  (1UL << NAUT_CONFIG_PROFILE_TABLE_ORDER)
+#define NK_INSTR_STACK_DEPTH NAUT_CONFIG_PROFILE_STACK_DEPTH
+
+struct nk_instr_func {
+    uint64_t     key;        // 0 => free slot
+    const char * name;       // NULL => symbolize key
+    uint64_t     calls;
+    uint64_t     incl;       // cycles
+    uint64_t     excl;       // cycles
+    uint64_t     max_incl;
+    uint64_t     min_incl;
 };
 
-struct free_data {
+struct nk_instr_lat {
     uint64_t count;
-    uint64_t start_count;
-    uint64_t avg_latency;
+    uint64_t start_count;    // TSC at entry
+    uint64_t avg_latency;    // cycles
     uint64_t max_latency;
     uint64_t min_latency;
 };
 
-struct irq_data {
-    uint64_t count;
-    uint64_t start_count;
-    uint64_t avg_latency;
-    uint64_t max_latency;
-    uint64_t min_latency;
+struct nk_instr_data {
+    uint64_t             func_dropped;   // calls not recorded because the table was full
+    struct nk_instr_lat  irqstat;
+    struct nk_instr_lat  mallocstat;
+    struct nk_instr_lat  freestat;
+    struct nk_instr_lat  thr_switch;
+    struct nk_instr_func funcs[NK_INSTR_TABLE_SIZE];
 };
 
-struct thread_switch_data {
-    uint64_t count;
-    uint64_t start_count;
-    uint64_t avg_latency;
-    uint64_t max_latency;
-    uint64_t min_latency;
+struct nk_instr_frame {
+    uint64_t     key;
+    const char * name;
+    uint64_t     start;      // TSC at entry
+    uint64_t     child;      // inclusive cycles of completed callees
+    uint64_t     nested;     // probe pairs completed below this frame
 };
 
-struct nk_instr_data {
-    struct nk_hashtable * func_htable;
-    struct irq_data irqstat;
-    struct malloc_data mallocstat;
-    struct free_data freestat;
-    struct thread_switch_data thr_switch;
+// embedded in each thread
+struct nk_instr_stack {
+    uint64_t              epoch;   // stale if not the current instrumentation epoch
+    uint32_t              depth;   // may exceed NK_INSTR_STACK_DEPTH, deeper calls are not timed
+    struct nk_instr_frame frames[NK_INSTR_STACK_DEPTH];
 };
 
+#endif
+
 
 void nk_profile_func_enter(const char * func);
 void nk_profile_func_exit(const char * func);
@@ -109,6 +132,7 @@ void nk_instrument_start(void);
 void nk_instrument_end(void);
 void nk_instrument_query(void);
 void nk_instrument_clear(void);
+// measures the probe overhead that is subtracted from function times
 void nk_instrument_calibrate(unsigned loops);
 
 
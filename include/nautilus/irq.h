@@ -63,6 +63,11 @@ void nk_mask_irq(uint8_t irq);
 void nk_unmask_irq(uint8_t irq);
 uint8_t nk_irq_is_assigned(uint8_t irq);
 
+#ifdef NAUT_CONFIG_TRACE
+void nk_irq_trace_enter(uint64_t vec);
+void nk_irq_trace_exit(uint64_t vec);
+#endif
+
 uint8_t irq_to_vec (uint8_t irq);
 void irqmap_set_ioapic (uint8_t irq, struct ioapic * ioapic);
 void disable_8259pic(void);
@@ -40,14 +40,39 @@ struct symtab_info {
     char * strtab;
 };
 
+struct symhash_slot {
+    uint32_t hash;
+    uint32_t idx;   // index of the symbol descriptor + 1, 0 if empty
+};
+
 struct nk_link_info {
     int ready;
     struct symtab_info symtab;
+    // symbol descriptors sorted by address
+    symentry_t ** by_addr;
+    uint32_t by_addr_count;
+    // open addressed hash of symbol names
+    struct symhash_slot * by_name;
+    uint32_t by_name_mask;
 };
 
 
 int nk_link_prog (struct nk_link_info * linfo, struct nk_prog_info * prog);
 int nk_linker_init (struct naut_info * naut);
 
+/*
+ * Find the kernel symbol called name. Returns 0 and sets *addr to its
+ * value, or returns -1 if there is no such symbol. If several symbols
+ * have the name, the first in the table wins.
+ */
+int nk_linker_sym_to_addr (struct nk_link_info * linfo, const char * name, uint64_t * addr);
+
+/*
+ * Find the symbol containing addr, that is, the one with the greatest
+ * value not above it. Returns its name and sets *sym_addr to its
+ * value, or returns NULL if there is no symbol table or no such symbol.
+ */
+const char * nk_linker_addr_to_sym (struct nk_link_info * linfo, uint64_t addr, uint64_t * sym_addr);
+
 
 #endif
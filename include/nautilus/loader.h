@@ -28,6 +28,12 @@
 
 // load executable from file, do not run
 struct nk_exec *nk_load_exec(char *path);
+// load executable from an image already in memory, for example
+// a multiboot module.  If its text is page aligned and the image has
+// room for the BSS, the image is used in place, and must stay valid
+// until the executable is unloaded.  Running it changes the image,
+// so an image that has been used in place cannot be loaded again
+struct nk_exec *nk_load_exec_image(void *image, uint64_t size);
 // run executable's entry point - this is a blocking call on the current thread
 // user I/O is via the current VC
 int             nk_start_exec(struct nk_exec *exec, void *in, void **out);
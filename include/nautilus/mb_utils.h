@@ -40,6 +40,8 @@ void* mb_get_first_hrt_addr (ulong_t mbd);
 typedef enum {
     MOD_SYMTAB,
     MOD_PROGRAM,
+    MOD_EXEC,       // has a multiboot2 header, for nk_load_exec_image
+    MOD_OTHER,
 } mod_type_t;
 
 struct multiboot_mod {
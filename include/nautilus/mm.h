@@ -114,15 +114,28 @@ void   kmem_free(void * addr);
 // user flags are allocate from low bit up, while kmem's flags are allocated
 // high bit down
 int  kmem_find_block(void *any_addr, void **block_addr, uint64_t *block_size, uint64_t *flags);
+// find the block as above, and atomically set flag in its flags
+// returns 1 if this call set it, 0 if it was already set, and
+// negative if the addr is within no allocated block.  This one is
+// safe to use from several cores at once, with the world stopped
+int  kmem_find_and_set_block_flag(void *any_addr, uint64_t flag, void **block_addr, uint64_t *block_size);
 // set the flags of an allocated block
 int  kmem_set_block_flags(void *block_addr, uint64_t flags);
 // apply an mask to all the blocks (and mask unless or=1)
 int  kmem_mask_all_blocks_flags(uint64_t mask, int ormask);
+// flags that newly allocated blocks start with (normally 0), so
+// that an incremental GC can treat new blocks as already visited.
+// Safe to change while the world is running.
+void kmem_set_alloc_flags(uint64_t flags);
 
 // range of addresses used for internal kmem state that should be
 // ignored when pointer-chasing the heap, for example in a GC
 void kmem_get_internal_pointer_range(void **start, void **end);
 
+// lowest and highest+1 address of all the memory kmem manages, so
+// no heap pointer lies outside of it
+void kmem_get_managed_range(void **start, void **end);
+
 // check to see if the masked flags match the given flags
 int  kmem_apply_to_matching_blocks(uint64_t mask, uint64_t flags, int (*func)(void *block, void *state), void *state);
 
@@ -66,6 +66,11 @@ nk_mwait (uint32_t eax, uint32_t ecx)
 }
 
 int nk_mwait_init(void);
+int nk_mwait_available(void);
+// whether ecx bit 0 (wake on interrupts even if masked) is honored
+int nk_mwait_ints_as_breaks(void);
+// number of sub-states of C-state cstate (0..4) reported by CPUID
+int nk_mwait_substates(int cstate);
 
 
 #ifdef __cplusplus
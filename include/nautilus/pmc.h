@@ -52,6 +52,11 @@
 #define INTEL_PERF_CTL_MSR_N(n) (IA32_PERFEVTSEL_BASE + (n))
 #define INTEL_PERF_CTR_MSR_N(n) (IA32_PMC_BASE + (n))
 
+/* architectural PMC version 2+ */
+#define IA32_PERF_GLOBAL_STATUS   0x38e
+#define IA32_PERF_GLOBAL_CTRL     0x38f
+#define IA32_PERF_GLOBAL_OVF_CTRL 0x390
+
 
 /* EVENTS */
 
@@ -193,6 +198,11 @@ struct pmc_ops {
     int      (*init)(struct pmc_info * pmc);
     void     (*event_init)(perf_event_t * event);
 
+    /* overflow interrupt (PMI) support, used by the sampler */
+    void     (*intr_ctr)(perf_event_t * event, int on);
+    int      (*ovf_ctr)(uint8_t idx);
+    void     (*ack_ctr)(uint8_t idx);
+
     int      (*version)();
     int      (*msr_cnt)();
     int      (*msr_width)();
@@ -236,4 +246,99 @@ void     nk_pmc_write(perf_event_t * event, uint64_t val);
 
 void     nk_pmc_report(void);
 
+
+#ifdef NAUT_CONFIG_PMC_SAMPLING
+
+/* SAMPLING
+ *
+ * A counter is programmed on every CPU to overflow every "period"
+ * events.  The overflow is delivered as an NMI through the local
+ * APIC's performance counter LVT entry, and the NMI handler records
+ * the interrupted RIP, the current thread and a frame pointer call
+ * chain into the CPU's sample buffer. Reports aggregate all buffers.
+ *
+ */
+
+struct nk_pmc_sample {
+    uint64_t rip;
+    uint32_t tid;
+    uint32_t depth;   // valid entries in chain (return addresses)
+    uint64_t chain[NAUT_CONFIG_PMC_SAMPLING_DEPTH];
+};
+
+struct nk_pmc_sample_buf {
+    uint64_t count;     // samples recorded
+    uint64_t dropped;   // overflows not recorded because the buffer was full
+    uint64_t size;      // capacity in samples
+    struct nk_pmc_sample samples[0];
+};
+
+struct excp_entry_state;
+
+int      nk_pmc_sample_start(uint32_t event_id, uint64_t period);
+int      nk_pmc_sample_stop(void);
+#define  NK_PMC_REPORT_FLAT  0
+#define  NK_PMC_REPORT_GRAPH 1
+void     nk_pmc_sample_report(int type, int max_entries);
+// returns nonzero if the NMI was a counter overflow and was consumed
+int      nk_pmc_sample_nmi(struct excp_entry_state * excp, void * state);
+
+#endif
+
+
+#ifdef NAUT_CONFIG_PMC_VIRT
+
+/* VIRTUALIZED COUNTERS
+ *
+ * A counter set claims hardware slots for a few events on all CPUs.
+ * Threads attached to a set count those events only while they run:
+ * the scheduler saves a thread's counts when it switches out and
+ * reprograms the counters when it switches in, on whatever CPU that
+ * is. The set also accumulates the counts of all threads ever
+ * attached to it, which is how thread groups are measured.
+ *
+ * Attaching or detaching a thread other than the caller requires that
+ * thread not be running (attach to a running thread takes effect at its
+ * next switch in). Values of a thread running elsewhere, and the set
+ * totals, are current as of the last switch out.
+ *
+ */
+
+#define NK_PMC_SET_MAX 4
+
+struct nk_pmc_set {
+    int               num;
+    perf_event_t    * events[NK_PMC_SET_MAX];
+    uint64_t          mask;                    // counter width
+    volatile uint64_t totals[NK_PMC_SET_MAX];
+    volatile uint64_t refcount;                // attached threads
+};
+
+struct nk_pmc_thread_ctx {
+    struct nk_pmc_set * set;
+    int                 live;                  // counting since start[]
+    uint64_t            start[NK_PMC_SET_MAX];
+    uint64_t            vals[NK_PMC_SET_MAX];
+};
+
+struct nk_thread;
+struct nk_thread_group;
+
+struct nk_pmc_set * nk_pmc_set_create(int num, uint32_t * event_ids);
+// fails while threads are attached
+int      nk_pmc_set_destroy(struct nk_pmc_set * set);
+// returns the number of values written
+int      nk_pmc_set_read(struct nk_pmc_set * set, uint64_t * vals);
+
+int      nk_pmc_thread_attach(struct nk_thread * t, struct nk_pmc_set * set);
+int      nk_pmc_thread_detach(struct nk_thread * t);
+int      nk_pmc_thread_read(struct nk_thread * t, uint64_t * vals);
+// attaches all current members
+int      nk_pmc_group_attach(struct nk_thread_group * group, struct nk_pmc_set * set);
+
+// scheduler hook, called with interrupts off when either thread has a context
+void     nk_pmc_thread_switch(struct nk_thread * prev, struct nk_thread * next);
+
+#endif
+
 #endif /* !__PMC_H__! */
@@ -54,6 +54,22 @@ int sscanf(const char * buf, const char * fmt, ...);
 
 void warn_slowpath(const char * file, int line, const char * fmt, ...);
 
+#ifdef NAUT_CONFIG_PRINTK_RING
+// per-CPU log rings drained to the consoles by a thread
+#define PRINTK_RECORD_TEXT 224
+
+extern int nk_printk_ring_active;
+
+int  nk_printk_ring_init(void);
+// returns nonzero if the caller must print synchronously instead
+int  nk_printk_ring_write(const char *s);
+// stop buffering and flush what is there, for panics
+void nk_printk_ring_emergency(void);
+// write out everything bound for vc before it is freed
+struct nk_virtual_console;
+void nk_printk_ring_release_vc(struct nk_virtual_console *vc);
+#endif
+
 
 #ifdef __cplusplus
 }
@@ -32,6 +32,10 @@ struct nk_prog_info {
     void * entry_addr;
     int argc;
     char ** argv;
+    // what each dynamic symbol resolved to, kept across links
+    uint64_t * sym_cache;
+    uint8_t * sym_cached;   // 0 = not yet, 1 = resolved, 2 = failed
+    uint64_t sym_cache_count;
 };
 
 int nk_prog_init (struct naut_info * naut);
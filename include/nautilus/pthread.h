@@ -0,0 +1,209 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#ifndef __NK_PTHREAD_H__
+#define __NK_PTHREAD_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  POSIX threads on Nautilus threads
+
+  The types have the sizes of glibc's on x86_64, and their static
+  initializers are all zeros as in glibc, so code built against the
+  host's <pthread.h>, such as the C++ runtime and Legion, can use
+  these functions directly.
+
+  Mutexes, condition variables, rwlocks, barriers and once controls
+  are built on futex words (see futex.h), so a waiter parks without
+  holding any spinlock.  Mutexes are adaptive: a contended locker
+  spins on the lock word for up to a number of tries that adapts to
+  how long the lock is usually held, and only then parks.
+
+  Timed waits take an absolute time on CLOCK_MONOTONIC, the only
+  clock Nautilus has.
+*/
+
+struct timespec;
+
+typedef unsigned long pthread_t;
+typedef unsigned int  pthread_key_t;
+typedef int           pthread_once_t;
+
+typedef union {
+    struct {
+        int    detached;
+        int    cpu;            // -1 => not bound
+        size_t stack_size;     // 0 => default
+    } a;
+    char __size[56];
+    long __align;
+} pthread_attr_t;
+
+typedef union {
+    struct {
+        volatile uint32_t lock;     // futex mutex word, see futex.h
+        uint32_t          count;    // recursion depth
+        int               __owner;
+        uint32_t          __nusers;
+        int               kind;     // as glibc's __kind
+        short             spins;    // adaptive spin estimate
+        short             __elision;
+        void * volatile   owner;    // nk_thread_t of the holder
+        void             *__pad;
+    } m;
+    char __size[40];
+    long __align;
+} pthread_mutex_t;
+
+typedef union {
+    struct {
+        volatile uint32_t seq;      // futex word, bumped by each wakeup
+        volatile uint32_t waiters;
+    } c;
+    char __size[48];
+    long long __align;
+} pthread_cond_t;
+
+typedef union {
+    struct {
+        volatile uint32_t state;    // number of readers, or RWLOCK_WRITER
+        volatile uint32_t waiters;
+    } rw;
+    char __size[56];
+    long __align;
+} pthread_rwlock_t;
+
+typedef union {
+    struct {
+        volatile uint32_t lock;     // futex mutex word
+        uint32_t          count;
+        volatile uint32_t left;
+        volatile uint32_t seq;      // futex word, bumped by each release
+    } b;
+    char __size[32];
+    long __align;
+} pthread_barrier_t;
+
+typedef union { char __size[4]; int __align; } pthread_mutexattr_t;
+typedef union { char __size[4]; int __align; } pthread_condattr_t;
+typedef union { char __size[8]; long __align; } pthread_rwlockattr_t;
+typedef union { char __size[4]; int __align; } pthread_barrierattr_t;
+
+#define PTHREAD_MUTEX_INITIALIZER  { { 0 } }
+#define PTHREAD_COND_INITIALIZER   { { 0 } }
+#define PTHREAD_RWLOCK_INITIALIZER { { 0 } }
+#define PTHREAD_ONCE_INIT          0
+
+enum {
+    PTHREAD_MUTEX_NORMAL,
+    PTHREAD_MUTEX_RECURSIVE,
+    PTHREAD_MUTEX_ERRORCHECK,
+    PTHREAD_MUTEX_ADAPTIVE_NP,
+    PTHREAD_MUTEX_DEFAULT = PTHREAD_MUTEX_NORMAL
+};
+
+#define PTHREAD_CREATE_JOINABLE 0
+#define PTHREAD_CREATE_DETACHED 1
+
+#define PTHREAD_BARRIER_SERIAL_THREAD -1
+
+// as glibc's cpu_set_t, only one CPU may be set, as a Nautilus
+// thread is bound to at most one
+#ifndef CPU_SETSIZE
+#define CPU_SETSIZE 1024
+typedef struct {
+    unsigned long __bits[CPU_SETSIZE / (8 * sizeof(unsigned long))];
+} cpu_set_t;
+#define __CPU_WORD(c) ((c) / (8 * sizeof(unsigned long)))
+#define __CPU_BIT(c)  (1UL << ((c) % (8 * sizeof(unsigned long))))
+#define CPU_ZERO(s)     memset((s), 0, sizeof(cpu_set_t))
+#define CPU_SET(c, s)   ((s)->__bits[__CPU_WORD(c)] |= __CPU_BIT(c))
+#define CPU_CLR(c, s)   ((s)->__bits[__CPU_WORD(c)] &= ~__CPU_BIT(c))
+#define CPU_ISSET(c, s) (!!((s)->__bits[__CPU_WORD(c)] & __CPU_BIT(c)))
+#endif
+
+int  pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                    void *(*start)(void *), void *arg);
+int  pthread_join(pthread_t thread, void **retval);
+int  pthread_detach(pthread_t thread);
+void pthread_exit(void *retval) __attribute__((noreturn));
+pthread_t pthread_self(void);
+int  pthread_equal(pthread_t t1, pthread_t t2);
+int  pthread_yield(void);
+int  sched_yield(void);
+
+int  pthread_attr_init(pthread_attr_t *attr);
+int  pthread_attr_destroy(pthread_attr_t *attr);
+int  pthread_attr_setdetachstate(pthread_attr_t *attr, int state);
+int  pthread_attr_getdetachstate(const pthread_attr_t *attr, int *state);
+int  pthread_attr_setstacksize(pthread_attr_t *attr, size_t size);
+int  pthread_attr_getstacksize(const pthread_attr_t *attr, size_t *size);
+int  pthread_attr_setaffinity_np(pthread_attr_t *attr, size_t size, const cpu_set_t *set);
+int  pthread_attr_getaffinity_np(const pthread_attr_t *attr, size_t size, cpu_set_t *set);
+
+int  pthread_mutexattr_init(pthread_mutexattr_t *attr);
+int  pthread_mutexattr_destroy(pthread_mutexattr_t *attr);
+int  pthread_mutexattr_settype(pthread_mutexattr_t *attr, int kind);
+int  pthread_mutexattr_gettype(const pthread_mutexattr_t *attr, int *kind);
+
+int  pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr);
+int  pthread_mutex_destroy(pthread_mutex_t *mutex);
+int  pthread_mutex_lock(pthread_mutex_t *mutex);
+int  pthread_mutex_trylock(pthread_mutex_t *mutex);
+int  pthread_mutex_unlock(pthread_mutex_t *mutex);
+
+int  pthread_condattr_init(pthread_condattr_t *attr);
+int  pthread_condattr_destroy(pthread_condattr_t *attr);
+
+int  pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr);
+int  pthread_cond_destroy(pthread_cond_t *cond);
+int  pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+int  pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                            const struct timespec *abstime);
+int  pthread_cond_signal(pthread_cond_t *cond);
+int  pthread_cond_broadcast(pthread_cond_t *cond);
+
+int  pthread_rwlock_init(pthread_rwlock_t *rwlock, const pthread_rwlockattr_t *attr);
+int  pthread_rwlock_destroy(pthread_rwlock_t *rwlock);
+int  pthread_rwlock_rdlock(pthread_rwlock_t *rwlock);
+int  pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock);
+int  pthread_rwlock_wrlock(pthread_rwlock_t *rwlock);
+int  pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock);
+int  pthread_rwlock_unlock(pthread_rwlock_t *rwlock);
+
+int  pthread_barrier_init(pthread_barrier_t *barrier, const pthread_barrierattr_t *attr,
+                          unsigned count);
+int  pthread_barrier_destroy(pthread_barrier_t *barrier);
+int  pthread_barrier_wait(pthread_barrier_t *barrier);
+
+int  pthread_once(pthread_once_t *once, void (*init)(void));
+
+int  pthread_key_create(pthread_key_t *key, void (*destructor)(void *));
+int  pthread_key_delete(pthread_key_t key);
+void *pthread_getspecific(pthread_key_t key);
+int  pthread_setspecific(pthread_key_t key, const void *val);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -131,6 +131,21 @@ int    nk_sched_thread_move(struct nk_thread *thread, int new_cpu, int block);
 // any threads are stolen
 int    nk_sched_cpu_mug(int cpu, uint64_t max, uint64_t *actual);
 
+#ifdef NAUT_CONFIG_LOAD_BALANCE
+//
+// Have this CPU pull at most max threads from the busiest CPU
+// in the nearest topological domain that is sufficiently more
+// loaded than this one.   Called periodically from the idle thread,
+// and promptly if nk_sched_balance_wanted() says a waker asked us to
+int    nk_sched_balance(uint64_t max, uint64_t *actual);
+int    nk_sched_balance_wanted(void);
+#endif
+
+#ifdef NAUT_CONFIG_IDLE_GOVERNOR
+// Is anything other than the idle thread runnable on this CPU?
+int    nk_sched_have_runnable(void);
+#endif
+
 // Make the thread schedulable - generally only called by thread.c
 // When the thread is first launched admit=1 is used to do admisson on the 
 // designated CPU
@@ -203,6 +218,14 @@ void nk_sched_stop_world();
 struct nk_thread *nk_sched_get_cur_thread_on_cpu(int cpu);
 void nk_sched_start_world();
 
+// While the world is stopped, the stopper can put the stopped cores
+// to work.  func(arg,n) is run by all n of them, including the
+// caller, and this returns once they have all returned.  func runs
+// with interrupts off on whatever stack each core was stopped on, so
+// it must not block or use much stack.  If the world is not stopped
+// by the caller, func just runs on the caller, with n==1
+void nk_sched_stop_world_run(void (*func)(void *arg, int n), void *arg);
+
 
 // Invoked by interrupt handler wrapper and other code
 // to cause thread context switches
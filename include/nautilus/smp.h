@@ -71,6 +71,18 @@ struct nk_xcall {
     struct nk_instr_data;
 #endif
 
+#ifdef NAUT_CONFIG_TRACE
+    struct nk_trace_buf;
+#endif
+
+#ifdef NAUT_CONFIG_PMC_SAMPLING
+    struct nk_pmc_sample_buf;
+#endif
+
+#ifdef NAUT_CONFIG_IDLE_GOVERNOR
+    struct nk_idle_state;
+#endif
+
 struct cpu {
     struct nk_thread * cur_thread;             /* +0  KCH: this must be first! */
     // track whether we are in an interrupt, nested or otherwise
@@ -132,6 +144,18 @@ struct cpu {
 #ifdef NAUT_CONFIG_PROFILE
     struct nk_instr_data * instr_data;
 #endif
+
+#ifdef NAUT_CONFIG_TRACE
+    struct nk_trace_buf * trace_buf;
+#endif
+
+#ifdef NAUT_CONFIG_PMC_SAMPLING
+    struct nk_pmc_sample_buf * pmc_samples;
+#endif
+
+#ifdef NAUT_CONFIG_IDLE_GOVERNOR
+    struct nk_idle_state * idle_state;
+#endif
 };
 
 
@@ -156,6 +180,11 @@ struct ap_init_area {
 int smp_early_init(struct naut_info * naut);
 int smp_bringup_aps(struct naut_info * naut);
 int smp_xcall(cpu_id_t cpu_id, nk_xcall_func_t fun, void * arg, uint8_t wait);
+#ifdef NAUT_CONFIG_IDLE_GOVERNOR
+// run xcalls queued for this CPU without an IPI, interrupts off
+int smp_xcall_pending(void);
+void smp_xcall_poll(void);
+#endif
 void smp_ap_entry (struct cpu * core);
 int smp_setup_xcall_bsp (struct cpu * core);
 
@@ -38,6 +38,10 @@ extern "C" {
 #include <nautilus/cachepart.h>
 #include <nautilus/aspace.h>
 
+#ifdef NAUT_CONFIG_PROFILE
+#include <nautilus/instrument.h>
+#endif
+
 typedef uint64_t nk_stack_size_t;
     
 #include <nautilus/scheduler.h>
@@ -121,6 +125,14 @@ void nk_thread_exit(void * retval) __attribute__((noreturn));
 // by the reaper logic in the scheduler
 void nk_thread_destroy(nk_thread_id_t t);
 
+#ifdef NAUT_CONFIG_THREAD_CACHE
+// per-CPU caches of thread+stack pairs, prewarmed at boot
+int  nk_thread_cache_init(void);
+// enable/disable use of the caches, returns previous setting
+int  nk_thread_cache_enable(int enable);
+void nk_thread_cache_dump(void);
+#endif
+
 
 #ifndef __LEGION__
 nk_thread_id_t nk_get_tid(void);
@@ -135,6 +147,8 @@ int nk_tls_key_create(nk_tls_key_t * key, void (*destructor)(void*));
 int nk_tls_key_delete(nk_tls_key_t key);
 void* nk_tls_get(nk_tls_key_t key);
 int nk_tls_set(nk_tls_key_t key, const void * val);
+// run the destructors of the current thread's values, as on exit
+void nk_tls_exit(void);
 
 
 /********* INTERNALS ***********/
@@ -207,6 +221,10 @@ struct nk_thread {
     int placement_cpu;
     int current_cpu;
 
+#ifdef NAUT_CONFIG_THREAD_CACHE
+    struct nk_thread *cache_next;  // link while on a per-CPU thread cache
+#endif
+
     uint8_t is_idle;
 
     void **output_loc;  // where the thread should write output
@@ -222,6 +240,14 @@ struct nk_thread {
     void  *gc_state;
 #endif
 
+#ifdef NAUT_CONFIG_PMC_VIRT
+    struct nk_pmc_thread_ctx *pmc_ctx;  // virtualized counters, if attached
+#endif
+
+#ifdef NAUT_CONFIG_PROFILE
+    struct nk_instr_stack instr_stack;  // shadow stack of profiled functions
+#endif
+
     char name[MAX_THREAD_NAME];
 
     const void * tls[TLS_MAX_KEYS];
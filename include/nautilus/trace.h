@@ -0,0 +1,113 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#ifndef __NK_TRACE_H__
+#define __NK_TRACE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Event tracing
+
+  Each CPU records events into its own ring buffer.  Only the owning
+  CPU (including interrupt handlers on it) writes its buffer, so
+  recording is a reservation by atomic increment, a TSC read, and
+  a few stores.  When a buffer is full, the oldest events are
+  overwritten.  Tracepoints are compiled out unless
+  NAUT_CONFIG_TRACE is set, and cost a test of nk_trace_mask when
+  their category is not selected.
+*/
+
+// categories, selected at runtime via nk_trace_mask
+#define NK_TRACE_SCHED   0x01
+#define NK_TRACE_IRQ     0x02
+#define NK_TRACE_XCALL   0x04
+#define NK_TRACE_TASK    0x08
+#define NK_TRACE_WAIT    0x10
+#define NK_TRACE_KMEM    0x20
+#define NK_TRACE_ALL     0x3f
+
+typedef enum {
+    NK_TRACE_EV_NONE=0,
+    NK_TRACE_EV_SWITCH,         // a=old tid, b=new tid
+    NK_TRACE_EV_SLEEP,          // a=tid
+    NK_TRACE_EV_YIELD,          // a=tid
+    NK_TRACE_EV_EXIT,           // a=tid
+    NK_TRACE_EV_CHANGE,         // a=tid
+    NK_TRACE_EV_IRQ_ENTER,      // a=vector
+    NK_TRACE_EV_IRQ_EXIT,       // a=vector
+    NK_TRACE_EV_XCALL_SEND,     // a=target cpu, b=function
+    NK_TRACE_EV_XCALL_ENTER,    // a=function
+    NK_TRACE_EV_XCALL_EXIT,     // a=function
+    NK_TRACE_EV_TASK_PRODUCE,   // a=task, b=cpu
+    NK_TRACE_EV_TASK_CONSUME,   // a=task, b=cpu
+    NK_TRACE_EV_WAIT_SLEEP,     // a=queue
+    NK_TRACE_EV_WAIT_WAKE,      // a=queue, b=tid woken
+    NK_TRACE_EV_MALLOC,         // a=address, b=size
+    NK_TRACE_EV_FREE,           // a=address, b=size
+    NK_TRACE_EV_MAX
+} nk_trace_ev_t;
+
+struct nk_trace_event {
+    uint64_t tsc;
+    uint64_t a;
+    uint64_t b;
+    uint32_t tid;   // of the thread current at the time
+    uint32_t type;  // nk_trace_ev_t
+};
+
+struct nk_trace_buf {
+    volatile uint64_t     head;       // next slot to reserve
+    volatile uint64_t     committed;  // slots completely written
+    uint64_t              mask;       // number of slots - 1
+    struct nk_trace_event events[0];
+};
+
+extern volatile uint32_t nk_trace_mask;
+
+void nk_trace_record(uint32_t type, uint64_t a, uint64_t b);
+
+#ifdef NAUT_CONFIG_TRACE
+#define NK_TRACE(cat,type,a,b)						\
+    do {								\
+	if (__builtin_expect(nk_trace_mask & (cat),0)) {		\
+	    nk_trace_record((type),(uint64_t)(a),(uint64_t)(b));	\
+	}								\
+    } while (0)
+#else
+#define NK_TRACE(cat,type,a,b)
+#endif
+
+int  nk_trace_init(void);
+// returns the previous mask
+uint32_t nk_trace_set_mask(uint32_t mask);
+void nk_trace_clear(void);
+
+#define NK_TRACE_FORMAT_JSON 0   // Chrome trace / Perfetto
+#define NK_TRACE_FORMAT_BIN  1   // header + raw events per CPU
+// path==0 => serial (JSON only), tracing is paused during the dump
+int  nk_trace_dump(int format, char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
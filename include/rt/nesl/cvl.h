@@ -723,6 +723,16 @@ void rkd_led P_((vec_p d, vec_p s, vec_p segd, int vec_len, int seg_count, vec_p
 int rkd_led_scratch P_((int vec_len, int seg_count));
 unsigned int rkd_led_inplace P_((void));
 void rnd_foz P_((int seed));
+
+#ifdef NAUT_CONFIG_NESL_RT_CVL_PARALLEL
+/* Parallel CVL: start the workers, and find the parallel version
+ * of a function, if there is one.  See cvl/parallel/par.h.
+ */
+typedef void (*cvl_fun_p)();
+int cvl_par_init P_((void));
+cvl_fun_p cvl_par_find P_((cvl_fun_p serial));
+#endif
+
 #if __cplusplus | c_plusplus
 }
 #endif
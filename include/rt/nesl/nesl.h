@@ -33,4 +33,18 @@ void nk_nesl_deinit();
 // vcode is run
 int nk_nesl_exec(void *vcode);
 
+// Execute vcode with the given flags, and vmem doubles of
+// vector memory (0 = default)
+#define NK_NESL_QUIET 0x1    // no program dump or command trace
+int nk_nesl_exec_opts(void *vcode, int flags, unsigned vmem);
+
+// The first element of the INT or FLOAT vector the last program
+// left on top of the stack, returns -1 if it left no such vector
+int nk_nesl_result_int(int *val);
+int nk_nesl_result_float(double *val);
+
+// Use the parallel CVL (the default if it is configured) or
+// the serial CVL, returns -1 if parallel CVL is not configured
+int nk_nesl_set_parallel(int on);
+
 #endif
@@ -66,7 +66,13 @@ typedef int omp_proc_bind_t;
 
 omp_proc_bind_t omp_get_proc_bind(void);
 
-typedef int * omp_sched_t;
+typedef enum omp_sched_t {
+    omp_sched_static = 1,
+    omp_sched_dynamic = 2,
+    omp_sched_guided = 3,
+    omp_sched_auto = 4,
+    omp_sched_monotonic = 0x80000000U
+} omp_sched_t;
 
 void omp_get_schedule(omp_sched_t *kind, int *chunk_size);
 
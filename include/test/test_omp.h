@@ -25,6 +25,6 @@
 #define _TEST_OMP
 
 int test_omp();
-int test_ompbench();
+int test_ompbench(char *which);
 
 #endif
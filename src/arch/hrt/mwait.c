@@ -69,6 +69,8 @@ nk_mwait_init (void)
 {
     cpuid_ret_t ret;
 
+    memset(&mwait, 0, sizeof(mwait));
+
     if (has_mwait()) {
         printk("Processor supports MONITOR/MWAIT extensions\n");
         mwait.available = 1;
@@ -77,8 +79,6 @@ nk_mwait_init (void)
         return 0;
     }
 
-    memset(&mwait, 0, sizeof(mwait));
-
     cpuid(0x5, &ret);
 
     mwait.min_line_size = ret.a & 0xffff;
@@ -97,3 +97,31 @@ nk_mwait_init (void)
 
     return 0;
 }
+
+
+int
+nk_mwait_available (void)
+{
+    return mwait.available;
+}
+
+
+int
+nk_mwait_ints_as_breaks (void)
+{
+    return mwait.ints_as_breaks;
+}
+
+
+int
+nk_mwait_substates (int cstate)
+{
+    switch (cstate) {
+        case 0: return mwait.c0_substates;
+        case 1: return mwait.c1_substates;
+        case 2: return mwait.c2_substates;
+        case 3: return mwait.c3_substates;
+        case 4: return mwait.c4_substates;
+        default: return 0;
+    }
+}
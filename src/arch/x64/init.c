@@ -66,6 +66,7 @@
 #include <nautilus/linker.h>
 #include <nautilus/shell.h>
 #include <nautilus/pmc.h>
+#include <nautilus/trace.h>
 #include <nautilus/prog.h>
 #include <nautilus/cmdline.h>
 #include <test/test.h>
@@ -410,6 +411,10 @@ init (unsigned long mbd,
 
     nk_sched_init(&sched_cfg);
 
+#ifdef NAUT_CONFIG_THREAD_CACHE
+    nk_thread_cache_init();
+#endif
+
 #ifdef NAUT_CONFIG_CACHEPART
 #ifdef NAUT_CONFIG_CACHEPART_INTERRUPT
     nk_cache_part_init(NAUT_CONFIG_CACHEPART_THREAD_DEFAULT_PERCENT,
@@ -439,6 +444,10 @@ init (unsigned long mbd,
     nk_instrument_init();
 #endif
 
+#ifdef NAUT_CONFIG_TRACE
+    nk_trace_init();
+#endif
+
 #ifdef NAUT_CONFIG_REAL_MODE_INTERFACE 
     nk_real_mode_init();
 #endif
@@ -485,6 +494,9 @@ init (unsigned long mbd,
 
     nk_vc_init();
 
+#ifdef NAUT_CONFIG_PRINTK_RING
+    nk_printk_ring_init();
+#endif
     
 #ifdef NAUT_CONFIG_VIRTUAL_CONSOLE_CHARDEV_CONSOLE
     nk_vc_start_chardev_console(NAUT_CONFIG_VIRTUAL_CONSOLE_CHARDEV_CONSOLE_NAME);
@@ -31,6 +31,7 @@
 #include <nautilus/mm.h>
 #include <nautilus/shell.h>
 #include <nautilus/timer.h>
+#include <nautilus/scheduler.h>
 #include <nautilus/dev.h>
 #include <dev/apic.h>
 #include <dev/i8254.h>
@@ -477,6 +478,19 @@ apic_timer_setup (struct apic_dev * apic, uint32_t quantum_ms)
     APIC_DEBUG("APIC timer has:  x2apic=%d tscdeadline=%d arat=%d\n",
 	       x2apic, tscdeadline, arat);
 
+#ifdef NAUT_CONFIG_APIC_TSC_DEADLINE
+    if (tscdeadline) {
+        // the deadline is compared against the TSC, so the TSC
+        // needs to tick at a constant rate through P- and C-states
+        cpuid(CPUID_EXT_FUNC_INV_TSC, &ret);
+        if ((ret.d >> 8) & 0x1) {
+            apic->tsc_deadline = 1;
+        } else {
+            APIC_PRINT("TSC is not invariant, not using TSC-deadline timer\n");
+        }
+    }
+#endif
+
     // Note that no state is used here since APICs are per-CPU
     if (register_int_handler(APIC_TIMER_INT_VEC,
 			     apic_timer_handler,
@@ -486,7 +500,15 @@ apic_timer_setup (struct apic_dev * apic, uint32_t quantum_ms)
 
     calibrate_apic_timer(apic);
 
-    apic_set_oneshot_timer(apic,apic_realtime_to_ticks(apic,quantum_ms*1000000ULL));
+    if (apic->tsc_deadline) {
+        APIC_DEBUG("Using TSC-deadline timer for APIC 0x%x\n", apic->id);
+        apic_write(apic, APIC_REG_LVTT, APIC_TIMER_TSCDLINE | APIC_DEL_MODE_FIXED | APIC_TIMER_INT_VEC);
+        // the LVT write must be seen before the first deadline write
+        mbarrier();
+        apic_set_deadline_timer(apic,rdtsc()+apic_realtime_to_cycles(apic,quantum_ms*1000000ULL));
+    } else {
+        apic_set_oneshot_timer(apic,apic_realtime_to_ticks(apic,quantum_ms*1000000ULL));
+    }
 }
 
 
@@ -961,6 +983,11 @@ apic_init (struct cpu * core)
 
 void apic_set_oneshot_timer(struct apic_dev *apic, uint32_t ticks) 
 {
+    if (apic->tsc_deadline) {
+        apic_set_deadline_timer(apic, rdtsc() + (uint64_t)ticks*apic->cycles_per_tick);
+        return;
+    }
+
     apic_write(apic, APIC_REG_LVTT, APIC_TIMER_ONESHOT | APIC_DEL_MODE_FIXED | APIC_TIMER_INT_VEC);
     apic_write(apic, APIC_REG_TMDCR, APIC_TIMER_DIVCODE);
 
@@ -975,6 +1002,11 @@ void apic_set_oneshot_timer(struct apic_dev *apic, uint32_t ticks)
 void apic_update_oneshot_timer(struct apic_dev *apic, uint32_t ticks,
 			       nk_timer_condition_t cond)
 {
+    if (apic->tsc_deadline) {
+        apic_update_deadline_timer(apic, rdtsc() + (uint64_t)ticks*apic->cycles_per_tick, cond);
+        return;
+    }
+
     if (!apic->timer_set) { 
 	apic_set_oneshot_timer(apic,ticks);
     } else {
@@ -995,6 +1027,55 @@ void apic_update_oneshot_timer(struct apic_dev *apic, uint32_t ticks,
     // note that this is set at the entry to null_kick
     apic->in_kick_interrupt=0;
 }
+
+
+void apic_set_deadline_timer(struct apic_dev *apic, uint64_t tsc)
+{
+    // a deadline of zero disarms the timer, so never use it
+    if (!tsc) {
+	tsc = 1;
+    }
+    msr_write(IA32_TSC_DEADLINE_MSR, tsc);
+    apic->timer_set = 1;
+    apic->current_deadline = tsc;
+}
+
+void apic_update_deadline_timer(struct apic_dev *apic, uint64_t tsc,
+				nk_timer_condition_t cond)
+{
+    if (!apic->timer_set) { 
+	apic_set_deadline_timer(apic,tsc);
+    } else {
+	switch (cond) { 
+	case UNCOND:
+	    apic_set_deadline_timer(apic,tsc);
+	    break;
+	case IF_EARLIER:
+	    if (tsc < apic->current_deadline) { apic_set_deadline_timer(apic,tsc);}
+	    break;
+	case IF_LATER:
+	    if (tsc > apic->current_deadline) { apic_set_deadline_timer(apic,tsc);}
+	    break;
+	}
+    }
+    apic->in_timer_interrupt=0;
+    apic->in_kick_interrupt=0;
+}
+
+uint64_t apic_timer_remaining_ns(struct apic_dev *apic)
+{
+    uint64_t now;
+
+    if (apic->tsc_deadline) {
+	now = rdtsc();
+	if (!apic->timer_set || apic->current_deadline <= now) {
+	    return 0;
+	}
+	return ((apic->current_deadline - now)*1000ULL)/apic->cycles_per_us;
+    } else {
+	return (apic_read(apic, APIC_REG_TMCCT)*apic->ps_per_tick)/1000ULL;
+    }
+}
 	    
 
 
@@ -1020,6 +1101,13 @@ uint64_t apic_cycles_to_realtime(struct apic_dev *apic, uint64_t cycles)
     return 1000ULL*(cycles/(apic->cycles_per_us));
 }
 
+// inverse of apic_cycles_to_realtime for absolute times, split
+// so that the multiply does not overflow for large TSC values
+uint64_t apic_realtime_to_tsc(struct apic_dev *apic, uint64_t ns)
+{
+    return (ns/1000ULL)*apic->cycles_per_us + ((ns%1000ULL)*apic->cycles_per_us)/1000ULL;
+}
+
 
 // this is 10 ms (1/100)
 #define TEST_TIME_SEC_RECIP 100
@@ -1352,7 +1440,7 @@ static int apic_timer_handler(excp_entry_t * excp, excp_vec_t vec, void *state)
 
     struct apic_dev * apic = (struct apic_dev*)per_cpu_get(apic);
 
-    uint64_t time_to_next_ns;
+    uint64_t next_ns, now_ns;
 
     apic->in_timer_interrupt=1;
 
@@ -1362,7 +1450,8 @@ static int apic_timer_handler(excp_entry_t * excp, excp_vec_t vec, void *state)
 
     // do all our callbacks
     // note that currently all cores see the events
-    time_to_next_ns = nk_timer_handler();
+    // this is the absolute time of the earliest pending timer
+    next_ns = nk_timer_handler();
 
     // note that the low-level interrupt handler code in excp_early.S
     // takes care of invoking the scheduler if needed, and the scheduler
@@ -1379,11 +1468,20 @@ static int apic_timer_handler(excp_entry_t * excp, excp_vec_t vec, void *state)
     // as far as the next interrupt or cooperative rescheduling request,
     // breaking real-time semantics.  
 
-    if (time_to_next_ns == -1) { 
+    if (apic->tsc_deadline) {
+	// program the absolute time directly, "infinite" becomes the
+	// same distance as the maximum one-shot count
+	if (next_ns == -1) {
+	    apic_set_deadline_timer(apic,rdtsc()+0xffffffffULL*apic->cycles_per_tick);
+	} else {
+	    apic_set_deadline_timer(apic,apic_realtime_to_tsc(apic,next_ns));
+	}
+    } else if (next_ns == -1) { 
 	// indicates "infinite", which we turn into the maximum timer count
 	apic_set_oneshot_timer(apic,-1);
     } else {
-	apic_set_oneshot_timer(apic,apic_realtime_to_ticks(apic,time_to_next_ns));
+	now_ns = nk_sched_get_realtime();
+	apic_set_oneshot_timer(apic,next_ns > now_ns ? apic_realtime_to_ticks(apic,next_ns-now_ns) : 1);
     }
 
     IRQ_HANDLER_END();
@@ -157,4 +157,11 @@ int  nk_gc_bdwgc_test()
 
     return bdwgc_test();
 }
+
+int  nk_gc_bdwgc_bench(int max_threads, uint64_t allocs)
+{
+    extern int bdwgc_bench(int, unsigned long);
+
+    return bdwgc_bench(max_threads, allocs);
+}
 #endif
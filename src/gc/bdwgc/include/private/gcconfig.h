@@ -2314,7 +2314,8 @@ extern char _data_end[];
 #       undef NEED_FIND_LIMIT
 #       undef HAVE_BUILTIN_UNWIND_INIT
 //#       define THREAD_GROWS_UP
-//#       define GC_THREADS // parallel marker
+//#       define GC_THREADS
+        // PARALLEL_MARK comes from the Makefile, if configured
 #       define NAUT_THREADS
 #       define DEBUG_THREADS
 //#       define GC_PTHREADS
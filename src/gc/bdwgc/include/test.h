@@ -11,5 +11,7 @@ int leak_test();
 int bdwgc_test_gc(); // Run all internal tets
 int bdwgc_test_leak_detector(); // Run all internal tets
 
+int bdwgc_bench(int max_threads, unsigned long allocs); // Allocation rate and pauses
+
 
 #endif
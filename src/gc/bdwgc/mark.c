@@ -106,6 +106,13 @@ STATIC word GC_n_rescuing_pages = 0;
 GC_INNER size_t GC_mark_stack_size = 0;
 
 #ifdef PARALLEL_MARK
+# ifdef NAUT
+#   include <nautilus/percpu.h>
+    /* Runs the initiator here, and GC_help_marker on the other CPUs, */
+    /* see naut_threads.c.                                            */
+    GC_INNER void GC_run_markers(void (*initiator)(void));
+# endif
+
   STATIC volatile AO_t GC_first_nonempty = 0;
         /* Lowest entry on mark stack   */
         /* that may be nonempty.        */
@@ -374,7 +381,11 @@ static void alloc_mark_stack(size_t);
               /* asynchronously in multiple threads, without grabbing   */
               /* the allocation lock.                                   */
                 if (GC_parallel) {
-                  GC_do_parallel_mark();
+#                 ifdef NAUT
+                    GC_run_markers(GC_do_parallel_mark);
+#                 else
+                    GC_do_parallel_mark();
+#                 endif
                   GC_ASSERT(GC_mark_stack_top < (mse *)GC_first_nonempty);
                   GC_mark_stack_top = GC_mark_stack - 1;
                   if (GC_mark_stack_too_small) {
@@ -923,6 +934,25 @@ GC_INNER word GC_mark_no = 0;
         /* We don't overflow half of it in a single call to             */
         /* GC_mark_from.                                                */
 
+#ifdef NAUT
+  /* Nautilus markers are the CPUs stopped with the world, running on  */
+  /* whatever stack they were stopped on, which may be far too small   */
+  /* for a local mark stack.  So each CPU gets one ahead of time.      */
+  STATIC mse * GC_local_mark_stacks = 0;
+
+  GC_INNER GC_bool GC_alloc_local_mark_stacks(int n)
+  {
+    GC_local_mark_stacks = (mse *)GC_scratch_alloc(
+                        (size_t)n * LOCAL_MARK_STACK_SIZE * sizeof(mse));
+    return GC_local_mark_stacks != 0;
+  }
+
+# define DCL_LOCAL_MARK_STACK(s) \
+        mse *s = GC_local_mark_stacks + my_cpu_id() * LOCAL_MARK_STACK_SIZE
+#else
+# define DCL_LOCAL_MARK_STACK(s) mse s[LOCAL_MARK_STACK_SIZE]
+#endif
+
 /* Wait all markers to finish initialization (i.e. store        */
 /* marker_[b]sp, marker_mach_threads, GC_marker_Id).            */
 GC_INNER void GC_wait_for_markers_init(void)
@@ -1172,7 +1202,7 @@ STATIC void GC_mark_local(mse *local_mark_stack, int id)
 /* empty.                                       */
 STATIC void GC_do_parallel_mark(void)
 {
-    mse local_mark_stack[LOCAL_MARK_STACK_SIZE];
+    DCL_LOCAL_MARK_STACK(local_mark_stack);
 
     GC_acquire_mark_lock();
     GC_ASSERT(I_HOLD_LOCK());
@@ -1209,7 +1239,7 @@ STATIC void GC_do_parallel_mark(void)
 /* We do not hold the GC lock, but the requestor does.  */
 GC_INNER void GC_help_marker(word my_mark_no)
 {
-    mse local_mark_stack[LOCAL_MARK_STACK_SIZE];
+    DCL_LOCAL_MARK_STACK(local_mark_stack);
     unsigned my_id;
 
     if (!GC_parallel) return;
@@ -44,15 +44,22 @@
 
 #include <nautilus/list.h>
 #include <nautilus/scheduler.h>
+#include <gc/bdwgc/bdwgc.h>
 #include "private/pthread_support.h"
 
 
 #ifdef NAUT_THREADS
 
 
+// How long the world stays stopped, which is the pause every
+// thread sees.  Protected by the allocation lock.
+static uint64_t stop_start;
+static struct nk_gc_bdwgc_stats pause_stats;
+
 GC_INNER void GC_stop_world(void)
 {
     BDWGC_DEBUG("Stopping the world from thread %p tid %lu\n", get_cur_thread(),get_cur_thread()->tid);
+    stop_start = nk_sched_get_realtime();
     nk_sched_stop_world();
 }
 
@@ -61,8 +68,43 @@ GC_INNER void GC_stop_world(void)
 /* the world stopped.                                                   */
 GC_INNER void GC_start_world(void)
 {
+    uint64_t ns;
+
     BDWGC_DEBUG("Starting the world from %p (tid %lu)\n", get_cur_thread(),get_cur_thread()->tid);
     nk_sched_start_world();
+
+    ns = nk_sched_get_realtime() - stop_start;
+    pause_stats.num_pauses++;
+    pause_stats.pause_ns_total += ns;
+    if (ns > pause_stats.pause_ns_max) {
+	pause_stats.pause_ns_max = ns;
+    }
+}
+
+
+void nk_gc_bdwgc_get_stats(struct nk_gc_bdwgc_stats *s)
+{
+    DCL_LOCK_STATE;
+
+    LOCK();
+    *s = pause_stats;
+#ifdef PARALLEL_MARK
+    s->markers = GC_parallel ? GC_markers : 1;
+#else
+    s->markers = 1;
+#endif
+    s->num_gcs = GC_gc_no;
+    s->heap_bytes = GC_heapsize;
+    UNLOCK();
+}
+
+void nk_gc_bdwgc_reset_stats()
+{
+    DCL_LOCK_STATE;
+
+    LOCK();
+    memset(&pause_stats,0,sizeof(pause_stats));
+    UNLOCK();
 }
 
 
@@ -45,6 +45,7 @@ struct nk_thread_constraints;
 #include <nautilus/list.h>
 #include <nautilus/thread.h>
 #include <nautilus/scheduler.h>
+#include <nautilus/spinlock.h>
 #include <gc/bdwgc/bdwgc.h>
 #include "bdwgc_internal.h"
 #include "private/pthread_support.h"
@@ -63,11 +64,103 @@ GC_INNER NK_LOCK_T GC_allocate_ml; //PTHREAD_MUTEX_INITIALIZER;
 /* Return the number of processors. */
 STATIC int GC_get_nprocs(void)
 {
-  BDWGC_DEBUG("(WARNING: UNIMPLEMENTED!) GC_get_npos: Returning number of proccesors as %d\n", 2);
-  return 2;
+  return nk_get_num_cpus();
 }
 
 
+#ifdef PARALLEL_MARK
+
+/*
+ * Parallel marking
+ *
+ * A collection marks with the world stopped by nk_sched_stop_world(),
+ * so marker threads would never get to run during one.  Instead, the
+ * stopped CPUs are the markers: GC_run_markers() has the initiator
+ * do GC_do_parallel_mark() while every other CPU does
+ * GC_help_marker().  Nothing involved can sleep, so the mark lock is
+ * a spinlock, and waiting on the "condition variables" is spinning
+ * with the lock dropped.  Every wait is in a loop that rechecks its
+ * condition, so there is nothing to notify.
+ */
+
+GC_INNER GC_bool GC_alloc_local_mark_stacks(int n);
+
+static spinlock_t mark_lock = 0;
+static uint8_t    mark_lock_flags;
+
+// Interrupts are off while the lock is held, so a holder cannot be
+// stopped along with the world, which would leave the markers
+// waiting on it forever
+GC_INNER void GC_acquire_mark_lock(void)
+{
+  uint8_t flags = spin_lock_irq_save(&mark_lock);
+  mark_lock_flags = flags;
+}
+
+GC_INNER void GC_release_mark_lock(void)
+{
+  uint8_t flags = mark_lock_flags;
+  spin_unlock_irq_restore(&mark_lock, flags);
+}
+
+static void wait_with_mark_lock_dropped(void)
+{
+  GC_release_mark_lock();
+  asm volatile ("pause");
+  GC_acquire_mark_lock();
+}
+
+GC_INNER void GC_wait_marker(void)
+{
+  wait_with_mark_lock_dropped();
+}
+
+GC_INNER void GC_notify_all_marker(void)
+{
+}
+
+GC_INNER void GC_notify_all_builder(void)
+{
+}
+
+GC_INNER void GC_wait_for_reclaim(void)
+{
+  GC_acquire_mark_lock();
+  while (GC_fl_builder_count > 0) {
+    wait_with_mark_lock_dropped();
+  }
+  GC_release_mark_lock();
+}
+
+
+static void (*mark_initiator)(void);
+static int    mark_initiator_cpu;
+static word   mark_helper_no;
+
+static void run_marker(void *arg, int n)
+{
+  if (my_cpu_id() == mark_initiator_cpu) {
+    mark_initiator();
+  } else {
+    GC_help_marker(mark_helper_no);
+  }
+}
+
+/* We hold the GC lock, and the world is stopped, unless this is an */
+/* early collection, in which case we mark alone.                   */
+GC_INNER void GC_run_markers(void (*initiator)(void))
+{
+  mark_initiator = initiator;
+  mark_initiator_cpu = my_cpu_id();
+  /* Only the initiator advances this. */
+  mark_helper_no = GC_mark_no;
+
+  nk_sched_stop_world_run(run_marker, 0);
+}
+
+#endif /* PARALLEL_MARK */
+
+
 
 /* Called by GC_finalize() (in case of an allocation failure observed). */
 GC_INNER void GC_reset_finalizer_nested(void)
@@ -330,6 +423,17 @@ GC_INNER void GC_thr_init(void)
     WARN("GC_get_nprocs() returned %" GC_PRIdPTR "\n", GC_nprocs);
     GC_nprocs = 2; /* assume dual-core */
   }
+
+#ifdef PARALLEL_MARK
+  /* Every CPU marks, including the one that initiates */
+  GC_markers = GC_nprocs;
+  if (GC_markers > 1 && GC_alloc_local_mark_stacks(GC_markers)) {
+    GC_parallel = TRUE;
+  } else {
+    GC_markers = 1;
+  }
+  BDWGC_INFO("%ld CPUs will mark\n", GC_markers);
+#endif
 }
 
 
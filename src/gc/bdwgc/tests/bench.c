@@ -0,0 +1,128 @@
+#include <nautilus/nautilus.h>
+#include <nautilus/thread.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/vc.h>
+#include <gc/bdwgc/bdwgc.h>
+
+#include "test.h"
+#include "gc.h"
+
+/*
+ * Allocation benchmark
+ *
+ * For 1, 2, 4, ... threads, each bound to its own CPU, every thread
+ * allocates small objects of varying size as fast as it can.  Each
+ * thread keeps a ring of the most recent ones alive, each with a
+ * pointer-free child, so collections have something to mark.  We
+ * report the aggregate allocation rate and the collection pauses.
+ */
+
+#define LIVE_SLOTS 4096
+
+struct bench_node {
+    struct bench_node *peer;
+    char              *data;
+};
+
+struct bench_arg {
+    int      id;
+    uint64_t allocs;
+};
+
+static void bench_thread(void *in, void **out)
+{
+    struct bench_arg *a = (struct bench_arg *)in;
+    struct bench_node **live;
+    struct bench_node *n;
+    uint64_t i, seed = a->id + 1;
+    size_t sz;
+
+    live = GC_MALLOC(LIVE_SLOTS * sizeof(*live));
+    if (!live) {
+        nk_vc_printf("bdwgcbench: thread %d cannot allocate its live set\n", a->id);
+        return;
+    }
+
+    for (i = 0; i < a->allocs; i += 2) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        sz = sizeof(*n) + ((seed >> 33) % 240);
+        n = GC_MALLOC(sz);
+        if (!n) {
+            nk_vc_printf("bdwgcbench: thread %d out of memory\n", a->id);
+            return;
+        }
+        n->data = GC_MALLOC_ATOMIC(16 + ((seed >> 41) % 112));
+        n->peer = live[(i / 2 + 1) % LIVE_SLOTS];
+        if (n->peer) {
+            // do not let chains through the ring build up
+            n->peer->peer = 0;
+        }
+        live[(i / 2) % LIVE_SLOTS] = n;
+    }
+}
+
+static int bench_one(int nthreads, uint64_t allocs)
+{
+    struct bench_arg args[nthreads];
+    nk_thread_id_t tids[nthreads];
+    struct nk_gc_bdwgc_stats st;
+    uint64_t start, end, heap, bytes;
+    int i, started;
+
+    GC_gcollect();
+    nk_gc_bdwgc_reset_stats();
+    heap = GC_get_total_bytes();
+
+    start = nk_sched_get_realtime();
+
+    for (started = 0; started < nthreads; started++) {
+        args[started].id = started;
+        args[started].allocs = allocs;
+        if (nk_thread_start(bench_thread, &args[started], 0, 0, 0,
+                            &tids[started], started % nk_get_num_cpus())) {
+            nk_vc_printf("bdwgcbench: could only start %d threads\n", started);
+            break;
+        }
+    }
+
+    for (i = 0; i < started; i++) {
+        nk_join(tids[i], 0);
+    }
+
+    end = nk_sched_get_realtime();
+
+    nk_gc_bdwgc_get_stats(&st);
+    bytes = GC_get_total_bytes() - heap;
+
+    nk_vc_printf("%7d %10lu %8lu %6lu %10lu %10lu %7lu\n",
+                 started,
+                 (started * allocs * 1000) / (end - start),
+                 (bytes * 1000) / (end - start),
+                 st.num_pauses,
+                 st.num_pauses ? st.pause_ns_total / st.num_pauses / 1000 : 0,
+                 st.pause_ns_max / 1000,
+                 st.markers);
+
+    return started == nthreads ? 0 : -1;
+}
+
+int bdwgc_bench(int max_threads, unsigned long allocs)
+{
+    int n;
+
+    nk_vc_printf("bdwgcbench: %lu allocations per thread, %d objects live per thread\n",
+                 allocs, 2 * LIVE_SLOTS);
+    nk_vc_printf("%7s %10s %8s %6s %10s %10s %7s\n",
+                 "threads", "Kallocs/ms", "MB/s", "gcs", "pause(us)", "max(us)", "markers");
+
+    for (n = 1; n <= max_threads; n *= 2) {
+        if (bench_one(n, allocs)) {
+            return -1;
+        }
+        if (n < max_threads && n * 2 > max_threads) {
+            n = max_threads / 2;
+        }
+    }
+
+    return 0;
+}
@@ -177,6 +177,11 @@ GC_API void * GC_CALL GC_malloc_atomic(size_t bytes)
     void *result;
     void **tiny_fl;
 
+    if (!tsd) {
+        /* No thread, or one started before the collector was up */
+        return GC_core_malloc_atomic(bytes);
+    }
+
     GC_ASSERT(GC_is_initialized);
     tiny_fl = ((GC_tlfs)tsd) -> ptrfree_freelists;
     GC_FAST_MALLOC_GRANS(result, granules, tiny_fl, DIRECT_GRANULES, PTRFREE,
@@ -41,14 +41,35 @@ handle_collect (char * buf, void * priv)
     return 0;
 #else
 #ifdef NAUT_CONFIG_ENABLE_PDSGC
-    nk_vc_printf("Doing PDSGC global garbage collection\n");
     struct nk_gc_pdsgc_stats s;
-    int rc = nk_gc_pdsgc_collect(&s);
-    nk_vc_printf("PDSGC global garbage collection done result: %d\n",rc);
+    int rc;
+#ifdef NAUT_CONFIG_INCREMENTAL_PDSGC
+    uint64_t us;
+    if (sscanf(buf,"collect inc %lu",&us)==1) {
+	nk_gc_pdsgc_set_max_pause(us*1000);
+    }
+    if (!strncmp(buf,"collect inc",11)) {
+	nk_vc_printf("Doing PDSGC incremental garbage collection\n");
+	rc = nk_gc_pdsgc_collect_incremental(&s);
+	nk_vc_printf("PDSGC incremental garbage collection done result: %d\n",rc);
+	nk_vc_printf("%lu pauses, longest %lu us, last budget %lu us\n",
+		     s.slices, s.max_pause_ns/1000, s.budget_ns/1000);
+    } else
+#endif
+    {
+	nk_vc_printf("Doing PDSGC global garbage collection\n");
+	rc = nk_gc_pdsgc_collect(&s);
+	nk_vc_printf("PDSGC global garbage collection done result: %d\n",rc);
+    }
     nk_vc_printf("%lu blocks / %lu bytes freed\n",
 		 s.num_blocks, s.total_bytes);
     nk_vc_printf("smallest freed block: %lu bytes, largest freed block: %lu bytes\n",
 		 s.min_block, s.max_block);
+    nk_vc_printf("pause %lu us, mark %lu us on %lu cpus (%lu steals)\n",
+		 s.pause_ns/1000, s.mark_ns/1000, s.mark_cpus, s.steals);
+    nk_vc_printf("%lu blocks / %lu bytes reachable, %lu bytes scanned (%lu MB/s)\n",
+		 s.marked_blocks, s.marked_bytes, s.scanned_bytes,
+		 s.mark_ns ? (s.scanned_bytes*1000)/s.mark_ns : 0);
     return 0;
 #else 
     nk_vc_printf("No garbage collector is enabled...\n");
@@ -93,6 +114,27 @@ handle_bdwgc (char * buf, void * priv)
 #endif
 }
 
+static int
+handle_bdwgcbench (char * buf, void * priv)
+{
+#ifdef NAUT_CONFIG_TEST_BDWGC
+    int threads = nk_get_num_cpus();
+    uint64_t allocs = 1000000;
+
+    sscanf(buf, "bdwgcbench %d %lu", &threads, &allocs);
+
+    if (threads < 1 || !allocs) {
+        nk_vc_printf("bdwgcbench [threads] [allocs]\n");
+        return 0;
+    }
+
+    return nk_gc_bdwgc_bench(threads, allocs);
+#else
+    nk_vc_printf("BDWGC tests are not enabled...\n");
+    return 0;
+#endif
+}
+
 static int
 handle_pdsgc (char * buf, void * priv)
 {
@@ -106,7 +148,7 @@ handle_pdsgc (char * buf, void * priv)
 
 static struct shell_cmd_impl collect_impl = {
     .cmd      = "collect",
-    .help_str = "collect",
+    .help_str = "collect [inc [max_pause_us]]",
     .handler  = handle_collect,
 };
 nk_register_shell_cmd(collect_impl);
@@ -125,6 +167,13 @@ static struct shell_cmd_impl bdwgc_impl = {
 };
 nk_register_shell_cmd(bdwgc_impl);
 
+static struct shell_cmd_impl bdwgcbench_impl = {
+    .cmd      = "bdwgcbench",
+    .help_str = "bdwgcbench [threads] [allocs]",
+    .handler  = handle_bdwgcbench,
+};
+nk_register_shell_cmd(bdwgcbench_impl);
+
 static struct shell_cmd_impl pdsgc_impl = {
     .cmd      = "pdsgc",
     .help_str = "pdsgc",
@@ -30,11 +30,22 @@
 #include <nautilus/thread.h>
 #include <nautilus/scheduler.h>
 #include <nautilus/backtrace.h>
+#include <nautilus/spinlock.h>
+#include <nautilus/futex.h>
+#include <nautilus/timer.h>
 #include <gc/pdsgc/pdsgc.h>
 
+// Block flags are the tri-color state: a block is white if VISITED
+// is clear, grey if it is VISITED and either on a mark stack or
+// GREY, and black once it is VISITED and has been scanned.  GREY is
+// only set on a block that could not be pushed, so that it can be
+// found again.
 #define VISITED 0x1
+#define GREY    0x2
 
-#define GC_STACK_SIZE (4*1024*1024)
+// marking does not recurse, so this only needs to hold the
+// collector's own frames
+#define GC_STACK_SIZE (64*1024)
 #define GC_MAX_THREADS (NAUT_CONFIG_MAX_THREADS*16)
 
 #ifndef NAUT_CONFIG_DEBUG_PDSGC
@@ -56,8 +67,53 @@
 #define PDSGC_SPECIFIC_STACK_BOTTOM(t) ((t) ? ((void*)((uint64_t)(t)->stack + (t)->stack_size - 0)) : 0)
 #define PDSGC_STACK_BOTTOM() (PDSGC_SPECIFIC_STACK_BOTTOM(get_cur_thread()))
 
+// Marking uses an explicit mark stack per CPU instead of recursion.
+// Ranges larger than MARK_CHUNK are scanned a piece at a time, with
+// the rest pushed back, so that idle CPUs can steal them.  If a
+// stack fills, the block being pushed stays marked but unscanned,
+// and it is rescanned after the pass.
+#define MARK_STACK_ENTRIES 8192
+#define MARK_CHUNK         (16*1024)
+#define MARK_STEAL_MAX     32
+#define MARK_BATCH         32
+
+struct mark_range {
+    void *start;
+    void *end;
+};
+
+struct mark_stack {
+    spinlock_t         lock;
+    volatile uint64_t  top;
+    struct mark_range *entries;
+    // stats for the current pass
+    uint64_t           blocks;
+    uint64_t           bytes;
+    uint64_t           scanned;
+    uint64_t           steals;
+} __attribute__((aligned(64)));
+
 static void *gc_stack=0;
 
+static struct mark_stack *mark_stacks = 0;
+static struct mark_range *mark_entries = 0;
+static int                mark_num_stacks = 0;
+
+static volatile uint64_t  mark_idle;
+static volatile int       mark_overflowed;
+static volatile int       mark_failed;
+static int                mark_cpus;
+
+// nonzero if marking must stop at this time, as in a slice
+static volatile uint64_t  mark_deadline;
+
+// held for the duration of any collection, so a full collection
+// waits for an incremental one to finish
+static volatile uint32_t  gc_lock;
+
+// candidate pointers outside of this cannot point to the heap
+static void *heap_start, *heap_end;
+
 static uint64_t num_thread_stack_limits;
 
 static struct thread_stack_limits {
@@ -80,6 +136,18 @@ int  nk_gc_pdsgc_init()
 	ERROR("Failed to allocate GC thread stack limits array\n");
 	return -1;
     } 
+    mark_num_stacks = nk_get_num_cpus();
+    mark_stacks = kmem_mallocz(sizeof(struct mark_stack)*mark_num_stacks);
+    mark_entries = kmem_mallocz(sizeof(struct mark_range)*MARK_STACK_ENTRIES*mark_num_stacks);
+    if (!mark_stacks || !mark_entries) {
+	ERROR("Failed to allocate mark stacks\n");
+	return -1;
+    }
+    int i;
+    for (i=0;i<mark_num_stacks;i++) {
+	spinlock_init(&mark_stacks[i].lock);
+	mark_stacks[i].entries = &mark_entries[i*MARK_STACK_ENTRIES];
+    }
     INFO("init\n");
     return 0;
 }
@@ -88,6 +156,8 @@ void nk_gc_bdsgc_deinit()
 {
     kmem_free(gc_stack);
     kmem_free(gc_thread_stack_limits);
+    kmem_free(mark_stacks);
+    kmem_free(mark_entries);
     INFO("deinit\n");
 }
 
@@ -206,53 +276,102 @@ static int capture_thread_stack_limits()
     }
 }
 
-static inline int handle_block(void *start, void *end);
-
-static inline int handle_address(void *start)
+static inline int mark_push(struct mark_stack *m, void *start, void *end)
 {
-    void *block_addr;
-    uint64_t block_size, flags;
-    void *approx_rsp = &approx_rsp;
+    int rc = 0;
 
-    // short circuit 0 
-    if (!start) { 
-	return 0;
+    spin_lock(&m->lock);
+    if (m->top == MARK_STACK_ENTRIES) {
+	rc = -1;
+    } else {
+	m->entries[m->top].start = start;
+	m->entries[m->top].end = end;
+	m->top++;
     }
+    spin_unlock(&m->lock);
 
-    if ((addr_t)approx_rsp < (addr_t)(gc_stack+4096)) { 
-	ERROR("Ran out of room in the GC stack!\n");
-	return -1;
-    }
+    return rc;
+}
+
+static inline int mark_pop(struct mark_stack *m, struct mark_range *r)
+{
+    int rc = 0;
 
-    if (kmem_find_block(start,&block_addr,&block_size,&flags)) { 
-	//DEBUG("Skipping address %p as it is non-heap\n",start);
-	// not a valid block - skip
+    if (!m->top) {
 	return 0;
     }
 
-    if (flags & VISITED) { 
-	DEBUG("Skipping address %p (block %p) as it is already marked\n", start, block_addr);
-	return 0;
+    spin_lock(&m->lock);
+    if (m->top) {
+	m->top--;
+	*r = m->entries[m->top];
+	rc = 1;
     }
+    spin_unlock(&m->lock);
 
-    if (kmem_set_block_flags(block_addr, flags | VISITED)) {
-	ERROR("Failed to set visited on block %p\n", block_addr);
-	return -1;
+    return rc;
+}
+
+// move up to half of some other stack's ranges onto ours
+static int mark_steal(struct mark_stack *m, int n)
+{
+    struct mark_range buf[MARK_STEAL_MAX];
+    int me = m - mark_stacks;
+    uint64_t k, i;
+    int j;
+
+    for (j=1;j<n;j++) {
+	struct mark_stack *v = &mark_stacks[(me+j)%n];
+
+	if (!v->top) {
+	    continue;
+	}
+
+	spin_lock(&v->lock);
+	k = (v->top+1)/2;
+	if (k > MARK_STEAL_MAX) {
+	    k = MARK_STEAL_MAX;
+	}
+	for (i=0;i<k;i++) {
+	    buf[i] = v->entries[--v->top];
+	}
+	spin_unlock(&v->lock);
+
+	if (k) {
+	    // we are empty, so there is room
+	    for (i=0;i<k;i++) {
+		mark_push(m,buf[i].start,buf[i].end);
+	    }
+	    m->steals++;
+	    return 1;
+	}
     }
 
-    DEBUG("Visited block %p via address %p - now visiting its children\n", block_addr, start);
+    return 0;
+}
+
+static void mark_drain(struct mark_stack *m);
 
-    return handle_block(block_addr,block_addr+block_size);
+static inline int mark_expired()
+{
+    return mark_deadline && nk_sched_get_realtime() >= mark_deadline;
 }
-    
 
-static inline int handle_block(void *start, void *end)
+// push a range, scanning what we have if there is no room
+static void mark_push_root(struct mark_stack *m, void *start, void *end)
 {
-    void *cur;
+    while (mark_push(m,start,end)) {
+	mark_drain(m);
+    }
+}
 
-    DEBUG("Handling block %p-%p\n", start,end);
-    
+// queue the contents of a block we have just marked
+static void mark_push_block(struct mark_stack *m, void *start, void *end)
+{
     struct thread_stack_limits *t = is_thread_stack(start,end);
+    void *block = start, *block_addr;
+    uint64_t block_size;
+    int rc;
 
     if (t) { 
 	// if it's a thread stack, then consider only the range
@@ -263,119 +382,293 @@ static inline int handle_block(void *start, void *end)
     }
 
     if ((addr_t)start%8 || (addr_t)end%8) { 
-	ERROR("Block %p-%p is not aligned to a pointer\n");
-	return -1;
+	ERROR("Block %p-%p is not aligned to a pointer\n",start,end);
+	mark_failed = 1;
+	return;
     }
     
     // If we contain the kmem internal range, we must not scan this
     // since it has pointers to all allocated blocks
-
-    // do we contain the kmem internal range?
     if (((addr_t)kmem_internal_start>=(addr_t)start) &&
 	((addr_t)kmem_internal_end<=(addr_t)end)) { 
-	
 	DEBUG("block %p-%p contains kmem range %p-%p - skipping that range\n",
 	      start,end,kmem_internal_start,kmem_internal_end);
-	
-	for (cur=start;cur<kmem_internal_start;cur+=sizeof(addr_t)) { 
-	    if (handle_address(*(void**)cur)) { 
-		ERROR("Failed to handle address %p - failing block\n", cur);
-		return -1;
-	    }
+	rc = 0;
+	if (start<kmem_internal_start) {
+	    rc |= mark_push(m,start,kmem_internal_start);
 	}
-	
-	for (cur=kmem_internal_end;cur<end;cur+=sizeof(addr_t)) { 
-	    if (handle_address(*(void**)cur)) { 
-		ERROR("Failed to handle address %p - failing block\n", cur);
-		return -1;
-	    }
+	if (kmem_internal_end<end) {
+	    rc |= mark_push(m,kmem_internal_end,end);
 	}
-	
     } else {
-	
-	for (cur=start;cur<end;cur+=sizeof(addr_t)) { 
-	    if (handle_address(*(void**)cur)) { 
-		ERROR("Failed to handle address %p - failing block\n", cur);
-		return -1;
+	rc = mark_push(m,start,end);
+    }
+
+    if (rc) {
+	// leave it grey for the rescan
+	kmem_find_and_set_block_flag(block,GREY,&block_addr,&block_size);
+	mark_overflowed = 1;
+    }
+}
+
+// mark whatever blocks a batch of candidate pointers land in
+static void mark_batch(struct mark_stack *m, void **batch, int n)
+{
+    void *block_addr, *last = 0;
+    uint64_t block_size;
+    int i;
+
+    for (i=0;i<n;i++) {
+	// runs of pointers to the same object are common
+	if (batch[i] == last) {
+	    continue;
+	}
+	last = batch[i];
+	if (kmem_find_and_set_block_flag(batch[i],VISITED,&block_addr,&block_size)==1) {
+	    DEBUG("Visited block %p via address %p\n", block_addr, batch[i]);
+	    m->blocks++;
+	    m->bytes += block_size;
+	    mark_push_block(m,block_addr,block_addr+block_size);
+	}
+    }
+}
+
+static void mark_scan(struct mark_stack *m, void *start, void *end)
+{
+    void *batch[MARK_BATCH];
+    void **cur;
+    int n = 0;
+
+    DEBUG("Scanning %p-%p\n", start,end);
+
+    m->scanned += end-start;
+
+    // the cheap range check weeds out most words, the rest are
+    // looked up together
+    for (cur=start;(void*)cur<end;cur++) { 
+	void *p = *cur;
+	if (p>=heap_start && p<heap_end) {
+	    batch[n++] = p;
+	    if (n==MARK_BATCH) {
+		mark_batch(m,batch,n);
+		n = 0;
 	    }
 	}
     }
-	
-    return 0;
+
+    mark_batch(m,batch,n);
 }
 
-static int mark_gc_state()
+// work through our own stack until it is empty
+static void mark_drain(struct mark_stack *m)
 {
-    void *block_addr;
-    uint64_t block_size, flags;
+    struct mark_range r;
 
-    if (kmem_find_block(gc_stack,&block_addr,&block_size,&flags)) { 
-	ERROR("Could not find GC stack?!\n");
-	return -1;
+    while (mark_pop(m,&r)) {
+	if (r.end-r.start > MARK_CHUNK) {
+	    // we just made room for this
+	    mark_push(m,r.start+MARK_CHUNK,r.end);
+	    r.end = r.start+MARK_CHUNK;
+	}
+	mark_scan(m,r.start,r.end);
+	if (mark_expired()) {
+	    return;
+	}
+    }
+}
+
+static int mark_any_work(int n)
+{
+    int i;
+
+    for (i=0;i<n;i++) {
+	if (mark_stacks[i].top) {
+	    return 1;
+	}
     }
+    return 0;
+}
 
-    if (kmem_set_block_flags(block_addr, flags | VISITED)) {
-	ERROR("Failed to set visited on GC stack\n");
-	return -1;
+// run by every CPU while the world is stopped
+static void mark_worker(void *arg, int n)
+{
+    struct mark_stack *m = &mark_stacks[my_cpu_id()];
+
+    mark_cpus = n;
+
+    while (1) {
+	mark_drain(m);
+
+	if (mark_expired()) {
+	    return;
+	}
+
+	if (mark_steal(m,n)) {
+	    continue;
+	}
+
+	// we are out of work, and so is everyone else when all n
+	// of us are, since only a working CPU can create more
+	__sync_fetch_and_add(&mark_idle,1);
+	while (1) {
+	    if (mark_idle == n || mark_expired()) {
+		return;
+	    }
+	    if (mark_any_work(n)) {
+		__sync_fetch_and_sub(&mark_idle,1);
+		break;
+	    }
+	    asm volatile("pause");
+	}
     }
+}
+
+static void mark_run()
+{
+    mark_idle = 0;
+    nk_sched_stop_world_run(mark_worker,0);
+}
 
-    if (kmem_find_block(gc_thread_stack_limits,&block_addr,&block_size,&flags)) { 
-	ERROR("Could not find GC thread stack limits?!\n");
+static int mark_gc_block(void *addr, char *what)
+{
+    void *block_addr;
+    uint64_t block_size, flags;
+
+    if (kmem_find_block(addr,&block_addr,&block_size,&flags)) { 
+	ERROR("Could not find %s?!\n",what);
 	return -1;
     }
 
     if (kmem_set_block_flags(block_addr, flags | VISITED)) {
-	ERROR("Failed to set visited on GC thread stack limits\n");
+	ERROR("Failed to set visited on %s\n",what);
 	return -1;
     }
 
     return 0;
 }
 
+static int is_gc_state(void *block)
+{
+    return block==gc_stack || block==gc_thread_stack_limits ||
+	block==mark_stacks || block==mark_entries;
+}
+
+static int mark_gc_state()
+{
+    return mark_gc_block(gc_stack,"GC stack") ||
+	mark_gc_block(gc_thread_stack_limits,"GC thread stack limits") ||
+	mark_gc_block(mark_stacks,"GC mark stacks") ||
+	mark_gc_block(mark_entries,"GC mark stack entries");
+}
+
 extern int _data_start, _data_end;
 
-static int handle_data_roots()
+static int push_data_roots()
 {
-    DEBUG("***Handling data roots %p-%p\n",&_data_start,&_data_end);
-    int rc = handle_block(&_data_start, &_data_end);
-    if (rc) {
-	ERROR("***Handling data roots failed\n");
-    }
-    return rc;
+    DEBUG("***Pushing data roots %p-%p\n",&_data_start,&_data_end);
+    mark_push_root(&mark_stacks[my_cpu_id()],&_data_start,&_data_end);
+    return 0;
 }
 
 // we need to handle our thread stack separately
-static void handle_thread_stack(nk_thread_t *t, void *state)
+// stacks are dealt round robin to the mark stacks of the CPUs
+static void push_thread_stack(nk_thread_t *t, void *state)
 {
     void *start = PDSGC_SPECIFIC_STACK_TOP(t);
     void *end = PDSGC_SPECIFIC_STACK_BOTTOM(t);
+    uint64_t *next = (uint64_t *)state;
   
-    DEBUG("***Handling thread stack for thread %lu (%s) - %p-%p\n",
+    DEBUG("***Pushing thread stack for thread %lu (%s) - %p-%p\n",
 	  t->tid,t->is_idle ? "(*idle*)" : !t->name[0] ? "*unnamed*" : t->name,start,end);
 
-    int rc =  handle_block(start,end);
+    if ((addr_t)start%8 || (addr_t)end%8) { 
+	ERROR("***Thread stack %p-%p is not aligned to a pointer\n",start,end);
+	mark_failed = 1;
+	return;
+    }
 
-    if (rc) { 
-	ERROR("***Handling thread stack failed\n");
+    mark_push_root(&mark_stacks[(*next)++ % mark_num_stacks],start,end);
+}
+
+static int push_thread_stack_roots()
+{
+    uint64_t next = 0;
+
+    DEBUG("***Pushing thread stacks\n");
+
+    nk_sched_map_threads(-1,push_thread_stack,&next);
+
+    return 0;
+}
+
+// if a mark stack overflowed, some marked blocks were never scanned,
+// and these were left grey, so we push them again.  With the world
+// running (concurrent!=0) we cannot mark, so we leave what does not
+// fit for later
+static int rescan_block(void *block, void *state)
+{
+    int concurrent = state!=0;
+    void *block_addr;
+    uint64_t block_size, flags;
+    uint8_t irq;
+
+    if (is_gc_state(block) ||
+	kmem_find_block(block,&block_addr,&block_size,&flags)) {
+	return 0;
+    }
+
+    irq = irq_disable_save();
+
+    struct mark_stack *m = &mark_stacks[my_cpu_id()];
+
+    // make room ahead of time, so the push cannot overflow
+    if (m->top > MARK_STACK_ENTRIES-2) {
+	if (concurrent) {
+	    mark_overflowed = 1;
+	    irq_enable_restore(irq);
+	    return 0;
+	}
+	mark_drain(m);
     }
 
-    *(int *)state |= rc;
+    // it is already visited, so nobody else changes its flags
+    kmem_set_block_flags(block_addr, flags & ~GREY);
+    mark_push_block(m,block_addr,block_addr+block_size);
+
+    irq_enable_restore(irq);
+
+    return 0;
 }
 
-static int handle_thread_stack_roots()
+// mark until nothing is grey
+static int mark_finish()
 {
-    int rc = 0;
+    int passes = 0;
+
+    mark_run();
+
+    while (mark_overflowed && !mark_failed) {
+	DEBUG("***Mark stack overflowed - rescanning grey blocks (pass %d)\n",++passes);
+	mark_overflowed = 0;
+	if (kmem_apply_to_matching_blocks(GREY,GREY,rescan_block,0)) {
+	    return -1;
+	}
+	mark_run();
+    }
 
-    DEBUG("***Handling thread stacks\n");
+    return mark_failed ? -1 : 0;
+}
 
-    nk_sched_map_threads(-1,handle_thread_stack,&rc);
+static int mark_all()
+{
+    mark_overflowed = 0;
+    mark_failed = 0;
 
-    if (rc) { 
-	ERROR("***Failed to handle some thread stack rc=%d!\n",rc);
+    if (push_data_roots() || push_thread_stack_roots()) { 
 	return -1;
-    } else {
-	return 0;
     }
+
+    return mark_finish();
 }
 
 static uint64_t num_gc=0;
@@ -444,17 +737,50 @@ static int leak(void *block, void *state)
     return 0;
 }
 
+// empty the stacks, which a failed pass may have left work on,
+// and zero their stats
+static void mark_reset()
+{
+    int i;
+
+    for (i=0;i<mark_num_stacks;i++) {
+	mark_stacks[i].top = 0;
+	mark_stacks[i].blocks = 0;
+	mark_stacks[i].bytes = 0;
+	mark_stacks[i].scanned = 0;
+	mark_stacks[i].steals = 0;
+    }
+}
+
+static void mark_stats_fold(struct nk_gc_pdsgc_stats *s)
+{
+    int i;
+
+    for (i=0;i<mark_num_stacks;i++) {
+	s->marked_blocks += mark_stacks[i].blocks;
+	s->marked_bytes += mark_stacks[i].bytes;
+	s->scanned_bytes += mark_stacks[i].scanned;
+	s->steals += mark_stacks[i].steals;
+    }
+    s->mark_cpus = mark_cpus;
+}
+
 static int  _nk_gc_pdsgc_handle(int (*handle_unvisited)(void *block, void *state), void *state)
 {
+    uint64_t start, mark_start, mark_end;
+
+    start = nk_sched_get_realtime();
+
     nk_sched_stop_world();
 
     blocks_freed=0;
 
     kmem_get_internal_pointer_range(&kmem_internal_start,&kmem_internal_end);
+    kmem_get_managed_range(&heap_start,&heap_end);
 
     DEBUG("kmem internal range is %p-%p\n",kmem_internal_start, kmem_internal_end);
 
-    if (kmem_mask_all_blocks_flags(~VISITED,0)) { 
+    if (kmem_mask_all_blocks_flags(~(VISITED|GREY),0)) { 
 	ERROR("Failed to clear visit flags...\n");
 	goto out_bad;
     }
@@ -462,24 +788,30 @@ static int  _nk_gc_pdsgc_handle(int (*handle_unvisited)(void *block, void *state
     // Do not revisit the GC's own state
     if (mark_gc_state()) { 
 	ERROR("Failed to mark GC stack....\n");
-	return -1;
+	goto out_bad;
     }
 
     if (capture_thread_stack_limits()) { 
 	ERROR("Cannot capture thread stack limits\n");
-	return -1;
-    }
-    
-    if (handle_data_roots()) {
-	ERROR("Failed to handle data segment roots\n");
 	goto out_bad;
     }
 
-    if (handle_thread_stack_roots()) { 
-	ERROR("Failed to handle thread stack roots\n");
+    mark_reset();
+
+    mark_start = nk_sched_get_realtime();
+
+    if (mark_all()) {
+	ERROR("Failed to mark from roots\n");
 	goto out_bad;
     }
 
+    mark_end = nk_sched_get_realtime();
+
+    if (stats) {
+	mark_stats_fold(stats);
+	stats->mark_ns = mark_end - mark_start;
+    }
+
     DEBUG("Now applying dealloc or leak to unvisited blocks\n");
     if (kmem_apply_to_matching_blocks(VISITED,0,handle_unvisited,state)) { 
 	ERROR("Failed to complete applying dealloc/leak function\n");
@@ -490,6 +822,11 @@ static int  _nk_gc_pdsgc_handle(int (*handle_unvisited)(void *block, void *state
     DEBUG("Pass succeeded - pass %lu freed/detected %lu blocks\n", num_gc, blocks_freed);
     num_gc++;
     nk_sched_start_world();
+    if (stats) {
+	stats->pause_ns = nk_sched_get_realtime() - start;
+	stats->max_pause_ns = stats->pause_ns;
+	stats->slices = 1;
+    }
     return 0;
 
  out_bad:
@@ -525,6 +862,8 @@ int  nk_gc_pdsgc_collect(struct nk_gc_pdsgc_stats *s)
 
     INFO("Performing garbage collection\n");
 
+    nk_futex_mutex_lock(&gc_lock);
+
     stats = s;
     if (stats) { 
 	memset(stats,0,sizeof(*stats));
@@ -536,6 +875,9 @@ int  nk_gc_pdsgc_collect(struct nk_gc_pdsgc_stats *s)
     if (stats && !stats->num_blocks) { 
 	stats->min_block=0;
     }
+
+    stats = 0;
+    nk_futex_mutex_unlock(&gc_lock);
     
     return rc;
 }
@@ -552,6 +894,8 @@ int  nk_gc_pdsgc_leak_detect(struct nk_gc_pdsgc_stats *s)
 
     INFO("Performing leak detection\n");
 
+    nk_futex_mutex_lock(&gc_lock);
+
     stats = s;
     if (stats) { 
 	memset(stats,0,sizeof(*stats));
@@ -563,10 +907,345 @@ int  nk_gc_pdsgc_leak_detect(struct nk_gc_pdsgc_stats *s)
     if (stats && !stats->num_blocks) { 
 	stats->min_block=0;
     }
+
+    stats = 0;
+    nk_futex_mutex_unlock(&gc_lock);
     
     return rc;
 }
 
+#ifdef NAUT_CONFIG_INCREMENTAL_PDSGC
+
+// Incremental collection
+//
+// A cycle runs on its own low priority aperiodic thread, so it only
+// gets time the scheduler has not promised to anyone else:
+//
+//   1. Clear the flags, with the world running, since nothing is
+//      being marked yet.
+//   2. Stop the world briefly to make new blocks start visited
+//      (allocate black), push the roots, and turn on the barrier.
+//   3. Mark in slices, each of which stops the world and marks on
+//      all CPUs until the pause budget runs out.  The barrier shades
+//      any block whose pointer is stored into the heap in between.
+//   4. Stop the world to rescan the roots, which were not covered by
+//      the barrier, and mark whatever that finds.
+//   5. Sweep with the world running.  Everything allocated since 2
+//      is visited, so only garbage is white.
+
+#define GC_THREAD_PRIORITY 1000000000ULL  // ns quantum, well below default
+#define MIN_SLICE_NS       10000ULL
+
+volatile int nk_gc_pdsgc_marking = 0;
+
+static uint64_t max_pause_ns = NAUT_CONFIG_PDSGC_MAX_PAUSE_US*1000ULL;
+
+static volatile int      inc_thread_started = 0;
+static volatile uint32_t inc_requested = 0;
+static volatile uint32_t inc_completed = 0;
+static int               inc_rc;
+static struct nk_gc_pdsgc_stats inc_stats;
+
+void nk_gc_pdsgc_set_max_pause(uint64_t ns)
+{
+    max_pause_ns = ns;
+}
+
+void nk_gc_pdsgc_shade(void *ptr)
+{
+    void *block_addr;
+    uint64_t block_size;
+    uint8_t flags;
+
+    if (ptr<heap_start || ptr>=heap_end) {
+	return;
+    }
+
+    // a slice cannot start between marking the block and queueing it
+    flags = irq_disable_save();
+
+    if (nk_gc_pdsgc_marking &&
+	kmem_find_and_set_block_flag(ptr,VISITED,&block_addr,&block_size)==1) {
+	struct mark_stack *m = &mark_stacks[my_cpu_id()];
+	DEBUG("Barrier shaded block %p via address %p\n", block_addr, ptr);
+	m->blocks++;
+	m->bytes += block_size;
+	mark_push_block(m,block_addr,block_addr+block_size);
+    }
+
+    irq_enable_restore(flags);
+}
+
+static void min_slack(nk_thread_t *t, void *state)
+{
+    struct nk_sched_constraints c;
+    uint64_t *slack = (uint64_t *)state;
+
+    if (!nk_sched_thread_get_constraints(t,&c) &&
+	c.type==PERIODIC &&
+	c.periodic.period > c.periodic.slice &&
+	c.periodic.period - c.periodic.slice < *slack) {
+	*slack = c.periodic.period - c.periodic.slice;
+    }
+}
+
+// how long the next slice may stop the world for
+static uint64_t slice_budget()
+{
+    uint64_t slack = -1ULL;
+    uint64_t budget = max_pause_ns;
+
+    // a periodic thread can absorb a delay of up to its slack in
+    // each period, and we leave it half of that
+    nk_sched_map_threads(-1,min_slack,&slack);
+
+    if (slack/2 < budget) {
+	budget = slack/2;
+    }
+    if (budget < MIN_SLICE_NS) {
+	budget = MIN_SLICE_NS;
+    }
+
+    return budget;
+}
+
+static uint64_t slice_begin()
+{
+    uint64_t start = nk_sched_get_realtime();
+
+    nk_sched_stop_world();
+
+    return start;
+}
+
+static void slice_end(uint64_t start)
+{
+    uint64_t pause;
+
+    nk_sched_start_world();
+
+    pause = nk_sched_get_realtime() - start;
+
+    stats->pause_ns += pause;
+    stats->slices++;
+    if (pause > stats->max_pause_ns) {
+	stats->max_pause_ns = pause;
+    }
+}
+
+static int sweep(void *block, void *state)
+{
+    void *block_addr;
+    uint64_t block_size, flags;
+
+    // it may have been freed and reallocated (visited) since
+    // we looked at its flags
+    if (kmem_find_block(block,&block_addr,&block_size,&flags) ||
+	(flags & VISITED)) {
+	return 0;
+    }
+
+    return dealloc(block,state);
+}
+
+static int inc_cycle()
+{
+    uint64_t start, mark_time = 0, t;
+    int rc = -1;
+
+    nk_futex_mutex_lock(&gc_lock);
+
+    stats = &inc_stats;
+    memset(stats,0,sizeof(*stats));
+    stats->min_block = -1;
+    blocks_freed = 0;
+
+    mark_overflowed = 0;
+    mark_failed = 0;
+    mark_reset();
+
+    // 1. whiten
+    if (kmem_mask_all_blocks_flags(~(VISITED|GREY),0)) {
+	ERROR("Failed to clear visit flags...\n");
+	goto out;
+    }
+
+    // 2. snapshot the roots
+    start = slice_begin();
+
+    kmem_get_internal_pointer_range(&kmem_internal_start,&kmem_internal_end);
+    kmem_get_managed_range(&heap_start,&heap_end);
+    kmem_set_alloc_flags(VISITED);
+
+    if (mark_gc_state() || capture_thread_stack_limits() ||
+	push_data_roots() || push_thread_stack_roots()) {
+	ERROR("Failed to start incremental cycle\n");
+	kmem_set_alloc_flags(0);
+	slice_end(start);
+	goto out;
+    }
+
+    nk_gc_pdsgc_marking = 1;
+
+    slice_end(start);
+
+    // 3. mark in slices
+    while (!mark_failed) {
+	if (mark_overflowed) {
+	    mark_overflowed = 0;
+	    if (kmem_apply_to_matching_blocks(GREY,GREY,rescan_block,(void*)1)) {
+		mark_failed = 1;
+		break;
+	    }
+	}
+
+	if (!mark_overflowed && !mark_any_work(mark_num_stacks)) {
+	    break;
+	}
+
+	stats->budget_ns = slice_budget();
+
+	start = slice_begin();
+	t = nk_sched_get_realtime();
+	mark_deadline = start + stats->budget_ns;
+	mark_run();
+	mark_deadline = 0;
+	mark_time += nk_sched_get_realtime() - t;
+	slice_end(start);
+
+	// let everyone else run for at least as long
+	nk_sleep(stats->budget_ns);
+    }
+
+    // 4. rescan the roots and finish
+    start = slice_begin();
+    t = nk_sched_get_realtime();
+
+    if (!mark_failed && !capture_thread_stack_limits()) {
+	if (push_data_roots() || push_thread_stack_roots() || mark_finish()) {
+	    mark_failed = 1;
+	}
+    } else {
+	mark_failed = 1;
+    }
+
+    nk_gc_pdsgc_marking = 0;
+    mark_time += nk_sched_get_realtime() - t;
+    slice_end(start);
+
+    if (mark_failed) {
+	ERROR("Failed to mark incrementally\n");
+	kmem_set_alloc_flags(0);
+	goto out;
+    }
+
+    mark_stats_fold(stats);
+    stats->mark_ns = mark_time;
+
+    // 5. sweep
+    if (kmem_apply_to_matching_blocks(VISITED,0,sweep,0)) {
+	ERROR("Failed to complete sweep\n");
+	kmem_set_alloc_flags(0);
+	goto out;
+    }
+
+    kmem_set_alloc_flags(0);
+
+    DEBUG("Incremental pass %lu freed %lu blocks in %lu slices\n", num_gc, blocks_freed, stats->slices);
+
+    rc = 0;
+
+ out:
+    num_gc++;
+    if (!stats->num_blocks) {
+	stats->min_block = 0;
+    }
+    stats = 0;
+    nk_futex_mutex_unlock(&gc_lock);
+    return rc;
+}
+
+static void inc_thread(void *in, void **out)
+{
+    uint32_t seen = 0;
+
+    if (nk_thread_name(get_cur_thread(),"(pdsgc)")) {
+	ERROR("Failed to name GC thread\n");
+    }
+
+    struct nk_sched_constraints c = { .type=APERIODIC,
+				      .interrupt_priority_class=0x0,
+				      .aperiodic.priority=GC_THREAD_PRIORITY };
+
+    if (nk_sched_thread_change_constraints(&c)) {
+	ERROR("Unable to lower priority of GC thread\n");
+    }
+
+    while (1) {
+	while (inc_requested == seen) {
+	    nk_futex_wait(&inc_requested,seen,0);
+	}
+	// requests made before now are covered by this cycle
+	seen = inc_requested;
+	inc_rc = inc_cycle();
+	inc_completed = seen;
+	nk_futex_wake(&inc_completed,NK_FUTEX_WAKE_ALL);
+    }
+}
+
+static int inc_request(uint32_t *ticket)
+{
+    nk_thread_id_t tid;
+
+    if (!inc_thread_started && !__sync_lock_test_and_set(&inc_thread_started,1)) {
+	if (nk_thread_start(inc_thread,0,0,1,0,&tid,CPU_ANY)) {
+	    ERROR("Failed to start GC thread\n");
+	    inc_thread_started = 0;
+	    return -1;
+	}
+    }
+
+    *ticket = __sync_add_and_fetch(&inc_requested,1);
+    nk_futex_wake(&inc_requested,1);
+
+    return 0;
+}
+
+int nk_gc_pdsgc_start_incremental()
+{
+    uint32_t ticket;
+
+    return inc_request(&ticket);
+}
+
+int nk_gc_pdsgc_collect_incremental(struct nk_gc_pdsgc_stats *s)
+{
+    uint32_t ticket, done;
+    int rc;
+
+    INFO("Performing incremental garbage collection\n");
+
+    if (inc_request(&ticket)) {
+	return -1;
+    }
+
+    while ((int)((done = inc_completed) - ticket) < 0) {
+	nk_futex_wait(&inc_completed,done,0);
+    }
+
+    // a later cycle may have run by now, which is also fine
+    nk_futex_mutex_lock(&gc_lock);
+    rc = inc_rc;
+    if (s) {
+	*s = inc_stats;
+    }
+    nk_futex_mutex_unlock(&gc_lock);
+
+    return rc;
+}
+
+#endif
+
 #define NUM_ALLOCS 8
 
 static uint64_t num_bytes_alloced = 0;
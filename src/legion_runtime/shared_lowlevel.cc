@@ -60,6 +60,8 @@ using namespace LegionRuntime::Accessor;
 #include <nautilus/irq.h>
 #include <nautilus/instrument.h>
 #include <nautilus/numa.h>
+#include <nautilus/nautilus.h>
+#include <nautilus/scheduler.h>
 
 #include "naut_debug.h"
 //#include <libccompat.h>
@@ -76,9 +78,9 @@ using namespace LegionRuntime::Accessor;
 #define NUM_PROCS 62
 //#define NUM_PROCS	1
 #define NUM_UTIL_PROCS  1
-#define NUM_DMA_THREADS 1
+#define NUM_DMA_THREADS 1       // per NUMA domain
 // Maximum memory in global
-#define GLOBAL_MEM      4096   // (MB)	
+#define GLOBAL_MEM      4096   // (MB) per NUMA domain
 #define LOCAL_MEM       16384  // (KB)
 // Default Pthreads stack size
 #define STACK_SIZE      2      // (MB) 
@@ -184,6 +186,30 @@ static void thread_proc_free(void *arg)
   free(arg);
 }
 
+// NUMA topology, as Nautilus found it
+static unsigned num_numa_domains(void)
+{
+  unsigned num_domains = nk_get_num_domains();
+  return (num_domains > 0) ? num_domains : 1;
+}
+
+static unsigned cpu_numa_domain(int cpu)
+{
+  struct cpu *c = nk_get_nautilus_info()->sys.cpus[cpu];
+  if ((c->domain == NULL) || (c->domain->id >= num_numa_domains()))
+    return 0;
+  return c->domain->id;
+}
+
+// ACPI SLIT distance between two domains, 10 being local
+static unsigned numa_distance(unsigned a, unsigned b)
+{
+  struct nk_locality_info *loc = &(nk_get_nautilus_info()->sys.locality_info);
+  if (loc->numa_matrix != NULL)
+    return loc->numa_matrix[a * loc->num_domains + b];
+  return (a == b) ? 10 : 20;
+}
+
 namespace LegionRuntime {
   namespace LowLevel {
 
@@ -199,6 +225,7 @@ namespace LegionRuntime {
     class ProcessorImpl;
     class ProcessorGroup;
     class DMAQueue;
+    class DMAOperation;
     class CopyOperation;
 
     class Runtime {
@@ -251,6 +278,9 @@ namespace LegionRuntime {
       std::deque<ReservationImpl*> free_reservations;
       std::vector<MemoryImpl*> memories;
       std::vector<ProcessorImpl*> processors;
+      std::vector<int> proc_cpus;               // by processor id
+      std::vector<unsigned> proc_domains;       // by processor id
+      std::vector<Memory> domain_memories;      // by NUMA domain
       std::vector<ProcessorGroup*> proc_groups;
       std::vector<IndexSpace::Impl*> metadatas;
       std::deque<IndexSpace::Impl*> free_metas;
@@ -288,18 +318,58 @@ namespace LegionRuntime {
     Runtime *Runtime::runtime = NULL;
     DMAQueue *Runtime::dma_queue = NULL;
 
+    // Anything the DMA threads can do.  It triggers its own completion
+    // event, and returns the number of bytes it moved.
+    class DMAOperation {
+    public:
+      virtual ~DMAOperation(void) { }
+      virtual size_t perform_copy_operation(void) = 0;
+    };
+
+    // The DMA queue has num_dma_threads threads in each NUMA domain,
+    // bound to the last CPUs of the domain, as the processors are
+    // started on the first CPUs.  A copy is queued in the domain of the
+    // CPU that issues it, which is most likely where its data is, and
+    // DMA threads with nothing to do take copies from other domains
+    // before they sleep.
     class DMAQueue {
     public:
-      DMAQueue(unsigned num_threads);
+      DMAQueue(unsigned threads_per_domain);
     public:
       void start(void);
       void shutdown(void);
-      void run_dma_loop(void);
-      void enqueue_dma(CopyOperation *copy);
+      void run_dma_loop(unsigned domain);
+      void enqueue_dma(DMAOperation *copy);
     public:
       static void* start_dma_thread(void *args);
+      // Processors count the tasks they are running, so that the time
+      // spent copying can be split into time that overlapped with tasks
+      // and time that did not
+      static void task_begin(void) { __sync_fetch_and_add(&running_tasks, 1); }
+      static void task_end(void) { __sync_fetch_and_sub(&running_tasks, 1); }
     public:
       const unsigned num_dma_threads;
+    protected:
+      struct DMADomain {
+        NK_LOCK_T                 lock;
+        nk_condvar_t              cond;
+        std::deque<DMAOperation*> ready_copies;
+        std::vector<int>          cpus;
+        unsigned                  threads;
+        // accounting
+        uint64_t                  copies;
+        uint64_t                  stolen;   // taken by another domain
+        uint64_t                  bytes;
+        uint64_t                  busy_ns;
+        uint64_t                  overlap_ns;
+      };
+      struct DMAThreadArgs {
+        DMAQueue *queue;
+        unsigned  domain;
+      };
+      DMAOperation* steal_dma(unsigned domain);
+      void perform_dma(DMADomain *d, DMAOperation *copy);
+      void report(void);
     protected:
       bool dma_shutdown;
       /*
@@ -307,11 +377,16 @@ namespace LegionRuntime {
       pthread_cond_t dma_cond;
       std::vector<pthread_t> dma_threads;
       */
-      NK_LOCK_T      dma_lock;
-      nk_condvar_t       dma_cond;
+      std::vector<DMADomain*> domains;
       std::vector<nk_thread_id_t> dma_threads;
-      std::deque<CopyOperation*> ready_copies;
+      std::vector<DMAThreadArgs> thread_args;
+      // copies done by the thread issuing them, with no DMA threads
+      DMADomain inline_copies;
+      static volatile int running_tasks;
     };
+
+    /* static */
+    volatile int DMAQueue::running_tasks = 0;
     
     struct TimerStackEntry {
     public:
@@ -2465,7 +2540,9 @@ namespace LegionRuntime {
 
                     NAUTILUS_DEEP_DEBUG("invoking func :%p\n", func);
                     //uint8_t flags = irq_disable_save();
+                    DMAQueue::task_begin();
                     func(task->args, task->arglen, proc);
+                    DMAQueue::task_end();
                     //irq_enable_restore(flags);
                     // Trigger the event indicating that the task has been run
                     NAUTILUS_DEEP_DEBUG("triggering in execute task: %p\n", task);
@@ -2579,8 +2656,8 @@ namespace LegionRuntime {
 
     class MemoryImpl {
     public:
-	MemoryImpl(size_t max, Memory::Kind k) 
-		: max_size(max), remaining(max), kind(k)
+	MemoryImpl(size_t max, Memory::Kind k, int c = -1) 
+		: max_size(max), remaining(max), kind(k), cpu(c)
 	{
                 //mutex = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
 		//PTHREAD_SAFE_CALL(pthread_mutex_init(mutex,NULL));
@@ -2606,6 +2683,7 @@ namespace LegionRuntime {
 	//pthread_mutex_t *mutex;
     NK_LOCK_T *mutex;
         const Memory::Kind kind;
+        const int cpu; // allocate in the NUMA zone of this CPU, if not -1
     };
 
     size_t MemoryImpl::remaining_bytes(void) 
@@ -2626,7 +2704,10 @@ namespace LegionRuntime {
 	if (size < remaining)
 	{
 		remaining -= size;
-		ptr = malloc(size);
+		if (cpu >= 0)
+		  ptr = malloc_specific(size, cpu);
+		else
+		  ptr = malloc(size);
 #ifdef DEBUG_LOW_LEVEL
 		assert(ptr != NULL);
 #endif
@@ -3113,7 +3194,7 @@ namespace LegionRuntime {
     // CopyOperation (Declaration Only) 
     ////////////////////////////////////////////////////////
 
-    class CopyOperation : public Triggerable {
+    class CopyOperation : public Triggerable, public DMAOperation {
     public:
       CopyOperation(const std::vector<Domain::CopySrcDstField>& _srcs,
                     const std::vector<Domain::CopySrcDstField>& _dsts,
@@ -3138,7 +3219,7 @@ namespace LegionRuntime {
         NK_LOCK_DEINIT(&mutex);
       }
 
-      void perform_copy_operation(void);
+      virtual size_t perform_copy_operation(void);
 
       virtual bool trigger(unsigned count = 1, TriggerHandle handle = 0);
 
@@ -3380,7 +3461,7 @@ namespace LegionRuntime {
 	RegionInstance get_instance(void) const;
 	bool trigger(unsigned count, TriggerHandle handle);
         Reservation get_reservation(void);
-        void perform_copy_operation(RegionInstance::Impl *target, const ElementMask &src_mask, const ElementMask &dst_mask);
+        size_t perform_copy_operation(RegionInstance::Impl *target, const ElementMask &src_mask, const ElementMask &dst_mask);
         void apply_list(RegionInstance::Impl *target);
         void append_list(RegionInstance::Impl *target);
         void verify_access(unsigned ptr);
@@ -3432,6 +3513,28 @@ namespace LegionRuntime {
         std::list<CopyOperation2> pending_copies;
     };
 
+    // A whole instance copy, done by the DMA threads
+    class InstanceCopy : public DMAOperation {
+    public:
+      InstanceCopy(RegionInstance::Impl *s, RegionInstance::Impl *t, EventImpl *c,
+                   const ElementMask &sm, const ElementMask &dm)
+        : src(s), target(t), complete(c), src_mask(sm), dst_mask(dm) { }
+    public:
+      virtual size_t perform_copy_operation(void)
+      {
+        size_t bytes = src->perform_copy_operation(target, src_mask, dst_mask);
+        NAUTILUS_DEEP_DEBUG("complete trigger\n");
+        complete->trigger();
+        return bytes;
+      }
+    protected:
+      RegionInstance::Impl *src;
+      RegionInstance::Impl *target;
+      EventImpl *complete;
+      const ElementMask &src_mask;
+      const ElementMask &dst_mask;
+    };
+
     /*static*/ const RegionInstance RegionInstance::NO_INST = { 0 };
 
     RegionAccessor<AccessorType::Generic> RegionInstance::get_accessor(void) const
@@ -3623,8 +3726,13 @@ namespace LegionRuntime {
                         // Fall through and perform the copy
 		}
 	}
-        perform_copy_operation(target_impl,mask,target_mask);
-        return Event::NO_EVENT;
+        // Hand the copy to the DMA threads, and let the caller wait
+        // on it only if it needs the data
+        EventImpl *complete = Runtime::get_runtime()->get_free_event();
+        Event result = complete->get_event();
+        Runtime::get_dma_queue()->enqueue_dma(
+            new InstanceCopy(this,target_impl,complete,mask,target_mask));
+        return result;
     }
 
     bool RegionInstance::Impl::trigger(unsigned count, TriggerHandle handle)
@@ -3633,15 +3741,15 @@ namespace LegionRuntime {
     NK_LOCK(mutex);
         // Find the copy operation in the set
         bool found = false;
-        EventImpl *complete = NULL; 
+        InstanceCopy *copy = NULL; 
         for (std::list<CopyOperation2>::iterator it = pending_copies.begin();
               it != pending_copies.end(); it++)
         {
           if (it->id == handle)
           {
             found = true;
-            perform_copy_operation(it->target,it->src_mask,it->dst_mask);
-            complete = it->complete;
+            copy = new InstanceCopy(this,it->target,it->complete,
+                                    it->src_mask,it->dst_mask);
             // Remove it from the list
             pending_copies.erase(it);
             break;
@@ -3652,32 +3760,78 @@ namespace LegionRuntime {
 #endif
 	//PTHREAD_SAFE_CALL(pthread_mutex_unlock(mutex));
     NK_UNLOCK(mutex);
-        // Trigger the event saying we're done while not holding the lock!
-        NAUTILUS_DEEP_DEBUG("complete trigger\n");
-        complete->trigger();
+        // Queue the copy while not holding the lock!  The DMA thread
+        // triggers the event saying we're done
+        Runtime::get_dma_queue()->enqueue_dma(copy);
         return false;
     }
 
+    // The kernel's memcpy moves a byte at a time, which is fine for
+    // the small copies in the rest of the runtime but not for the
+    // dense spans of an instance copy.  rep movsb is done in cache
+    // lines by the CPUs we run on (ERMSB).
+    static inline void bulk_copy(void *dst, const void *src, size_t bytes)
+    {
+      __asm__ __volatile__ ("rep movsb"
+                            : "+D"(dst), "+S"(src), "+c"(bytes)
+                            : : "memory");
+    }
+
+    // Copy count elements of size bytes, each stride bytes after the
+    // last on either side.  If the elements fill their strides on both
+    // sides this is a single bulk copy, otherwise copy them one by one,
+    // as words where the field is a word.
+    static inline void strided_copy(char *dst, size_t dst_stride,
+                                    const char *src, size_t src_stride,
+                                    size_t size, size_t count)
+    {
+      if ((size == dst_stride) && (size == src_stride))
+      {
+        bulk_copy(dst, src, size * count);
+        return;
+      }
+      switch (size)
+      {
+        case 4:
+          for (size_t idx = 0; idx < count; idx++)
+            *(uint32_t*)(dst + idx * dst_stride) =
+              *(const uint32_t*)(src + idx * src_stride);
+          break;
+        case 8:
+          for (size_t idx = 0; idx < count; idx++)
+            *(uint64_t*)(dst + idx * dst_stride) =
+              *(const uint64_t*)(src + idx * src_stride);
+          break;
+        default:
+          for (size_t idx = 0; idx < count; idx++)
+            bulk_copy(dst + idx * dst_stride, src + idx * src_stride, size);
+          break;
+      }
+    }
+
     namespace RangeExecutors {
       class Memcpy {
       public:
         Memcpy(void *_dst_base, const void *_src_base, size_t _elmt_size)
           : dst_base((char*)_dst_base), src_base((const char*)_src_base), 
-            elmt_size(_elmt_size) { }
+            elmt_size(_elmt_size), bytes(0) { }
 
         void do_span(int offset, int count)
         {
           off_t byte_offset = offset * elmt_size;
           size_t byte_count = count  * elmt_size;
-          memcpy(dst_base + byte_offset,
-                 src_base + byte_offset,
-                 byte_count);
+          bulk_copy(dst_base + byte_offset,
+                    src_base + byte_offset,
+                    byte_count);
+          bytes += byte_count;
         }
 
       protected:
         char *dst_base;
         const char *src_base;
         size_t elmt_size;
+      public:
+        size_t bytes;
       };
 
       class RedopApply {
@@ -3685,7 +3839,7 @@ namespace LegionRuntime {
         RedopApply(const ReductionOpUntyped *_redop, void *_dst_base,
                    const void *_src_base, size_t _elmt_size)
           : redop(_redop), dst_base((char*)_dst_base),
-            src_base((const char*)_src_base), elmt_size(_elmt_size) { }
+            src_base((const char*)_src_base), elmt_size(_elmt_size), bytes(0) { }
 
         void do_span(int offset, int count)
         {
@@ -3694,6 +3848,7 @@ namespace LegionRuntime {
           redop->apply(dst_base + dst_offset,
                        src_base + src_offset,
                        count, false/*exclusive*/);
+          bytes += count * redop->sizeof_rhs;
         }
 
       protected:
@@ -3701,6 +3856,8 @@ namespace LegionRuntime {
         char *dst_base;
         const char *src_base;
         size_t elmt_size;
+      public:
+        size_t bytes;
       };
 
       class RedopFold {
@@ -3708,7 +3865,7 @@ namespace LegionRuntime {
         RedopFold(const ReductionOpUntyped *_redop, void *_dst_base,
                   const void *_src_base)
           : redop(_redop), dst_base((char*)_dst_base),
-            src_base((const char*)_src_base) { }
+            src_base((const char*)_src_base), bytes(0) { }
 
         void do_span(int offset, int count)
         {
@@ -3716,20 +3873,24 @@ namespace LegionRuntime {
           redop->fold(dst_base + byte_offset,
                       src_base + byte_offset,
                       count, false/*exclusive*/);
+          bytes += count * redop->sizeof_rhs;
         }
 
       protected:
         const ReductionOpUntyped *redop;
         char *dst_base;
         const char *src_base;
+      public:
+        size_t bytes;
       };
     }; // Namespace RangeExecutors
 
-    void RegionInstance::Impl::perform_copy_operation(RegionInstance::Impl *target, const ElementMask &src_mask, const ElementMask &dst_mask)
+    size_t RegionInstance::Impl::perform_copy_operation(RegionInstance::Impl *target, const ElementMask &src_mask, const ElementMask &dst_mask)
     {
         DetailedTimer::ScopedPush sp(TIME_COPY); 
         const void *src_ptr = base_ptr;
         void       *tgt_ptr = target->base_ptr;
+        size_t bytes = 0;
 #ifdef DEBUG_LOW_LEVEL
         assert((src_ptr != NULL) && (tgt_ptr != NULL));
 #endif
@@ -3749,12 +3910,14 @@ namespace LegionRuntime {
 	  assert((block_size == 1) && (target->block_size == 1));
           RangeExecutors::Memcpy rexec(tgt_ptr, src_ptr, elmt_size);
           ElementMask::forall_ranges(rexec, dst_mask, src_mask);
+          bytes = rexec.bytes;
         }
         else
         {
           // See if this is a list reduction or a fold reduction
           if (list)
           {
+            bytes = cur_entry * elmt_size;
             if (!target->reduction)
             {
               // We need to apply the reductions to the actual buffer 
@@ -3794,6 +3957,7 @@ namespace LegionRuntime {
               // Reduction-to-normal copy  
               RangeExecutors::RedopApply rexec(redop, tgt_ptr, src_ptr, elmt_size);
               ElementMask::forall_ranges(rexec, dst_mask, src_mask);
+              bytes = rexec.bytes;
             }
             else
             {
@@ -3818,9 +3982,11 @@ namespace LegionRuntime {
               // Reduction-to-reduction copy
               RangeExecutors::RedopFold rexec(redop, tgt_ptr, src_ptr);
               ElementMask::forall_ranges(rexec, dst_mask, src_mask);
+              bytes = rexec.bytes;
             }
           }
         }
+        return bytes;
     }
 
     void RegionInstance::Impl::apply_list(RegionInstance::Impl *target)
@@ -4593,7 +4759,7 @@ namespace LegionRuntime {
       public:
 	GatherScatter(const std::vector<Domain::CopySrcDstField>& _srcs,
 		      const std::vector<Domain::CopySrcDstField>& _dsts)
-	  : srcs(_srcs), dsts(_dsts)
+	  : srcs(_srcs), dsts(_dsts), bytes(0)
 	{
 	  // determine element size
 	  elem_size = 0;
@@ -4601,6 +4767,17 @@ namespace LegionRuntime {
 	    elem_size += i->size;
 
 	  buffer = new char[elem_size];
+
+	  // spans can be copied field by field, without the gather
+	  // buffer, if the sources and destinations pair up and all
+	  // the instances are AOS
+	  bulk = (srcs.size() == dsts.size());
+	  for(size_t idx = 0; bulk && (idx < srcs.size()); idx++) {
+	    RegionInstance::Impl *s = Runtime::get_runtime()->get_instance_impl(srcs[idx].inst);
+	    RegionInstance::Impl *d = Runtime::get_runtime()->get_instance_impl(dsts[idx].inst);
+	    bulk = ((srcs[idx].size == dsts[idx].size) &&
+		    (s->get_block_size() == 1) && (d->get_block_size() == 1));
+	  }
 	}
 
 	~GatherScatter(void)
@@ -4608,8 +4785,50 @@ namespace LegionRuntime {
 	  delete[] buffer;
 	}
 
+	// The index of the first element of a span in an instance, or -1
+	// if the span does not map to consecutive elements
+	static int span_image(RegionInstance::Impl *inst, int start, int count)
+	{
+	  if(inst->get_linearization().get_dim() != 1)
+	    return start;
+	  Arrays::Mapping<1, 1> *m = inst->get_linearization().get_mapping<1>();
+	  if(!m->image_is_dense(Arrays::Rect<1>(start, start + count - 1)))
+	    return -1;
+	  int lo = m->image(start);
+	  int hi = m->image(start + count - 1);
+	  return ((hi - lo) == (count - 1)) ? lo : -1;
+	}
+
+	// Copy a span a field at a time, in strides, if it can be
+	bool bulk_span(int start, int count)
+	{
+	  std::vector<int> src_index(srcs.size()), dst_index(dsts.size());
+	  for(size_t idx = 0; idx < srcs.size(); idx++) {
+	    RegionInstance::Impl *s = Runtime::get_runtime()->get_instance_impl(srcs[idx].inst);
+	    RegionInstance::Impl *d = Runtime::get_runtime()->get_instance_impl(dsts[idx].inst);
+	    src_index[idx] = span_image(s, start, count);
+	    dst_index[idx] = span_image(d, start, count);
+	    if((src_index[idx] < 0) || (dst_index[idx] < 0))
+	      return false;
+	  }
+	  for(size_t idx = 0; idx < srcs.size(); idx++) {
+	    RegionInstance::Impl *s = Runtime::get_runtime()->get_instance_impl(srcs[idx].inst);
+	    RegionInstance::Impl *d = Runtime::get_runtime()->get_instance_impl(dsts[idx].inst);
+	    strided_copy((char*)d->get_address(dst_index[idx], dsts[idx].offset, 0, 0),
+			 d->get_elmt_size(),
+			 (const char*)s->get_address(src_index[idx], srcs[idx].offset, 0, 0),
+			 s->get_elmt_size(),
+			 srcs[idx].size, count);
+	  }
+	  bytes += elem_size * count;
+	  return true;
+	}
+
         void do_span(int start, int count)
         {
+	  if(bulk && bulk_span(start, count))
+	    return;
+	  bytes += elem_size * count;
 	  for(int index = start; index < (start + count); index++) {
 	    // gather data from source
 	    int write_offset = 0;
@@ -4671,6 +4890,7 @@ namespace LegionRuntime {
         {
 	  for(Domain::DomainPointIterator dpi(domain); dpi; dpi++) {
 	    DomainPoint dp = dpi.p;
+	    bytes += elem_size;
 
 	    // gather data from source
 	    int write_offset = 0;
@@ -4729,6 +4949,9 @@ namespace LegionRuntime {
 	std::vector<Domain::CopySrcDstField> dsts;
 	size_t elem_size;
 	char *buffer;
+	bool bulk;
+      public:
+	size_t bytes;
       };
 
       class ReductionFold {
@@ -4736,7 +4959,7 @@ namespace LegionRuntime {
         ReductionFold(const std::vector<Domain::CopySrcDstField>& _srcs,
 		      const std::vector<Domain::CopySrcDstField>& _dsts,
                       const ReductionOpUntyped *_redop)
-	  : srcs(_srcs), dsts(_dsts), redop(_redop) 
+	  : srcs(_srcs), dsts(_dsts), redop(_redop), bytes(0)
         { 
           // Assume reductions can only be applied to a single field at a time
           assert(srcs.size() == 1);
@@ -4760,6 +4983,7 @@ namespace LegionRuntime {
             void *src_ptr = src_inst->get_address(src_index, 0, redop->sizeof_rhs, 0);
             void *dst_ptr = dst_inst->get_address(dst_index, 0, redop->sizeof_rhs, 0);
             redop->fold(dst_ptr, src_ptr, 1, false/*exclusive*/);
+            bytes += redop->sizeof_rhs;
           }
         }
         void do_domain(const Domain domain)
@@ -4771,12 +4995,15 @@ namespace LegionRuntime {
             void *src_ptr = src_inst->get_address(src_inst->get_linearization().get_image(dp), 0, redop->sizeof_rhs, 0);
             void *dst_ptr = dst_inst->get_address(dst_inst->get_linearization().get_image(dp), 0, redop->sizeof_rhs, 0);
             redop->fold(dst_ptr, src_ptr, 1, false/*exclusive*/);
+            bytes += redop->sizeof_rhs;
           }
         }
       protected:
         std::vector<Domain::CopySrcDstField> srcs;
         std::vector<Domain::CopySrcDstField> dsts;
         const ReductionOpUntyped *redop;
+      public:
+        size_t bytes;
       };
 
       class ReductionApply {
@@ -4784,7 +5011,7 @@ namespace LegionRuntime {
         ReductionApply(const std::vector<Domain::CopySrcDstField>& _srcs,
 		       const std::vector<Domain::CopySrcDstField>& _dsts,
                        const ReductionOpUntyped *_redop)
-	  : srcs(_srcs), dsts(_dsts), redop(_redop) 
+	  : srcs(_srcs), dsts(_dsts), redop(_redop), bytes(0)
         { 
           // Assume reductions can only be applied to a single field at a time
           assert(srcs.size() == 1);
@@ -4811,6 +5038,7 @@ namespace LegionRuntime {
             void *src_ptr = src_inst->get_address(src_index, 0, redop->sizeof_rhs, 0);  
             void *dst_ptr = dst_inst->get_address(dst_index, field_start, field_size, within_field);
             redop->apply(dst_ptr, src_ptr, 1, false/*exclusive*/);
+            this->bytes += redop->sizeof_rhs;
           }
         }
         void do_domain(const Domain domain)
@@ -4828,12 +5056,15 @@ namespace LegionRuntime {
             void *dst_ptr = dst_inst->get_address(dst_inst->get_linearization().get_image(dp),
                                                   field_start, field_size, within_field);
             redop->apply(dst_ptr, src_ptr, 1, false/*exclusive*/);
+            this->bytes += redop->sizeof_rhs;
           }
         }
       protected:
         std::vector<Domain::CopySrcDstField> srcs;
         std::vector<Domain::CopySrcDstField> dsts;
         const ReductionOpUntyped *redop;
+      public:
+        size_t bytes;
       };
     };
 
@@ -4877,9 +5108,10 @@ namespace LegionRuntime {
       return result;
     }
 
-    void CopyOperation::perform_copy_operation(void)
+    size_t CopyOperation::perform_copy_operation(void)
     {
       DetailedTimer::ScopedPush sp(TIME_COPY); 
+      size_t bytes = 0;
 #ifdef LEGION_LOGGING
       LegionRuntime::HighLevel::LegionLogging::log_timing_event(
                                     Processor::NO_PROC,
@@ -4898,6 +5130,7 @@ namespace LegionRuntime {
         } else {
           rexec.do_domain(domain);
         }
+        bytes = rexec.bytes;
       }
       else // This is a reduction operation
       {
@@ -4914,6 +5147,7 @@ namespace LegionRuntime {
           } else {
             rexec.do_domain(domain);
           }
+          bytes = rexec.bytes;
         }
         else
         {
@@ -4925,6 +5159,7 @@ namespace LegionRuntime {
           } else {
             rexec.do_domain(domain);
           }
+          bytes = rexec.bytes;
         }
       }
 #ifdef LEGION_LOGGING
@@ -4935,6 +5170,7 @@ namespace LegionRuntime {
       // Trigger the event indicating that we are done
       NAUTILUS_DEEP_DEBUG("Done event trigger\n");
       done_event->trigger();
+      return bytes;
     }
 
     Event IndexSpace::Impl::copy(RegionInstance src_inst, RegionInstance dst_inst, size_t elem_size,
@@ -4972,123 +5208,238 @@ namespace LegionRuntime {
     // DMA Queue 
     ////////////////////////////////////////////////////////
 
-    DMAQueue::DMAQueue(unsigned num_threads)
-      : num_dma_threads(num_threads), dma_shutdown(false)
+    DMAQueue::DMAQueue(unsigned threads_per_domain)
+      : num_dma_threads(threads_per_domain), dma_shutdown(false)
     {
-      //PTHREAD_SAFE_CALL(pthread_mutex_init(&dma_lock,NULL));
-      NK_LOCK_INIT(&dma_lock);
-      //PTHREAD_SAFE_CALL(pthread_cond_init(&dma_cond,NULL));
-      NAUTILUS_DEEP_DEBUG("dmaqueue condvar init\n");
-      nk_condvar_init(&dma_cond);
-      dma_threads.resize(num_dma_threads);
+      unsigned num_domains = num_numa_domains();
+      for (unsigned idx = 0; idx < num_domains; idx++)
+      {
+        DMADomain *d = new DMADomain();
+        //PTHREAD_SAFE_CALL(pthread_mutex_init(&d->lock,NULL));
+        NK_LOCK_INIT(&d->lock);
+        //PTHREAD_SAFE_CALL(pthread_cond_init(&d->cond,NULL));
+        NAUTILUS_DEEP_DEBUG("dmaqueue condvar init\n");
+        nk_condvar_init(&d->cond);
+        d->threads = 0;
+        d->copies = d->stolen = d->bytes = d->busy_ns = d->overlap_ns = 0;
+        domains.push_back(d);
+      }
+      // Group the CPUs by domain
+      for (unsigned cpu = 0; cpu < nk_get_num_cpus(); cpu++)
+        domains[cpu_numa_domain(cpu)]->cpus.push_back(cpu);
+      inline_copies.threads = 0;
+      inline_copies.copies = inline_copies.stolen = inline_copies.bytes = 0;
+      inline_copies.busy_ns = inline_copies.overlap_ns = 0;
     }
 
     void DMAQueue::start(void)
     {
       //pthread_attr_t attr;
       //PTHREAD_SAFE_CALL(pthread_attr_init(&attr));
-      for (unsigned idx = 0; idx < num_dma_threads; idx++)
+      // thread_args must not move once the threads have pointers into it
+      thread_args.reserve(domains.size() * num_dma_threads);
+      for (unsigned domain = 0; domain < domains.size(); domain++)
       {
+        const std::vector<int> &cpus = domains[domain]->cpus;
+        // a domain without CPUs is served by stealing
+        if (cpus.empty())
+          continue;
+        for (unsigned idx = 0; idx < num_dma_threads; idx++)
+        {
+          DMAThreadArgs args = { this, domain };
+          thread_args.push_back(args);
+          nk_thread_id_t tid;
           /*
-        PTHREAD_SAFE_CALL(pthread_create(&dma_threads[idx], &attr,
-                                         DMAQueue::start_dma_thread, (void*)this));
-                                         */
-          nk_thread_start((void (*)(void*,void**))DMAQueue::start_dma_thread, 
-                                          (void*)this, 
-                                          NULL,
-                                          0,
-                                          TSTACK_2MB,
-                                          &dma_threads[idx],
-                                          0);
+          PTHREAD_SAFE_CALL(pthread_create(&dma_threads[idx], &attr,
+                                           DMAQueue::start_dma_thread, (void*)this));
+                                           */
+          if (nk_thread_start((void (*)(void*,void**))DMAQueue::start_dma_thread, 
+                              (void*)&thread_args.back(), 
+                              NULL,
+                              0,
+                              TSTACK_2MB,
+                              &tid,
+                              cpus[cpus.size() - 1 - (idx % cpus.size())]))
+          {
+            printk("Cannot start DMA thread %u for domain %u\n", idx, domain);
+            thread_args.pop_back();
+            continue;
+          }
+          dma_threads.push_back(tid);
+          domains[domain]->threads++;
+        }
       }
       //PTHREAD_SAFE_CALL(pthread_attr_destroy(&attr));
     }
 
     void DMAQueue::shutdown(void)
     {
-      //PTHREAD_SAFE_CALL(pthread_mutex_lock(&dma_lock));
-      NK_LOCK(&dma_lock);
-      dma_shutdown = true;
-      //PTHREAD_SAFE_CALL(pthread_cond_broadcast(&dma_cond));
-      //PTHREAD_SAFE_CALL(pthread_mutex_unlock(&dma_lock));
-      nk_condvar_bcast(&dma_cond);
-      NK_UNLOCK(&dma_lock);
+      for (unsigned domain = 0; domain < domains.size(); domain++)
+      {
+        DMADomain *d = domains[domain];
+        //PTHREAD_SAFE_CALL(pthread_mutex_lock(&d->lock));
+        NK_LOCK(&d->lock);
+        dma_shutdown = true;
+        //PTHREAD_SAFE_CALL(pthread_cond_broadcast(&d->cond));
+        //PTHREAD_SAFE_CALL(pthread_mutex_unlock(&d->lock));
+        nk_condvar_bcast(&d->cond);
+        NK_UNLOCK(&d->lock);
+      }
       // Now join on all the threads
-      NAUTILUS_DEEP_DEBUG("joining %u DMA threads\n", num_dma_threads);
-      for (unsigned idx = 0; idx < num_dma_threads; idx++)
+      NAUTILUS_DEEP_DEBUG("joining %lu DMA threads\n", dma_threads.size());
+      for (unsigned idx = 0; idx < dma_threads.size(); idx++)
       {
         void *result;
         //PTHREAD_SAFE_CALL(pthread_join(dma_threads[idx],&result));
         nk_join(dma_threads[idx], &result);
 
       }
+      report();
     }
 
-    void DMAQueue::run_dma_loop(void)
+    void DMAQueue::report(void)
     {
-      while (true)
+      for (unsigned domain = 0; domain <= domains.size(); domain++)
+      {
+        DMADomain *d = (domain < domains.size()) ? domains[domain] : &inline_copies;
+        if (d->copies == 0)
+          continue;
+        printk("DMA %s %u: %lu copies (%lu stolen), %lu bytes, %lu us busy, %lu us overlapped with tasks\n",
+               (d == &inline_copies) ? "inline" : "domain", domain,
+               d->copies, d->stolen, d->bytes, d->busy_ns / 1000, d->overlap_ns / 1000);
+      }
+    }
+
+    // Take a copy from another domain's queue
+    DMAOperation* DMAQueue::steal_dma(unsigned domain)
+    {
+      for (unsigned idx = 1; idx < domains.size(); idx++)
       {
-        CopyOperation *copy = NULL;
-        //PTHREAD_SAFE_CALL(pthread_mutex_lock(&dma_lock));
-        NK_LOCK(&dma_lock);
-        if (ready_copies.empty() && !dma_shutdown)
+        DMADomain *victim = domains[(domain + idx) % domains.size()];
+        // racy peek, the lock is only taken if there is something to take
+        if (victim->ready_copies.empty())
+          continue;
+        DMAOperation *copy = NULL;
+        NK_LOCK(&victim->lock);
+        if (!victim->ready_copies.empty())
         {
-          // Go to sleep
-          //PTHREAD_SAFE_CALL(pthread_cond_wait(&dma_cond, &dma_lock));
-          nk_condvar_wait(&dma_cond, &dma_lock);
+          copy = victim->ready_copies.front();
+          victim->ready_copies.pop_front();
         }
-        // When we wake up see if there is anything
-        // to do or see if we are done
-        if (!ready_copies.empty())
+        NK_UNLOCK(&victim->lock);
+        if (copy != NULL)
+          return copy;
+      }
+      return NULL;
+    }
+
+    void DMAQueue::perform_dma(DMADomain *d, DMAOperation *copy)
+    {
+      bool overlapped = (running_tasks > 0);
+      uint64_t start = nk_sched_get_realtime();
+      size_t bytes = copy->perform_copy_operation();
+      uint64_t ns = nk_sched_get_realtime() - start;
+      delete copy;
+      __sync_fetch_and_add(&d->copies, 1);
+      __sync_fetch_and_add(&d->bytes, bytes);
+      __sync_fetch_and_add(&d->busy_ns, ns);
+      if (overlapped)
+        __sync_fetch_and_add(&d->overlap_ns, ns);
+    }
+
+    void DMAQueue::run_dma_loop(unsigned domain)
+    {
+      DMADomain *d = domains[domain];
+      while (true)
+      {
+        DMAOperation *copy = NULL;
+        //PTHREAD_SAFE_CALL(pthread_mutex_lock(&d->lock));
+        NK_LOCK(&d->lock);
+        if (!d->ready_copies.empty())
         {
-          copy = ready_copies.front();
-          ready_copies.pop_front();
+          copy = d->ready_copies.front();
+          d->ready_copies.pop_front();
         }
-        else if (dma_shutdown)
+        //PTHREAD_SAFE_CALL(pthread_mutex_unlock(&d->lock));
+        NK_UNLOCK(&d->lock);
+        if (copy == NULL)
         {
-          //PTHREAD_SAFE_CALL(pthread_mutex_unlock(&dma_lock));
-          NK_UNLOCK(&dma_lock);
-          // Break out of the loop
-          break;
+          // Nothing here, help the other domains before sleeping
+          copy = steal_dma(domain);
+          if (copy != NULL)
+            __sync_fetch_and_add(&d->stolen, 1);
         }
-        // Release our lock
-        //PTHREAD_SAFE_CALL(pthread_mutex_unlock(&dma_lock));
-        NK_UNLOCK(&dma_lock);
-        // If we have a copy perform it and then delete it
         if (copy != NULL)
         {
-          copy->perform_copy_operation();
-          delete copy;
+          // perform it and then delete it
+          perform_dma(d, copy);
+          continue;
+        }
+        NK_LOCK(&d->lock);
+        if (d->ready_copies.empty() && !dma_shutdown)
+        {
+          // Go to sleep
+          //PTHREAD_SAFE_CALL(pthread_cond_wait(&d->cond, &d->lock));
+          nk_condvar_wait(&d->cond, &d->lock);
         }
+        // When we wake up see if we are done, otherwise go
+        // around again to see what there is to do
+        bool done = d->ready_copies.empty() && dma_shutdown;
+        NK_UNLOCK(&d->lock);
+        if (done)
+          break;
       }
     }
 
-    void DMAQueue::enqueue_dma(CopyOperation *copy)
+    void DMAQueue::enqueue_dma(DMAOperation *copy)
     {
-      if (num_dma_threads > 0)
+      if (dma_threads.size() > 0)
       {
-        //PTHREAD_SAFE_CALL(pthread_mutex_lock(&dma_lock));
-        NK_LOCK(&dma_lock);
-        ready_copies.push_back(copy);
-        //PTHREAD_SAFE_CALL(pthread_cond_signal(&dma_cond));
-        nk_condvar_signal(&dma_cond);
-        //PTHREAD_SAFE_CALL(pthread_mutex_unlock(&dma_lock));
-        NK_UNLOCK(&dma_lock);
+        // Queue it where it was issued, or in the next domain that
+        // has DMA threads
+        unsigned domain = nk_my_numa_node();
+        if (domain >= domains.size())
+          domain = 0;
+        while (domains[domain]->threads == 0)
+          domain = (domain + 1) % domains.size();
+        DMADomain *d = domains[domain];
+        //PTHREAD_SAFE_CALL(pthread_mutex_lock(&d->lock));
+        NK_LOCK(&d->lock);
+        d->ready_copies.push_back(copy);
+        bool backlog = (d->ready_copies.size() > d->threads);
+        //PTHREAD_SAFE_CALL(pthread_cond_signal(&d->cond));
+        nk_condvar_signal(&d->cond);
+        //PTHREAD_SAFE_CALL(pthread_mutex_unlock(&d->lock));
+        NK_UNLOCK(&d->lock);
+        // If this domain is behind, wake a thread in the next one
+        // to steal from it
+        if (backlog && (domains.size() > 1))
+        {
+          unsigned next = (domain + 1) % domains.size();
+          while (domains[next]->threads == 0)
+            next = (next + 1) % domains.size();
+          if (next != domain)
+          {
+            NK_LOCK(&domains[next]->lock);
+            nk_condvar_signal(&domains[next]->cond);
+            NK_UNLOCK(&domains[next]->lock);
+          }
+        }
       }
       else
       {
         // If we don't have any dma threads, just do the copy now
-        copy->perform_copy_operation();
-        delete copy;
+        perform_dma(&inline_copies, copy);
       }
     }
 
     /*static*/ void* DMAQueue::start_dma_thread(void *args)
     {
-      DMAQueue *dma_queue = (DMAQueue*)args;
-      dma_queue->run_dma_loop();
+      DMAThreadArgs *dma_args = (DMAThreadArgs*)args;
+      dma_args->queue->run_dma_loop(dma_args->domain);
       // pthread_exit(NULL);
       nk_thread_exit(NULL);
+      return NULL;
     }
 
 #ifdef LEGION_BACKTRACE
@@ -5288,16 +5639,37 @@ namespace LegionRuntime {
                 Runtime::runtime->processors.push_back(impl);
         }
 #endif
+        // Place the processors.  Processor 1 runs on this thread, the
+        // others are bound to the CPU of the same number.
+        const unsigned num_domains = num_numa_domains();
+        Runtime::runtime->proc_cpus.push_back(-1);
+        Runtime::runtime->proc_domains.push_back(0);
+        for (unsigned id = 1; id < Runtime::runtime->processors.size(); id++)
+        {
+          int cpu = (id == 1) ? my_cpu_id() : (id % nk_get_num_cpus());
+          Runtime::runtime->proc_cpus.push_back(cpu);
+          Runtime::runtime->proc_domains.push_back(cpu_numa_domain(cpu));
+        }
+        // Each NUMA domain has a system memory, allocated from the zone
+        // of its first CPU.  A single domain machine just uses malloc.
+        std::vector<int> domain_cpus(num_domains, -1);
+        if (num_domains > 1)
+        {
+          for (int cpu = nk_get_num_cpus() - 1; cpu >= 0; cpu--)
+            domain_cpus[cpu_numa_domain(cpu)] = cpu;
+        }
         if (cpu_mem_size_in_mb > 0)
 	{
                 // Make the first memory null
                 Runtime::runtime->memories.push_back(NULL);
-                // Do the global memory
+                // Do the system memory of the first domain
 		Memory global;
 		global.id = 1;
 		memories.insert(global);
-		MemoryImpl *impl = new MemoryImpl(cpu_mem_size_in_mb*1024*1024, Memory::SYSTEM_MEM);
+		MemoryImpl *impl = new MemoryImpl(cpu_mem_size_in_mb*1024*1024, Memory::SYSTEM_MEM,
+                                                  domain_cpus[0]);
 		Runtime::runtime->memories.push_back(impl);
+                Runtime::runtime->domain_memories.push_back(global);
 	}
         else
         {
@@ -5319,6 +5691,17 @@ namespace LegionRuntime {
                   Runtime::runtime->memories.push_back(impl);
           }
         }
+        // The system memories of the other domains come after the L1s
+        for (unsigned domain = 1; domain < num_domains; domain++)
+        {
+                Memory m;
+                m.id = Runtime::runtime->memories.size();
+                memories.insert(m);
+                MemoryImpl *impl = new MemoryImpl(cpu_mem_size_in_mb*1024*1024, Memory::SYSTEM_MEM,
+                                                  domain_cpus[domain]);
+                Runtime::runtime->memories.push_back(impl);
+                Runtime::runtime->domain_memories.push_back(m);
+        }
 	// All memories are visible from each processor
 	for (unsigned id=1; id<=num_cpus; id++)
 	{
@@ -5327,24 +5710,27 @@ namespace LegionRuntime {
 		visible_memories_from_procs.insert(std::pair<Processor,std::set<Memory> >(p,memories));
 	}	
 	// All memories are visible from all memories, all processors are visible from all memories
-	for (unsigned id=1; id<=(num_cpus+1); id++)
+	for (std::set<Memory>::const_iterator it = memories.begin(); it != memories.end(); it++)
 	{
-		Memory m;
-		m.id = id;
-		visible_memories_from_memory.insert(std::pair<Memory,std::set<Memory> >(m,memories));
-		visible_procs_from_memory.insert(std::pair<Memory,std::set<Processor> >(m,procs));
+		visible_memories_from_memory.insert(std::pair<Memory,std::set<Memory> >(*it,memories));
+		visible_procs_from_memory.insert(std::pair<Memory,std::set<Processor> >(*it,procs));
 	}
 
         // Now set up the affinities for each of the different processors and memories
         for (std::set<Processor>::iterator it = procs.begin(); it != procs.end(); it++)
         {
-          // Give all processors 32 GB/s to the global memory
+          // Give all processors 32 GB/s to the system memory of their
+          // domain, and less to the others as they get further away
+          unsigned proc_domain = Runtime::runtime->proc_domains[it->id];
+          for (unsigned domain = 0; domain < num_domains; domain++)
           {
-            ProcessorMemoryAffinity global_affin = { *it, {1}, 32, 50/* higher latency */ };
+            unsigned distance = numa_distance(proc_domain, domain);
+            ProcessorMemoryAffinity global_affin = { *it, Runtime::runtime->domain_memories[domain],
+                                                     32*10/distance, 5*distance/* higher latency */ };
             proc_mem_affinities.push_back(global_affin);
           }
           // Give the processor good affinity to its L1, but not to other L1
-          for (unsigned id = 2; id <= (num_cpus+1); id++)
+          for (unsigned id = 2; (cpu_l1_size_in_kb > 0) && (id <= (num_cpus+1)); id++)
           {
             if (id == (it->id+1))
             {
@@ -5362,15 +5748,34 @@ namespace LegionRuntime {
         }
         // Set up the affinities between the different memories
         {
-          // Global to all others
-          for (unsigned id = 2; id <= (num_cpus+1); id++)
+          // System memories to each other
+          for (unsigned domain = 0; domain < num_domains; domain++)
           {
-            MemoryMemoryAffinity global_affin = { {1}, {id}, 32, 50 };
-            mem_mem_affinities.push_back(global_affin);
+            for (unsigned other = domain+1; other < num_domains; other++)
+            {
+              unsigned distance = numa_distance(domain, other);
+              MemoryMemoryAffinity numa_affin = { Runtime::runtime->domain_memories[domain],
+                                                  Runtime::runtime->domain_memories[other],
+                                                  32*10/distance, 5*distance };
+              mem_mem_affinities.push_back(numa_affin);
+            }
+          }
+
+          // System memories to all others, an L1 being in the domain
+          // of its processor
+          for (unsigned id = 2; (cpu_l1_size_in_kb > 0) && (id <= (num_cpus+1)); id++)
+          {
+            for (unsigned domain = 0; domain < num_domains; domain++)
+            {
+              unsigned distance = numa_distance(domain, Runtime::runtime->proc_domains[id-1]);
+              MemoryMemoryAffinity global_affin = { Runtime::runtime->domain_memories[domain], {id},
+                                                    32*10/distance, 5*distance };
+              mem_mem_affinities.push_back(global_affin);
+            }
           }
 
           // From any one to any other one
-          for (unsigned id = 2; id <= (num_cpus+1); id++)
+          for (unsigned id = 2; (cpu_l1_size_in_kb > 0) && (id <= (num_cpus+1)); id++)
           {
             for (unsigned other=id+1; other <= (num_cpus+1); other++)
             {
@@ -5496,7 +5901,7 @@ namespace LegionRuntime {
                     0,
                     TSTACK_2MB,
                     &other_threads[id],
-                    id);
+                    Runtime::runtime->proc_cpus[id]);
                     //nk_get_cpu_by_lapicid(lev_lapic_pref_order[id]));
         }
         /* NOTE: check */
@@ -24,6 +24,8 @@
 #include <nautilus/nautilus.h>
 #include <nautilus/cpu.h>
 #include <nautilus/thread.h>
+#include <nautilus/backtrace.h>
+#include <nautilus/linker.h>
 
 extern int printk (const char * fmt, ...);
 
@@ -35,12 +37,54 @@ __do_backtrace (void ** fp, unsigned depth)
         return;
     }
     
-    printk("[%2u] RIP: %p RBP: %p\n", depth, *(fp+1), *fp);
+    const char * sym;
+    uint64_t sym_addr;
+
+    sym = nk_linker_addr_to_sym(nk_get_nautilus_info()->sys.linker_info, (uint64_t)*(fp+1), &sym_addr);
+
+    if (sym) {
+        printk("[%2u] RIP: %p RBP: %p %s+0x%lx\n", depth, *(fp+1), *fp, sym, (uint64_t)*(fp+1) - sym_addr);
+    } else {
+        printk("[%2u] RIP: %p RBP: %p\n", depth, *(fp+1), *fp);
+    }
 
     __do_backtrace(*fp, depth+1);
 }
 
 
+/*
+ * Walk the frame pointer chain starting at fp, storing up to max
+ * return addresses in pcs without printing anything.  Every frame
+ * must lie within [lo,hi) and frames must move up the stack, so a
+ * garbage fp (e.g., one seen from an interrupt) is harmless.
+ * Returns the number of addresses stored.
+ */
+int
+nk_backtrace_collect (void ** fp, void * lo, void * hi, uint64_t * pcs, int max)
+{
+    int n = 0;
+
+    while (n < max &&
+           !((uint64_t)fp & 0x7) &&
+           (void*)fp >= lo && (void*)(fp+2) <= hi) {
+
+        if (!IS_VALID(*(fp+1))) {
+            break;
+        }
+
+        pcs[n++] = (uint64_t)*(fp+1);
+
+        if ((void**)*fp <= fp) {
+            break;
+        }
+
+        fp = (void**)*fp;
+    }
+
+    return n;
+}
+
+
 /*
  * dump memory in 16 byte chunks
  */
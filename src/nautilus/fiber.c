@@ -80,11 +80,13 @@ typedef struct nk_fiber_percpu_state {
     struct list_head f_sched_queue; /* sched queue for fibers on this CPU (can be accessed by other CPUs) */
     struct nk_wait_queue *waitq; /* Wait queue that the fiber thread can sleep on */
     int fork_cpu; /* Determines which CPU forked fibers will be placed on. Default => curr CPU */
+    spinlock_t *park_lock; /* Lock to release once a parking fiber is off its stack (see nk_fiber_park) */
 } fiber_state;
 
 /* These functions are implemented in assembly. Can be found in src/asm/fiber_lowlevel.S */
 extern void _nk_fiber_context_switch(nk_fiber_t *f_to);
 extern void _nk_fiber_context_switch_early(nk_fiber_t* f_to);
+extern void _nk_fiber_context_switch_unlock(nk_fiber_t *f_to, spinlock_t *lock);
 extern void _nk_exit_switch(nk_fiber_t *next);
 extern nk_fiber_t *nk_fiber_fork();
 extern int _nk_fiber_fork_exit(nk_fiber_t *curr);
@@ -112,6 +114,21 @@ nk_fiber_t* nk_fiber_current()
   return _get_fiber_state()->curr_fiber;
 }
 
+// returns the fiber the caller runs in, or NULL outside of a
+// (non-idle) fiber, where nk_fiber_current() would name whatever
+// fiber the CPU's fiber thread last ran
+nk_fiber_t* nk_fiber_current_or_null()
+{
+  fiber_state *state = _GET_FIBER_STATE();
+
+  if (!state || state->fiber_thread != get_cur_thread() ||
+      !state->curr_fiber || state->curr_fiber->is_idle) {
+    return NULL;
+  }
+
+  return state->curr_fiber;
+}
+
 // returns the current CPU's idle fiber
 static nk_fiber_t* _nk_idle_fiber()
 {
@@ -418,6 +435,15 @@ __attribute__((noreturn)) void __nk_fiber_join_yield(uint64_t rsp, uint64_t offs
   // Adjust f_from's stack ptr
   f_from->rsp = rsp;
 
+  #if NAUT_CONFIG_FIBER_FSAVE
+  f_from->fpu_state_offset = offset;
+  #endif
+
+  // If we are parking (nk_fiber_park), grab the waiter list lock that must
+  // be dropped only after we have left f_from's stack
+  spinlock_t *park_lock = state->park_lock;
+  state->park_lock = 0;
+
   // get next fiber to yield to
   _LOCK_SCHED_QUEUE(state);
   nk_fiber_t *f_to = _rr_policy();
@@ -448,6 +474,10 @@ __attribute__((noreturn)) void __nk_fiber_join_yield(uint64_t rsp, uint64_t offs
 
   // Begin context switch (register saving and stack change)
   *(uint64_t*)(rsp+GPR_RAX_OFFSET) = 0;
+  if (park_lock) {
+    // A waker on another CPU may requeue f_from as soon as this lock drops
+    _nk_fiber_context_switch_unlock(f_to, park_lock);
+  }
   _nk_fiber_context_switch(f_to);
   
   // Tells compiler this point is unreachable, stops compiler warning
@@ -1216,6 +1246,72 @@ int nk_fiber_join(nk_fiber_t *wait_on)
   return _nk_fiber_join_yield();
 }
 
+/* 
+ * nk_fiber_park
+ *
+ * Blocks the current fiber until some other fiber or thread calls
+ * nk_fiber_wake() on it. This is the building block for the fiber-aware
+ * synchronization primitives in fiber_sync.c. The parked fiber is not on
+ * any sched queue, so it costs nothing while it waits.
+ *
+ * The caller must hold @lock and must already have linked the current
+ * fiber (via its wait_node) onto the waiter list protected by @lock.
+ * The lock is released only once we have switched off of the fiber's
+ * stack, so a waker that takes the lock can never requeue us early.
+ *
+ * @lock: the (held) spinlock protecting the waiter list
+ *
+ * on failure (not called from a non-idle fiber), returns -1 with @lock still held
+ * on success, returns 0 after being woken, with @lock released
+ */
+int nk_fiber_park(spinlock_t *lock)
+{
+  fiber_state *state = _GET_FIBER_STATE();
+  nk_fiber_t *curr_fiber;
+
+  if (!state || state->fiber_thread != get_cur_thread()) {
+    FIBER_ERROR("nk_fiber_park() : called outside of a fiber thread\n");
+    return -1;
+  }
+
+  curr_fiber = state->curr_fiber;
+  if (curr_fiber->is_idle) {
+    FIBER_ERROR("nk_fiber_park() : idle fiber cannot park\n");
+    return -1;
+  }
+
+  // Update status of curr_fiber and yield. Since we are not placed on a
+  // sched queue, only nk_fiber_wake() will make us runnable again
+  _LOCK_FIBER(curr_fiber);
+  curr_fiber->f_status = WAIT;
+  _UNLOCK_FIBER(curr_fiber);
+
+  state->park_lock = lock;
+  return _nk_fiber_join_yield();
+}
+
+/* 
+ * nk_fiber_wake
+ *
+ * Makes a fiber parked with nk_fiber_park() runnable again. The fiber
+ * is queued on the CPU it last ran on to preserve cache locality.
+ * The caller must already have unlinked @f from the waiter list.
+ *
+ * @f: the parked fiber
+ *
+ * returns the return value of nk_fiber_run
+ */
+int nk_fiber_wake(nk_fiber_t *f)
+{
+  int cpu = f->curr_cpu;
+
+  if (cpu < 0) {
+    cpu = F_RAND_CPU;
+  }
+
+  return nk_fiber_run(f, cpu);
+}
+
 /* 
  * __nk_fiber_fork
  *
@@ -0,0 +1,598 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/fiber.h>
+#include <nautilus/fiber_sync.h>
+
+#ifndef NAUT_CONFIG_DEBUG_FIBERS
+#undef  DEBUG_PRINT
+#define DEBUG_PRINT(fmt, args...)
+#endif
+#define ERROR(fmt, args...) ERROR_PRINT("fiber_sync: " fmt, ##args)
+#define DEBUG(fmt, args...) DEBUG_PRINT("fiber_sync: " fmt, ##args)
+
+/*
+  All primitives follow the same pattern: the object's spinlock
+  protects its state and waiter list(s). A fiber that must block
+  links its wait_node onto a waiter list and calls nk_fiber_park()
+  with the lock still held; the lock is dropped only after the fiber
+  is off its stack. A waker unlinks a waiter under the lock and calls
+  nk_fiber_wake() after dropping it.
+
+  Where possible, the resource is handed directly to the woken fiber
+  (mutex ownership, semaphore units) so it never has to recheck.
+*/
+
+// remove and return the first waiter, if any
+static inline nk_fiber_t *dequeue_waiter(struct list_head *waiters)
+{
+    nk_fiber_t *f;
+
+    if (list_empty(waiters)) {
+        return 0;
+    }
+
+    f = list_first_entry(waiters, nk_fiber_t, wait_node);
+    list_del_init(&f->wait_node);
+
+    return f;
+}
+
+// wake every fiber on a list that has already been detached from its object
+static void wake_all(struct list_head *waiters)
+{
+    nk_fiber_t *f, *n;
+
+    list_for_each_entry_safe(f, n, waiters, wait_node) {
+        // must unlink before waking as the fiber may reuse its wait_node at once
+        list_del_init(&f->wait_node);
+        nk_fiber_wake(f);
+    }
+}
+
+// link the current fiber onto waiters and park, called with lock held
+// on failure, the lock is still held and the fiber has been unlinked
+static int park_on(struct list_head *waiters, spinlock_t *lock)
+{
+    nk_fiber_t *me = nk_fiber_current();
+
+    list_add_tail(&me->wait_node, waiters);
+
+    if (nk_fiber_park(lock)) {
+        list_del_init(&me->wait_node);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/******************* Mutex *******************/
+
+int nk_fiber_mutex_init(nk_fiber_mutex_t *m)
+{
+    spinlock_init(&m->lock);
+    m->owner = 0;
+    INIT_LIST_HEAD(&m->waiters);
+    return 0;
+}
+
+int nk_fiber_mutex_destroy(nk_fiber_mutex_t *m)
+{
+    if (m->owner || !list_empty(&m->waiters)) {
+        ERROR("Destroying mutex %p that is held or has waiters\n", m);
+        return -1;
+    }
+    spinlock_deinit(&m->lock);
+    return 0;
+}
+
+int nk_fiber_mutex_lock(nk_fiber_mutex_t *m)
+{
+    nk_fiber_t *me = nk_fiber_current_or_null();
+
+    // the owner is a fiber, so only a fiber can hold the mutex
+    if (!me) {
+        ERROR("Cannot lock mutex %p outside of a fiber\n", m);
+        return -1;
+    }
+
+    spin_lock(&m->lock);
+
+    if (!m->owner) {
+        m->owner = me;
+        spin_unlock(&m->lock);
+        return 0;
+    }
+
+    if (m->owner == me) {
+        spin_unlock(&m->lock);
+        ERROR("Fiber %p attempted to relock mutex %p\n", me, m);
+        return -1;
+    }
+
+    if (park_on(&m->waiters, &m->lock)) {
+        spin_unlock(&m->lock);
+        ERROR("Cannot block on mutex %p\n", m);
+        return -1;
+    }
+
+    // ownership was handed to us by the unlocker
+    DEBUG("Fiber %p acquired mutex %p after blocking\n", me, m);
+
+    return 0;
+}
+
+int nk_fiber_mutex_try_lock(nk_fiber_mutex_t *m)
+{
+    nk_fiber_t *me = nk_fiber_current_or_null();
+    int rc = -1;
+
+    if (!me) {
+        ERROR("Cannot lock mutex %p outside of a fiber\n", m);
+        return -1;
+    }
+
+    spin_lock(&m->lock);
+    if (!m->owner) {
+        m->owner = me;
+        rc = 0;
+    }
+    spin_unlock(&m->lock);
+
+    return rc;
+}
+
+int nk_fiber_mutex_unlock(nk_fiber_mutex_t *m)
+{
+    nk_fiber_t *next;
+
+    spin_lock(&m->lock);
+
+    if (!m->owner) {
+        spin_unlock(&m->lock);
+        ERROR("Unlock of unheld mutex %p\n", m);
+        return -1;
+    }
+
+    // hand off directly to the first waiter, if any
+    next = dequeue_waiter(&m->waiters);
+    m->owner = next;
+
+    spin_unlock(&m->lock);
+
+    if (next) {
+        nk_fiber_wake(next);
+    }
+
+    return 0;
+}
+
+
+/******************* Condition Variable *******************/
+
+int nk_fiber_condvar_init(nk_fiber_condvar_t *c)
+{
+    spinlock_init(&c->lock);
+    INIT_LIST_HEAD(&c->waiters);
+    return 0;
+}
+
+int nk_fiber_condvar_destroy(nk_fiber_condvar_t *c)
+{
+    if (!list_empty(&c->waiters)) {
+        ERROR("Destroying condvar %p that has waiters\n", c);
+        return -1;
+    }
+    spinlock_deinit(&c->lock);
+    return 0;
+}
+
+int nk_fiber_condvar_wait(nk_fiber_condvar_t *c, nk_fiber_mutex_t *m)
+{
+    nk_fiber_t *me = nk_fiber_current_or_null();
+
+    if (!me || m->owner != me) {
+        ERROR("Wait on condvar %p without holding mutex %p\n", c, m);
+        return -1;
+    }
+
+    // we are on the waiter list before the mutex is released,
+    // so a signal issued after the release cannot be lost
+    spin_lock(&c->lock);
+
+    nk_fiber_mutex_unlock(m);
+
+    if (park_on(&c->waiters, &c->lock)) {
+        spin_unlock(&c->lock);
+        nk_fiber_mutex_lock(m);
+        ERROR("Cannot block on condvar %p outside of a fiber\n", c);
+        return -1;
+    }
+
+    return nk_fiber_mutex_lock(m);
+}
+
+int nk_fiber_condvar_signal(nk_fiber_condvar_t *c)
+{
+    nk_fiber_t *f;
+
+    spin_lock(&c->lock);
+    f = dequeue_waiter(&c->waiters);
+    spin_unlock(&c->lock);
+
+    if (f) {
+        nk_fiber_wake(f);
+    }
+
+    return 0;
+}
+
+int nk_fiber_condvar_broadcast(nk_fiber_condvar_t *c)
+{
+    struct list_head waiters;
+
+    INIT_LIST_HEAD(&waiters);
+
+    spin_lock(&c->lock);
+    list_splice_init(&c->waiters, &waiters);
+    spin_unlock(&c->lock);
+
+    wake_all(&waiters);
+
+    return 0;
+}
+
+
+/******************* Semaphore *******************/
+
+int nk_fiber_semaphore_init(nk_fiber_semaphore_t *s, int init_count)
+{
+    spinlock_init(&s->lock);
+    s->count = init_count;
+    INIT_LIST_HEAD(&s->waiters);
+    return 0;
+}
+
+int nk_fiber_semaphore_destroy(nk_fiber_semaphore_t *s)
+{
+    if (!list_empty(&s->waiters)) {
+        ERROR("Destroying semaphore %p that has waiters\n", s);
+        return -1;
+    }
+    spinlock_deinit(&s->lock);
+    return 0;
+}
+
+int nk_fiber_semaphore_down(nk_fiber_semaphore_t *s)
+{
+    spin_lock(&s->lock);
+
+    if (s->count > 0) {
+        s->count--;
+        spin_unlock(&s->lock);
+        return 0;
+    }
+
+    if (park_on(&s->waiters, &s->lock)) {
+        spin_unlock(&s->lock);
+        ERROR("Cannot block on semaphore %p outside of a fiber\n", s);
+        return -1;
+    }
+
+    // the unit was handed to us by the upper
+    return 0;
+}
+
+int nk_fiber_semaphore_try_down(nk_fiber_semaphore_t *s)
+{
+    int rc = -1;
+
+    spin_lock(&s->lock);
+    if (s->count > 0) {
+        s->count--;
+        rc = 0;
+    }
+    spin_unlock(&s->lock);
+
+    return rc;
+}
+
+int nk_fiber_semaphore_up(nk_fiber_semaphore_t *s)
+{
+    nk_fiber_t *f;
+
+    spin_lock(&s->lock);
+    f = dequeue_waiter(&s->waiters);
+    if (!f) {
+        s->count++;
+    }
+    spin_unlock(&s->lock);
+
+    if (f) {
+        nk_fiber_wake(f);
+    }
+
+    return 0;
+}
+
+
+/******************* Waitgroup *******************/
+
+int nk_fiber_waitgroup_init(nk_fiber_waitgroup_t *w)
+{
+    spinlock_init(&w->lock);
+    w->count = 0;
+    INIT_LIST_HEAD(&w->waiters);
+    return 0;
+}
+
+int nk_fiber_waitgroup_destroy(nk_fiber_waitgroup_t *w)
+{
+    if (!list_empty(&w->waiters)) {
+        ERROR("Destroying waitgroup %p that has waiters\n", w);
+        return -1;
+    }
+    spinlock_deinit(&w->lock);
+    return 0;
+}
+
+int nk_fiber_waitgroup_add(nk_fiber_waitgroup_t *w, int delta)
+{
+    struct list_head waiters;
+
+    INIT_LIST_HEAD(&waiters);
+
+    spin_lock(&w->lock);
+
+    if (w->count + delta < 0) {
+        spin_unlock(&w->lock);
+        ERROR("Waitgroup %p count would become negative\n", w);
+        return -1;
+    }
+
+    w->count += delta;
+
+    if (!w->count) {
+        list_splice_init(&w->waiters, &waiters);
+    }
+
+    spin_unlock(&w->lock);
+
+    wake_all(&waiters);
+
+    return 0;
+}
+
+int nk_fiber_waitgroup_wait(nk_fiber_waitgroup_t *w)
+{
+    spin_lock(&w->lock);
+
+    if (!w->count) {
+        spin_unlock(&w->lock);
+        return 0;
+    }
+
+    if (park_on(&w->waiters, &w->lock)) {
+        spin_unlock(&w->lock);
+        ERROR("Cannot block on waitgroup %p outside of a fiber\n", w);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/******************* Channel *******************/
+
+int nk_fiber_channel_init(nk_fiber_channel_t *ch, uint64_t capacity)
+{
+    if (!capacity) {
+        ERROR("Channel capacity must be at least one\n");
+        return -1;
+    }
+
+    ch->buf = (void **)malloc(sizeof(void *)*capacity);
+
+    if (!ch->buf) {
+        ERROR("Cannot allocate channel buffer\n");
+        return -1;
+    }
+
+    spinlock_init(&ch->lock);
+    ch->closed = 0;
+    ch->capacity = capacity;
+    ch->count = 0;
+    ch->head = 0;
+    INIT_LIST_HEAD(&ch->senders);
+    INIT_LIST_HEAD(&ch->receivers);
+
+    return 0;
+}
+
+int nk_fiber_channel_destroy(nk_fiber_channel_t *ch)
+{
+    if (!list_empty(&ch->senders) || !list_empty(&ch->receivers)) {
+        ERROR("Destroying channel %p that has waiters\n", ch);
+        return -1;
+    }
+    free(ch->buf);
+    ch->buf = 0;
+    spinlock_deinit(&ch->lock);
+    return 0;
+}
+
+// lock must be held, channel must not be full
+static inline nk_fiber_t *channel_put(nk_fiber_channel_t *ch, void *val)
+{
+    ch->buf[(ch->head + ch->count) % ch->capacity] = val;
+    ch->count++;
+    return dequeue_waiter(&ch->receivers);
+}
+
+// lock must be held, channel must not be empty
+static inline nk_fiber_t *channel_get(nk_fiber_channel_t *ch, void **val)
+{
+    if (val) {
+        *val = ch->buf[ch->head];
+    }
+    ch->head = (ch->head + 1) % ch->capacity;
+    ch->count--;
+    return dequeue_waiter(&ch->senders);
+}
+
+int nk_fiber_channel_send(nk_fiber_channel_t *ch, void *val)
+{
+    nk_fiber_t *f;
+
+    spin_lock(&ch->lock);
+
+    // woken fibers recheck, since another fiber may have taken the space
+    while (!ch->closed && ch->count == ch->capacity) {
+        if (park_on(&ch->senders, &ch->lock)) {
+            spin_unlock(&ch->lock);
+            ERROR("Cannot block on channel %p outside of a fiber\n", ch);
+            return -1;
+        }
+        spin_lock(&ch->lock);
+    }
+
+    if (ch->closed) {
+        spin_unlock(&ch->lock);
+        return -1;
+    }
+
+    f = channel_put(ch, val);
+
+    spin_unlock(&ch->lock);
+
+    if (f) {
+        nk_fiber_wake(f);
+    }
+
+    return 0;
+}
+
+int nk_fiber_channel_recv(nk_fiber_channel_t *ch, void **val)
+{
+    nk_fiber_t *f;
+
+    spin_lock(&ch->lock);
+
+    while (!ch->closed && !ch->count) {
+        if (park_on(&ch->receivers, &ch->lock)) {
+            spin_unlock(&ch->lock);
+            ERROR("Cannot block on channel %p outside of a fiber\n", ch);
+            return -1;
+        }
+        spin_lock(&ch->lock);
+    }
+
+    // a closed channel still delivers what was sent before the close
+    if (!ch->count) {
+        spin_unlock(&ch->lock);
+        return -1;
+    }
+
+    f = channel_get(ch, val);
+
+    spin_unlock(&ch->lock);
+
+    if (f) {
+        nk_fiber_wake(f);
+    }
+
+    return 0;
+}
+
+int nk_fiber_channel_try_send(nk_fiber_channel_t *ch, void *val)
+{
+    nk_fiber_t *f;
+
+    spin_lock(&ch->lock);
+
+    if (ch->closed) {
+        spin_unlock(&ch->lock);
+        return -1;
+    }
+
+    if (ch->count == ch->capacity) {
+        spin_unlock(&ch->lock);
+        return 1;
+    }
+
+    f = channel_put(ch, val);
+
+    spin_unlock(&ch->lock);
+
+    if (f) {
+        nk_fiber_wake(f);
+    }
+
+    return 0;
+}
+
+int nk_fiber_channel_try_recv(nk_fiber_channel_t *ch, void **val)
+{
+    nk_fiber_t *f;
+
+    spin_lock(&ch->lock);
+
+    if (!ch->count) {
+        int rc = ch->closed ? -1 : 1;
+        spin_unlock(&ch->lock);
+        return rc;
+    }
+
+    f = channel_get(ch, val);
+
+    spin_unlock(&ch->lock);
+
+    if (f) {
+        nk_fiber_wake(f);
+    }
+
+    return 0;
+}
+
+int nk_fiber_channel_close(nk_fiber_channel_t *ch)
+{
+    struct list_head waiters;
+
+    INIT_LIST_HEAD(&waiters);
+
+    spin_lock(&ch->lock);
+
+    if (ch->closed) {
+        spin_unlock(&ch->lock);
+        return -1;
+    }
+
+    ch->closed = 1;
+    list_splice_init(&ch->senders, &waiters);
+    list_splice_init(&ch->receivers, &waiters);
+
+    spin_unlock(&ch->lock);
+
+    wake_all(&waiters);
+
+    return 0;
+}
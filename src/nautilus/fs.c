@@ -437,6 +437,22 @@ ssize_t nk_fs_read(nk_fs_fd_t fd, void *buf, size_t num_bytes)
     return n;
 }
 
+ssize_t nk_fs_pread(nk_fs_fd_t fd, void *buf, size_t num_bytes, off_t offset)
+{
+    DEBUG("attempt read of %ld bytes at offset %lu\n", num_bytes, offset);
+
+    if (FS_FD_ERR(fd) || !(fd->flags & O_RDONLY)) { // includes RDWR
+	ERROR("Cannot read file not opened for reading\n");
+	return -1;
+    }
+
+    if (!fd->fs || !fd->fs->interface || !fd->fs->interface->read_file) {
+	return -1;
+    }
+
+    return fd->fs->interface->read_file(fd->fs->state, fd->file, buf, offset, num_bytes);
+}
+
 ssize_t nk_fs_write(nk_fs_fd_t fd, void *buf, size_t num_bytes) 
 {
     FILE_LOCK_CONF;
@@ -0,0 +1,316 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#include <nautilus/nautilus.h>
+#include <nautilus/futex.h>
+#include <nautilus/list.h>
+#include <nautilus/spinlock.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/waitqueue.h>
+#include <nautilus/timer.h>
+#include <nautilus/shell.h>
+
+#define ERROR(fmt, args...) ERROR_PRINT("futex: " fmt, ##args)
+
+/*
+ * A sleeper is a node on its own stack, linked into the bucket for
+ * its address.  A waker unlinks it and marks it woken with the
+ * bucket lock held, and the sleeper takes that lock again before it
+ * returns, so the node is never touched after it goes away.
+ *
+ * A timed sleep is also queued on the thread's default timer's wait
+ * queue, the same way nk_semaphore_down_timeout does it.  Whichever
+ * of the two gets the thread from WAITING to SUSPENDED wakes it, and
+ * the sleeper works out which it was from whether it is still in its
+ * bucket.
+ *
+ * A sleeper counts itself into its bucket's pending count before it
+ * looks at the word, and a waker changes the word before it reads
+ * that count, both with full barriers.  So a waker that sees no one
+ * pending knows any sleeper still to come will see the new word, and
+ * it can skip the bucket lock.
+ */
+
+#define FUTEX_BUCKETS_ORDER 8
+#define FUTEX_BUCKETS       (1 << FUTEX_BUCKETS_ORDER)
+
+struct futex_bucket {
+    spinlock_t        lock;
+    struct hlist_head waiters;     // oldest first
+    volatile uint32_t pending;     // sleepers from their check until return
+} __attribute__((aligned(64)));
+
+struct futex_waiter {
+    struct hlist_node node;
+    volatile uint32_t *addr;
+    nk_thread_t      *thread;
+    int               woken;
+};
+
+// zeroed is unlocked and empty
+static struct futex_bucket buckets[FUTEX_BUCKETS];
+
+
+static inline struct futex_bucket *bucket_of(volatile uint32_t *addr)
+{
+    uint64_t h = ((uint64_t)addr >> 2) * 0x9e3779b97f4a7c15ULL;
+
+    return &buckets[h >> (64 - FUTEX_BUCKETS_ORDER)];
+}
+
+static void enqueue(struct futex_bucket *b, struct futex_waiter *w)
+{
+    struct hlist_node *last = 0, *cur;
+
+    // buckets are short, and wakeups should go in arrival order
+    hlist_for_each(cur, &b->waiters) {
+        last = cur;
+    }
+
+    if (last) {
+        hlist_add_after(last, &w->node);
+    } else {
+        hlist_add_head(&w->node, &b->waiters);
+    }
+}
+
+
+struct release_state {
+    struct futex_bucket *bucket;
+    nk_timer_t          *timer;
+};
+
+static void release(void *state)
+{
+    struct release_state *r = (struct release_state *)state;
+
+    if (r->timer) {
+        spin_unlock(&r->timer->waitq->lock);
+    }
+    spin_unlock(&r->bucket->lock);
+}
+
+
+int nk_futex_wait(volatile uint32_t *addr, uint32_t expected, uint64_t timeout_ns)
+{
+    struct futex_bucket *b = bucket_of(addr);
+    nk_thread_t *t = get_cur_thread();
+    struct futex_waiter w = { .addr = addr, .thread = t, .woken = 0 };
+    struct release_state r = { .bucket = b, .timer = 0 };
+    uint8_t flags;
+    int rc = 0;
+
+    if (timeout_ns) {
+        r.timer = nk_timer_get_thread_default();
+        if (!r.timer) {
+            ERROR("No timer available for timed wait\n");
+            return NK_FUTEX_TIMEDOUT;
+        }
+        if (nk_timer_set(r.timer, timeout_ns, NK_TIMER_WAIT_ONE, 0, 0, 0) ||
+            nk_timer_start(r.timer)) {
+            ERROR("Cannot start timer for timed wait\n");
+            return NK_FUTEX_TIMEDOUT;
+        }
+    }
+
+    flags = irq_disable_save();
+
+    spin_lock(&b->lock);
+    if (r.timer) {
+        spin_lock(&r.timer->waitq->lock);
+    }
+
+    __sync_fetch_and_add(&b->pending, 1);
+
+    // a waker changes the word before it reads the pending count, so
+    // if it has not changed yet, its wake will find us
+    if (*addr != expected) {
+        rc = NK_FUTEX_AGAIN;
+    } else if (r.timer && r.timer->state == NK_TIMER_SIGNALLED) {
+        rc = NK_FUTEX_TIMEDOUT;
+    }
+
+    if (rc) {
+        __sync_fetch_and_sub(&b->pending, 1);
+        release(&r);
+        irq_enable_restore(flags);
+        if (r.timer) {
+            nk_timer_cancel(r.timer);
+        }
+        return rc;
+    }
+
+    enqueue(b, &w);
+
+    t->status = NK_THR_WAITING;
+
+    if (r.timer && nk_wait_queue_enqueue_extended(r.timer->waitq, t, 1)) {
+        panic("Cannot enqueue thread onto timer wait queue\n");
+    }
+
+    __asm__ __volatile__ ("mfence" : : : "memory");
+
+    // the scheduler releases both locks once we are switched out
+    nk_sched_sleep_extended(release, &r);
+
+    // interrupts are still off
+
+    if (r.timer) {
+        nk_wait_queue_remove_specific(r.timer->waitq, t);
+        nk_timer_cancel(r.timer);
+    }
+
+    spin_lock(&b->lock);
+    if (!w.woken) {
+        hlist_del_init(&w.node);
+        rc = NK_FUTEX_TIMEDOUT;
+    }
+    __sync_fetch_and_sub(&b->pending, 1);
+    spin_unlock(&b->lock);
+
+    irq_enable_restore(flags);
+
+    return rc;
+}
+
+
+int nk_futex_wake(volatile uint32_t *addr, int n)
+{
+    struct futex_bucket *b = bucket_of(addr);
+    struct hlist_node *cur, *next;
+    struct futex_waiter *w;
+    nk_thread_t *t;
+    uint8_t flags;
+    int count = 0;
+
+    // order the caller's change to the word before our look at
+    // the pending count, the sleeper does the opposite
+    __sync_synchronize();
+
+    if (n <= 0 || !b->pending) {
+        return 0;
+    }
+
+    flags = spin_lock_irq_save(&b->lock);
+
+    hlist_for_each_safe(cur, next, &b->waiters) {
+        if (count >= n) {
+            break;
+        }
+        w = hlist_entry(cur, struct futex_waiter, node);
+        if (w->addr != addr) {
+            continue;
+        }
+        hlist_del_init(&w->node);
+        t = w->thread;
+        w->woken = 1;
+        count++;
+        // the timer may have beaten us to it
+        if (__sync_bool_compare_and_swap(&t->status, NK_THR_WAITING, NK_THR_SUSPENDED)) {
+            if (nk_sched_awaken(t, t->current_cpu)) {
+                ERROR("Failed to awaken thread %lu\n", t->tid);
+                continue;
+            }
+            nk_sched_kick_cpu(t->current_cpu);
+        }
+    }
+
+    spin_unlock_irq_restore(&b->lock, flags);
+
+    return count;
+}
+
+
+/*
+ * futextest: threads take turns incrementing a counter under a
+ * futex mutex while yielding inside the critical section, so the
+ * lock is contended and its holders sleep.
+ */
+
+#define TEST_THREADS 8
+#define TEST_ITERS   1000
+
+static volatile uint32_t test_mutex;
+static volatile uint64_t test_count;
+static volatile uint64_t test_inside;
+static volatile uint64_t test_errors;
+
+static void test_thread(void *in, void **out)
+{
+    int i;
+
+    for (i = 0; i < TEST_ITERS; i++) {
+        nk_futex_mutex_lock(&test_mutex);
+        if (__sync_fetch_and_add(&test_inside, 1)) {
+            __sync_fetch_and_add(&test_errors, 1);
+        }
+        test_count++;
+        if (!(i % 16)) {
+            nk_yield();
+        }
+        __sync_fetch_and_sub(&test_inside, 1);
+        nk_futex_mutex_unlock(&test_mutex);
+    }
+}
+
+static int handle_futextest(char *buf, void *priv)
+{
+    nk_thread_id_t tids[TEST_THREADS];
+    volatile uint32_t word = 0;
+    uint64_t start, end;
+    int i, rc;
+
+    test_mutex = 0;
+    test_count = 0;
+    test_inside = 0;
+    test_errors = 0;
+
+    for (i = 0; i < TEST_THREADS; i++) {
+        if (nk_thread_start(test_thread, 0, 0, 0, 0, &tids[i], i % nk_get_num_cpus())) {
+            nk_vc_printf("futextest: failed to start thread %d\n", i);
+            tids[i] = 0;
+        }
+    }
+    for (i = 0; i < TEST_THREADS; i++) {
+        if (tids[i]) {
+            nk_join(tids[i], 0);
+        }
+    }
+
+    nk_vc_printf("futextest: mutex count %lu (expected %lu), %lu exclusion errors\n",
+                 test_count, (uint64_t)TEST_THREADS * TEST_ITERS, test_errors);
+
+    rc = nk_futex_wait(&word, 1, 0);
+    nk_vc_printf("futextest: wait on changed word returns %d (expected %d)\n", rc, NK_FUTEX_AGAIN);
+
+    start = nk_sched_get_realtime();
+    rc = nk_futex_wait(&word, 0, 10000000ULL);
+    end = nk_sched_get_realtime();
+    nk_vc_printf("futextest: 10 ms timed wait returns %d (expected %d) after %lu us\n",
+                 rc, NK_FUTEX_TIMEDOUT, (end - start) / 1000);
+
+    return 0;
+}
+
+static struct shell_cmd_impl futextest_impl = {
+    .cmd      = "futextest",
+    .help_str = "futextest",
+    .handler  = handle_futextest,
+};
+nk_register_shell_cmd(futextest_impl);
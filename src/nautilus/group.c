@@ -558,3 +558,26 @@ uint64_t
 nk_thread_group_get_size(nk_thread_group_t *group) {
   return group->group_size;
 }
+
+// apply a function to every current member, stopping at the first failure
+int
+nk_thread_group_for_each(nk_thread_group_t *group, int (*fn)(nk_thread_t *, void *), void *arg) {
+  struct list_head *cur;
+  group_member_t *member;
+  int i, rc = 0;
+
+  spin_lock(&group->group_lock);
+
+  for (i = 0; i < MAX_CPU_NUM && !rc; i++) {
+    list_for_each(cur, &group->group_member_array[i]) {
+      member = list_entry(cur, group_member_t, group_member_node);
+      if ((rc = fn(member->thread, arg))) {
+        break;
+      }
+    }
+  }
+
+  spin_unlock(&group->group_lock);
+
+  return rc;
+}
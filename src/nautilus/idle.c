@@ -87,6 +87,17 @@ idle (void * in, void ** out)
 	
 #if NAUT_CONFIG_WORK_STEALING
 	runtime = nk_sched_get_runtime(get_cur_thread());
+#if NAUT_CONFIG_LOAD_BALANCE
+	if (nk_sched_balance_wanted() ||
+	    (runtime - last_steal) > (NAUT_CONFIG_WORK_STEALING_INTERVAL_MS*1000000ULL)) {
+	    preempt_disable();
+	    DEBUG_PRINT("CPU %d balancing\n",my_cpu_id());
+	    nk_sched_balance(NAUT_CONFIG_WORK_STEALING_AMOUNT,&numstolen);
+	    DEBUG_PRINT("CPU %d pulled %lu threads\n",my_cpu_id(),numstolen);
+	    last_steal = runtime;
+	    preempt_enable();
+	}
+#else
 	if ((runtime - last_steal) > (NAUT_CONFIG_WORK_STEALING_INTERVAL_MS*1000000ULL)) {
 	    preempt_disable();
 	    DEBUG_PRINT("CPU %d trying to steal\n",my_cpu_id());
@@ -96,10 +107,14 @@ idle (void * in, void ** out)
 	    preempt_enable();
 	}
 #endif
+#endif
 	    
 
         nk_yield();
 
+#ifdef NAUT_CONFIG_IDLE_GOVERNOR
+        nk_idle_wait();
+#else
 #ifdef NAUT_CONFIG_XEON_PHI
         udelay(1);
 #else
@@ -109,6 +124,7 @@ idle (void * in, void ** out)
 #ifdef NAUT_CONFIG_HALT_WHILE_IDLE
         sti();
         halt();
+#endif
 #endif
     }
 }
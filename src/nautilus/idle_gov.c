@@ -0,0 +1,239 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#include <nautilus/nautilus.h>
+#include <nautilus/idle.h>
+#include <nautilus/cpu.h>
+#include <nautilus/irq.h>
+#include <nautilus/smp.h>
+#include <nautilus/mwait.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/shell.h>
+#include <dev/apic.h>
+
+#define ERROR(fmt, args...) ERROR_PRINT("idle: " fmt, ##args)
+
+/*
+ * Target residency and exit latency of each C-state, in ns.  These
+ * are conservative figures for recent Intel parts; the ACPI _CST
+ * tables are not consulted.  A state is only chosen if the timer
+ * will not fire for at least its residency, and its exit latency is
+ * within the current limit.
+ */
+static const struct {
+    uint64_t residency;
+    uint64_t latency;
+} cstates[NK_IDLE_CSTATES] = {
+    {     2000,    2000 },   // C1
+    {    20000,   10000 },   // C2
+    {   200000,  100000 },   // C3
+    {   800000,  200000 },   // C4
+};
+
+static uint64_t max_latency_ns = NAUT_CONFIG_IDLE_MAX_LATENCY_US * 1000ULL;
+
+
+static struct nk_idle_state *
+get_state (void)
+{
+    struct nk_idle_state * st = per_cpu_get(idle_state);
+
+    if (!st) {
+        st = malloc_specific(sizeof(*st), my_cpu_id());
+        if (!st) {
+            ERROR("Cannot allocate idle state for cpu %d\n", my_cpu_id());
+            return 0;
+        }
+        memset(st, 0, sizeof(*st));
+        __sync_synchronize();
+        get_cpu()->idle_state = st;
+    }
+
+    return st;
+}
+
+
+static int
+mwait_usable (void)
+{
+    return nk_mwait_available() && nk_mwait_ints_as_breaks();
+}
+
+
+// CPU 0 keeps its tick: it runs the timer list (see nk_timer_handler),
+// and a timer armed elsewhere does not reprogram it, so sleeping past
+// the quantum there would make every timer late
+int
+nk_idle_tickless (void)
+{
+    return my_cpu_id() != 0 && mwait_usable();
+}
+
+
+int
+nk_idle_nudge (int cpu)
+{
+    struct nk_idle_state * st = nk_get_nautilus_info()->sys.cpus[cpu]->idle_state;
+
+    // order the caller's enqueue before our read of waiting, the
+    // waiter does the opposite, so one of us sees the other
+    __sync_synchronize();
+
+    if (st && st->waiting) {
+        st->wake = rdtsc();
+        return 1;
+    }
+
+    return 0;
+}
+
+
+// time until the local APIC timer fires, in ns
+static uint64_t
+time_to_timer (void)
+{
+    return apic_timer_remaining_ns(per_cpu_get(apic));
+}
+
+
+static int
+select_cstate (uint64_t idle_ns)
+{
+    int c, best = 0;
+
+    for (c = 1; c < NK_IDLE_CSTATES; c++) {
+        if (!nk_mwait_substates(c + 1) ||
+            cstates[c].residency > idle_ns ||
+            cstates[c].latency > max_latency_ns) {
+            break;
+        }
+        best = c;
+    }
+
+    return best;
+}
+
+
+void
+nk_idle_wait (void)
+{
+    struct nk_idle_state * st = get_state();
+    uint64_t start, end, wake;
+    int c;
+
+    if (!st || !mwait_usable()) {
+        // no usable MWAIT, so wait for the next interrupt,
+        // which the quantum tick guarantees
+        if (st) {
+            st->halts++;
+        }
+        sti();
+        halt();
+        return;
+    }
+
+    cli();
+
+    st->waiting = 1;
+    __sync_synchronize();
+
+    nk_monitor((addr_t)&st->wake, 0, 0);
+
+    // anything enqueued before the monitor was armed is visible now
+    if (nk_sched_have_runnable() || smp_xcall_pending()) {
+        st->waiting = 0;
+        smp_xcall_poll();
+        sti();
+        return;
+    }
+
+    c = select_cstate(time_to_timer());
+
+    wake = st->wake;
+    start = rdtsc();
+
+    // ecx=1: an interrupt ends the wait even though we have them off
+    nk_mwait(c << 4, 1);
+
+    end = rdtsc();
+
+    st->waiting = 0;
+    __sync_synchronize();
+
+    st->entries[c]++;
+    st->residency[c] += end - start;
+
+    if (st->wake != wake) {
+        uint64_t lat = end > st->wake ? end - st->wake : 0;
+        st->remote_wakeups++;
+        st->wake_latency_sum += lat;
+        if (lat > st->wake_latency_max) {
+            st->wake_latency_max = lat;
+        }
+    }
+
+    smp_xcall_poll();
+
+    // any interrupt that woke us is taken here
+    sti();
+}
+
+
+static int
+handle_idlestat (char * buf, void * priv)
+{
+    struct sys_info * sys = per_cpu_get(system);
+    struct nk_idle_state * st;
+    uint64_t us;
+    int cpu, c;
+
+    if (sscanf(buf, "idlestat latency %lu", &us) == 1) {
+        max_latency_ns = us * 1000ULL;
+        nk_vc_printf("maximum exit latency now %lu us\n", us);
+        return 0;
+    }
+
+    nk_vc_printf("mwait %s, maximum exit latency %lu us\n",
+                 mwait_usable() ? "in use" : "unavailable", max_latency_ns / 1000);
+
+    for (cpu = 0; cpu < sys->num_cpus; cpu++) {
+        st = sys->cpus[cpu]->idle_state;
+        if (!st) {
+            continue;
+        }
+        nk_vc_printf("%dc:", cpu);
+        for (c = 0; c < NK_IDLE_CSTATES; c++) {
+            nk_vc_printf(" C%d=%lu/%lucyc", c + 1, st->entries[c], st->residency[c]);
+        }
+        nk_vc_printf(" halt=%lu remote=%lu lat=%lu/%lucyc noipi=%lu\n",
+                     st->halts, st->remote_wakeups,
+                     st->remote_wakeups ? st->wake_latency_sum / st->remote_wakeups : 0,
+                     st->wake_latency_max, st->ipis_avoided);
+    }
+
+    return 0;
+}
+
+
+static struct shell_cmd_impl idlestat_impl = {
+    .cmd      = "idlestat",
+    .help_str = "idlestat [latency us]",
+    .handler  = handle_idlestat,
+};
+nk_register_shell_cmd(idlestat_impl);
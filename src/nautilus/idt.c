@@ -36,6 +36,9 @@
 #ifdef NAUT_CONFIG_ENABLE_MONITOR
 #include <nautilus/monitor.h>
 #endif
+#ifdef NAUT_CONFIG_PMC_SAMPLING
+#include <nautilus/pmc.h>
+#endif
 
 extern ulong_t idt_handler_table[NUM_IDT_ENTRIES];
 extern ulong_t idt_state_table[NUM_IDT_ENTRIES]; 
@@ -236,8 +239,8 @@ pic_spur_int_handler (excp_entry_t * excp,
 
 /*
 
-  NMIs are currently used for two purposes, the watchdog
-  timer and the monitor.   
+  NMIs are currently used for three purposes, the watchdog
+  timer, the monitor, and (when sampling) PMC overflows.
 
   When the monitor is entered on any CPU, the monitor
   NMIs all other CPUs to force them into the monitor as well,
@@ -247,7 +250,8 @@ pic_spur_int_handler (excp_entry_t * excp,
 
   As a consequence, NMIs can come from three possible places: monitor,
   watchdog timer and other NMI-triggering event on the machine.
-  Disambiguating these cases is a challenge.
+  Disambiguating these cases is a challenge.  PMC overflows are the
+  exception, since the counter's overflow status identifies them.
 
 */
 
@@ -257,6 +261,13 @@ int nmi_handler (excp_entry_t * excp,
 		 void *state)
 {
 
+#ifdef NAUT_CONFIG_PMC_SAMPLING
+    // counter overflows are the common case while profiling
+    if (nk_pmc_sample_nmi(excp, state)) {
+	return 0;
+    }
+#endif
+
 #if defined(NAUT_CONFIG_WATCHDOG) && !defined(NAUT_CONFIG_ENABLE_MONITOR)
     int barking = 0;
     
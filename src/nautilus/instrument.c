@@ -22,12 +22,14 @@
  */
 #include <nautilus/nautilus.h>
 #include <nautilus/printk.h>
-#include <nautilus/hashtable.h>
 #include <nautilus/naut_string.h>
 #include <nautilus/percpu.h>
 #include <nautilus/atomic.h>
 #include <nautilus/mm.h>
 #include <nautilus/libccompat.h>
+#include <nautilus/cpu.h>
+#include <nautilus/thread.h>
+#include <nautilus/linker.h>
 #include <nautilus/shell.h>
 #include <nautilus/irq.h>
 
@@ -43,494 +45,572 @@
 #define DEBUG(fmt, args...) 
 #endif
 
+// nothing in this file may itself be instrumented
+#define NOINSTR __attribute__((no_instrument_function))
 
-static uint8_t instr_active = 0;
+
+static volatile uint8_t  instr_active = 0;
+static volatile uint64_t instr_epoch = 0;
 static uint64_t instr_start_count = 0;
 static uint64_t instr_end_count = 0;
+static uint64_t instr_overhead = 0;     // cycles per probe pair
 
-struct func_data {
-    uint64_t call_count;
-    uint64_t avg_nsec;
-    uint64_t max_nsec;
-    uint64_t min_nsec;
-    uint64_t start_count;
-    uint64_t total_count;
-};
 
+static void NOINSTR __attribute__((noinline))
+instr_calibrate (void)
+{
+    NK_PROFILE_ENTRY();
 
-static unsigned 
-instr_hash_fn(addr_t key) {
-    char * name = (char *)key;
-    return nk_hash_buffer((uint8_t *)name, strlen(name));
+    NK_PROFILE_EXIT();
 }
 
 
-static int 
-instr_eq_fn (addr_t key1, addr_t key2) {
-    char * name1 = (char *)key1;
-    char * name2 = (char *)key2;
+// strcmp() may itself be instrumented
+static int NOINSTR
+instr_streq (const char * a, const char * b)
+{
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
 
-    return (strcmp(name1, name2) == 0);
+static inline uint64_t NOINSTR
+instr_hash (uint64_t key)
+{
+    return (key * 0x9e3779b97f4a7c15ULL) >> (64 - NAUT_CONFIG_PROFILE_TABLE_ORDER);
 }
 
 
-static void 
-instr_calibrate (void)
+static void NOINSTR
+func_record (uint64_t key, const char * name, uint64_t incl, uint64_t excl)
 {
-    NK_PROFILE_ENTRY();
+    struct nk_instr_data * id = per_cpu_get(instr_data);
+    struct nk_instr_func * f;
+    uint64_t i, n;
 
-    NK_PROFILE_EXIT();
+    if (!id) {
+        return;
+    }
+
+    i = instr_hash(key);
+
+    for (n = 0; n < NK_INSTR_TABLE_SIZE; n++, i = (i + 1) & (NK_INSTR_TABLE_SIZE - 1)) {
+        f = &id->funcs[i];
+        if (f->key == key) {
+            break;
+        }
+        // an interrupt on this cpu may claim the same slot
+        if (!f->key && 
+            (__sync_bool_compare_and_swap(&f->key, 0, key) || f->key == key)) {
+            f->name = name;
+            break;
+        }
+    }
+
+    if (n == NK_INSTR_TABLE_SIZE) {
+        id->func_dropped++;
+        return;
+    }
+
+    f->calls++;
+    f->incl += incl;
+    f->excl += excl;
+    if (incl < f->min_incl) {
+        f->min_incl = incl;
+    }
+    if (incl > f->max_incl) {
+        f->max_incl = incl;
+    }
 }
 
 
-void 
-nk_profile_func_enter (const char  *func)
+static inline void NOINSTR
+func_enter (uint64_t key, const char * name)
 {
-    struct func_data * new = NULL;
-    struct timespec ts;
+    nk_thread_t * t;
+    struct nk_instr_stack * s;
+    struct nk_instr_frame * f;
+    uint32_t d;
 
     if (!instr_active) {
         return;
     }
 
-    if (!(per_cpu_get(instr_data)->func_htable)) {
+    t = get_cur_thread();
+
+    if (!t) {
         return;
     }
 
-    new = (struct func_data*)nk_htable_search(per_cpu_get(instr_data)->func_htable, (addr_t)(func));
-
-    if (!new) {
+    s = &t->instr_stack;
 
-        new = malloc(sizeof(struct func_data));
-        memset(new, 0, sizeof(struct func_data));
+    if (s->epoch != instr_epoch) {
+        // frames from before this start can never be matched
+        s->depth = 0;
+        s->epoch = instr_epoch;
+    }
 
-        new->call_count  = 1;
-        new->min_nsec = ULONG_MAX;
+    // an interrupt landing here pushes above us, not over us
+    d = __atomic_fetch_add(&s->depth, 1, __ATOMIC_RELAXED);
 
-        nk_htable_insert(per_cpu_get(instr_data)->func_htable, (addr_t)func, (addr_t)new);
-    } else {
-        new->call_count++;
+    if (d < NK_INSTR_STACK_DEPTH) {
+        f = &s->frames[d];
+        f->key    = key;
+        f->name   = name;
+        f->child  = 0;
+        f->nested = 0;
+        f->start  = rdtsc();
     }
-
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    new->start_count = ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
 
-void 
-nk_profile_func_exit (const char *func)
+static inline void NOINSTR
+func_exit (uint64_t key, const char * name)
 {
-    struct timespec te;
-    struct func_data * data = NULL;
-    uint64_t end;
-    uint64_t time;
+    uint64_t now = rdtsc();
+    nk_thread_t * t;
+    struct nk_instr_stack * s;
+    struct nk_instr_frame * f;
+    uint64_t raw, incl, excl, o;
+    uint32_t d;
 
-    if (!instr_active) {
+    t = get_cur_thread();
+
+    if (!t) {
         return;
     }
 
-    if (!(per_cpu_get(instr_data)->func_htable)) {
+    s = &t->instr_stack;
+
+    if (s->epoch != instr_epoch || !s->depth) {
         return;
     }
 
-    clock_gettime(CLOCK_MONOTONIC, &te);
-
-    data = (struct func_data*)nk_htable_search(per_cpu_get(instr_data)->func_htable, (addr_t)func);
+    d = s->depth - 1;
 
-    if (!data) {
+    if (d >= NK_INSTR_STACK_DEPTH) {
+        s->depth = d;
         return;
-    } else {
-        end = 1000000000 * te.tv_sec + te.tv_nsec;
-        if (end < data->start_count) {
+    }
+
+    // frames skipped by a longjmp or similar are discarded
+    while (s->frames[d].key != key &&
+           !(name && s->frames[d].name && instr_streq(name, s->frames[d].name))) {
+        if (!d) {
+            // not ours (entered before this start)
             return;
         }
-        time = end - data->start_count;
-        data->total_count += time;
-        if (time < data->min_nsec) {
-            data->min_nsec = time;
-        }
-        if (time > data->max_nsec) {
-            data->max_nsec = time;
-        }
-        data->avg_nsec = (((data->avg_nsec * (data->call_count - 1)) + time )/ data->call_count);
+        d--;
+    }
+
+    f = &s->frames[d];
+
+    raw  = now - f->start;
+    o    = f->nested * instr_overhead;
+    incl = raw > o ? raw - o : 0;
+    excl = incl > f->child ? incl - f->child : 0;
+
+    if (d) {
+        s->frames[d-1].child  += incl;
+        s->frames[d-1].nested += f->nested + 1;
+    }
+
+    if (instr_active) {
+        func_record(f->key, f->name, incl, excl);
     }
+
+    s->depth = d;
+}
+
+
+void NOINSTR
+nk_profile_func_enter (const char  *func)
+{
+    func_enter((uint64_t)func, func);
+}
+
+
+void NOINSTR
+nk_profile_func_exit (const char *func)
+{
+    func_exit((uint64_t)func, func);
+}
+
+
+#ifdef NAUT_CONFIG_PROFILE_INSTRUMENT_FUNCTIONS
+void NOINSTR
+__cyg_profile_func_enter (void * fn, void * call_site)
+{
+    func_enter((uint64_t)fn, 0);
+}
+
+
+void NOINSTR
+__cyg_profile_func_exit (void * fn, void * call_site)
+{
+    func_exit((uint64_t)fn, 0);
+}
+#endif
+
+
+static void
+lat_clear (struct nk_instr_lat * l)
+{
+    memset(l, 0, sizeof(*l));
+    l->min_latency = ULONG_MAX;
+}
+
+
+static inline void NOINSTR
+lat_enter (struct nk_instr_lat * l)
+{
+    l->count++;
+    l->start_count = rdtsc();
+}
+
+
+static inline void NOINSTR
+lat_exit (struct nk_instr_lat * l)
+{
+    uint64_t end = rdtsc();
+    uint64_t time;
+
+    if (!l->count || end < l->start_count) {
+        return;
+    }
+
+    time = end - l->start_count;
+
+    if (time < l->min_latency) {
+        l->min_latency = time;
+    }
+    if (time > l->max_latency) {
+        l->max_latency = time;
+    }
+    l->avg_latency = (((l->avg_latency * (l->count - 1)) + time) / l->count);
 }
 
 
 void 
 nk_instrument_clear (void) 
 {
-    int i;
+    int i, j;
 
     DEBUG("Clearing Instrumentation\n");
 
-    uint8_t flags = irq_disable_save();
-    
     for (i = 0; i < nk_get_nautilus_info()->sys.num_cpus; i++) {
         struct cpu * this_cpu = nk_get_nautilus_info()->sys.cpus[i];
-        int flags2 = spin_lock_irq_save(&this_cpu->lock);
+        struct nk_instr_data * id;
+
         if (!this_cpu) {
             ERROR("Could not get CPU\n");
-            spin_unlock_irq_restore(&this_cpu->lock, flags2);
             return;
         }
 
-	if (!this_cpu->instr_data) { 
-	    // first time
-
-	    this_cpu->instr_data = malloc(sizeof(struct nk_instr_data));
-	    memset(this_cpu->instr_data, 0, sizeof(struct nk_instr_data));
-	    this_cpu->instr_data->mallocstat.min_latency = ULONG_MAX;
-	    this_cpu->instr_data->freestat.min_latency = ULONG_MAX;
-	    this_cpu->instr_data->irqstat.min_latency    = ULONG_MAX;
-	    this_cpu->instr_data->thr_switch.min_latency = ULONG_MAX;
-
-	    this_cpu->instr_data->func_htable = nk_create_htable(0, instr_hash_fn, instr_eq_fn);
-	    if (!this_cpu->instr_data->func_htable) {
-		ERROR("Could not create instrumentation hash table for core %u\n",
-		      i);
-		spin_unlock_irq_restore(&this_cpu->lock, flags2);
-		return;
-	    }
-	    
-	} else {
-	    // reinit
-	    memset(&this_cpu->instr_data->mallocstat, 0, sizeof(struct malloc_data));
-	    memset(&this_cpu->instr_data->freestat, 0, sizeof(struct free_data));
-	    memset(&this_cpu->instr_data->irqstat,0,sizeof(struct irq_data));
-	    memset(&this_cpu->instr_data->thr_switch,0,sizeof(struct thread_switch_data));
-	    this_cpu->instr_data->mallocstat.min_latency = ULONG_MAX;
-	    this_cpu->instr_data->freestat.min_latency = ULONG_MAX;
-	    this_cpu->instr_data->irqstat.min_latency    = ULONG_MAX;
-	    this_cpu->instr_data->thr_switch.min_latency = ULONG_MAX;
-	    
-	    // blow away htable and delete values (keys are just func addresses, so not freed)
-	    nk_free_htable(this_cpu->instr_data->func_htable, 1, 0);
-
-	    this_cpu->instr_data->func_htable = nk_create_htable(0, instr_hash_fn, instr_eq_fn);
-
-	    if (!this_cpu->instr_data->func_htable) {
-		ERROR("Could not create instrumentation hash table for core %u\n",
-		      i);
-		spin_unlock_irq_restore(&this_cpu->lock, flags2);
-		return;
-	    }
-	}
-	spin_unlock_irq_restore(&this_cpu->lock, flags2);
-    }
+        if (!this_cpu->instr_data) { 
+            // first time, the table must never be allocated by a probe
+            id = malloc_specific(sizeof(struct nk_instr_data), i);
+            if (!id) {
+                ERROR("Could not allocate instrumentation data for core %u\n", i);
+                return;
+            }
+            memset(id, 0, sizeof(struct nk_instr_data));
+        } else {
+            id = this_cpu->instr_data;
+        }
 
-    irq_enable_restore(flags);
+        int flags = spin_lock_irq_save(&this_cpu->lock);
+
+        lat_clear(&id->mallocstat);
+        lat_clear(&id->freestat);
+        lat_clear(&id->irqstat);
+        lat_clear(&id->thr_switch);
+
+        id->func_dropped = 0;
+
+        for (j = 0; j < NK_INSTR_TABLE_SIZE; j++) {
+            memset(&id->funcs[j], 0, sizeof(struct nk_instr_func));
+            id->funcs[j].min_incl = ULONG_MAX;
+        }
+
+        this_cpu->instr_data = id;
+
+        spin_unlock_irq_restore(&this_cpu->lock, flags);
+    }
 }
 
-/* TODO: calibrate and subtract the overhead of instrumentation */
+
 void 
 nk_instrument_init (void) 
 {
     nk_instrument_clear();
-    INFO("inited\n");
+
+    // measure the probes so their cost can be subtracted
+    instr_epoch++;
+    instr_active = 1;
+    nk_instrument_calibrate(INSTR_CAL_LOOPS);
+    instr_active = 0;
+
+    nk_instrument_clear();
+
+    INFO("inited (probe overhead %lu cycles)\n", instr_overhead);
 }
 
+
 void
 nk_instrument_start (void)
 {
-    struct timespec ts;
     DEBUG("Beginning Instrumentation\n");
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    instr_start_count = 1000000000 * ts.tv_sec + ts.tv_nsec;
+    instr_start_count = rdtsc();
+    // invalidates every thread's shadow stack
+    __sync_fetch_and_add(&instr_epoch, 1);
     atomic_cmpswap(instr_active, 0, 1);
 }
 
+
 void 
 nk_instrument_end (void) 
 {
-    struct timespec te;
-    clock_gettime(CLOCK_MONOTONIC, &te);
-    instr_end_count = 1000000000 * te.tv_sec + te.tv_nsec;
+    instr_end_count = rdtsc();
     DEBUG("Deactivating instrumentation\n");
     atomic_cmpswap(instr_active, 1, 0);
 }
 
-void
+
+void NOINSTR
 nk_malloc_enter (void)
 {
-    struct malloc_data * md = NULL;
-    struct timespec ts;
-
     if (!instr_active) {
         return;
     }
 
-    md = &(per_cpu_get(instr_data)->mallocstat);
-    md->count++;
-
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-
-    md->start_count = 1000000000 * ts.tv_sec + ts.tv_nsec;
+    lat_enter(&(per_cpu_get(instr_data)->mallocstat));
 }
 
-void
+
+void NOINSTR
 nk_malloc_exit (void)
 {
-    struct malloc_data * md = NULL;
-    struct timespec te;
-    uint64_t end;
-    uint64_t time;
-
     if (!instr_active) {
         return;
     }
 
-    md = &(per_cpu_get(instr_data)->mallocstat);
-    
-    clock_gettime(CLOCK_MONOTONIC, &te);
-
-    end = 1000000000 * te.tv_sec + te.tv_nsec;
-    if (end < md->start_count) {
-        return;
-    }
-    time = end - md->start_count;
-    if (time < md->min_latency) {
-        md->min_latency = time;
-    }
-    if (time > md->max_latency) {
-        md->max_latency = time;
-    }
-    md->avg_latency = (((md->avg_latency * (md->count - 1)) + time)/ md->count);
+    lat_exit(&(per_cpu_get(instr_data)->mallocstat));
 }
 
-void
+
+void NOINSTR
 nk_free_enter (void)
 {
-    struct free_data * md = NULL;
-    struct timespec ts;
-
     if (!instr_active) {
         return;
     }
 
-    md = &(per_cpu_get(instr_data)->freestat);
-    md->count++;
-
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-
-    md->start_count = 1000000000 * ts.tv_sec + ts.tv_nsec;
+    lat_enter(&(per_cpu_get(instr_data)->freestat));
 }
 
-void
+
+void NOINSTR
 nk_free_exit (void)
 {
-    struct free_data * md = NULL;
-    struct timespec te;
-    uint64_t end;
-    uint64_t time;
-
     if (!instr_active) {
         return;
     }
 
-    md = &(per_cpu_get(instr_data)->freestat);
-    
-    clock_gettime(CLOCK_MONOTONIC, &te);
-
-    end = 1000000000 * te.tv_sec + te.tv_nsec;
-    if (end < md->start_count) {
-        return;
-    }
-    time = end - md->start_count;
-    if (time < md->min_latency) {
-        md->min_latency = time;
-    }
-    if (time > md->max_latency) {
-        md->max_latency = time;
-    }
-    md->avg_latency = (((md->avg_latency * (md->count - 1)) + time)/ md->count);
+    lat_exit(&(per_cpu_get(instr_data)->freestat));
 }
 
 
-void
+void NOINSTR
 nk_irq_prof_enter (void)
 {
-    struct irq_data * irq = NULL;
-    struct timespec ts;
-
     if (!instr_active) {
         return;
     }
 
-    irq = &(per_cpu_get(instr_data)->irqstat);
-    irq->count++;
-
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-
-    irq->start_count = 1000000000 * ts.tv_sec + ts.tv_nsec;
+    lat_enter(&(per_cpu_get(instr_data)->irqstat));
 }
 
 
-void
+void NOINSTR
 nk_irq_prof_exit (void)
 {
-    struct irq_data * irq = NULL;
-    struct timespec te;
-    uint64_t end;
-    uint64_t time;
-
     if (!instr_active) {
         return;
     }
 
-    irq = &(per_cpu_get(instr_data)->irqstat);
-    
-    clock_gettime(CLOCK_MONOTONIC, &te);
-
-    end = 1000000000 * te.tv_sec + te.tv_nsec;
-    if (end < irq->start_count) {
-        return;
-    }
-    time = end - irq->start_count;
-    if (time < irq->min_latency) {
-        irq->min_latency = time;
-    }
-    if (time > irq->max_latency) {
-        irq->max_latency = time;
-    }
-    irq->avg_latency = (((irq->avg_latency * (irq->count - 1)) + time)/ irq->count);
+    lat_exit(&(per_cpu_get(instr_data)->irqstat));
 }
 
 
-void
+void NOINSTR
 nk_thr_switch_prof_enter (void)
 {
-    struct thread_switch_data * thr = NULL;
-    struct timespec ts;
-
     if (!instr_active) {
         return;
     }
 
-    thr = &(per_cpu_get(instr_data)->thr_switch);
-    thr->count++;
-
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-
-    thr->start_count = 1000000000 * ts.tv_sec + ts.tv_nsec;
+    lat_enter(&(per_cpu_get(instr_data)->thr_switch));
 }
 
 
-void
+void NOINSTR
 nk_thr_switch_prof_exit (void)
 {
-    struct thread_switch_data * thr = NULL;
-    struct timespec te;
-    uint64_t end;
-    uint64_t time;
-
     if (!instr_active) {
         return;
     }
 
-    thr = &(per_cpu_get(instr_data)->thr_switch);
+    lat_exit(&(per_cpu_get(instr_data)->thr_switch));
+}
 
-    if (thr->count == 0) {
-        return;
-    }
-    
-    clock_gettime(CLOCK_MONOTONIC, &te);
 
-    end = 1000000000 * te.tv_sec + te.tv_nsec;
-    if (end < thr->start_count) {
-        return;
-    }
-    time = end - thr->start_count;
-    if (time < thr->min_latency) {
-        thr->min_latency = time;
+static const char *
+func_name (struct nk_instr_func * f, uint64_t * off)
+{
+    uint64_t start;
+    const char * name;
+
+    *off = 0;
+
+    if (f->name) {
+        return f->name;
     }
-    if (time > thr->max_latency) {
-        thr->max_latency = time;
+
+    name = nk_linker_addr_to_sym(nk_get_nautilus_info()->sys.linker_info, f->key, &start);
+
+    if (name) {
+        *off = f->key - start;
     }
-    thr->avg_latency = (((thr->avg_latency * (thr->count - 1)) + time)/ thr->count);
+
+    return name;
+}
+
+
+static void
+print_lat (char * what, int cpu, struct nk_instr_lat * l)
+{
+    printk("%s Stats for Core %u:\n", what, cpu);
+    printk("\tCount: %16lu Lat - Avg: %16lu cycles Max: %16lu cycles Min: %16lu cycles\n", 
+           l->count,
+           l->avg_latency,
+           l->max_latency,
+           l->count ? l->min_latency : 0);
 }
 
 
 void 
 nk_instrument_query (void)
 {
-    int i;
+    uint64_t total = instr_end_count - instr_start_count;
+    struct nk_instr_func ** sorted;
+    int i, j, n, gap, k;
+
+    if (!total) {
+        total = 1;
+    }
+
+    sorted = malloc(sizeof(struct nk_instr_func *) * NK_INSTR_TABLE_SIZE);
+    if (!sorted) {
+        ERROR("Could not allocate query buffer\n");
+        return;
+    }
+
+    printk("Dumping instrumentation data (probe overhead %lu cycles, %lu cycles elapsed)...\n",
+           instr_overhead, total);
 
-    printk("Dumping instrumentation data...\n");
     for (i = 0; i < nk_get_nautilus_info()->sys.num_cpus; i++) {
         struct cpu * this_cpu = nk_get_nautilus_info()->sys.cpus[i];
+        struct nk_instr_data * id = this_cpu->instr_data;
 
-
-        printk("Function Table Stats for Core %u:\n", i);
-        struct nk_hashtable_iter * iter = nk_create_htable_iter(this_cpu->instr_data->func_htable);
-        if (!iter) {
-            ERROR("Could not iterate over function htable on core %u\n", i);
+        if (!id) {
             continue;
         }
 
-        do {
-            char * func = (void*)nk_htable_get_iter_key(iter);
-            struct func_data * data = (struct func_data*)nk_htable_get_iter_value(iter);
-
-            uint64_t total_nsec = (instr_end_count - instr_start_count);
-
-            if (data->call_count > 0) {
-                printk("\t%lu.%lu\% Func: %s\n\tCount: %16u Lat - Avg: %16llunsec Max: %16llunsec Min: %16llunsec\n", 
-                        data->total_count / total_nsec,
-                        data->total_count % total_nsec,
-                        func,
-                        data->call_count,
-                        data->avg_nsec,
-                        data->max_nsec,
-                        data->min_nsec);
+        for (j = 0, n = 0; j < NK_INSTR_TABLE_SIZE; j++) {
+            if (id->funcs[j].key && id->funcs[j].calls) {
+                sorted[n++] = &id->funcs[j];
             }
+        }
 
+        // shell sort by exclusive time, largest first
+        for (gap = n/2; gap > 0; gap /= 2) {
+            for (j = gap; j < n; j++) {
+                struct nk_instr_func * f = sorted[j];
+                for (k = j; k >= gap && sorted[k-gap]->excl < f->excl; k -= gap) {
+                    sorted[k] = sorted[k-gap];
+                }
+                sorted[k] = f;
+            }
+        }
 
-        } while (nk_htable_iter_advance(iter) != 0);
-
-        printk("Malloc Stats for Core %u:\n", i);
-
-        /* print malloc data */
-        printk("\tCount: %16u Lat - Avg: %16llunsec, Max: %16llunsec Min: %16llunsec\n", 
-                this_cpu->instr_data->mallocstat.count,
-                this_cpu->instr_data->mallocstat.avg_latency,
-                this_cpu->instr_data->mallocstat.max_latency,
-                this_cpu->instr_data->mallocstat.min_latency);
-
-        printk("Free Stats for Core %u:\n", i);
-
-        /* print free data */
-        printk("\tCount: %16u Lat - Avg: %16llunsec, Max: %16llunsec Min: %16llunsec\n", 
-                this_cpu->instr_data->freestat.count,
-                this_cpu->instr_data->freestat.avg_latency,
-                this_cpu->instr_data->freestat.max_latency,
-                this_cpu->instr_data->freestat.min_latency);
-
-        printk("IRQ Stats for Core %u:\n", i);
-        printk("\tCount: %16u Lat - Avg: %16llunsec Max: %16llunsec Min: %16llunsec\n", 
-                this_cpu->instr_data->irqstat.count,
-                this_cpu->instr_data->irqstat.avg_latency,
-                this_cpu->instr_data->irqstat.max_latency,
-                this_cpu->instr_data->irqstat.min_latency);
-        printk("Thread Switch Stats for Core %u:\n", i);
-        printk("\tCount: %16u Lat - Avg: %16llunsec Max: %16llunsec Min: %16llunsec\n", 
-                
-                this_cpu->instr_data->thr_switch.count,
-                this_cpu->instr_data->thr_switch.avg_latency,
-                this_cpu->instr_data->thr_switch.max_latency,
-                this_cpu->instr_data->thr_switch.min_latency);
+        printk("Function Table Stats for Core %u (%d functions, %lu calls dropped):\n",
+               i, n, id->func_dropped);
+
+        for (j = 0; j < n; j++) {
+            struct nk_instr_func * f = sorted[j];
+            uint64_t off;
+            const char * name = func_name(f, &off);
+
+            printk("\t%lu.%02lu%% excl %lu.%02lu%% incl Func: ",
+                   f->excl * 100 / total, (f->excl * 10000 / total) % 100,
+                   f->incl * 100 / total, (f->incl * 10000 / total) % 100);
+            if (!name) {
+                printk("%p\n", (void *)f->key);
+            } else if (off) {
+                printk("%s+0x%lx\n", name, off);
+            } else {
+                printk("%s\n", name);
+            }
+            printk("\tCount: %16lu Excl: %16lu Incl - Avg: %16lu Max: %16lu Min: %16lu cycles\n", 
+                   f->calls,
+                   f->excl,
+                   f->incl / f->calls,
+                   f->max_incl,
+                   f->min_incl);
+        }
 
+        print_lat("Malloc", i, &id->mallocstat);
+        print_lat("Free", i, &id->freestat);
+        print_lat("IRQ", i, &id->irqstat);
+        print_lat("Thread Switch", i, &id->thr_switch);
     }
+
+    free(sorted);
 }
 
 
 void
 nk_instrument_calibrate (unsigned loops)
 {
-    int i; 
-    for (i = 0; i < loops; i++) {
-        instr_calibrate();
+    uint64_t start, cost, best = ULONG_MAX;
+    uint8_t flags;
+    int round, i;
+
+    if (!loops) {
+        return;
+    }
+
+    flags = irq_disable_save();
+
+    // the best of a few rounds, without interrupts, is the probe cost
+    instr_overhead = 0;
+    for (round = 0; round < 8; round++) {
+        start = rdtsc();
+        for (i = 0; i < loops; i++) {
+            instr_calibrate();
+        }
+        cost = (rdtsc() - start) / loops;
+        if (cost < best) {
+            best = cost;
+        }
     }
+    instr_overhead = best;
+
+    irq_enable_restore(flags);
 }
 
 
@@ -25,6 +25,7 @@
 #include <nautilus/irq.h>
 #include <nautilus/cpu.h>
 #include <nautilus/mm.h>
+#include <nautilus/trace.h>
 
 #define PIC_MASTER_CMD_PORT  0x20
 #define PIC_MASTER_DATA_PORT 0x21
@@ -161,6 +162,26 @@ register_irq_handler (uint16_t irq,
 }
 
 
+#ifdef NAUT_CONFIG_TRACE
+/*
+ * These are invoked by the low-level interrupt entry 
+ * code around the handler for the vector
+ */
+void
+nk_irq_trace_enter (uint64_t vec)
+{
+    NK_TRACE(NK_TRACE_IRQ, NK_TRACE_EV_IRQ_ENTER, vec, 0);
+}
+
+
+void
+nk_irq_trace_exit (uint64_t vec)
+{
+    NK_TRACE(NK_TRACE_IRQ, NK_TRACE_EV_IRQ_EXIT, vec, 0);
+}
+#endif
+
+
 void 
 disable_8259pic (void)
 {
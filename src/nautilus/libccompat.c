@@ -36,6 +36,7 @@
 #include <nautilus/thread.h>
 #include <nautilus/errno.h>
 #include <nautilus/random.h>
+#include <nautilus/futex.h>
 #include <dev/hpet.h>
 
 
@@ -857,9 +858,6 @@ GEN_DEF(__towupper_l)
 GEN_DEF(__uselocale)
 GEN_DEF(__strftime_l)
 GEN_DEF(mbsnrtowcs)
-GEN_DEF(pthread_mutex_init)
-GEN_DEF(pthread_mutex_lock)
-GEN_DEF(pthread_mutex_unlock)
 GEN_DEF(wcscoll)
 //GEN_DEF(strcoll)
 GEN_DEF(towupper)
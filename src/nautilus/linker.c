@@ -43,6 +43,108 @@
 #endif
 
 
+/*
+ * GNU hash (Bernstein's) of a symbol name
+ */
+static inline uint32_t
+sym_hash (const char * name)
+{
+    uint32_t h = 5381;
+
+    while (*name) {
+        h = (h << 5) + h + (uint8_t)*name++;
+    }
+
+    return h;
+}
+
+
+static int
+build_name_index (struct nk_link_info * linfo)
+{
+    struct symhash_slot * slots = NULL;
+    uint32_t size = 1;
+    uint32_t mask, i, j, h;
+    char * name;
+
+    // at most half full
+    while (size < 2 * linfo->symtab.sym_count) {
+        size <<= 1;
+    }
+    mask = size - 1;
+
+    slots = malloc(sizeof(struct symhash_slot) * size);
+    if (!slots) {
+        ERROR("Could not allocate symbol name index\n");
+        return -1;
+    }
+    memset(slots, 0, sizeof(struct symhash_slot) * size);
+
+    for (i = 0; i < linfo->symtab.sym_count; i++) {
+
+        name = &linfo->symtab.strtab[linfo->symtab.entries[i].offset];
+        h    = sym_hash(name);
+
+        for (j = h & mask; slots[j].idx; j = (j + 1) & mask) {
+            if (slots[j].hash == h &&
+                strncmp(name, &linfo->symtab.strtab[linfo->symtab.entries[slots[j].idx-1].offset], MAX_SYM_LEN) == 0) {
+                // keep the first, as a scan of the table would
+                break;
+            }
+        }
+
+        if (!slots[j].idx) {
+            slots[j].hash = h;
+            slots[j].idx  = i + 1;
+        }
+    }
+
+    linfo->by_name_mask = mask;
+    linfo->by_name      = slots;
+
+    return 0;
+}
+
+
+int
+nk_linker_sym_to_addr (struct nk_link_info * linfo, const char * name, uint64_t * addr)
+{
+    symentry_t * e;
+    uint32_t h, j;
+
+    if (!linfo || !linfo->ready) {
+        return -1;
+    }
+
+    if (!linfo->by_name) {
+        // no index, so do it the slow way
+        for (j = 0; j < linfo->symtab.sym_count; j++) {
+            e = &linfo->symtab.entries[j];
+            if (strncmp(name, &linfo->symtab.strtab[e->offset], MAX_SYM_LEN) == 0) {
+                *addr = e->value;
+                return 0;
+            }
+        }
+        return -1;
+    }
+
+    h = sym_hash(name);
+
+    for (j = h & linfo->by_name_mask; linfo->by_name[j].idx; j = (j + 1) & linfo->by_name_mask) {
+        if (linfo->by_name[j].hash != h) {
+            continue;
+        }
+        e = &linfo->symtab.entries[linfo->by_name[j].idx - 1];
+        if (strncmp(name, &linfo->symtab.strtab[e->offset], MAX_SYM_LEN) == 0) {
+            *addr = e->value;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+
 /*
  * @name is the string containing the symbol name
  * @addr will be filled in with the resolved address of the symbol on success
@@ -64,25 +166,13 @@ resolve_symbol (struct nk_link_info * linfo,
 
         DEBUG("Looking up symbol (%s):\n", name);
 
-        for (int i = 0; i < linfo->symtab.sym_count; i++) {
-
-            int sym_offset = linfo->symtab.entries[i].offset;
-
-            if (strncmp(name, &(linfo->symtab.strtab[sym_offset]), MAX_SYM_LEN) == 0) {
+        if (nk_linker_sym_to_addr(linfo, name, addr) == 0) {
 
-                DEBUG("-->name:           %s\n", name);
-                DEBUG("-->GOT entry addr: %016llx\n", linfo->symtab.entries[i].value);
-                DEBUG("-->PLT entry addr: %016llx\n", addr);
+            DEBUG("-->name:           %s\n", name);
+            DEBUG("-->PLT entry addr: %016llx\n", addr);
+            DEBUG("Symbol value resolved to %p\n", (void*)*addr);
 
-                *addr = linfo->symtab.entries[i].value;
-
-                DEBUG("-->PLT entry value: %016llx\n", addr[0]);
-
-                DEBUG("Symbol value resolved to %p\n", (void*)*addr);
-
-                return 0;
-            }
-            
+            return 0;
         }
 
         ERROR("Could not resolve symbol (%s)\n", name);
@@ -98,6 +188,80 @@ resolve_symbol (struct nk_link_info * linfo,
 }
 
 
+/*
+ * Many relocations refer to the same symbol (e.g., its GOT and PLT
+ * entries), so we resolve each dynamic symbol only once per program,
+ * and remember the result for the next time the program is linked.
+ */
+static int
+resolve_cached (struct nk_link_info * linfo,
+                struct nk_prog_info * pinfo,
+                uint64_t symidx,
+                char * name,
+                uint64_t * addr,
+                const uint64_t value)
+{
+    uint64_t resolved;
+
+    if (symidx >= pinfo->sym_cache_count) {
+        return resolve_symbol(linfo, pinfo, name, addr, value);
+    }
+
+    if (!pinfo->sym_cached[symidx]) {
+        if (resolve_symbol(linfo, pinfo, name, &resolved, value) == 0) {
+            pinfo->sym_cache[symidx]  = resolved;
+            pinfo->sym_cached[symidx] = 1;
+        } else {
+            pinfo->sym_cached[symidx] = 2;
+        }
+    }
+
+    if (pinfo->sym_cached[symidx] != 1) {
+        return -1;
+    }
+
+    *addr = pinfo->sym_cache[symidx];
+
+    return 0;
+}
+
+
+static int
+alloc_sym_cache (struct nk_prog_info * prog, uint64_t count)
+{
+    if (!count || (prog->sym_cache && prog->sym_cache_count == count)) {
+        return 0;
+    }
+
+    if (prog->sym_cache) {
+        free(prog->sym_cache);
+        free(prog->sym_cached);
+    }
+
+    prog->sym_cache_count = 0;
+    prog->sym_cache       = malloc(sizeof(uint64_t) * count);
+    prog->sym_cached      = malloc(count);
+
+    if (!prog->sym_cache || !prog->sym_cached) {
+        ERROR("Could not allocate symbol cache, linking without it\n");
+        if (prog->sym_cache) {
+            free(prog->sym_cache);
+        }
+        if (prog->sym_cached) {
+            free(prog->sym_cached);
+        }
+        prog->sym_cache  = NULL;
+        prog->sym_cached = NULL;
+        return -1;
+    }
+
+    memset(prog->sym_cached, 0, count);
+    prog->sym_cache_count = count;
+
+    return 0;
+}
+
+
 int
 nk_link_prog (struct nk_link_info * linfo, struct nk_prog_info * prog)
 {
@@ -146,6 +310,8 @@ nk_link_prog (struct nk_link_info * linfo, struct nk_prog_info * prog)
         }
     }
     
+    alloc_sym_cache(prog, dsymenum);
+
     // parse global symbol table
     
     DEBUG("Parsing global symbol table\n");
@@ -162,7 +328,7 @@ nk_link_prog (struct nk_link_info * linfo, struct nk_prog_info * prog)
         addr  = filebuf + relaidx[i].r_offset;
         value = symidx[relaidx[i].r_info >> 32].st_value;
 
-        resolve_symbol(linfo, prog, name, addr, value);
+        resolve_cached(linfo, prog, relaidx[i].r_info >> 32, name, addr, value);
     }
 
     // resolve PLT
@@ -176,13 +342,92 @@ nk_link_prog (struct nk_link_info * linfo, struct nk_prog_info * prog)
         addr  = filebuf + relaidx[i].r_offset;
         value = symidx[relaidx[i].r_info >> 32].st_value;
 
-        resolve_symbol(linfo, prog, name, addr, value);
+        resolve_cached(linfo, prog, relaidx[i].r_info >> 32, name, addr, value);
     }
 
     return 0;
 }
 
 
+static int
+build_addr_index (struct nk_link_info * linfo)
+{
+    symentry_t ** idx = NULL;
+    uint32_t n = 0;
+    uint32_t gap, i, j;
+
+    idx = malloc(sizeof(symentry_t*) * linfo->symtab.sym_count);
+    if (!idx) {
+        ERROR("Could not allocate symbol address index\n");
+        return -1;
+    }
+
+    for (i = 0; i < linfo->symtab.sym_count; i++) {
+        if (linfo->symtab.entries[i].value) {
+            idx[n++] = &linfo->symtab.entries[i];
+        }
+    }
+
+    // shell sort by value
+    for (gap = n/2; gap > 0; gap /= 2) {
+        for (i = gap; i < n; i++) {
+            symentry_t * e = idx[i];
+            for (j = i; j >= gap && idx[j-gap]->value > e->value; j -= gap) {
+                idx[j] = idx[j-gap];
+            }
+            idx[j] = e;
+        }
+    }
+
+    linfo->by_addr_count = n;
+
+    // another caller may have raced us here
+    if (!__sync_bool_compare_and_swap(&linfo->by_addr, 0, idx)) {
+        free(idx);
+    }
+
+    return 0;
+}
+
+
+const char *
+nk_linker_addr_to_sym (struct nk_link_info * linfo, uint64_t addr, uint64_t * sym_addr)
+{
+    uint32_t lo, hi, mid;
+
+    if (!linfo || !linfo->ready) {
+        return NULL;
+    }
+
+    if (!linfo->by_addr && build_addr_index(linfo)) {
+        return NULL;
+    }
+
+    if (!linfo->by_addr_count || addr < linfo->by_addr[0]->value) {
+        return NULL;
+    }
+
+    // find the last entry with value <= addr
+    lo = 0;
+    hi = linfo->by_addr_count;
+
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (linfo->by_addr[mid]->value <= addr) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (sym_addr) {
+        *sym_addr = linfo->by_addr[lo]->value;
+    }
+
+    return &linfo->symtab.strtab[linfo->by_addr[lo]->offset];
+}
+
+
 /*
  * The kernel symbol table is a formatted blob containing
  * symbol descriptors derived from the kernel's ELF symbol
@@ -247,6 +492,11 @@ nk_linker_init (struct naut_info * naut)
             DEBUG("|--> Symbol Count:                 %d\n", linfo->symtab.sym_count);
             DEBUG("|--> String Table Addr:            0x%016llx\n", linfo->symtab.strtab);
 
+            // if these fail, lookups by name scan the table, and the
+            // address index is tried again on first use
+            build_name_index(linfo);
+            build_addr_index(linfo);
+
             break;
         }
 
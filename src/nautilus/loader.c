@@ -26,6 +26,9 @@
 #include <nautilus/loader.h>
 #include <nautilus/fs.h>
 #include <nautilus/shell.h>
+#include <nautilus/thread.h>
+#include <nautilus/spinlock.h>
+#include <nautilus/mb_utils.h>
 
 #ifndef NAUT_CONFIG_DEBUG_LOADER
 #undef DEBUG_PRINT
@@ -40,6 +43,7 @@ struct nk_exec {
     void      *blob;          // where we loaded it
     uint64_t   blob_size;     // extent in memory
     uint64_t   entry_offset;  // where to start executing in it
+    int        in_place;      // blob is in the caller's image
 };
 
 
@@ -353,12 +357,194 @@ parse_multiboot_header (void *data, uint64_t size, mb_data_t *mb)
 
 #define MB_LOAD (2*PAGE_SIZE_4KB)
 
+#define ALIGN_UP(x) (((x) % PAGE_SIZE_4KB) ? PAGE_SIZE_4KB*(1 + (x)/PAGE_SIZE_4KB) : (x))
+
+#define REQUIRED_FLAGS (MB_TAG_MB64_HRT_FLAG_RELOC | MB_TAG_MB64_HRT_FLAG_EXE)
+
+// where things go, as offsets into the blob, which begins with
+// what follows the first MB_LOAD bytes of the image
+struct exec_layout {
+    uint64_t data_len;      // bytes from the image
+    uint64_t bss_len;       // zeroed bytes following them
+    uint64_t blob_size;
+    uint64_t entry_offset;
+};
+
+static int
+parse_exec (void *hdr, char *what, struct exec_layout *l)
+{
+    mb_data_t m;
+    uint64_t load_start, load_end, bss_end;
+
+    // the MB header should be in the first 2 pages by construction
+
+    if (parse_multiboot_header(hdr, MB_LOAD, &m)) { 
+        ERROR("Cannot parse multiboot kernel header from first page of %s\n", what);
+        return -1;
+    }
+
+    DEBUG("Parsed MB header from %s\n", what);
+
+    if (!m.mb64_hrt) { 
+        ERROR("%s is not a MB64 image\n", what);
+        return -1;
+    }
+
+    if ((m.mb64_hrt->hrt_flags & REQUIRED_FLAGS)!=REQUIRED_FLAGS) {
+        ERROR("%s's flags (%lx) do not include %lx\n", what, m.mb64_hrt->hrt_flags, REQUIRED_FLAGS);
+        return -1;
+    }
+    
+    // although these are target addresses, we assume 
+    // we can use them as offsets as well.   The next page we load
+    // will be the "real" start of the text segment
+    load_start = m.addr->load_addr;
+    load_end = m.addr->load_end_addr;
+    bss_end = m.addr->bss_end_addr;
+
+    l->data_len = load_end - load_start;
+    l->bss_len = bss_end - load_end;
+    l->blob_size = ALIGN_UP(bss_end - load_start + 1);
+    l->entry_offset = m.entry->entry_addr - PAGE_SIZE_4KB; 
+
+    DEBUG("Load continuing... start=0x%lx, end=0x%lx, bss_end=0x%lx, blob_size=0x%lx\n",
+	  load_start, load_end, bss_end, l->blob_size);
+
+    return 0;
+}
+
+
+// zero with non-temporal stores, since a large BSS will not be
+// touched again soon, and there is no point in filling the cache
+static void
+zero_nt (void *dst, uint64_t n)
+{
+    uint64_t *d;
+    uint64_t head = (8 - ((addr_t)dst & 0x7)) & 0x7;
+
+    if (n < 4096) {
+        memset(dst, 0, n);
+        return;
+    }
+
+    memset(dst, 0, head);
+    d = dst + head;
+    n -= head;
+
+    while (n >= 8) {
+        __asm__ __volatile__ ("movnti %1, %0" : "=m" (*d) : "r" (0UL));
+        d++;
+        n -= 8;
+    }
+
+    memset(d, 0, n);
+
+    __asm__ __volatile__ ("sfence" : : : "memory");
+}
+
+
+/*
+ * Large images are loaded by several threads at once.  The data is
+ * cut into chunks, followed by the BSS, and each thread takes the
+ * next chunk, reading it from the file at its own offset, or zeroing
+ * it.  The file systems read with blocking requests, so this is how
+ * we get more than one request to the device at a time.
+ */
+#define LOAD_CHUNK        (2*1024*1024)
+#define LOAD_PARALLEL_MIN (4*LOAD_CHUNK)
+#define LOAD_MAX_THREADS  8
+
+struct load_work {
+    nk_fs_fd_t        fd;
+    void             *blob;
+    struct exec_layout *l;
+    uint64_t          data_chunks;
+    uint64_t          chunks;
+    volatile uint64_t next;
+    volatile uint64_t bytes;
+    volatile int      failed;
+};
+
+static void
+load_chunks (struct load_work *w)
+{
+    uint64_t i, start, len;
+    ssize_t n;
+
+    while ((i = __sync_fetch_and_add(&w->next,1)) < w->chunks) {
+        if (i < w->data_chunks) {
+            start = i * LOAD_CHUNK;
+            len = w->l->data_len - start;
+            len = len > LOAD_CHUNK ? LOAD_CHUNK : len;
+            if ((n = nk_fs_pread(w->fd, w->blob + start, len, MB_LOAD + start)) < 0) {
+                w->failed = 1;
+            } else {
+                __sync_fetch_and_add(&w->bytes, n);
+            }
+        } else {
+            start = (i - w->data_chunks) * LOAD_CHUNK;
+            len = w->l->bss_len - start;
+            len = len > LOAD_CHUNK ? LOAD_CHUNK : len;
+            zero_nt(w->blob + w->l->data_len + start, len);
+        }
+    }
+}
+
+static void
+load_thread (void *in, void **out)
+{
+    load_chunks((struct load_work *)in);
+}
+
+static int
+load_blob (nk_fs_fd_t fd, void *blob, struct exec_layout *l, char *path)
+{
+    struct load_work w = { .fd = fd, .blob = blob, .l = l };
+    nk_thread_id_t tids[LOAD_MAX_THREADS];
+    int i, nthreads = 1;
+
+    w.data_chunks = (l->data_len + LOAD_CHUNK - 1) / LOAD_CHUNK;
+    w.chunks = w.data_chunks + (l->bss_len + LOAD_CHUNK - 1) / LOAD_CHUNK;
+
+    if (l->data_len + l->bss_len >= LOAD_PARALLEL_MIN) {
+        nthreads = nk_get_num_cpus();
+        nthreads = nthreads > LOAD_MAX_THREADS ? LOAD_MAX_THREADS : nthreads;
+        nthreads = nthreads > w.chunks ? w.chunks : nthreads;
+    }
+
+    // we are one of the loaders
+    for (i = 1; i < nthreads; i++) {
+        if (nk_thread_start(load_thread, &w, 0, 0, 0, &tids[i], (my_cpu_id() + i) % nk_get_num_cpus())) {
+            DEBUG("Could only start %d loader threads for %s\n", i - 1, path);
+            break;
+        }
+    }
+    nthreads = i;
+
+    load_chunks(&w);
+
+    for (i = 1; i < nthreads; i++) {
+        nk_join(tids[i], 0);
+    }
+
+    if (w.failed) {
+        ERROR("Unable to read blob from %s\n", path);
+        return -1;
+    }
+
+    DEBUG("Tried to read 0x%lx bytes with %d threads, got 0x%lx bytes\n", l->data_len, nthreads, w.bytes);
+
+    return 0;
+}
+
+
 // load executable from file, do not run
 struct nk_exec *nk_load_exec(char *path)
 {
     nk_fs_fd_t fd=FS_BAD_FD;
     void *page = 0;
     struct nk_exec *e = 0;
+    struct exec_layout l;
      
     DEBUG("Loading executable at path %s\n", path);
 
@@ -374,52 +560,15 @@ struct nk_exec *nk_load_exec(char *path)
         goto out_bad;
     }
 
-    if (nk_fs_read(fd,page,MB_LOAD)!=MB_LOAD) { 
+    if (nk_fs_pread(fd,page,MB_LOAD,0)!=MB_LOAD) { 
         ERROR("Could not read first page of file %s\n", path);
         goto out_bad;
     }
 
-    // the MB header should be in the first 2 pages by construction
-
-    mb_data_t m;
-
-    if (parse_multiboot_header(page, MB_LOAD, &m)) { 
-        ERROR("Cannot parse multiboot kernel header from first page of %s\n", path);
+    if (parse_exec(page, path, &l)) {
         goto out_bad;
     }
 
-    DEBUG("Parsed MB header from %s\n", path);
-
-    if (!m.mb64_hrt) { 
-        ERROR("%s is not a MB64 image\n", path);
-        goto out_bad;
-    }
-
-#define REQUIRED_FLAGS (MB_TAG_MB64_HRT_FLAG_RELOC | MB_TAG_MB64_HRT_FLAG_EXE)
-
-    if ((m.mb64_hrt->hrt_flags & REQUIRED_FLAGS)!=REQUIRED_FLAGS) {
-        ERROR("%s's flags (%lx) do not include %lx\n", path, m.mb64_hrt->hrt_flags, REQUIRED_FLAGS);
-        goto out_bad;
-    }
-    
-    uint64_t load_start, load_end, bss_end;
-    uint64_t blob_size;
-
-    // although these are target addresses, we assume 
-    // we can use them as offsets as well.   The next page we load
-    // will be the "real" start of the text segment
-    load_start = m.addr->load_addr;
-    load_end = m.addr->load_end_addr;
-    bss_end = m.addr->bss_end_addr;
-
-#define ALIGN_UP(x) (((x) % PAGE_SIZE_4KB) ? PAGE_SIZE_4KB*(1 + (x)/PAGE_SIZE_4KB) : (x))
-
-    blob_size = ALIGN_UP(bss_end - load_start + 1);
-
-    DEBUG("Load continuing... start=0x%lx, end=0x%lx, bss_end=0x%lx, blob_size=0x%lx\n",
-	  load_start, load_end, bss_end, blob_size);
-    
-
     e = malloc(sizeof(struct nk_exec));
     
     if (!e) { 
@@ -429,33 +578,23 @@ struct nk_exec *nk_load_exec(char *path)
 
     memset(e,0,sizeof(*e));
 
-    e->blob = malloc(blob_size);
+    e->blob = malloc(l.blob_size);
 
     if (!e->blob) { 
         ERROR("Cannot allocate executable blob for %s\n",path);
         goto out_bad;
     }
     
-    e->blob_size = blob_size;
-    e->entry_offset = m.entry->entry_addr - PAGE_SIZE_4KB; 
-    
-    // now copy it to memory
-    ssize_t n;
-    
+    e->blob_size = l.blob_size;
+    e->entry_offset = l.entry_offset;
     
-    if ((n = nk_fs_read(fd,e->blob,e->blob_size))<0) {
-        ERROR("Unable to read blob from %s\n", path);
+    // now copy it to memory, and clear the BSS
+    if (load_blob(fd, e->blob, &l, path)) {
         goto out_bad;
     }
 
-    DEBUG("Tried to read 0x%lx byte blob, got 0x%lx bytes\n", e->blob_size, n);
-    
     DEBUG("Successfully loaded executable %s\n",path);
 
-    memset(e->blob+(load_end-load_start),0,bss_end-load_end);
-
-    DEBUG("Cleared BSS\n");
-
     nk_fs_close(fd);
     DEBUG("file closed\n");
     free(page);
@@ -471,6 +610,109 @@ struct nk_exec *nk_load_exec(char *path)
     return 0;
 }
 
+
+// Images that have been used in place.  Their .data and BSS have been
+// run on, so they no longer hold what a fresh load needs
+struct used_image {
+    void              *image;
+    struct used_image *next;
+};
+
+static struct used_image *used_images = 0;
+static spinlock_t         used_lock;
+
+// record image as used in place, or fail if it already was
+static int
+claim_image (void *image)
+{
+    struct used_image *u, *n = malloc(sizeof(*n));
+    int rc = 0;
+
+    if (!n) {
+        ERROR("Cannot allocate record of image use\n");
+        return -1;
+    }
+
+    spin_lock(&used_lock);
+    for (u = used_images; u; u = u->next) {
+        if (u->image == image) {
+            rc = -1;
+            break;
+        }
+    }
+    if (!rc) {
+        n->image = image;
+        n->next = used_images;
+        used_images = n;
+    }
+    spin_unlock(&used_lock);
+
+    if (rc) {
+        free(n);
+    }
+
+    return rc;
+}
+
+
+// load executable from an image already in memory, do not run
+struct nk_exec *nk_load_exec_image(void *image, uint64_t size)
+{
+    struct nk_exec *e = 0;
+    struct exec_layout l;
+
+    DEBUG("Loading executable image at %p (%lu bytes)\n", image, size);
+
+    if (size < MB_LOAD || parse_exec(image, "image", &l)) {
+        ERROR("Cannot load image at %p\n", image);
+        return 0;
+    }
+
+    if (MB_LOAD + l.data_len > size) {
+        ERROR("Image at %p is truncated\n", image);
+        return 0;
+    }
+
+    e = malloc(sizeof(struct nk_exec));
+
+    if (!e) { 
+        ERROR("Cannot allocate executable exec for image\n");
+        return 0;
+    }
+
+    memset(e,0,sizeof(*e));
+
+    e->blob_size = l.blob_size;
+    e->entry_offset = l.entry_offset;
+
+    if (!((addr_t)(image + MB_LOAD) % PAGE_SIZE_4KB) &&
+        MB_LOAD + l.blob_size <= size) {
+        // aligned, and there is room for the BSS, so run it where it is
+        if (claim_image(image)) {
+            ERROR("Image at %p has already been used in place\n", image);
+            free(e);
+            return 0;
+        }
+        DEBUG("Using image in place\n");
+        e->blob = image + MB_LOAD;
+        e->in_place = 1;
+    } else {
+        e->blob = malloc(l.blob_size);
+        if (!e->blob) { 
+            ERROR("Cannot allocate executable blob for image\n");
+            free(e);
+            return 0;
+        }
+        memcpy(e->blob, image + MB_LOAD, l.data_len);
+    }
+
+    zero_nt(e->blob + l.data_len, l.bss_len);
+
+    DEBUG("Successfully loaded executable image\n");
+
+    return e;
+}
+
 // run executable's entry point - this is a blocking call on the current thread
 // user I/O is via the current VC
 
@@ -514,7 +756,7 @@ nk_start_exec (struct nk_exec *exec, void *in, void **out)
 int 
 nk_unload_exec (struct nk_exec *exec)
 {
-    if (exec && exec->blob) {
+    if (exec && exec->blob && !exec->in_place) {
         free(exec->blob);
     }
     if (exec) { 
@@ -529,6 +771,7 @@ int
 nk_loader_init( )
 {
     DEBUG("init\n");
+    spinlock_init(&used_lock);
     return 0;
 }
 
@@ -539,18 +782,52 @@ nk_loader_deinit ()
 }
 
 
+// an executable multiboot module whose command line starts with name
+static struct multiboot_mod *
+find_module (char *name)
+{
+    struct multiboot_info *mb = nk_get_nautilus_info()->sys.mb_info;
+    struct multiboot_mod *mod;
+    struct list_head *cur;
+    int len = strlen(name);
+
+    if (!mb) {
+        return 0;
+    }
+
+    list_for_each(cur, &mb->mod_list) {
+        mod = list_entry(cur, struct multiboot_mod, elm);
+        if (mod->type == MOD_EXEC && mod->cmdline &&
+            !strncmp(mod->cmdline, name, len) &&
+            (!mod->cmdline[len] || mod->cmdline[len] == ' ')) {
+            return mod;
+        }
+    }
+
+    return 0;
+}
+
 static int
 handle_run (char * buf, void * priv)
 {
     char path[80];
-
-    if (sscanf(buf,"run %s", path)!=1) { 
+    struct multiboot_mod *mod;
+    struct nk_exec *e;
+
+    if (sscanf(buf,"run -m %s", path)==1) {
+        // a multiboot module, used in place if it can be
+        if (!(mod = find_module(path))) {
+            nk_vc_printf("No module %s\n", path);
+            return 0;
+        }
+        e = nk_load_exec_image((void*)mod->start, mod->end - mod->start);
+    } else if (sscanf(buf,"run %s", path)==1) { 
+        e = nk_load_exec(path);
+    } else {
         nk_vc_printf("Can't determine what to run\n");
         return 0;
     }
 
-    struct nk_exec *e = nk_load_exec(path);
-
     if (!e) { 
         nk_vc_printf("Can't load %s\n", path);
         return 0;
@@ -573,7 +850,7 @@ handle_run (char * buf, void * priv)
 
 static struct shell_cmd_impl run_impl = {
     .cmd      = "run",
-    .help_str = "run path",
+    .help_str = "run path | run -m module",
     .handler  = handle_run,
 };
 nk_register_shell_cmd(run_impl);
@@ -36,6 +36,7 @@
 #include <nautilus/intrinsics.h>
 #include <nautilus/percpu.h>
 #include <nautilus/shell.h>
+#include <nautilus/trace.h>
 
 #include <dev/gpio.h>
 
@@ -470,6 +471,9 @@ static void     *boot_start;
 static void     *boot_end;
 static uint64_t  boot_flags;
 
+// what a new block's flags start as
+static volatile uint64_t alloc_flags = 0;
+
 void kmem_inform_boot_allocation(void *low, void *high)
 {
     KMEM_DEBUG("Handling boot range %p-%p\n", low, high);
@@ -555,6 +559,7 @@ _kmem_malloc (size_t size, int cpu, int zero)
         if (hdr) {
 	    hdr->addr = block;
             hdr->zone = zone;
+	    hdr->flags = alloc_flags;
 	    // force a software barrier here, since our next write must come last
 	    __asm__ __volatile__ ("" :::"memory");
 	    hdr->order = order; // allocation complete
@@ -579,6 +584,8 @@ _kmem_malloc (size_t size, int cpu, int zero)
     }
 
     KMEM_DEBUG("malloc succeeded: size %lu order %lu -> 0x%lx\n",size, order, block);
+
+    NK_TRACE(NK_TRACE_KMEM,NK_TRACE_EV_MALLOC,block,1UL << order);
  
     if (zero) { 
 	memset(block,0,1ULL << hdr->order);
@@ -679,6 +686,7 @@ kmem_free (void * addr)
     buddy_free(zone, addr, order);
     spin_unlock_irq_restore(&zone->lock, flags);
     KMEM_DEBUG("free succeeded: addr=0x%lx order=%lu\n",addr,order);
+    NK_TRACE(NK_TRACE_KMEM,NK_TRACE_EV_FREE,addr,1UL << order);
     block_hash_free_entry(hdr);
 
 #if SANITY_CHECK_PER_OP
@@ -813,9 +821,9 @@ void  kmem_get_internal_pointer_range(void **start, void **end)
     *end = kmem_private_end;
 }
 
-int  kmem_find_block(void *any_addr, void **block_addr, uint64_t *block_size, uint64_t *flags)
+// finds the block containing any_addr, and where its flags live
+static int _kmem_find_block(void *any_addr, void **block_addr, uint64_t *block_size, volatile uint64_t **flags)
 {
-    uint64_t i;
     uint64_t order;
     addr_t   zone_base;
     uint64_t zone_min_order;
@@ -832,7 +840,7 @@ int  kmem_find_block(void *any_addr, void **block_addr, uint64_t *block_size, ui
 	// in some boot_mm allocation that we treat as a single block
 	*block_addr = boot_start;
 	*block_size = boot_end-boot_start;
-	*flags = boot_flags;
+	*flags = &boot_flags;
 	KMEM_DEBUG("Search of %p found boot block (%p-%p)\n", any_addr, boot_start, boot_end);
 	return 0;
     }
@@ -851,7 +859,7 @@ int  kmem_find_block(void *any_addr, void **block_addr, uint64_t *block_size, ui
 	if (hdr && hdr->order>=MIN_ORDER) { 
 	    *block_addr = search_addr;
 	    *block_size = 0x1ULL<<hdr->order;
-	    *flags = hdr->flags;
+	    *flags = (volatile uint64_t *)((void*)hdr + offsetof(struct kmem_block_hdr, flags));
 	    return 0;
 	    
 	}
@@ -859,6 +867,57 @@ int  kmem_find_block(void *any_addr, void **block_addr, uint64_t *block_size, ui
     return -1;
 }
 
+int  kmem_find_block(void *any_addr, void **block_addr, uint64_t *block_size, uint64_t *flags)
+{
+    volatile uint64_t *f;
+
+    if (_kmem_find_block(any_addr,block_addr,block_size,&f)) {
+	return -1;
+    }
+
+    *flags = *f;
+    return 0;
+}
+
+int  kmem_find_and_set_block_flag(void *any_addr, uint64_t flag, void **block_addr, uint64_t *block_size)
+{
+    volatile uint64_t *f;
+
+    if (_kmem_find_block(any_addr,block_addr,block_size,&f)) {
+	return -1;
+    }
+
+    // cheap test first, since most candidates are already set
+    if (*f & flag) {
+	return 0;
+    }
+
+    return !(__sync_fetch_and_or(f,flag) & flag);
+}
+
+
+void kmem_get_managed_range(void **start, void **end)
+{
+    struct mem_region * region = NULL;
+    addr_t lo = -1ULL, hi = 0;
+
+    list_for_each_entry(region, &glob_zone_list, glob_link) {
+        if (region->base_addr < lo) {
+            lo = region->base_addr;
+        }
+        if (region->base_addr + region->len > hi) {
+            hi = region->base_addr + region->len;
+        }
+    }
+
+    if (lo > hi) {
+        lo = hi = 0;
+    }
+
+    *start = (void*)lo;
+    *end = (void*)hi;
+}
+
 
 // set the flags of an allocated block
 int  kmem_set_block_flags(void *block_addr, uint64_t flags)
@@ -880,6 +939,12 @@ int  kmem_set_block_flags(void *block_addr, uint64_t flags)
     }
 }
 
+void kmem_set_alloc_flags(uint64_t flags)
+{
+    alloc_flags = flags;
+    __sync_synchronize();
+}
+
 // applies only to allocated blocks
 int  kmem_mask_all_blocks_flags(uint64_t mask, int or)
 {
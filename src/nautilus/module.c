@@ -36,10 +36,30 @@
  *
  * There are initially only two types of modules, a symbol table (much like
  * System.map in Linux) and an ELF module, which is a PIC-compiled shared
- * object which will be run as a program.
+ * object which will be run as a program.  A module carrying a multiboot2
+ * header, ELF or not, is instead an executable for nk_load_exec_image.
  */
 
 
+/* The loader looks for the header 4-byte aligned in the first 32K */
+static int
+has_mb_header (uint8_t * data, uint64_t size)
+{
+    uint64_t limit = size > MULTIBOOT_SEARCH ? MULTIBOOT_SEARCH : size;
+    uint64_t i;
+
+    for (i = 0; i + sizeof(struct multiboot_header) <= limit; i += 4) {
+        struct multiboot_header * h = (struct multiboot_header *)&data[i];
+        if (h->magic == MULTIBOOT2_HEADER_MAGIC &&
+            h->magic + h->architecture + h->header_length + h->checksum == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
 int
 nk_register_mod (struct multiboot_info * mb_info, struct multiboot_tag_module * m)
 {
@@ -60,6 +80,13 @@ nk_register_mod (struct multiboot_info * mb_info, struct multiboot_tag_module *
 
     cursor = (uint32_t*)mod->start;
 
+    if (*cursor != ST_MAGIC &&
+        has_mb_header((uint8_t*)mod->start, mod->end - mod->start)) {
+        DEBUG_PRINT("Found executable module\n");
+        mod->type = MOD_EXEC;
+        goto out;
+    }
+
     switch (*cursor) {
         case ST_MAGIC: 
             DEBUG_PRINT("Found symbol table module\n");
@@ -70,9 +97,11 @@ nk_register_mod (struct multiboot_info * mb_info, struct multiboot_tag_module *
             mod->type = MOD_PROGRAM;
             break;
         default:
-            ERROR_PRINT("Found unknown module (magic=0x%08x)\n", *cursor);
+            DEBUG_PRINT("Found other module (magic=0x%08x)\n", *cursor);
+            mod->type = MOD_OTHER;
     }
 
+out:
     list_add(&mod->elm, &(mb_info->mod_list));
 
     return 0;
@@ -507,6 +507,54 @@ intel_disable_ctr (perf_event_t * event)
 }
 
 
+static void
+intel_intr_ctr (perf_event_t * event, int on)
+{
+    pmc_info_t * pmc = nk_get_nautilus_info()->sys.pmc_info;
+    pmc_ctl_intel_t ctl;
+
+    ctl.val = intel_read_ctl(event->assigned_idx);
+    ctl.intr = !!on;
+    intel_write_ctl(event->assigned_idx, ctl.val);
+
+    // the counter also needs to be enabled globally, which it is
+    // after reset, but firmware may have changed that
+    if (on && pmc->version_id >= 2) {
+        msr_write(IA32_PERF_GLOBAL_CTRL,
+                  msr_read(IA32_PERF_GLOBAL_CTRL) | (1ULL << event->assigned_idx));
+    }
+}
+
+
+/*
+ * Version 2+ has a global overflow status. Before that, we rely
+ * on the counter having been preloaded with a negative value, so
+ * the top bit clears when it wraps.
+ */
+static int
+intel_ovf_ctr (uint8_t idx)
+{
+    pmc_info_t * pmc = nk_get_nautilus_info()->sys.pmc_info;
+
+    if (pmc->version_id >= 2) {
+        return !!(msr_read(IA32_PERF_GLOBAL_STATUS) & (1ULL << idx));
+    }
+
+    return !(intel_read_ctr(idx) & (1ULL << (pmc->msr_width - 1)));
+}
+
+
+static void
+intel_ack_ctr (uint8_t idx)
+{
+    pmc_info_t * pmc = nk_get_nautilus_info()->sys.pmc_info;
+
+    if (pmc->version_id >= 2) {
+        msr_write(IA32_PERF_GLOBAL_OVF_CTRL, 1ULL << idx);
+    }
+}
+
+
 static int
 intel_pmc_init (pmc_info_t * pmc)
 {
@@ -658,6 +706,36 @@ amd_disable_ctr (perf_event_t * event)
 }
 
 
+static void
+amd_intr_ctr (perf_event_t * event, int on)
+{
+    pmc_ctl_amd_t ctl;
+
+    ctl.val = amd_read_ctl(event->assigned_idx);
+    ctl.int_enable = !!on;
+    amd_write_ctl(event->assigned_idx, ctl.val);
+}
+
+
+/*
+ * There is no overflow status register, so like Intel v1 we rely on
+ * the counter having been preloaded with a negative value.  The
+ * counters are 48 bits wide.
+ */
+static int
+amd_ovf_ctr (uint8_t idx)
+{
+    return !(amd_read_ctr(idx) & (1ULL << 47));
+}
+
+
+static void
+amd_ack_ctr (uint8_t idx)
+{
+    // nothing to clear
+}
+
+
 static struct pmc_ops amd_ops = {
 	.init        = amd_pmc_init,
 	.read_ctr    = amd_read_ctr,
@@ -667,6 +745,9 @@ static struct pmc_ops amd_ops = {
     .unbind_ctr  = amd_unbind_ctr,
     .enable_ctr  = amd_enable_ctr,
     .disable_ctr = amd_disable_ctr,
+    .intr_ctr    = amd_intr_ctr,
+    .ovf_ctr     = amd_ovf_ctr,
+    .ack_ctr     = amd_ack_ctr,
     .version     = amd_get_pmc_version,
     .msr_cnt     = amd_get_pmc_msr_count,
     .msr_width   = amd_get_pmc_msr_bitwidth,
@@ -681,6 +762,9 @@ static struct pmc_ops intel_ops = {
     .unbind_ctr  = intel_unbind_ctr,
     .enable_ctr  = intel_enable_ctr,
     .disable_ctr = intel_disable_ctr,
+    .intr_ctr    = intel_intr_ctr,
+    .ovf_ctr     = intel_ovf_ctr,
+    .ack_ctr     = intel_ack_ctr,
     .version     = intel_get_pmc_version,
     .msr_cnt     = intel_get_pmc_msr_count,
     .msr_width   = intel_get_pmc_msr_bitwidth,
@@ -0,0 +1,632 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#include <nautilus/nautilus.h>
+#include <nautilus/cpu.h>
+#include <nautilus/thread.h>
+#include <nautilus/idt.h>
+#include <nautilus/pmc.h>
+#include <nautilus/backtrace.h>
+#include <nautilus/linker.h>
+#include <nautilus/hashtable.h>
+#include <nautilus/timer.h>
+#include <nautilus/shell.h>
+#include <dev/apic.h>
+
+/*
+ * PMC overflow sampling
+ *
+ * One counter slot is claimed through the normal PMC interface and
+ * then programmed identically on every CPU, preloaded with -period
+ * and with its overflow interrupt enabled.  The local APIC delivers
+ * the overflow as an NMI, so code running with interrupts off is
+ * sampled too.  The NMI handler only touches the local CPU's sample
+ * buffer.  Aggregation and symbolization happen when a report is
+ * requested, after sampling has stopped.
+ */
+
+#define INFO(fmt, args...)  INFO_PRINT("perf: " fmt, ##args)
+#define ERROR(fmt, args...) ERROR_PRINT("perf: " fmt, ##args)
+
+#define SAMPLES NAUT_CONFIG_PMC_SAMPLING_BUFFER_SIZE
+#define DEPTH   NAUT_CONFIG_PMC_SAMPLING_DEPTH
+
+// per-CPU enable, kept apart from the buffer header that reports read
+static volatile int armed[NAUT_CONFIG_MAX_CPUS];
+
+static struct {
+    perf_event_t * volatile event;  // non-null while counters are programmed
+    uint64_t       reload;          // -period, truncated to the counter width
+    uint64_t       period;
+    const char   * name;            // of the last event sampled
+} sampler;
+
+
+static void
+arm_cpu (void * arg)
+{
+    pmc_info_t * pmc = nk_get_nautilus_info()->sys.pmc_info;
+    perf_event_t * e = sampler.event;
+    struct nk_pmc_sample_buf * b = per_cpu_get(pmc_samples);
+
+    b->count   = 0;
+    b->dropped = 0;
+
+    pmc->ops->bind_ctr(e, e->assigned_idx);
+    pmc->ops->intr_ctr(e, 1);
+    pmc->ops->write_ctr(e->assigned_idx, sampler.reload);
+    pmc->ops->ack_ctr(e->assigned_idx);
+
+    apic_write(per_cpu_get(apic), APIC_REG_LVTPC, APIC_DEL_MODE_NMI);
+
+    armed[my_cpu_id()] = 1;
+
+    pmc->ops->enable_ctr(e);
+}
+
+
+static void
+disarm_cpu (void * arg)
+{
+    pmc_info_t * pmc = nk_get_nautilus_info()->sys.pmc_info;
+    perf_event_t * e = sampler.event;
+
+    armed[my_cpu_id()] = 0;
+
+    pmc->ops->disable_ctr(e);
+    apic_write(per_cpu_get(apic), APIC_REG_LVTPC, APIC_DEL_MODE_NMI | APIC_LVT_DISABLED);
+    pmc->ops->ack_ctr(e->assigned_idx);
+    pmc->ops->unbind_ctr(e->assigned_idx);
+}
+
+
+int
+nk_pmc_sample_nmi (excp_entry_t * excp, void * state)
+{
+    pmc_info_t * pmc = nk_get_nautilus_info()->sys.pmc_info;
+    perf_event_t * e = sampler.event;
+    struct nk_pmc_sample_buf * b;
+    struct nk_pmc_sample * s;
+    struct nk_regs * r;
+    nk_thread_t * t;
+
+    if (!e || !pmc->ops->ovf_ctr(e->assigned_idx)) {
+        return 0;
+    }
+
+    if (!armed[my_cpu_id()]) {
+        // raced with disarm_cpu, drop it
+        pmc->ops->ack_ctr(e->assigned_idx);
+        return 1;
+    }
+
+    pmc->ops->disable_ctr(e);
+
+    b = per_cpu_get(pmc_samples);
+
+    if (b->count < b->size) {
+        // the saved GPRs sit immediately below the exception frame
+        r = (struct nk_regs *)((char *)excp - __builtin_offsetof(struct nk_regs, err_code));
+        t = get_cur_thread();
+        s = &b->samples[b->count];
+
+        s->rip   = excp->rip;
+        s->tid   = t ? t->tid : 0;
+        s->depth = t ? nk_backtrace_collect((void **)r->rbp,
+                                            t->stack,
+                                            t->stack + t->stack_size,
+                                            s->chain,
+                                            DEPTH) : 0;
+        b->count++;
+    } else {
+        b->dropped++;
+    }
+
+    pmc->ops->write_ctr(e->assigned_idx, sampler.reload);
+    pmc->ops->ack_ctr(e->assigned_idx);
+
+    // Intel masks the LVT entry when it delivers the interrupt
+    apic_write(per_cpu_get(apic), APIC_REG_LVTPC, APIC_DEL_MODE_NMI);
+
+    pmc->ops->enable_ctr(e);
+
+    return 1;
+}
+
+
+int
+nk_pmc_sample_start (uint32_t event_id, uint64_t period)
+{
+    struct sys_info * sys = per_cpu_get(system);
+    pmc_info_t * pmc = sys->pmc_info;
+    perf_event_t * e;
+    uint64_t mask;
+    int i;
+
+    if (!pmc || !pmc->valid) {
+        ERROR("PMC subsystem is not available\n");
+        return -1;
+    }
+
+    if (sampler.event) {
+        ERROR("Already sampling\n");
+        return -1;
+    }
+
+    // Intel sign-extends 32 bit counter writes
+    if (period == 0 || period > 0x7fffffffULL) {
+        ERROR("Period must be between 1 and 2^31-1\n");
+        return -1;
+    }
+
+    for (i = 0; i < sys->num_cpus; i++) {
+        if (!sys->cpus[i]->pmc_samples) {
+            struct nk_pmc_sample_buf * b = malloc_specific(sizeof(struct nk_pmc_sample_buf) +
+                                                           SAMPLES * sizeof(struct nk_pmc_sample), i);
+            if (!b) {
+                ERROR("Could not allocate sample buffer for cpu %d\n", i);
+                return -1;
+            }
+            b->count   = 0;
+            b->dropped = 0;
+            b->size    = SAMPLES;
+            sys->cpus[i]->pmc_samples = b;
+        }
+    }
+
+    e = nk_pmc_create(event_id);
+
+    if (!e) {
+        return -1;
+    }
+
+    if (!e->bound) {
+        ERROR("No counter slot available for %s\n", e->name);
+        nk_pmc_destroy(e);
+        return -1;
+    }
+
+    mask = (pmc->msr_width && pmc->msr_width < 64) ? (1ULL << pmc->msr_width) - 1 : (1ULL << 48) - 1;
+
+    sampler.reload = (-period) & mask;
+    sampler.period = period;
+    sampler.name   = e->name;
+    sampler.event  = e;
+
+    for (i = 0; i < sys->num_cpus; i++) {
+        smp_xcall(i, arm_cpu, 0, 1);
+    }
+
+    INFO("Sampling %s every %lu events on %d cpus\n", e->name, period, sys->num_cpus);
+
+    return 0;
+}
+
+
+int
+nk_pmc_sample_stop (void)
+{
+    struct sys_info * sys = per_cpu_get(system);
+    perf_event_t * e = sampler.event;
+    int i;
+
+    if (!e) {
+        ERROR("Not sampling\n");
+        return -1;
+    }
+
+    for (i = 0; i < sys->num_cpus; i++) {
+        smp_xcall(i, disarm_cpu, 0, 1);
+    }
+
+    sampler.event = 0;
+
+    nk_pmc_destroy(e);
+
+    return 0;
+}
+
+
+/*
+ * Report generation
+ *
+ * Addresses are reduced to the start address of their symbol (the
+ * "key"), or left as is when there is no symbol table.  The flat
+ * profile counts, per key, the samples whose RIP falls in it (self)
+ * and the samples with it anywhere on the stack (total).  The call
+ * graph counts distinct (self, caller, caller's caller, ...) chains.
+ */
+
+struct flat_ent {
+    uint64_t     key;
+    const char * name;
+    uint64_t     self;
+    uint64_t     total;
+};
+
+struct chain_ent {
+    uint64_t count;
+    uint32_t len;
+    uint64_t keys[DEPTH+1];
+};
+
+
+static uint64_t
+sym_key (uint64_t addr, const char ** name)
+{
+    uint64_t start;
+
+    *name = nk_linker_addr_to_sym(nk_get_nautilus_info()->sys.linker_info, addr, &start);
+
+    return *name ? start : addr;
+}
+
+
+static uint_t
+flat_hash_fn (addr_t key)
+{
+    return nk_hash_long(key, sizeof(addr_t) * 8);
+}
+
+
+static int
+flat_eq_fn (addr_t key1, addr_t key2)
+{
+    return key1 == key2;
+}
+
+
+static uint_t
+chain_hash_fn (addr_t key)
+{
+    struct chain_ent * c = (struct chain_ent *)key;
+    return nk_hash_buffer((uchar_t *)c->keys, c->len * sizeof(uint64_t));
+}
+
+
+static int
+chain_eq_fn (addr_t key1, addr_t key2)
+{
+    struct chain_ent * c1 = (struct chain_ent *)key1;
+    struct chain_ent * c2 = (struct chain_ent *)key2;
+
+    return c1->len == c2->len && !memcmp(c1->keys, c2->keys, c1->len * sizeof(uint64_t));
+}
+
+
+static struct flat_ent *
+flat_get (struct nk_hashtable * h, uint64_t key, const char * name)
+{
+    struct flat_ent * f = (struct flat_ent *)nk_htable_search(h, key);
+
+    if (!f) {
+        f = malloc(sizeof(*f));
+        if (!f) {
+            return 0;
+        }
+        f->key   = key;
+        f->name  = name;
+        f->self  = 0;
+        f->total = 0;
+        if (!nk_htable_insert(h, key, (addr_t)f)) {
+            free(f);
+            return 0;
+        }
+    }
+
+    return f;
+}
+
+
+static int
+chain_add (struct nk_hashtable * h, struct chain_ent * c)
+{
+    struct chain_ent * e = (struct chain_ent *)nk_htable_search(h, (addr_t)c);
+
+    if (!e) {
+        e = malloc(sizeof(*e));
+        if (!e) {
+            return -1;
+        }
+        *e = *c;
+        e->count = 0;
+        if (!nk_htable_insert(h, (addr_t)e, (addr_t)e)) {
+            free(e);
+            return -1;
+        }
+    }
+
+    e->count++;
+
+    return 0;
+}
+
+
+static uint64_t flat_self (void * p)   { return ((struct flat_ent *)p)->self; }
+static uint64_t chain_count (void * p) { return ((struct chain_ent *)p)->count; }
+
+// shell sort, largest first
+static void
+sort_desc (void ** a, int n, uint64_t (*val)(void *))
+{
+    int gap, i, j;
+
+    for (gap = n/2; gap > 0; gap /= 2) {
+        for (i = gap; i < n; i++) {
+            void * x = a[i];
+            for (j = i; j >= gap && val(a[j-gap]) < val(x); j -= gap) {
+                a[j] = a[j-gap];
+            }
+            a[j] = x;
+        }
+    }
+}
+
+
+static void **
+table_to_array (struct nk_hashtable * h, int * n)
+{
+    struct nk_hashtable_iter * iter;
+    void ** a;
+    int i = 0;
+
+    *n = nk_htable_count(h);
+
+    a = malloc(sizeof(void *) * (*n ? *n : 1));
+    if (!a) {
+        return 0;
+    }
+
+    if (*n) {
+        iter = nk_create_htable_iter(h);
+        if (!iter) {
+            free(a);
+            return 0;
+        }
+        do {
+            a[i++] = (void *)nk_htable_get_iter_value(iter);
+        } while (i < *n && nk_htable_iter_advance(iter));
+        nk_destroy_htable_iter(iter);
+    }
+
+    return a;
+}
+
+
+static void
+print_key (uint64_t key, struct nk_hashtable * flat)
+{
+    struct flat_ent * f = (struct flat_ent *)nk_htable_search(flat, key);
+
+    if (f && f->name) {
+        nk_vc_printf("%s", f->name);
+    } else {
+        nk_vc_printf("[%p]", (void *)key);
+    }
+}
+
+
+void
+nk_pmc_sample_report (int type, int max_entries)
+{
+    struct sys_info * sys = per_cpu_get(system);
+    struct nk_hashtable * flat = 0;
+    struct nk_hashtable * graph = 0;
+    void ** fa = 0;
+    void ** ca = 0;
+    int nf = 0, nc = 0;
+    uint64_t total = 0, dropped = 0;
+    int i, j, k, m;
+
+    if (sampler.event) {
+        nk_vc_printf("stop sampling before reporting\n");
+        return;
+    }
+
+    flat  = nk_create_htable(0, flat_hash_fn, flat_eq_fn);
+    graph = nk_create_htable(0, chain_hash_fn, chain_eq_fn);
+
+    if (!flat || !graph) {
+        ERROR("Could not allocate report tables\n");
+        goto out;
+    }
+
+    for (i = 0; i < sys->num_cpus; i++) {
+        struct nk_pmc_sample_buf * b = sys->cpus[i]->pmc_samples;
+
+        if (!b) {
+            continue;
+        }
+
+        total   += b->count;
+        dropped += b->dropped;
+
+        for (j = 0; j < b->count; j++) {
+            struct nk_pmc_sample * s = &b->samples[j];
+            struct chain_ent c;
+            const char * name;
+            struct flat_ent * f;
+
+            c.len = 0;
+
+            for (k = -1; k < (int)s->depth; k++) {
+                // return addresses point past the call
+                uint64_t key = sym_key(k < 0 ? s->rip : s->chain[k] - 1, &name);
+
+                f = flat_get(flat, key, name);
+                if (!f) {
+                    ERROR("Out of memory building report\n");
+                    goto out;
+                }
+
+                if (k < 0) {
+                    f->self++;
+                }
+
+                // recursion counts once toward the total
+                for (m = 0; m < c.len && c.keys[m] != key; m++) { }
+                if (m == c.len) {
+                    f->total++;
+                }
+
+                c.keys[c.len++] = key;
+            }
+
+            if (type == NK_PMC_REPORT_GRAPH && chain_add(graph, &c)) {
+                ERROR("Out of memory building report\n");
+                goto out;
+            }
+        }
+    }
+
+    nk_vc_printf("%lu samples (%lu dropped) of %s, period %lu\n",
+                 total, dropped, sampler.name ? sampler.name : "(none)", sampler.period);
+
+    if (!total) {
+        goto out;
+    }
+
+    fa = table_to_array(flat, &nf);
+    if (!fa) {
+        goto out;
+    }
+    sort_desc(fa, nf, flat_self);
+
+    if (type == NK_PMC_REPORT_FLAT) {
+        nk_vc_printf("   self%%  total%%    samples  symbol\n");
+        for (i = 0; i < nf && i < max_entries; i++) {
+            struct flat_ent * f = fa[i];
+            if (!f->self) {
+                break;
+            }
+            nk_vc_printf("  %5lu.%lu  %5lu.%lu  %9lu  ",
+                         f->self * 100 / total, (f->self * 1000 / total) % 10,
+                         f->total * 100 / total, (f->total * 1000 / total) % 10,
+                         f->self);
+            print_key(f->key, flat);
+            nk_vc_printf("\n");
+        }
+        goto out;
+    }
+
+    ca = table_to_array(graph, &nc);
+    if (!ca) {
+        goto out;
+    }
+    sort_desc(ca, nc, chain_count);
+
+    for (i = 0; i < nf && i < max_entries; i++) {
+        struct flat_ent * f = fa[i];
+        if (!f->self) {
+            break;
+        }
+        nk_vc_printf("%5lu.%lu%%  ",
+                     f->self * 100 / total, (f->self * 1000 / total) % 10);
+        print_key(f->key, flat);
+        nk_vc_printf("\n");
+        for (j = 0, m = 0; j < nc && m < max_entries; j++) {
+            struct chain_ent * c = ca[j];
+            if (c->keys[0] != f->key) {
+                continue;
+            }
+            nk_vc_printf("         %5lu.%lu%%  ",
+                         c->count * 100 / f->self, (c->count * 1000 / f->self) % 10);
+            for (k = 1; k < c->len; k++) {
+                nk_vc_printf("%s", k > 1 ? " <- " : "");
+                print_key(c->keys[k], flat);
+            }
+            nk_vc_printf("%s\n", c->len == 1 ? "[no callers]" : "");
+            m++;
+        }
+    }
+
+ out:
+    if (fa) {
+        free(fa);
+    }
+    if (ca) {
+        free(ca);
+    }
+    if (flat) {
+        nk_free_htable(flat, 1, 0);
+    }
+    if (graph) {
+        nk_free_htable(graph, 1, 0);
+    }
+}
+
+
+static int
+handle_perf (char * buf, void * priv)
+{
+    char what[16], type[16];
+    uint32_t id = 0;
+    uint64_t period = 1000000;
+    uint64_t secs = 5;
+    int n = 20;
+
+    if (sscanf(buf, "perf %15s", what) != 1) {
+        goto usage;
+    }
+
+    if (!strcmp(what, "record")) {
+        sscanf(buf, "perf record %u %lu %lu", &id, &period, &secs);
+        if (nk_pmc_sample_start(id, period)) {
+            return 0;
+        }
+        nk_sleep(secs * 1000000000ULL);
+        nk_pmc_sample_stop();
+        nk_pmc_sample_report(NK_PMC_REPORT_FLAT, n);
+        return 0;
+    }
+
+    if (!strcmp(what, "start")) {
+        sscanf(buf, "perf start %u %lu", &id, &period);
+        nk_pmc_sample_start(id, period);
+        return 0;
+    }
+
+    if (!strcmp(what, "stop")) {
+        nk_pmc_sample_stop();
+        return 0;
+    }
+
+    if (!strcmp(what, "report")) {
+        if (sscanf(buf, "perf report %15s %d", type, &n) < 1) {
+            strcpy(type, "flat");
+        }
+        if (strcmp(type, "flat") && strcmp(type, "graph")) {
+            goto usage;
+        }
+        nk_pmc_sample_report(strcmp(type, "graph") ? NK_PMC_REPORT_FLAT : NK_PMC_REPORT_GRAPH, n);
+        return 0;
+    }
+
+ usage:
+    nk_vc_printf("perf record [event [period [secs]]] | start [event [period]] | stop | report [flat|graph] [n]\n");
+    return 0;
+}
+
+
+static struct shell_cmd_impl perf_impl = {
+    .cmd      = "perf",
+    .help_str = "perf record|start|stop|report",
+    .handler  = handle_perf,
+};
+nk_register_shell_cmd(perf_impl);
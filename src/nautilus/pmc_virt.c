@@ -0,0 +1,426 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#include <nautilus/nautilus.h>
+#include <nautilus/cpu.h>
+#include <nautilus/thread.h>
+#include <nautilus/group.h>
+#include <nautilus/pmc.h>
+#include <nautilus/shell.h>
+
+/*
+ * Per-thread virtualized counters
+ *
+ * The slots of a set are claimed once, in the global slot table, so
+ * they are never handed to anyone else while the set exists.  Every
+ * CPU programs those slots only while it runs a thread attached to the
+ * set.  A switch between two threads of the same set leaves the
+ * counters running and just moves the baseline from one thread to the
+ * other, which is the common case for a runtime's worker threads.
+ */
+
+#define ERROR(fmt, args...) ERROR_PRINT("pmcvirt: " fmt, ##args)
+
+#define PMC() (nk_get_nautilus_info()->sys.pmc_info)
+
+
+// start counting for c on this CPU, interrupts are off
+static void
+ctx_in (struct nk_pmc_thread_ctx * c)
+{
+    pmc_info_t * pmc = PMC();
+    int i;
+
+    for (i = 0; i < c->set->num; i++) {
+        perf_event_t * e = c->set->events[i];
+        pmc->ops->bind_ctr(e, e->assigned_idx);
+        pmc->ops->enable_ctr(e);
+        c->start[i] = pmc->ops->read_ctr(e->assigned_idx);
+    }
+
+    c->live = 1;
+}
+
+
+// fold the counts since ctx_in into c and its set, interrupts are off
+static void
+ctx_out (struct nk_pmc_thread_ctx * c)
+{
+    pmc_info_t * pmc = PMC();
+    uint64_t d;
+    int i;
+
+    if (!c->live) {
+        return;
+    }
+
+    for (i = 0; i < c->set->num; i++) {
+        perf_event_t * e = c->set->events[i];
+        d = (pmc->ops->read_ctr(e->assigned_idx) - c->start[i]) & c->set->mask;
+        pmc->ops->disable_ctr(e);
+        c->vals[i] += d;
+        __sync_fetch_and_add(&c->set->totals[i], d);
+    }
+
+    c->live = 0;
+}
+
+
+void
+nk_pmc_thread_switch (nk_thread_t * prev, nk_thread_t * next)
+{
+    struct nk_pmc_thread_ctx * pc = prev->pmc_ctx;
+    struct nk_pmc_thread_ctx * nc = next->pmc_ctx;
+    pmc_info_t * pmc;
+    uint64_t v, d;
+    int i;
+
+    if (pc && nc && pc->set == nc->set && pc->live) {
+        pmc = PMC();
+        for (i = 0; i < pc->set->num; i++) {
+            v = pmc->ops->read_ctr(pc->set->events[i]->assigned_idx);
+            d = (v - pc->start[i]) & pc->set->mask;
+            pc->vals[i] += d;
+            __sync_fetch_and_add(&pc->set->totals[i], d);
+            nc->start[i] = v;
+        }
+        pc->live = 0;
+        nc->live = 1;
+        return;
+    }
+
+    if (pc) {
+        ctx_out(pc);
+    }
+
+    if (nc) {
+        ctx_in(nc);
+    }
+}
+
+
+struct nk_pmc_set *
+nk_pmc_set_create (int num, uint32_t * event_ids)
+{
+    pmc_info_t * pmc = PMC();
+    struct nk_pmc_set * set;
+    int i;
+
+    if (!pmc || !pmc->valid) {
+        ERROR("PMC subsystem is not available\n");
+        return 0;
+    }
+
+    if (num < 1 || num > NK_PMC_SET_MAX) {
+        ERROR("A set must have between 1 and %d events\n", NK_PMC_SET_MAX);
+        return 0;
+    }
+
+    set = malloc(sizeof(*set));
+    if (!set) {
+        ERROR("Could not allocate counter set\n");
+        return 0;
+    }
+    memset(set, 0, sizeof(*set));
+
+    for (i = 0; i < num; i++) {
+        set->events[i] = nk_pmc_create(event_ids[i]);
+        if (!set->events[i] || !set->events[i]->bound) {
+            ERROR("Could not get a counter slot for event %u\n", event_ids[i]);
+            goto out_err;
+        }
+        set->num++;
+    }
+
+    set->mask = (pmc->msr_width && pmc->msr_width < 64) ? (1ULL << pmc->msr_width) - 1 : (1ULL << 48) - 1;
+
+    return set;
+
+ out_err:
+    if (set->events[i]) {
+        nk_pmc_destroy(set->events[i]);
+    }
+    nk_pmc_set_destroy(set);
+    return 0;
+}
+
+
+int
+nk_pmc_set_destroy (struct nk_pmc_set * set)
+{
+    int i;
+
+    if (set->refcount) {
+        ERROR("Cannot destroy a counter set with %lu threads attached\n", set->refcount);
+        return -1;
+    }
+
+    for (i = 0; i < set->num; i++) {
+        nk_pmc_destroy(set->events[i]);
+    }
+
+    free(set);
+
+    return 0;
+}
+
+
+int
+nk_pmc_set_read (struct nk_pmc_set * set, uint64_t * vals)
+{
+    nk_thread_t * t = get_cur_thread();
+    struct nk_pmc_thread_ctx * c;
+    pmc_info_t * pmc = PMC();
+    uint8_t flags;
+    int i;
+
+    flags = irq_disable_save();
+
+    c = t->pmc_ctx;
+
+    for (i = 0; i < set->num; i++) {
+        vals[i] = set->totals[i];
+        if (c && c->set == set && c->live) {
+            vals[i] += (pmc->ops->read_ctr(set->events[i]->assigned_idx) - c->start[i]) & set->mask;
+        }
+    }
+
+    irq_enable_restore(flags);
+
+    return set->num;
+}
+
+
+int
+nk_pmc_thread_attach (nk_thread_t * t, struct nk_pmc_set * set)
+{
+    struct nk_pmc_thread_ctx * c;
+    uint8_t flags;
+
+    if (t->pmc_ctx) {
+        ERROR("Thread %lu already has counters attached\n", t->tid);
+        return -1;
+    }
+
+    c = malloc(sizeof(*c));
+    if (!c) {
+        ERROR("Could not allocate counter context\n");
+        return -1;
+    }
+    memset(c, 0, sizeof(*c));
+
+    c->set = set;
+
+    __sync_fetch_and_add(&set->refcount, 1);
+
+    if (t == get_cur_thread()) {
+        flags = irq_disable_save();
+        t->pmc_ctx = c;
+        ctx_in(c);
+        irq_enable_restore(flags);
+    } else {
+        // the scheduler starts counting at its next switch in
+        __sync_synchronize();
+        t->pmc_ctx = c;
+    }
+
+    return 0;
+}
+
+
+int
+nk_pmc_thread_detach (nk_thread_t * t)
+{
+    struct nk_pmc_thread_ctx * c = t->pmc_ctx;
+    uint8_t flags;
+
+    if (!c) {
+        return 0;
+    }
+
+    if (t == get_cur_thread()) {
+        flags = irq_disable_save();
+        ctx_out(c);
+        t->pmc_ctx = 0;
+        irq_enable_restore(flags);
+    } else if (t->status == NK_THR_RUNNING) {
+        ERROR("Cannot detach counters from thread %lu while it runs\n", t->tid);
+        return -1;
+    } else {
+        t->pmc_ctx = 0;
+    }
+
+    __sync_fetch_and_sub(&c->set->refcount, 1);
+
+    free(c);
+
+    return 0;
+}
+
+
+int
+nk_pmc_thread_read (nk_thread_t * t, uint64_t * vals)
+{
+    struct nk_pmc_thread_ctx * c;
+    pmc_info_t * pmc = PMC();
+    uint8_t flags;
+    int i;
+
+    flags = irq_disable_save();
+
+    c = t->pmc_ctx;
+
+    if (!c) {
+        irq_enable_restore(flags);
+        return -1;
+    }
+
+    for (i = 0; i < c->set->num; i++) {
+        vals[i] = c->vals[i];
+        if (t == get_cur_thread() && c->live) {
+            vals[i] += (pmc->ops->read_ctr(c->set->events[i]->assigned_idx) - c->start[i]) & c->set->mask;
+        }
+    }
+
+    irq_enable_restore(flags);
+
+    return c->set->num;
+}
+
+
+static int
+group_attach_one (nk_thread_t * t, void * arg)
+{
+    struct nk_pmc_set * set = (struct nk_pmc_set *)arg;
+
+    if (t->pmc_ctx && t->pmc_ctx->set == set) {
+        return 0;
+    }
+
+    return nk_pmc_thread_attach(t, set);
+}
+
+
+int
+nk_pmc_group_attach (nk_thread_group_t * group, struct nk_pmc_set * set)
+{
+    return nk_thread_group_for_each(group, group_attach_one, set);
+}
+
+
+/*
+ * pmcthread: a few unbound threads attach themselves to one set, do
+ * some work while yielding (so they get switched and may migrate),
+ * and report their own counts.  The set total should be their sum.
+ */
+
+#define TEST_THREADS 4
+
+struct test_state {
+    struct nk_pmc_set * set;
+    int                 id;
+};
+
+
+static void
+test_thread (void * in, void ** out)
+{
+    struct test_state * s = (struct test_state *)in;
+    uint64_t vals[NK_PMC_SET_MAX];
+    volatile uint64_t sum = 0;
+    int i, j;
+
+    if (nk_pmc_thread_attach(get_cur_thread(), s->set)) {
+        return;
+    }
+
+    for (i = 0; i < 100 * (s->id + 1); i++) {
+        for (j = 0; j < 10000; j++) {
+            sum += j;
+        }
+        nk_yield();
+    }
+
+    nk_pmc_thread_read(get_cur_thread(), vals);
+
+    for (i = 0; i < s->set->num; i++) {
+        nk_vc_printf("  thread %d (tid %lu, now on cpu %d): %s = %lu\n",
+                     s->id, get_cur_thread()->tid, my_cpu_id(),
+                     s->set->events[i]->name, vals[i]);
+    }
+
+    nk_pmc_thread_detach(get_cur_thread());
+}
+
+
+static int
+handle_pmcthread (char * buf, void * priv)
+{
+    uint32_t ids[NK_PMC_SET_MAX];
+    struct test_state st[TEST_THREADS];
+    nk_thread_id_t tids[TEST_THREADS];
+    uint64_t vals[NK_PMC_SET_MAX];
+    struct nk_pmc_set * set;
+    int n, i;
+
+    n = sscanf(buf, "pmcthread %u %u %u %u", &ids[0], &ids[1], &ids[2], &ids[3]);
+
+    if (n < 1) {
+        nk_vc_printf("pmcthread id [id]*\n");
+        return 0;
+    }
+
+    set = nk_pmc_set_create(n, ids);
+    if (!set) {
+        return 0;
+    }
+
+    for (i = 0; i < TEST_THREADS; i++) {
+        st[i].set = set;
+        st[i].id  = i;
+        if (nk_thread_start(test_thread, &st[i], 0, 0, 0, &tids[i], -1)) {
+            nk_vc_printf("failed to start thread %d\n", i);
+            tids[i] = 0;
+        }
+    }
+
+    for (i = 0; i < TEST_THREADS; i++) {
+        if (tids[i]) {
+            nk_join(tids[i], 0);
+        }
+    }
+
+    nk_pmc_set_read(set, vals);
+
+    for (i = 0; i < set->num; i++) {
+        nk_vc_printf("  set total: %s = %lu\n", set->events[i]->name, vals[i]);
+    }
+
+    nk_pmc_set_destroy(set);
+
+    return 0;
+}
+
+
+static struct shell_cmd_impl pmcthread_impl = {
+    .cmd      = "pmcthread",
+    .help_str = "pmcthread id [id]*",
+    .handler  = handle_pmcthread,
+};
+nk_register_shell_cmd(pmcthread_impl);
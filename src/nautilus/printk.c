@@ -96,11 +96,78 @@ printk_char (char * arg, int c)
 }
 
 
+#ifdef NAUT_CONFIG_PRINTK_RING
+// output headed for the log ring goes there a record's worth at a
+// time, so there is no limit on the length of a printk
+struct ring_state {
+	char buf[PRINTK_RECORD_TEXT];
+	unsigned int index;
+	int sync;                      // the ring refused, print now
+	struct printk_state direct;
+};
+
+
+static void
+ring_flush (struct ring_state *state)
+{
+	char *c;
+
+	state->buf[state->index] = 0;
+	state->index = 0;
+
+	if (!state->sync && nk_printk_ring_write(state->buf)) {
+		state->sync = 1;
+	}
+
+	if (state->sync) {
+		for (c = state->buf; *c; c++) {
+			printk_char((char *) &state->direct, *c);
+		}
+	}
+}
+
+
+static void
+ring_char (char * arg, int c)
+{
+	struct ring_state *state = (struct ring_state *) arg;
+
+	if (!c) {
+		return;
+	}
+
+	state->buf[state->index++] = c;
+
+	if (state->index == PRINTK_RECORD_TEXT - 1) {
+		ring_flush(state);
+	}
+}
+#endif
+
+
 int 
 vprintk (const char * fmt, va_list args)
 {
 	struct printk_state state;
 
+#ifdef NAUT_CONFIG_PRINTK_RING
+	if (nk_printk_ring_active) {
+	    struct ring_state rs;
+
+	    rs.index = 0;
+	    rs.sync = 0;
+	    rs.direct.index = 0;
+
+	    _doprnt(fmt, args, 0, ring_char, (char *) &rs);
+
+	    if (rs.index != 0)
+		ring_flush(&rs);
+	    if (rs.direct.index != 0)
+		flush(&rs.direct);
+	    return 0;
+	}
+#endif
+
     //uint8_t flags = spin_lock_irq_save(&printk_lock);
 
 	state.index = 0;
@@ -135,6 +202,11 @@ panic (const char * fmt, ...)
 
     va_list arg;
 
+#ifdef NAUT_CONFIG_PRINTK_RING
+    // get out what is buffered, and print synchronously from now on
+    nk_printk_ring_emergency();
+#endif
+
     va_start(arg, fmt);
     vprintk(fmt, arg);
     va_end(arg);
@@ -0,0 +1,418 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#include <nautilus/nautilus.h>
+#include <nautilus/printk.h>
+#include <nautilus/spinlock.h>
+#include <nautilus/thread.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/timer.h>
+#include <nautilus/vc.h>
+#include <nautilus/shell.h>
+
+/*
+ * printk log rings
+ *
+ * Each CPU appends the records of its printks to its own ring of
+ * fixed size slots, with interrupts off, so no lock is shared
+ * between CPUs.  The only shared write is the global sequence
+ * number that each record gets as it is published, which gives the
+ * order to merge the rings in.  A slot's sequence number is zero
+ * while it is being written, and readers copy a record and then
+ * check that its sequence number did not change underneath them.
+ *
+ * A low priority thread polls the rings and writes the records out
+ * to the consoles, in sequence order.  It does not get woken up by
+ * printk, since printk is called with all sorts of scheduler locks
+ * held.  If a ring wraps before the drain gets to it, the records
+ * it missed are counted as dropped.
+ *
+ * Until the drain thread starts, after a panic, and for nested
+ * printks (e.g., from an NMI), output is synchronous as before.
+ */
+
+#define ERROR(fmt, args...) ERROR_PRINT("printk: " fmt, ##args)
+
+#define RING_SLOTS         NAUT_CONFIG_PRINTK_RING_RECORDS
+#define RING_MASK          (RING_SLOTS - 1)
+#define DRAIN_PERIOD_NS    10000000ULL   // 10 ms
+#define DRAIN_PRIORITY     1000000000ULL // ns quantum, well below default
+
+#if RING_SLOTS & RING_MASK
+#error "NAUT_CONFIG_PRINTK_RING_RECORDS must be a power of two"
+#endif
+
+#define RECORD_NEWLINE 0x1
+
+struct printk_record {
+    volatile uint64_t seq;            // 0 while being written
+    uint64_t          time;           // ns
+    struct nk_virtual_console *vc;    // where it goes, 0 = default
+    uint16_t          len;
+    uint8_t           cpu;
+    uint8_t           flags;
+    char              text[PRINTK_RECORD_TEXT];
+};
+
+struct printk_ring {
+    volatile uint64_t     head;       // records written
+    uint64_t              tail;       // records drained
+    uint64_t              dropped;
+    int                   busy;
+    struct printk_record *records;
+} __attribute__((aligned(64)));
+
+int nk_printk_ring_active = 0;
+
+static struct printk_ring *rings[NAUT_CONFIG_MAX_CPUS];
+static volatile uint64_t   printk_seq = 0;
+static spinlock_t          drain_lock;
+
+
+static void
+ring_append (struct printk_ring *r, const char *s, int len, int newline)
+{
+    struct printk_record *rec = &r->records[r->head & RING_MASK];
+    struct nk_thread *t = get_cur_thread();
+
+    rec->seq = 0;
+    __asm__ __volatile__ ("" : : : "memory");
+
+    rec->time  = nk_sched_get_realtime();
+    rec->vc    = t ? t->vc : 0;
+    rec->len   = len;
+    rec->cpu   = my_cpu_id();
+    rec->flags = newline ? RECORD_NEWLINE : 0;
+    memcpy(rec->text, s, len);
+    rec->text[len] = 0;
+
+    // stores are not reordered with other stores on x86, so
+    // only the compiler needs to be told
+    __asm__ __volatile__ ("" : : : "memory");
+    rec->seq = __sync_add_and_fetch(&printk_seq, 1);
+
+    r->head++;
+}
+
+
+int
+nk_printk_ring_write (const char *s)
+{
+    struct printk_ring *r;
+    const char *nl;
+    uint8_t flags;
+    int len;
+
+    flags = irq_disable_save();
+
+    r = rings[my_cpu_id()];
+
+    if (!r || r->busy) {
+        irq_enable_restore(flags);
+        return -1;
+    }
+
+    r->busy = 1;
+
+    while (*s) {
+        nl = s;
+        while (*nl && *nl != '\n' && nl - s < PRINTK_RECORD_TEXT - 1) {
+            nl++;
+        }
+        len = nl - s;
+        if (*nl == '\n') {
+            ring_append(r, s, len, 1);
+            s = nl + 1;
+        } else {
+            ring_append(r, s, len, 0);
+            s = nl;
+        }
+    }
+
+    r->busy = 0;
+
+    irq_enable_restore(flags);
+
+    return 0;
+}
+
+
+// copy out record i of r, returns 0 if it was complete and not
+// overwritten while we looked
+static int
+ring_read (struct printk_ring *r, uint64_t i, struct printk_record *out)
+{
+    struct printk_record *rec = &r->records[i & RING_MASK];
+    uint64_t seq = rec->seq;
+
+    if (!seq) {
+        return -1;
+    }
+
+    __asm__ __volatile__ ("" : : : "memory");
+    *out = *rec;
+    __asm__ __volatile__ ("lfence" : : : "memory");
+
+    if (rec->seq != seq || r->head - i > RING_SLOTS) {
+        return -1;
+    }
+
+    out->text[PRINTK_RECORD_TEXT - 1] = 0;
+
+    return 0;
+}
+
+
+static void
+emit (struct printk_record *rec)
+{
+    if (rec->vc) {
+        nk_vc_printf_specific(rec->vc, "%s%s", rec->text, (rec->flags & RECORD_NEWLINE) ? "\n" : "");
+    } else {
+        nk_vc_print(rec->text);
+        if (rec->flags & RECORD_NEWLINE) {
+            nk_vc_putchar('\n');
+        }
+    }
+}
+
+
+// write out everything in the rings, oldest first,
+// the caller holds the drain lock
+static void
+drain (void)
+{
+    struct printk_record rec;
+    struct printk_ring *r, *best;
+    uint64_t seq, best_seq;
+    int cpu;
+
+    while (1) {
+        best = 0;
+        best_seq = 0;
+
+        for (cpu = 0; cpu < nk_get_num_cpus(); cpu++) {
+            if (!(r = rings[cpu])) {
+                continue;
+            }
+            if (r->head - r->tail > RING_SLOTS) {
+                r->dropped += r->head - r->tail - RING_SLOTS;
+                r->tail = r->head - RING_SLOTS;
+            }
+            if (r->tail == r->head) {
+                continue;
+            }
+            seq = r->records[r->tail & RING_MASK].seq;
+            if (seq && (!best || seq < best_seq)) {
+                best = r;
+                best_seq = seq;
+            }
+        }
+
+        if (!best) {
+            return;
+        }
+
+        if (!ring_read(best, best->tail, &rec)) {
+            emit(&rec);
+        }
+
+        best->tail++;
+    }
+}
+
+
+static void
+drain_thread (void *in, void **out)
+{
+    struct nk_sched_constraints c = { .type=APERIODIC,
+                                      .interrupt_priority_class=0x0,
+                                      .aperiodic.priority=DRAIN_PRIORITY };
+
+    if (nk_thread_name(get_cur_thread(), "(printk)")) {
+        ERROR("Failed to name drain thread\n");
+    }
+
+    if (nk_sched_thread_change_constraints(&c)) {
+        ERROR("Unable to lower priority of drain thread\n");
+    }
+
+    while (1) {
+        spin_lock(&drain_lock);
+        drain();
+        spin_unlock(&drain_lock);
+        nk_sleep(DRAIN_PERIOD_NS);
+    }
+}
+
+
+void
+nk_printk_ring_emergency (void)
+{
+    nk_printk_ring_active = 0;
+    __sync_synchronize();
+
+    // someone else may be draining, in which case we leave it to them
+    if (!spin_try_lock(&drain_lock)) {
+        drain();
+        spin_unlock(&drain_lock);
+    }
+}
+
+
+// Records keep a pointer to the console they are for.  Drain them
+// while it is still there, and point any that raced in after at the
+// default console instead.  Holding the drain lock keeps the drain
+// thread off the console until we are done.
+void
+nk_printk_ring_release_vc (struct nk_virtual_console *vc)
+{
+    struct printk_ring *r;
+    int cpu, i;
+
+    spin_lock(&drain_lock);
+
+    drain();
+
+    for (cpu = 0; cpu < nk_get_num_cpus(); cpu++) {
+        if (!(r = rings[cpu])) {
+            continue;
+        }
+        for (i = 0; i < RING_SLOTS; i++) {
+            if (r->records[i].vc == vc) {
+                r->records[i].vc = 0;
+            }
+        }
+    }
+
+    spin_unlock(&drain_lock);
+}
+
+
+int
+nk_printk_ring_init (void)
+{
+    int cpu;
+
+    spinlock_init(&drain_lock);
+
+    for (cpu = 0; cpu < nk_get_num_cpus(); cpu++) {
+        struct printk_ring *r = malloc_specific(sizeof(*r), cpu);
+        struct printk_record *recs = malloc_specific(sizeof(*recs) * RING_SLOTS, cpu);
+
+        if (!r || !recs) {
+            ERROR("Cannot allocate ring for cpu %d\n", cpu);
+            return -1;
+        }
+
+        memset(r, 0, sizeof(*r));
+        memset(recs, 0, sizeof(*recs) * RING_SLOTS);
+        r->records = recs;
+        rings[cpu] = r;
+    }
+
+    if (nk_thread_start(drain_thread, 0, 0, 1, 0, 0, CPU_ANY)) {
+        ERROR("Cannot start drain thread\n");
+        return -1;
+    }
+
+    __sync_synchronize();
+    nk_printk_ring_active = 1;
+
+    return 0;
+}
+
+
+static int
+handle_dmesg (char * buf, void * priv)
+{
+    struct printk_record rec;
+    struct printk_ring *r;
+    uint64_t pos[NAUT_CONFIG_MAX_CPUS];
+    uint64_t seq, best_seq;
+    int cpu, best, start_line = 1;
+
+    if (!strcmp(buf, "dmesg stats")) {
+        for (cpu = 0; cpu < nk_get_num_cpus(); cpu++) {
+            if ((r = rings[cpu])) {
+                nk_vc_printf("%3d: %lu records, %lu dropped, %lu pending\n",
+                             cpu, r->head, r->dropped, r->head - r->tail);
+            }
+        }
+        return 0;
+    }
+
+    // the oldest record each ring still has
+    for (cpu = 0; cpu < nk_get_num_cpus(); cpu++) {
+        r = rings[cpu];
+        pos[cpu] = !r ? 0 : r->head > RING_SLOTS ? r->head - RING_SLOTS : 0;
+    }
+
+    while (1) {
+        best = -1;
+        best_seq = 0;
+
+        for (cpu = 0; cpu < nk_get_num_cpus(); cpu++) {
+            if (!(r = rings[cpu])) {
+                continue;
+            }
+            // skip what has been overwritten since we started
+            if (r->head - pos[cpu] > RING_SLOTS) {
+                pos[cpu] = r->head - RING_SLOTS;
+            }
+            if (pos[cpu] == r->head) {
+                continue;
+            }
+            seq = r->records[pos[cpu] & RING_MASK].seq;
+            if (seq && (best < 0 || seq < best_seq)) {
+                best = cpu;
+                best_seq = seq;
+            }
+        }
+
+        if (best < 0) {
+            break;
+        }
+
+        if (!ring_read(rings[best], pos[best], &rec)) {
+            if (start_line) {
+                nk_vc_printf("[%5lu.%06lu] %2u: ", rec.time / 1000000000ULL,
+                             (rec.time % 1000000000ULL) / 1000, rec.cpu);
+            }
+            nk_vc_printf("%s%s", rec.text, (rec.flags & RECORD_NEWLINE) ? "\n" : "");
+            start_line = rec.flags & RECORD_NEWLINE;
+        }
+
+        pos[best]++;
+    }
+
+    if (!start_line) {
+        nk_vc_printf("\n");
+    }
+
+    return 0;
+}
+
+
+static struct shell_cmd_impl dmesg_impl = {
+    .cmd      = "dmesg",
+    .help_str = "dmesg [stats]",
+    .handler  = handle_dmesg,
+};
+nk_register_shell_cmd(dmesg_impl);
@@ -0,0 +1,961 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#include <nautilus/nautilus.h>
+#include <nautilus/thread.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/futex.h>
+#include <nautilus/errno.h>
+#include <nautilus/libccompat.h>
+#include <nautilus/shell.h>
+#include <nautilus/pthread.h>
+
+#define ERROR(fmt, args...) ERROR_PRINT("pthread: " fmt, ##args)
+
+// pthread code expects far more stack than a Nautilus thread's page
+#define PTHREAD_DEFAULT_STACK TSTACK_1MB
+
+// most tries a locker spins for before it parks
+#define MUTEX_SPIN_MAX  1000
+#define RWLOCK_SPINS    100
+#define BARRIER_SPINS   1000
+
+static inline void cpu_relax(void)
+{
+    __asm__ __volatile__ ("pause" : : : "memory");
+}
+
+
+/*
+ * Threads
+ *
+ * A pthread_t is a control block for the thread, which holds its
+ * return value until it is joined.  The Nautilus thread is always
+ * detached, so joining does not depend on who created the thread,
+ * and a joiner sleeps on the block's state word instead.  Threads
+ * not created here get a block on their first pthread_self(),
+ * which is freed when they exit.
+ */
+
+#define PT_JOINABLE 0
+#define PT_DETACHED 1
+#define PT_EXITED   2
+
+struct pthread {
+    void *(*fn)(void *);
+    void             *arg;
+    void             *ret;
+    volatile uint32_t state;
+    int               foreign;
+};
+
+static pthread_once_t self_once = PTHREAD_ONCE_INIT;
+static nk_tls_key_t   self_key;
+
+static void self_free(void *p)
+{
+    // a thread we started is freed by finish(), once it is joined
+    if (((struct pthread *)p)->foreign) {
+        free(p);
+    }
+}
+
+static void self_key_create(void)
+{
+    if (nk_tls_key_create(&self_key, self_free)) {
+        panic("pthread: cannot create thread self key\n");
+    }
+}
+
+static struct pthread *self_get(void)
+{
+    pthread_once(&self_once, self_key_create);
+    return (struct pthread *)nk_tls_get(self_key);
+}
+
+static void finish(struct pthread *p, void *ret)
+{
+    p->ret = ret;
+    if (__sync_bool_compare_and_swap(&p->state, PT_JOINABLE, PT_EXITED)) {
+        nk_futex_wake(&p->state, NK_FUTEX_WAKE_ALL);
+    } else {
+        // detached, nobody will look at it again
+        free(p);
+    }
+}
+
+static void start_thread(void *in, void **out)
+{
+    struct pthread *p = (struct pthread *)in;
+
+    nk_tls_set(self_key, p);
+    pthread_exit(p->fn(p->arg));
+}
+
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                   void *(*start)(void *), void *arg)
+{
+    struct pthread *p;
+    nk_thread_id_t tid;
+    nk_stack_size_t stack = PTHREAD_DEFAULT_STACK;
+    int cpu = -1;
+
+    pthread_once(&self_once, self_key_create);
+
+    p = malloc(sizeof(*p));
+    if (!p) {
+        ERROR("cannot allocate thread\n");
+        return EAGAIN;
+    }
+
+    memset(p, 0, sizeof(*p));
+    p->fn = start;
+    p->arg = arg;
+
+    if (attr) {
+        p->state = attr->a.detached ? PT_DETACHED : PT_JOINABLE;
+        cpu = attr->a.cpu;
+        if (attr->a.stack_size) {
+            stack = attr->a.stack_size;
+        }
+    }
+
+    // the thread may run, and even exit, before we return
+    *thread = (pthread_t)p;
+
+    if (nk_thread_start(start_thread, p, 0, 1, stack, &tid, cpu)) {
+        ERROR("cannot start thread\n");
+        free(p);
+        return EAGAIN;
+    }
+
+    return 0;
+}
+
+void pthread_exit(void *retval)
+{
+    struct pthread *p = self_get();
+
+    if (p && !p->foreign) {
+        // key destructors run before a joiner can see us exit
+        nk_tls_exit();
+        finish(p, retval);
+    }
+
+    nk_thread_exit(retval);
+}
+
+int pthread_join(pthread_t thread, void **retval)
+{
+    struct pthread *p = (struct pthread *)thread;
+    uint32_t s;
+
+    if (p == self_get()) {
+        return EDEADLK;
+    }
+
+    while ((s = p->state) == PT_JOINABLE) {
+        nk_futex_wait(&p->state, PT_JOINABLE, 0);
+    }
+
+    if (s != PT_EXITED) {
+        return EINVAL;
+    }
+
+    if (retval) {
+        *retval = p->ret;
+    }
+
+    free(p);
+
+    return 0;
+}
+
+int pthread_detach(pthread_t thread)
+{
+    struct pthread *p = (struct pthread *)thread;
+
+    if (__sync_bool_compare_and_swap(&p->state, PT_JOINABLE, PT_DETACHED)) {
+        return 0;
+    }
+
+    if (p->state == PT_EXITED) {
+        free(p);
+        return 0;
+    }
+
+    return EINVAL;
+}
+
+pthread_t pthread_self(void)
+{
+    struct pthread *p = self_get();
+
+    if (!p) {
+        p = malloc(sizeof(*p));
+        if (!p) {
+            panic("pthread: cannot allocate thread self\n");
+        }
+        memset(p, 0, sizeof(*p));
+        p->state = PT_DETACHED;
+        p->foreign = 1;
+        nk_tls_set(self_key, p);
+    }
+
+    return (pthread_t)p;
+}
+
+int pthread_equal(pthread_t t1, pthread_t t2)
+{
+    return t1 == t2;
+}
+
+int pthread_yield(void)
+{
+    nk_yield();
+    return 0;
+}
+
+int sched_yield(void)
+{
+    nk_yield();
+    return 0;
+}
+
+
+int pthread_attr_init(pthread_attr_t *attr)
+{
+    memset(attr, 0, sizeof(*attr));
+    attr->a.cpu = -1;
+    return 0;
+}
+
+int pthread_attr_destroy(pthread_attr_t *attr)
+{
+    return 0;
+}
+
+int pthread_attr_setdetachstate(pthread_attr_t *attr, int state)
+{
+    if (state != PTHREAD_CREATE_JOINABLE && state != PTHREAD_CREATE_DETACHED) {
+        return EINVAL;
+    }
+    attr->a.detached = state;
+    return 0;
+}
+
+int pthread_attr_getdetachstate(const pthread_attr_t *attr, int *state)
+{
+    *state = attr->a.detached;
+    return 0;
+}
+
+int pthread_attr_setstacksize(pthread_attr_t *attr, size_t size)
+{
+    attr->a.stack_size = size;
+    return 0;
+}
+
+int pthread_attr_getstacksize(const pthread_attr_t *attr, size_t *size)
+{
+    *size = attr->a.stack_size ? attr->a.stack_size : PTHREAD_DEFAULT_STACK;
+    return 0;
+}
+
+// a set of one CPU binds the thread to it, any wider set leaves it unbound
+int pthread_attr_setaffinity_np(pthread_attr_t *attr, size_t size, const cpu_set_t *set)
+{
+    int i, n = 0, cpu = -1;
+
+    for (i = 0; i < nk_get_num_cpus() && i < 8 * size; i++) {
+        if (CPU_ISSET(i, set)) {
+            cpu = i;
+            n++;
+        }
+    }
+
+    if (!n) {
+        return EINVAL;
+    }
+
+    attr->a.cpu = n == 1 ? cpu : -1;
+
+    return 0;
+}
+
+int pthread_attr_getaffinity_np(const pthread_attr_t *attr, size_t size, cpu_set_t *set)
+{
+    int i;
+
+    memset(set, 0, size);
+    for (i = 0; i < nk_get_num_cpus() && i < 8 * size; i++) {
+        if (attr->a.cpu < 0 || attr->a.cpu == i) {
+            CPU_SET(i, set);
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Mutexes
+ *
+ * The lock word is a futex mutex.  A locker that finds it taken
+ * spins on the word, and parks once it has spun for longer than the
+ * lock is usually held.  As in glibc's adaptive mutexes, that limit
+ * is twice a running average of past spins, so short critical
+ * sections are spun through and long ones are slept through.  The
+ * spin looks only at the lock word: the owner field is not
+ * synchronized with it, and the thread it names may have exited.
+ */
+
+static inline int mutex_checked(pthread_mutex_t *m)
+{
+    return m->m.kind == PTHREAD_MUTEX_RECURSIVE || m->m.kind == PTHREAD_MUTEX_ERRORCHECK;
+}
+
+// 0 if the lock was taken while spinning
+static int mutex_spin(pthread_mutex_t *m)
+{
+    int max = m->m.spins * 2 + 10;
+    int cnt = 0, rc = -1;
+
+    if (max > MUTEX_SPIN_MAX) {
+        max = MUTEX_SPIN_MAX;
+    }
+
+    for (cnt = 0; cnt < max; cnt++) {
+        if (!m->m.lock && !nk_futex_mutex_trylock(&m->m.lock)) {
+            rc = 0;
+            break;
+        }
+        cpu_relax();
+    }
+
+    m->m.spins += (cnt - m->m.spins) / 8;
+
+    return rc;
+}
+
+int pthread_mutexattr_init(pthread_mutexattr_t *attr)
+{
+    attr->__align = PTHREAD_MUTEX_DEFAULT;
+    return 0;
+}
+
+int pthread_mutexattr_destroy(pthread_mutexattr_t *attr)
+{
+    return 0;
+}
+
+int pthread_mutexattr_settype(pthread_mutexattr_t *attr, int kind)
+{
+    if (kind < PTHREAD_MUTEX_NORMAL || kind > PTHREAD_MUTEX_ADAPTIVE_NP) {
+        return EINVAL;
+    }
+    attr->__align = kind;
+    return 0;
+}
+
+int pthread_mutexattr_gettype(const pthread_mutexattr_t *attr, int *kind)
+{
+    *kind = attr->__align;
+    return 0;
+}
+
+int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr)
+{
+    memset(mutex, 0, sizeof(*mutex));
+    mutex->m.kind = attr ? attr->__align : PTHREAD_MUTEX_DEFAULT;
+    return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *mutex)
+{
+    return mutex->m.lock ? EBUSY : 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+    nk_thread_t *me = get_cur_thread();
+
+    if (mutex_checked(mutex) && mutex->m.owner == me) {
+        if (mutex->m.kind == PTHREAD_MUTEX_ERRORCHECK) {
+            return EDEADLK;
+        }
+        mutex->m.count++;
+        return 0;
+    }
+
+    if (nk_futex_mutex_trylock(&mutex->m.lock) && mutex_spin(mutex)) {
+        nk_futex_mutex_lock(&mutex->m.lock);
+    }
+
+    mutex->m.owner = me;
+    mutex->m.count = 1;
+
+    return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex)
+{
+    nk_thread_t *me = get_cur_thread();
+
+    if (mutex->m.kind == PTHREAD_MUTEX_RECURSIVE && mutex->m.owner == me) {
+        mutex->m.count++;
+        return 0;
+    }
+
+    if (nk_futex_mutex_trylock(&mutex->m.lock)) {
+        return EBUSY;
+    }
+
+    mutex->m.owner = me;
+    mutex->m.count = 1;
+
+    return 0;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+    if (mutex_checked(mutex)) {
+        if (mutex->m.owner != get_cur_thread()) {
+            return EPERM;
+        }
+        if (--mutex->m.count) {
+            return 0;
+        }
+    }
+
+    mutex->m.owner = 0;
+    mutex->m.count = 0;
+    nk_futex_mutex_unlock(&mutex->m.lock);
+
+    return 0;
+}
+
+
+/*
+ * Condition variables
+ *
+ * Waiters sleep on a sequence number that each signal bumps, so a
+ * signal sent after a waiter let go of the mutex, but before it
+ * went to sleep, is not lost: the futex wait sees the changed
+ * number and returns at once.
+ */
+
+int pthread_condattr_init(pthread_condattr_t *attr)
+{
+    attr->__align = 0;
+    return 0;
+}
+
+int pthread_condattr_destroy(pthread_condattr_t *attr)
+{
+    return 0;
+}
+
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr)
+{
+    memset(cond, 0, sizeof(*cond));
+    return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t *cond)
+{
+    return cond->c.waiters ? EBUSY : 0;
+}
+
+static int cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, uint64_t timeout_ns)
+{
+    uint32_t seq, count;
+    int rc;
+
+    if (mutex_checked(mutex) && mutex->m.owner != get_cur_thread()) {
+        return EPERM;
+    }
+
+    seq = cond->c.seq;
+    __sync_fetch_and_add(&cond->c.waiters, 1);
+
+    // let go of a recursive mutex entirely, and take it back as deep
+    count = mutex->m.count;
+    mutex->m.count = 1;
+    pthread_mutex_unlock(mutex);
+
+    rc = nk_futex_wait(&cond->c.seq, seq, timeout_ns);
+
+    __sync_fetch_and_sub(&cond->c.waiters, 1);
+
+    pthread_mutex_lock(mutex);
+    mutex->m.count = count;
+
+    return rc == NK_FUTEX_TIMEDOUT ? ETIMEDOUT : 0;
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+    return cond_wait(cond, mutex, 0);
+}
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                           const struct timespec *abstime)
+{
+    struct timespec now;
+    sint64_t ns;
+
+    if (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000) {
+        return EINVAL;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (abstime->tv_sec - now.tv_sec) * 1000000000LL + (abstime->tv_nsec - now.tv_nsec);
+    if (ns <= 0) {
+        return ETIMEDOUT;
+    }
+
+    return cond_wait(cond, mutex, ns);
+}
+
+static int cond_wake(pthread_cond_t *cond, int n)
+{
+    if (cond->c.waiters) {
+        __sync_fetch_and_add(&cond->c.seq, 1);
+        nk_futex_wake(&cond->c.seq, n);
+    }
+    return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t *cond)
+{
+    return cond_wake(cond, 1);
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond)
+{
+    return cond_wake(cond, NK_FUTEX_WAKE_ALL);
+}
+
+
+/*
+ * Reader/writer locks
+ *
+ * The state word is the number of readers, or RWLOCK_WRITER.  As
+ * glibc's default, readers are preferred: a reader gets in whenever
+ * there is no writer.  Lockers spin briefly, then sleep on the
+ * state word, and whoever brings it to zero wakes them all.
+ */
+
+#define RWLOCK_WRITER 0xffffffff
+
+int pthread_rwlock_init(pthread_rwlock_t *rwlock, const pthread_rwlockattr_t *attr)
+{
+    memset(rwlock, 0, sizeof(*rwlock));
+    return 0;
+}
+
+int pthread_rwlock_destroy(pthread_rwlock_t *rwlock)
+{
+    return rwlock->rw.state ? EBUSY : 0;
+}
+
+static void rwlock_park(pthread_rwlock_t *rwlock, uint32_t s, int *spins)
+{
+    if ((*spins)++ < RWLOCK_SPINS) {
+        cpu_relax();
+        return;
+    }
+    __sync_fetch_and_add(&rwlock->rw.waiters, 1);
+    nk_futex_wait(&rwlock->rw.state, s, 0);
+    __sync_fetch_and_sub(&rwlock->rw.waiters, 1);
+}
+
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock)
+{
+    uint32_t s;
+
+    while ((s = rwlock->rw.state) < RWLOCK_WRITER - 1) {
+        if (__sync_bool_compare_and_swap(&rwlock->rw.state, s, s + 1)) {
+            return 0;
+        }
+    }
+
+    return s == RWLOCK_WRITER ? EBUSY : EAGAIN;
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock)
+{
+    int spins = 0;
+    int rc;
+
+    while ((rc = pthread_rwlock_tryrdlock(rwlock)) == EBUSY) {
+        rwlock_park(rwlock, RWLOCK_WRITER, &spins);
+    }
+
+    return rc;
+}
+
+int pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock)
+{
+    return __sync_bool_compare_and_swap(&rwlock->rw.state, 0, RWLOCK_WRITER) ? 0 : EBUSY;
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock)
+{
+    int spins = 0;
+    uint32_t s;
+
+    while ((s = __sync_val_compare_and_swap(&rwlock->rw.state, 0, RWLOCK_WRITER))) {
+        rwlock_park(rwlock, s, &spins);
+    }
+
+    return 0;
+}
+
+int pthread_rwlock_unlock(pthread_rwlock_t *rwlock)
+{
+    uint32_t s;
+
+    if (rwlock->rw.state == RWLOCK_WRITER) {
+        s = 0;
+        __sync_lock_release(&rwlock->rw.state);
+        __sync_synchronize();
+    } else {
+        s = __sync_sub_and_fetch(&rwlock->rw.state, 1);
+    }
+
+    if (!s && rwlock->rw.waiters) {
+        nk_futex_wake(&rwlock->rw.state, NK_FUTEX_WAKE_ALL);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Barriers
+ *
+ * The last thread to arrive starts the next round and bumps the
+ * sequence number, which the others spin on briefly and then sleep
+ * on.
+ */
+
+int pthread_barrier_init(pthread_barrier_t *barrier, const pthread_barrierattr_t *attr,
+                         unsigned count)
+{
+    if (!count) {
+        return EINVAL;
+    }
+    memset(barrier, 0, sizeof(*barrier));
+    barrier->b.count = count;
+    barrier->b.left = count;
+    return 0;
+}
+
+int pthread_barrier_destroy(pthread_barrier_t *barrier)
+{
+    return barrier->b.left != barrier->b.count ? EBUSY : 0;
+}
+
+int pthread_barrier_wait(pthread_barrier_t *barrier)
+{
+    uint32_t seq;
+    int spins;
+
+    nk_futex_mutex_lock(&barrier->b.lock);
+    seq = barrier->b.seq;
+    if (!--barrier->b.left) {
+        barrier->b.left = barrier->b.count;
+        __sync_fetch_and_add(&barrier->b.seq, 1);
+        nk_futex_mutex_unlock(&barrier->b.lock);
+        nk_futex_wake(&barrier->b.seq, NK_FUTEX_WAKE_ALL);
+        return PTHREAD_BARRIER_SERIAL_THREAD;
+    }
+    nk_futex_mutex_unlock(&barrier->b.lock);
+
+    for (spins = 0; barrier->b.seq == seq && spins < BARRIER_SPINS; spins++) {
+        cpu_relax();
+    }
+    while (barrier->b.seq == seq) {
+        nk_futex_wait(&barrier->b.seq, seq, 0);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Once: 0 = not run, 1 = running, 2 = done
+ */
+
+int pthread_once(pthread_once_t *once, void (*init)(void))
+{
+    volatile uint32_t *o = (volatile uint32_t *)once;
+
+    if (*o == 2) {
+        __sync_synchronize();
+        return 0;
+    }
+
+    if (__sync_bool_compare_and_swap(o, 0, 1)) {
+        init();
+        __sync_synchronize();
+        *o = 2;
+        nk_futex_wake(o, NK_FUTEX_WAKE_ALL);
+        return 0;
+    }
+
+    while (*o != 2) {
+        nk_futex_wait(o, 1, 0);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Thread specific data is Nautilus TLS, whose destructors run when
+ * the thread exits
+ */
+
+int pthread_key_create(pthread_key_t *key, void (*destructor)(void *))
+{
+    return -nk_tls_key_create(key, destructor);
+}
+
+int pthread_key_delete(pthread_key_t key)
+{
+    return -nk_tls_key_delete(key);
+}
+
+void *pthread_getspecific(pthread_key_t key)
+{
+    return nk_tls_get(key);
+}
+
+int pthread_setspecific(pthread_key_t key, const void *val)
+{
+    return -nk_tls_set(key, val);
+}
+
+
+/*
+ * pthreadtest: threads contend for mutexes, hand items through a
+ * condition variable, share a rwlock, and meet at a barrier, and
+ * each check turns into an error count.
+ */
+
+#define TEST_THREADS 8
+#define TEST_ITERS   1000
+#define TEST_ITEMS   1000
+
+static pthread_mutex_t   test_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t   test_rmutex;
+static pthread_cond_t    test_cond = PTHREAD_COND_INITIALIZER;
+static pthread_rwlock_t  test_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_barrier_t test_barrier;
+static pthread_once_t    test_once;
+static pthread_key_t     test_key;
+
+static volatile uint64_t test_count;
+static volatile uint64_t test_inside;
+static volatile uint64_t test_writers;
+static volatile uint64_t test_errors;
+static volatile uint64_t test_onces;
+static volatile uint64_t test_dtors;
+static volatile int      test_items;
+static volatile uint64_t test_rounds[TEST_THREADS];
+
+#define CHECK(c) do { if (!(c)) { __sync_fetch_and_add(&test_errors, 1); } } while (0)
+
+static void test_once_fn(void)
+{
+    __sync_fetch_and_add(&test_onces, 1);
+}
+
+static void test_dtor(void *p)
+{
+    __sync_fetch_and_add(&test_dtors, 1);
+}
+
+static void *test_thread(void *in)
+{
+    long me = (long)in;
+    int i, j;
+
+    pthread_once(&test_once, test_once_fn);
+    CHECK(!pthread_setspecific(test_key, (void *)(me + 1)));
+
+    for (i = 0; i < TEST_ITERS; i++) {
+        CHECK(!pthread_mutex_lock(&test_mutex));
+        CHECK(!__sync_fetch_and_add(&test_inside, 1));
+        test_count++;
+        if (!(i % 16)) {
+            nk_yield();
+        }
+        __sync_fetch_and_sub(&test_inside, 1);
+        CHECK(!pthread_mutex_unlock(&test_mutex));
+
+        CHECK(!pthread_mutex_lock(&test_rmutex));
+        CHECK(!pthread_mutex_lock(&test_rmutex));
+        CHECK(!pthread_mutex_unlock(&test_rmutex));
+        CHECK(!pthread_mutex_unlock(&test_rmutex));
+
+        if (i % 8) {
+            CHECK(!pthread_rwlock_rdlock(&test_rwlock));
+            CHECK(!test_writers);
+            CHECK(!pthread_rwlock_unlock(&test_rwlock));
+        } else {
+            CHECK(!pthread_rwlock_wrlock(&test_rwlock));
+            CHECK(!__sync_fetch_and_add(&test_writers, 1));
+            __sync_fetch_and_sub(&test_writers, 1);
+            CHECK(!pthread_rwlock_unlock(&test_rwlock));
+        }
+    }
+
+    // everyone finishes each round before anyone starts the next
+    for (i = 0; i < 10; i++) {
+        test_rounds[me] = i;
+        pthread_barrier_wait(&test_barrier);
+        for (j = 0; j < TEST_THREADS; j++) {
+            CHECK(test_rounds[j] == i);
+        }
+        pthread_barrier_wait(&test_barrier);
+    }
+
+    CHECK(pthread_getspecific(test_key) == (void *)(me + 1));
+
+    return in;
+}
+
+static void *test_consumer(void *in)
+{
+    int got = 0;
+
+    pthread_mutex_lock(&test_mutex);
+    while (got < TEST_ITEMS) {
+        while (!test_items) {
+            pthread_cond_wait(&test_cond, &test_mutex);
+        }
+        got += test_items;
+        test_items = 0;
+        pthread_cond_signal(&test_cond);
+    }
+    pthread_mutex_unlock(&test_mutex);
+
+    return 0;
+}
+
+static int handle_pthreadtest(char *buf, void *priv)
+{
+    pthread_t tids[TEST_THREADS], consumer;
+    pthread_mutexattr_t mattr;
+    struct timespec ts;
+    void *ret;
+    uint64_t start, end;
+    int i, rc;
+
+    test_count = 0;
+    test_inside = 0;
+    test_writers = 0;
+    test_errors = 0;
+    test_onces = 0;
+    test_dtors = 0;
+    test_once = PTHREAD_ONCE_INIT;
+
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_settype(&mattr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&test_rmutex, &mattr);
+    pthread_barrier_init(&test_barrier, 0, TEST_THREADS);
+    if (pthread_key_create(&test_key, test_dtor)) {
+        nk_vc_printf("pthreadtest: cannot create key\n");
+        return 0;
+    }
+
+    start = nk_sched_get_realtime();
+    for (i = 0; i < TEST_THREADS; i++) {
+        if (pthread_create(&tids[i], 0, test_thread, (void *)(long)i)) {
+            nk_vc_printf("pthreadtest: failed to start thread %d\n", i);
+            tids[i] = 0;
+            test_errors++;
+        }
+    }
+    for (i = 0; i < TEST_THREADS; i++) {
+        if (tids[i]) {
+            CHECK(!pthread_join(tids[i], &ret));
+            CHECK(ret == (void *)(long)i);
+        }
+    }
+    end = nk_sched_get_realtime();
+
+    nk_vc_printf("pthreadtest: mutex count %lu (expected %lu), %lu once calls, %lu destructors in %lu us\n",
+                 test_count, (uint64_t)TEST_THREADS * TEST_ITERS, test_onces, test_dtors,
+                 (end - start) / 1000);
+    CHECK(test_count == (uint64_t)TEST_THREADS * TEST_ITERS);
+    CHECK(test_onces == 1);
+    CHECK(test_dtors == TEST_THREADS);
+
+    // producer/consumer
+    test_items = 0;
+    if (pthread_create(&consumer, 0, test_consumer, 0)) {
+        test_errors++;
+    } else {
+        for (i = 0; i < TEST_ITEMS; i++) {
+            pthread_mutex_lock(&test_mutex);
+            while (test_items) {
+                pthread_cond_wait(&test_cond, &test_mutex);
+            }
+            test_items = 1;
+            pthread_cond_signal(&test_cond);
+            pthread_mutex_unlock(&test_mutex);
+        }
+        CHECK(!pthread_join(consumer, 0));
+    }
+
+    // a timed wait nobody signals
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_nsec += 10000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&test_mutex);
+    rc = pthread_cond_timedwait(&test_cond, &test_mutex, &ts);
+    CHECK(test_mutex.m.owner == get_cur_thread());
+    pthread_mutex_unlock(&test_mutex);
+    CHECK(rc == ETIMEDOUT);
+
+    CHECK(pthread_join(pthread_self(), 0) == EDEADLK);
+
+    pthread_key_delete(test_key);
+    pthread_barrier_destroy(&test_barrier);
+    pthread_mutex_destroy(&test_rmutex);
+
+    nk_vc_printf("pthreadtest: %lu errors\n", test_errors);
+
+    return 0;
+}
+
+static struct shell_cmd_impl pthreadtest_impl = {
+    .cmd      = "pthreadtest",
+    .help_str = "pthreadtest",
+    .handler  = handle_pthreadtest,
+};
+nk_register_shell_cmd(pthreadtest_impl);
@@ -62,6 +62,16 @@
 #include <nautilus/backtrace.h>
 #include <nautilus/shell.h>
 #include <nautilus/topo.h>
+#include <nautilus/trace.h>
+#if NAUT_CONFIG_APERIODIC_FAIR
+#include <nautilus/rbtree.h>
+#endif
+#ifdef NAUT_CONFIG_PMC_VIRT
+#include <nautilus/pmc.h>
+#endif
+#ifdef NAUT_CONFIG_IDLE_GOVERNOR
+#include <nautilus/idle.h>
+#endif
 #include <dev/apic.h>
 #include <dev/gpio.h>
 
@@ -194,6 +204,11 @@ static volatile uint64_t     stopping;
 static nk_counting_barrier_t stop_barrier;
 // flags storage for the the core initiating the world stop
 static volatile uint8_t      stop_flags;
+// work handed to the stopped cores, see nk_sched_stop_world_run()
+static void                (*volatile stop_func)(void *, int);
+static void * volatile       stop_arg;
+static volatile uint64_t     stop_gen;
+static volatile uint64_t     stop_done;
 
 
 static struct nk_sched_global_state global_sched_state;
@@ -246,7 +261,7 @@ typedef struct rt_queue {
 
 static int        rt_queue_enqueue(rt_queue *queue, rt_thread *thread);
 static rt_thread* rt_queue_dequeue(rt_queue *queue);
-static rt_thread* rt_queue_peek(rt_queue *queue, uint64_t pos);
+static void       rt_queue_map(rt_queue *queue, int (*func)(rt_thread *t, void *priv), void *priv);
 static rt_thread* rt_queue_remove(rt_queue *queue, rt_thread *thread);
 static int        rt_queue_empty(rt_queue *queue);
 static void       rt_queue_dump(rt_queue *queue, char *pre);
@@ -267,11 +282,66 @@ typedef struct rt_priority_queue {
 
 static int        rt_priority_queue_enqueue(rt_priority_queue *queue, rt_thread *thread);
 static rt_thread* rt_priority_queue_dequeue(rt_priority_queue *queue);
-static rt_thread* rt_priority_queue_peek(rt_priority_queue *queue, uint64_t pos);
+static void       rt_priority_queue_map(rt_priority_queue *queue, int (*func)(rt_thread *t, void *priv), void *priv);
 static rt_thread* rt_priority_queue_remove(rt_priority_queue *queue, rt_thread *thread);
 static int        rt_priority_queue_empty(rt_priority_queue *queue);
 static void       rt_priority_queue_dump(rt_priority_queue *queue, char *pre);
 
+#if NAUT_CONFIG_APERIODIC_MULTILEVEL
+//
+// Multi-level queue for aperiodic threads
+//
+// One FIFO per power of two of the priority, and a bitmap of the
+// non-empty levels, so enqueue, dequeue, and removal are O(1)
+// regardless of the number of threads.  The idle thread lives
+// alone in the last level.
+//
+#define RT_LEVELS     64
+#define RT_IDLE_LEVEL (RT_LEVELS-1)
+
+typedef struct rt_level_queue {
+    queue_type       type;
+    uint64_t         size;
+    uint64_t         bitmap;             // bit i set => levels[i] is non-empty
+    struct list_head levels[RT_LEVELS];
+} rt_level_queue;
+
+static void       rt_level_queue_init(rt_level_queue *queue);
+static int        rt_level_queue_enqueue(rt_level_queue *queue, rt_thread *thread);
+static rt_thread* rt_level_queue_dequeue(rt_level_queue *queue);
+static rt_thread* rt_level_queue_remove(rt_level_queue *queue, rt_thread *thread);
+static void       rt_level_queue_map(rt_level_queue *queue, int (*func)(rt_thread *t, void *priv), void *priv);
+static int        rt_level_queue_empty(rt_level_queue *queue);
+static void       rt_level_queue_dump(rt_level_queue *queue, char *pre);
+#endif
+
+#if NAUT_CONFIG_APERIODIC_FAIR
+//
+// Weighted fair queue for aperiodic threads
+//
+// Threads are kept in a red-black tree ordered by virtual runtime,
+// which advances in proportion to the thread's priority (a larger
+// number is a lower priority, as elsewhere).  The leftmost thread
+// is cached, so dequeue is O(1) plus the rebalance.  The idle thread
+// is kept off the tree and is chosen only if the tree is empty.
+//
+typedef struct rt_fair_queue {
+    queue_type      type;
+    uint64_t        size;                // includes the idle thread
+    uint64_t        min_vruntime;        // monotonic floor of the tree
+    struct rb_root  root;
+    struct rb_node *leftmost;
+    rt_thread      *idle;
+} rt_fair_queue;
+
+static int        rt_fair_queue_enqueue(rt_fair_queue *queue, rt_thread *thread, uint64_t credit);
+static rt_thread* rt_fair_queue_dequeue(rt_fair_queue *queue);
+static rt_thread* rt_fair_queue_remove(rt_fair_queue *queue, rt_thread *thread);
+static void       rt_fair_queue_map(rt_fair_queue *queue, int (*func)(rt_thread *t, void *priv), void *priv);
+static int        rt_fair_queue_empty(rt_fair_queue *queue);
+static void       rt_fair_queue_dump(rt_fair_queue *queue, char *pre);
+#endif
+
 //
 // Per-CPU scheduler state - hangs off off global cpu struct
 //
@@ -296,6 +366,18 @@ typedef struct nk_sched_task_state {
     struct list_head   unsized_queue;    // tasks with unknown sizes;
 } task_info;
 
+#if NAUT_CONFIG_LOAD_BALANCE
+// Balancing domains, nearest first
+#define LB_CORE    0   // hardware threads of the same physical core
+#define LB_SOCKET  1   // other cores of the same socket
+#define LB_NUMA    2   // other sockets in the same NUMA domain
+#define LB_REMOTE  3   // other NUMA domains, by SLIT distance
+#define LB_LEVELS  4
+#if NAUT_CONFIG_LOAD_BALANCE_PUSH
+static void lb_push(struct nk_thread *thread, int cpu);
+#endif
+#endif
+
 typedef struct nk_sched_percpu_state {
     spinlock_t             lock;
     struct nk_sched_config cfg; 
@@ -312,6 +394,12 @@ typedef struct nk_sched_percpu_state {
 #if NAUT_CONFIG_APERIODIC_DYNAMIC_LIFETIME || NAUT_CONFIG_APERIODIC_DYNAMIC_QUANTUM
     rt_priority_queue aperiodic;   // Aperiodic threads that are runnable
 #endif
+#if NAUT_CONFIG_APERIODIC_MULTILEVEL
+    rt_level_queue    aperiodic;   // Aperiodic threads that are runnable
+#endif
+#if NAUT_CONFIG_APERIODIC_FAIR
+    rt_fair_queue     aperiodic;   // Aperiodic threads that are runnable
+#endif
 
     task_info tasks;       // tasks known to this local scheduler
     
@@ -323,6 +411,25 @@ typedef struct nk_sched_percpu_state {
 
     uint64_t reinject_count;  // how many timer/kick interrupts I've had to reinject
 
+#if NAUT_CONFIG_LOAD_BALANCE
+    int          *lb_order;              // other CPUs, nearest first
+    int           lb_end[LB_LEVELS];     // end of each level within lb_order
+    volatile int  lb_pull_from;          // CPU a waker asked us to pull from, or -1
+    uint64_t      lb_runs;               // balancing passes
+    uint64_t      lb_pulled[LB_LEVELS];  // threads pulled, by level
+    uint64_t      lb_pushed;             // threads pulled at a waker's request
+    uint64_t      lb_failed;             // moves that lost a race
+#endif
+
+#if NAUT_CONFIG_WAKEUP_BATCHING
+    rt_thread * volatile wake_list;      // woken by other CPUs, not yet queued
+    volatile int  kick_pending;          // a kick is outstanding for this batch
+    uint64_t      wake_batches;          // nonempty drains of wake_list
+    uint64_t      wake_remote;           // threads received through wake_list
+    uint64_t      kicks_sent;            // kick IPIs sent to us
+    uint64_t      kicks_avoided;         // kicks folded into an outstanding one
+#endif
+
 #if INSTRUMENT
     uint64_t resched_fast_num;
     uint64_t resched_fast_sum;
@@ -410,13 +517,46 @@ typedef struct nk_sched_percpu_state {
 #else
 #define DUMP_APERIODIC(s,p) 
 #endif
-#define PEEK_APERIODIC(s,k) rt_queue_peek(&(s)->aperiodic,k)
+#define MAP_APERIODIC(s,f,p) rt_queue_map(&(s)->aperiodic,f,p)
+#define SIZE_APERIODIC(s) ((s)->aperiodic.size)
+#elif NAUT_CONFIG_APERIODIC_MULTILEVEL
+#define GET_NEXT_APERIODIC(s) rt_level_queue_dequeue(&(s)->aperiodic)
+#define PUT_APERIODIC(s,t) rt_level_queue_enqueue(&(s)->aperiodic,t)
+#define REMOVE_APERIODIC(s,t) rt_level_queue_remove(&(s)->aperiodic,t)
+#define MAP_APERIODIC(s,f,p) rt_level_queue_map(&(s)->aperiodic,f,p)
 #define SIZE_APERIODIC(s) ((s)->aperiodic.size)
+#define HAVE_APERIODIC(s) (!rt_level_queue_empty(&(s)->aperiodic))
+#ifdef NAUT_CONFIG_DEBUG_SCHED
+#if DUMP_SCHED_STATE
+#define DUMP_APERIODIC(s,p) rt_level_queue_dump(&(s)->aperiodic,p)
+#else
+#define DUMP_APERIODIC(s,p) 
+#endif
+#else
+#define DUMP_APERIODIC(s,p) 
+#endif
+#elif NAUT_CONFIG_APERIODIC_FAIR
+// a thread that has been asleep gets at most a quantum of credit
+#define GET_NEXT_APERIODIC(s) rt_fair_queue_dequeue(&(s)->aperiodic)
+#define PUT_APERIODIC(s,t) rt_fair_queue_enqueue(&(s)->aperiodic,t,(s)->cfg.aperiodic_quantum)
+#define REMOVE_APERIODIC(s,t) rt_fair_queue_remove(&(s)->aperiodic,t)
+#define MAP_APERIODIC(s,f,p) rt_fair_queue_map(&(s)->aperiodic,f,p)
+#define SIZE_APERIODIC(s) ((s)->aperiodic.size)
+#define HAVE_APERIODIC(s) (!rt_fair_queue_empty(&(s)->aperiodic))
+#ifdef NAUT_CONFIG_DEBUG_SCHED
+#if DUMP_SCHED_STATE
+#define DUMP_APERIODIC(s,p) rt_fair_queue_dump(&(s)->aperiodic,p)
+#else
+#define DUMP_APERIODIC(s,p) 
+#endif
+#else
+#define DUMP_APERIODIC(s,p) 
+#endif
 #else
 #define GET_NEXT_APERIODIC(s) rt_priority_queue_dequeue(&(s)->aperiodic)
 #define PUT_APERIODIC(s,t) rt_priority_queue_enqueue(&(s)->aperiodic,t)
 #define REMOVE_APERIODIC(s,t) rt_priority_queue_remove(&(s)->aperiodic,t)
-#define PEEK_APERIODIC(s,k) rt_priority_queue_peek(&(s)->aperiodic,k)
+#define MAP_APERIODIC(s,f,p) rt_priority_queue_map(&(s)->aperiodic,f,p)
 #define SIZE_APERIODIC(s) ((s)->aperiodic.size)
 #define HAVE_APERIODIC(s) (!rt_priority_queue_empty(&(s)->aperiodic))
 #ifdef NAUT_CONFIG_DEBUG_SCHED
@@ -510,6 +650,10 @@ typedef struct nk_sched_thread_state {
     uint64_t miss_count;      // number of deadline misses
     uint64_t miss_time_sum;   // sum of missed time
     uint64_t miss_time_sum2;  // sum of squares of missed time
+    uint64_t late_count;      // periodic arrivals taken from the pending queue
+    uint64_t late_sum;        // sum of how late those arrivals were handled
+    uint64_t late_sum2;       // sum of squares of the same
+    uint64_t late_max;        // worst of the same
 
     // the thread context itself
     struct nk_thread *thread;
@@ -517,6 +661,24 @@ typedef struct nk_sched_thread_state {
     // the thread node in a thread list (the global thread list)
     struct rt_node   *list; 
 
+#if NAUT_CONFIG_APERIODIC_MULTILEVEL || NAUT_CONFIG_APERIODIC_FAIR
+    int               queued;      // on its CPU's aperiodic queue
+#endif
+#if NAUT_CONFIG_WAKEUP_BATCHING
+    rt_thread        *wake_next;   // link in its CPU's wake_list
+#endif
+#if NAUT_CONFIG_APERIODIC_MULTILEVEL
+    struct list_head  queue_node;  // link in its level
+    int               level;       // level it was enqueued at
+    int               demoted;     // used up its last quantum
+#endif
+#if NAUT_CONFIG_APERIODIC_FAIR
+    struct rb_node    fair_node;
+    uint64_t          vruntime;    // priority-weighted run time
+    uint64_t          vruntime_base; // run_time as of the last update
+    struct rt_fair_queue *fair_queue; // queue vruntime is relative to
+#endif
+
 } rt_thread ;
 
 static void       rt_thread_dump(rt_thread *thread, char *prefix);
@@ -547,6 +709,25 @@ static inline uint64_t get_random();
 
 
 
+static uint64_t isqrt(uint64_t x)
+{
+    uint64_t r = 0, b = 1ULL << 62;
+
+    while (b > x) {
+	b >>= 2;
+    }
+    while (b) {
+	if (x >= r + b) {
+	    x -= r + b;
+	    r = (r >> 1) + b;
+	} else {
+	    r >>= 1;
+	}
+	b >>= 2;
+    }
+    return r;
+}
+
 static void print_thread(rt_thread *r, void *priv)
 {
     ASSERT(r);
@@ -607,6 +788,15 @@ static void print_thread(rt_thread *r, void *priv)
 		     r->switch_in_count,
 		     r->miss_count);
 
+	if (r->constraints.type==PERIODIC && r->late_count) {
+	    uint64_t avg = r->late_sum/r->late_count;
+	    // mean and standard deviation of arrival slack (jitter)
+	    nk_vc_printf(" late: %lluus avg %lluus sd %lluus max",
+			 US(avg),
+			 US(isqrt(r->late_sum2/r->late_count - avg*avg)),
+			 US(r->late_max));
+	}
+
 	nk_vc_printf(" [%s]", r->thread->aspace ? r->thread->aspace->name : "default");
 	
 	nk_vc_printf("\n");
@@ -690,6 +880,14 @@ void nk_sched_dump_cores(int cpu_arg)
 #if NAUT_CONFIG_APERIODIC_LOTTERY
 		     "LO",
 #endif
+
+#if NAUT_CONFIG_APERIODIC_MULTILEVEL
+		     "ML",
+#endif
+
+#if NAUT_CONFIG_APERIODIC_FAIR
+		     "WF",
+#endif
 		     s->cfg.util_limit,
 		     s->cfg.sporadic_reservation, s->cfg.aperiodic_reservation, 
 		     s->cfg.aperiodic_quantum, s->cfg.aperiodic_default_priority,
@@ -706,6 +904,18 @@ void nk_sched_dump_cores(int cpu_arg)
 	    nk_vc_printf(buf);
 #if INSTRUMENT
 	    nk_vc_printf(buf2);
+#endif
+#if NAUT_CONFIG_LOAD_BALANCE
+	    nk_vc_printf("+ lb: %luruns pulled=(%luc %lus %lun %lur) %lupush %lufail\n",
+			 s->lb_runs,
+			 s->lb_pulled[LB_CORE], s->lb_pulled[LB_SOCKET],
+			 s->lb_pulled[LB_NUMA], s->lb_pulled[LB_REMOTE],
+			 s->lb_pushed, s->lb_failed);
+#endif
+#if NAUT_CONFIG_WAKEUP_BATCHING
+	    nk_vc_printf("+ wb: %luwoken in %lubatches, kicks %lusent %luavoided\n",
+			 s->wake_remote, s->wake_batches,
+			 s->kicks_sent, s->kicks_avoided);
 #endif
 	}
     }
@@ -960,6 +1170,27 @@ void nk_sched_start_world()
     
 }
 
+void nk_sched_stop_world_run(void (*func)(void *, int), void *arg)
+{
+    uint64_t num_cpus = nk_get_num_cpus();
+
+    if (!scheduler_ready || stopping!=(my_cpu_id()+1) || num_cpus==1) {
+	func(arg,1);
+	return;
+    }
+
+    stop_done = 0;
+    stop_func = func;
+    stop_arg = arg;
+
+    // the stopped cores notice the new generation and run it
+    __sync_fetch_and_add(&stop_gen,1);
+
+    func(arg,num_cpus);
+
+    PAUSE_WHILE(stop_done != num_cpus-1);
+}
+
 
 struct thread_query {
     uint64_t     tid;
@@ -1497,12 +1728,115 @@ static int    _sched_make_runnable(struct nk_thread *thread, int cpu, int admit,
     if (!have_lock) { 
 	LOCAL_UNLOCK(s);
     }
+#ifdef NAUT_CONFIG_IDLE_GOVERNOR
+    // wake the target if it is sitting in mwait
+    if (s != per_cpu_get(sched_state)) {
+	nk_idle_nudge(cpu);
+    }
+#endif
     return 0;
 }
 
+#ifdef NAUT_CONFIG_IDLE_GOVERNOR
+// whether anything besides the idle thread could run here
+int nk_sched_have_runnable(void)
+{
+    rt_scheduler *s = per_cpu_get(sched_state);
+
+    return SIZE_APERIODIC(s)>0 || s->runnable.size>0
+#if NAUT_CONFIG_WAKEUP_BATCHING
+	|| s->wake_list
+#endif
+	;
+}
+#endif
+
+#if NAUT_CONFIG_WAKEUP_BATCHING
+//
+// Wakeups of a thread on another CPU do not take that CPU's
+// scheduler lock.  The thread is pushed onto a lock-free list that
+// the CPU drains at the start of its next scheduling pass, under
+// its own lock.  Waking many threads on one CPU is then a series of
+// CASes, and nk_sched_kick_cpu() sends at most one kick for them.
+//
+// Only threads returning to the CPU they last ran on are batched,
+// and the drain comes strictly after that CPU has switched the
+// thread out, as it would if the waker had waited for the lock.
+//
+static void wake_list_push(rt_scheduler *s, rt_thread *t)
+{
+    rt_thread *head;
+
+    t->thread->status = NK_THR_SUSPENDED;
+
+    do {
+	head = s->wake_list;
+	t->wake_next = head;
+    } while (!__sync_bool_compare_and_swap(&s->wake_list,head,t));
+}
+
+// called with the local lock held
+static void wake_list_drain(rt_scheduler *s)
+{
+    rt_thread *t, *next, *rev = 0;
+
+    if (!s->wake_list) {
+	return;
+    }
+
+    t = __sync_lock_test_and_set(&s->wake_list,0);
+
+    // the list is newest first; restore wakeup order
+    while (t) {
+	next = t->wake_next;
+	t->wake_next = rev;
+	rev = t;
+	t = next;
+    }
+
+    if (rev) {
+	s->wake_batches++;
+    }
+
+    for (t=rev; t; t=next) {
+	next = t->wake_next;
+	t->wake_next = 0;
+	s->wake_remote++;
+	if (_sched_make_runnable(t->thread,my_cpu_id(),0,1)) {
+	    ERROR("Failed to enqueue remotely woken thread %lu\n",t->thread->tid);
+	}
+    }
+}
+#endif
+
 int nk_sched_make_runnable(struct nk_thread *thread, int cpu, int admit)
 {
+#if NAUT_CONFIG_WAKEUP_BATCHING
+    struct sys_info *sys = per_cpu_get(system);
+
+    if (!admit && cpu>=0 && cpu<sys->num_cpus &&
+	cpu==thread->current_cpu && cpu!=my_cpu_id()) {
+	wake_list_push(sys->cpus[cpu]->sched_state,thread->sched_state);
+#ifdef NAUT_CONFIG_IDLE_GOVERNOR
+	nk_idle_nudge(cpu);
+#endif
+#if NAUT_CONFIG_LOAD_BALANCE_PUSH
+	lb_push(thread,cpu);
+#endif
+	return 0;
+    }
+#endif
+#if NAUT_CONFIG_LOAD_BALANCE_PUSH
+    if (_sched_make_runnable(thread,cpu,admit,0)) {
+	return -1;
+    }
+    if (!admit) {
+	lb_push(thread,cpu);
+    }
+    return 0;
+#else
     return _sched_make_runnable(thread,cpu,admit,0);
+#endif
 }
 
 
@@ -1745,12 +2079,15 @@ static rt_thread* rt_queue_remove(rt_queue *queue, rt_thread *thread)
     }
 }
 
-static rt_thread *rt_queue_peek(rt_queue *queue, uint64_t pos)
+// apply func to each thread, oldest first, until it returns nonzero
+static void rt_queue_map(rt_queue *queue, int (*func)(rt_thread *t, void *priv), void *priv)
 {
-    if (pos>=queue->size) { 
-	return 0;
-    } else {
-	return queue->threads[(queue->tail+pos)%MAX_QUEUE];
+    uint64_t now;
+
+    for (now=0;now<queue->size;now++) {
+	if (func(queue->threads[(queue->tail+now)%MAX_QUEUE],priv)) {
+	    break;
+	}
     }
 }
 
@@ -1905,20 +2242,275 @@ static rt_thread* rt_priority_queue_remove(rt_priority_queue *queue, rt_thread *
     }
 }
 
-static rt_thread *rt_priority_queue_peek(rt_priority_queue *queue, uint64_t pos)
+// apply func to each thread, in heap order, until it returns nonzero
+static void rt_priority_queue_map(rt_priority_queue *queue, int (*func)(rt_thread *t, void *priv), void *priv)
+{
+    uint64_t now;
+
+    for (now=0;now<queue->size;now++) {
+	if (func(queue->threads[now],priv)) {
+	    break;
+	}
+    }
+}
+
+static int rt_priority_queue_empty(rt_priority_queue *queue)
+{
+    return queue->size==0;
+}
+
+#if NAUT_CONFIG_APERIODIC_MULTILEVEL
+
+static inline int rt_level_of(rt_thread *thread)
+{
+    uint64_t p = thread->constraints.aperiodic.priority;
+    int level;
+
+    if (thread->thread->is_idle) {
+	return RT_IDLE_LEVEL;
+    }
+
+    // floor(log2(priority)), with a thread that used up its
+    // last quantum demoted by one level
+    level = p ? 63 - __builtin_clzll(p) : 0;
+    level += thread->demoted;
+
+    return level < RT_IDLE_LEVEL ? level : RT_IDLE_LEVEL - 1;
+}
+
+static void rt_level_queue_init(rt_level_queue *queue)
+{
+    int i;
+
+    queue->size = 0;
+    queue->bitmap = 0;
+    for (i=0;i<RT_LEVELS;i++) {
+	INIT_LIST_HEAD(&queue->levels[i]);
+    }
+}
+
+static int rt_level_queue_enqueue(rt_level_queue *queue, rt_thread *thread)
+{
+    if (thread->queued) {
+	ERROR("Thread %lu is already on the aperiodic queue\n",thread->thread->tid);
+	return -1;
+    }
+
+    thread->level = rt_level_of(thread);
+    list_add_tail(&thread->queue_node,&queue->levels[thread->level]);
+    queue->bitmap |= 1ULL << thread->level;
+    queue->size++;
+    thread->queued = 1;
+    thread->q_type = queue->type;
+
+    return 0;
+}
+
+static rt_thread* rt_level_queue_remove(rt_level_queue *queue, rt_thread *thread)
+{
+    if (!thread->queued) {
+	return 0;
+    }
+
+    list_del_init(&thread->queue_node);
+    if (list_empty(&queue->levels[thread->level])) {
+	queue->bitmap &= ~(1ULL << thread->level);
+    }
+    queue->size--;
+    thread->queued = 0;
+
+    return thread;
+}
+
+// highest priority level first, FIFO within a level
+static rt_thread* rt_level_queue_dequeue(rt_level_queue *queue)
+{
+    rt_thread *thread;
+
+    if (!queue->bitmap) {
+	ERROR("Aperiodic Runnable QUEUE EMPTY! CAN'T DEQUEUE!\n");
+	return NULL;
+    }
+
+    thread = list_first_entry(&queue->levels[__builtin_ctzll(queue->bitmap)],rt_thread,queue_node);
+
+    return rt_level_queue_remove(queue,thread);
+}
+
+static void rt_level_queue_map(rt_level_queue *queue, int (*func)(rt_thread *t, void *priv), void *priv)
+{
+    uint64_t bits = queue->bitmap;
+    rt_thread *thread;
+    int level;
+
+    while (bits) {
+	level = __builtin_ctzll(bits);
+	bits &= bits - 1;
+	list_for_each_entry(thread,&queue->levels[level],queue_node) {
+	    if (func(thread,priv)) {
+		return;
+	    }
+	}
+    }
+}
+
+static int rt_level_queue_empty(rt_level_queue *queue)
+{
+    return queue->size==0;
+}
+
+static int rt_level_queue_dump_one(rt_thread *thread, void *priv)
+{
+    DEBUG("   %llu %s (level %d)\n",thread->thread->tid,
+	  thread->thread->is_idle ? "*idle*" :
+	  thread->thread->name[0] ? thread->thread->name : "(no name)",thread->level);
+    return 0;
+}
+
+static void rt_level_queue_dump(rt_level_queue *queue, char *pre)
+{
+    DEBUG("======%s==BEGIN=====\n",pre);
+    rt_level_queue_map(queue,rt_level_queue_dump_one,0);
+    DEBUG("======%s==END=====\n",pre);
+}
+
+#endif
+
+#if NAUT_CONFIG_APERIODIC_FAIR
+
+static int rt_fair_queue_enqueue(rt_fair_queue *queue, rt_thread *thread, uint64_t credit)
+{
+    struct rb_node **link = &queue->root.rb_node;
+    struct rb_node *parent = 0;
+    int leftmost = 1;
+
+    if (thread->queued) {
+	ERROR("Thread %lu is already on the aperiodic queue\n",thread->thread->tid);
+	return -1;
+    }
+
+    thread->queued = 1;
+    thread->q_type = queue->type;
+    queue->size++;
+
+    if (thread->thread->is_idle) {
+	queue->idle = thread;
+	return 0;
+    }
+
+    // A thread arriving from another CPU keeps its lead or lag
+    // relative to the queue it came from.  The old queue's floor
+    // is read without its lock, which at worst costs some fairness.
+    if (thread->fair_queue && thread->fair_queue != queue) {
+	uint64_t old = *(volatile uint64_t *)&thread->fair_queue->min_vruntime;
+	thread->vruntime = thread->vruntime > old ? thread->vruntime - old : 0;
+	thread->vruntime += queue->min_vruntime;
+    }
+    thread->fair_queue = queue;
+
+    if (queue->min_vruntime > credit && thread->vruntime < queue->min_vruntime - credit) {
+	thread->vruntime = queue->min_vruntime - credit;
+    }
+
+    while (*link) {
+	parent = *link;
+	if (thread->vruntime < rb_entry(parent,rt_thread,fair_node)->vruntime) {
+	    link = &parent->rb_left;
+	} else {
+	    // equal keys go right, so ties are served FIFO
+	    link = &parent->rb_right;
+	    leftmost = 0;
+	}
+    }
+
+    rb_link_node(&thread->fair_node,parent,link);
+    nk_rb_insert_color(&thread->fair_node,&queue->root);
+
+    if (leftmost) {
+	queue->leftmost = &thread->fair_node;
+    }
+
+    return 0;
+}
+
+static rt_thread* rt_fair_queue_remove(rt_fair_queue *queue, rt_thread *thread)
 {
-    if (pos>=queue->size) { 
+    if (!thread->queued) {
 	return 0;
+    }
+
+    if (thread == queue->idle) {
+	queue->idle = 0;
     } else {
-	return queue->threads[pos];
+	if (queue->leftmost == &thread->fair_node) {
+	    queue->leftmost = nk_rb_next(&thread->fair_node);
+	}
+	nk_rb_erase(&thread->fair_node,&queue->root);
     }
+
+    queue->size--;
+    thread->queued = 0;
+
+    return thread;
 }
 
-static int rt_priority_queue_empty(rt_priority_queue *queue)
+// least virtual runtime first, idle only if nothing else
+static rt_thread* rt_fair_queue_dequeue(rt_fair_queue *queue)
+{
+    rt_thread *thread;
+
+    if (queue->leftmost) {
+	thread = rb_entry(queue->leftmost,rt_thread,fair_node);
+	if (thread->vruntime > queue->min_vruntime) {
+	    queue->min_vruntime = thread->vruntime;
+	}
+    } else if (queue->idle) {
+	thread = queue->idle;
+    } else {
+	ERROR("Aperiodic Runnable QUEUE EMPTY! CAN'T DEQUEUE!\n");
+	return NULL;
+    }
+
+    return rt_fair_queue_remove(queue,thread);
+}
+
+static void rt_fair_queue_map(rt_fair_queue *queue, int (*func)(rt_thread *t, void *priv), void *priv)
+{
+    struct rb_node *n;
+
+    for (n=queue->leftmost;n;n=nk_rb_next(n)) {
+	if (func(rb_entry(n,rt_thread,fair_node),priv)) {
+	    return;
+	}
+    }
+
+    if (queue->idle) {
+	func(queue->idle,priv);
+    }
+}
+
+static int rt_fair_queue_empty(rt_fair_queue *queue)
 {
     return queue->size==0;
 }
 
+static int rt_fair_queue_dump_one(rt_thread *thread, void *priv)
+{
+    DEBUG("   %llu %s (%llu)\n",thread->thread->tid,
+	  thread->thread->is_idle ? "*idle*" :
+	  thread->thread->name[0] ? thread->thread->name : "(no name)",thread->vruntime);
+    return 0;
+}
+
+static void rt_fair_queue_dump(rt_fair_queue *queue, char *pre)
+{
+    DEBUG("======%s==BEGIN=====\n",pre);
+    rt_fair_queue_map(queue,rt_fair_queue_dump_one,0);
+    DEBUG("======%s==END=====\n",pre);
+}
+
+#endif
+
 static void rt_thread_dump(rt_thread *thread, char *pre)
 {
     
@@ -1951,6 +2543,14 @@ static void set_timer(rt_scheduler *scheduler, rt_thread *thread, uint64_t now)
 	uint64_t remaining_time;
 	switch (thread->constraints.type) { 
 	case APERIODIC:
+#ifdef NAUT_CONFIG_IDLE_GOVERNOR
+	    // an idle CPU is woken by a nudge when work arrives, so
+	    // there is no need to tick it every quantum
+	    if (thread->thread->is_idle && nk_idle_tickless()) {
+		next_preempt = now + NAUT_CONFIG_IDLE_MAX_SLEEP_MS*1000000ULL;
+		break;
+	    }
+#endif
 	    next_preempt = now + scheduler->cfg.aperiodic_quantum;
 	    break;
 	case SPORADIC:
@@ -1974,6 +2574,15 @@ static void set_timer(rt_scheduler *scheduler, rt_thread *thread, uint64_t now)
     scheduler->tsc.start_time = now;
     scheduler->tsc.set_time = MIN(next_arrival,next_preempt);
     
+    if (apic->tsc_deadline) {
+	// the set time is absolute, so it can be handed to the
+	// timer as is, with no reference to the current time
+	apic_update_deadline_timer(apic,
+				   apic_realtime_to_tsc(apic, scheduler->tsc.set_time + scheduler->slack),
+				   IF_EARLIER);
+	return;
+    }
+
   
     // the set time has been computed based on the "now" argument
     // which is the start of the scheduling pass.   We need to set
@@ -2144,6 +2753,18 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
     
     NK_GPIO_OUTPUT_MASK(0x4,GPIO_OR);
 
+#if NAUT_CONFIG_WAKEUP_BATCHING
+    // whatever brought us here, a kick sent after this point must
+    // get through, whether or not this pass drains the wake list
+    {
+	rt_scheduler *ks = per_cpu_get(system)->cpus[my_cpu_id()]->sched_state;
+	if (ks) {
+	    ks->kick_pending = 0;
+	    __sync_synchronize();
+	}
+    }
+#endif
+
     // even before we check for preemptability, we 
     // need to handle a world stop, which we always do
     if (stopping) { 
@@ -2155,12 +2776,23 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
 	    return 0;
 	} else {
 	    uint64_t num_cpus = nk_get_num_cpus();
+	    // the stopper cannot hand out work until we are all
+	    // through the barrier, so this is the generation before
+	    uint64_t gen = stop_gen;
 	    DEBUG("World stop signalled\n");
 	    // We now wait for everyone else to stop
 	    nk_counting_barrier(&stop_barrier);
 	    // everyone's stopped... we are now waiting for
-	    // the world stopper to restart us all
-	    PAUSE_WHILE(stopping);
+	    // the world stopper to restart us all, doing any
+	    // work it hands us in the meantime
+	    while (stopping) {
+		if (stop_gen != gen) {
+		    gen = stop_gen;
+		    stop_func(stop_arg,num_cpus);
+		    __sync_fetch_and_add(&stop_done,1);
+		}
+		asm volatile("pause");
+	    }
 	    // we've been restarted - we'll now wait for everyone
 	    nk_counting_barrier(&stop_barrier);
 	    // everyone's now restarted
@@ -2218,6 +2850,10 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
 	LOCAL_LOCK(scheduler);
     }
 
+#if NAUT_CONFIG_WAKEUP_BATCHING
+    wake_list_drain(scheduler);
+#endif
+
     scheduler->tsc.end_time = now;
 
     rt_c->run_time += now - rt_c->start_time;
@@ -2284,6 +2920,15 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
 	}
 	rt_a->arrival_count++;
 	if (rt_a->constraints.type==PERIODIC) { 
+	    // the arrival was due at the old deadline; how much later
+	    // we got here is the timer's slack for this thread
+	    uint64_t late = now - rt_a->deadline;
+	    rt_a->late_count++;
+	    rt_a->late_sum += late;
+	    rt_a->late_sum2 += late*late;
+	    if (late > rt_a->late_max) {
+		rt_a->late_max = late;
+	    }
 	    // the deadline is updated to be the end of the period, 
 	    // relative to this arrival time (not the current time)
 	    rt_a->deadline = rt_a->deadline + rt_a->constraints.periodic.period;
@@ -2738,6 +3383,14 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
 	      my_cpu_id());
 
 	rt_n->switch_in_count++;
+
+	NK_TRACE(NK_TRACE_SCHED,NK_TRACE_EV_SWITCH,rt_c->thread->tid,rt_n->thread->tid);
+
+#ifdef NAUT_CONFIG_PMC_VIRT
+	if (rt_c->thread->pmc_ctx || rt_n->thread->pmc_ctx) {
+	    nk_pmc_thread_switch(rt_c->thread,rt_n->thread);
+	}
+#endif
 	      
 	// we are switching threads, start accounting for the new one
 	rt_n->cur_run_time=0;
@@ -3005,11 +3658,32 @@ static int select_victim(int new_cpu)
 	b = (int)(get_random() % sys->num_cpus);
     } while (a==new_cpu || b==new_cpu);
 
-    return (sys->cpus[a]->sched_state->aperiodic.size  >
-	    sys->cpus[b]->sched_state->aperiodic.size) ? a : b;
+    return (SIZE_APERIODIC(sys->cpus[a]->sched_state) >
+	    SIZE_APERIODIC(sys->cpus[b]->sched_state)) ? a : b;
 
 }
 
+struct steal_state {
+    rt_thread **prosp;
+    uint64_t    count;
+    uint64_t    max;
+    uint64_t    hot_after;  // skip threads last started after this time
+};
+
+static int steal_candidate(rt_thread *t, void *priv)
+{
+    struct steal_state *s = (struct steal_state *)priv;
+
+    // do not steal the idle thread, interrupt thread, task thread, or any bound thread
+    if (!t->thread->is_idle && !t->is_intr && !t->is_task && t->thread->bound_cpu<0 &&
+	t->start_time <= s->hot_after) { 
+	DEBUG("Found thread %llu %s\n",t->thread->tid,t->thread->name);
+	s->prosp[s->count++] = t;
+    }
+
+    return s->count>=s->max;
+}
+
 uint64_t nk_sched_get_runtime(struct nk_thread *t)
 {
     return t->sched_state->run_time;
@@ -3023,8 +3697,9 @@ int nk_sched_cpu_mug(int old_cpu, uint64_t maxcount, uint64_t *actualcount)
     rt_scheduler *os;
     rt_scheduler *ns = sys->cpus[new_cpu]->sched_state;
     rt_thread *prosp[maxcount];
+    struct steal_state steal = { .prosp = prosp, .count = 0, .max = maxcount, .hot_after = -1ULL };
     uint64_t count=0;
-    uint64_t cur, pos;
+    uint64_t cur;
     int rc=-1;
 
 
@@ -3058,19 +3733,11 @@ int nk_sched_cpu_mug(int old_cpu, uint64_t maxcount, uint64_t *actualcount)
     // and examine it for prospective threads
     LOCAL_LOCK(os);
 
-    count=0;
-
-    for (cur=0;cur<SIZE_APERIODIC(os);cur++) {
-	rt_thread *t = PEEK_APERIODIC(os,cur);
-	// do not steal the idle thread, interrupt thread, task thread, or any bound thread
-	if (t && !t->thread->is_idle && !t->is_intr && !t->is_task && t->thread->bound_cpu<0 ) { 
-	    DEBUG("Found thread %llu %s\n",t->thread->tid,t->thread->name);
-	    prosp[count++] = t;
-	    if (count>=maxcount) { 
-		break;
-	    }
-	}
+    if (maxcount) {
+	MAP_APERIODIC(os,steal_candidate,&steal);
     }
+
+    count = steal.count;
     
     LOCAL_UNLOCK(os);
 
@@ -3100,11 +3767,259 @@ int nk_sched_cpu_mug(int old_cpu, uint64_t maxcount, uint64_t *actualcount)
 
 }
 
+#if NAUT_CONFIG_LOAD_BALANCE
+
+//
+// Topology-aware load balancing
+//
+// Each CPU orders the other CPUs by balancing domain (see LB_*),
+// and within the remote domain by SLIT distance.  A balancing pass
+// looks for the busiest CPU in each domain in turn, nearest first,
+// and pulls from the first one that is sufficiently busier than
+// we are.  Farther domains need a larger imbalance, and outside of
+// the core we leave alone threads that ran within the last
+// NAUT_CONFIG_LOAD_BALANCE_CACHE_HOT_US, preferring the ones that
+// have waited longest.  A waker that finds a woken thread's CPU busy
+// can ask an idle neighbor to pull from it right away, which goes
+// through the same move path as any other steal.
+//
+
+#define LB_SCAN 32    // candidates examined on the victim per pass
+
+static const uint64_t lb_threshold[LB_LEVELS] = { 1, 1, 2, 4 };
+
+// runnable and running threads other than idle
+static inline uint64_t lb_load(rt_scheduler *s)
+{
+    // exactly one of the current thread and the queued idle
+    // thread is counted by the aperiodic queue size
+    return SIZE_APERIODIC(s) + s->runnable.size;
+}
+
+static int lb_level(struct cpu *a, struct cpu *b)
+{
+    if (a->coord && b->coord) {
+	if (nk_topo_cpus_share_phys_core(a,b)) {
+	    return LB_CORE;
+	}
+	if (nk_topo_cpus_share_socket(a,b)) {
+	    return LB_SOCKET;
+	}
+    }
+    if (a->domain == b->domain) {
+	return LB_NUMA;
+    }
+    return LB_REMOTE;
+}
+
+static uint64_t lb_key(struct sys_info *sys, int me, int other)
+{
+    struct nk_locality_info *loc = &sys->locality_info;
+    struct cpu *a = sys->cpus[me];
+    struct cpu *b = sys->cpus[other];
+    uint64_t dist = 0;
+
+    if (loc->numa_matrix && a->domain && b->domain) {
+	dist = loc->numa_matrix[a->domain->id * loc->num_domains + b->domain->id];
+    }
+
+    return (uint64_t)lb_level(a,b) << 8 | dist;
+}
+
+// done lazily by the CPU's own idle thread, published last
+static int lb_build_order(rt_scheduler *s, int me)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    int *order;
+    int i, j, n, t;
+
+    order = MALLOC(sizeof(int)*sys->num_cpus);
+    if (!order) {
+	ERROR("Cannot allocate load balancing order\n");
+	return -1;
+    }
+
+    for (i=0, n=0; i<sys->num_cpus; i++) {
+	if (i!=me) {
+	    order[n++] = i;
+	}
+    }
+
+    // insertion sort, stable, so ties stay in CPU order
+    for (i=1; i<n; i++) {
+	t = order[i];
+	for (j=i; j>0 && lb_key(sys,me,order[j-1]) > lb_key(sys,me,t); j--) {
+	    order[j] = order[j-1];
+	}
+	order[j] = t;
+    }
+
+    for (i=0, j=0; i<LB_LEVELS; i++) {
+	while (j<n && lb_level(sys->cpus[me],sys->cpus[order[j]])<=i) {
+	    j++;
+	}
+	s->lb_end[i] = j;
+    }
+
+    __sync_synchronize();
+    s->lb_order = order;
+
+    return 0;
+}
+
+// pull up to count of the coldest eligible threads from old_cpu
+static uint64_t lb_pull(int old_cpu, uint64_t count, uint64_t hot_after)
+{
+    LOCAL_LOCK_CONF;
+    struct sys_info *sys = per_cpu_get(system);
+    rt_scheduler *os = sys->cpus[old_cpu]->sched_state;
+    rt_scheduler *ns = per_cpu_get(sched_state);
+    rt_thread *prosp[LB_SCAN];
+    struct steal_state steal = { .prosp = prosp, .count = 0, .max = LB_SCAN, .hot_after = hot_after };
+    uint64_t i, j, moved=0;
+    rt_thread *t;
+
+    LOCAL_LOCK(os);
+    MAP_APERIODIC(os,steal_candidate,&steal);
+    LOCAL_UNLOCK(os);
+
+    for (i=0; i<steal.count && moved<count; i++) {
+	// selection of the least recently started
+	for (j=i+1; j<steal.count; j++) {
+	    if (prosp[j]->start_time < prosp[i]->start_time) {
+		t = prosp[i]; prosp[i] = prosp[j]; prosp[j] = t;
+	    }
+	}
+	if (nk_sched_thread_move(prosp[i]->thread,my_cpu_id(),0)) {
+	    DEBUG("Could not pull thread %llu from cpu %d\n",prosp[i]->thread->tid,old_cpu);
+	    ns->lb_failed++;
+	} else {
+	    moved++;
+	}
+    }
+
+    ns->num_thefts += moved;
+
+    return moved;
+}
+
+int nk_sched_balance_wanted(void)
+{
+    return per_cpu_get(sched_state)->lb_pull_from >= 0;
+}
+
+int nk_sched_balance(uint64_t maxcount, uint64_t *actualcount)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    rt_scheduler *ns = per_cpu_get(sched_state);
+    uint64_t hot_after, mine, load, max, n;
+    int level, i, busiest, from;
+
+    *actualcount = 0;
+
+    if (!ns->lb_order && lb_build_order(ns,my_cpu_id())) {
+	return -1;
+    }
+
+    ns->lb_runs++;
+
+    from = __sync_lock_test_and_set(&ns->lb_pull_from,-1);
+    if (from>=0) {
+	*actualcount = lb_pull(from,1,-1ULL);
+	ns->lb_pushed += *actualcount;
+	if (*actualcount) {
+	    return 0;
+	}
+    }
+
+    mine = lb_load(ns);
+    hot_after = cur_time() - NAUT_CONFIG_LOAD_BALANCE_CACHE_HOT_US*1000ULL;
+
+    for (level=0, i=0; level<LB_LEVELS; level++) {
+	busiest = -1;
+	max = 0;
+	for (; i<ns->lb_end[level]; i++) {
+	    load = lb_load(sys->cpus[ns->lb_order[i]]->sched_state);
+	    if (load > max) {
+		max = load;
+		busiest = ns->lb_order[i];
+	    }
+	}
+
+	if (busiest<0 || max <= mine + lb_threshold[level]) {
+	    continue;
+	}
+
+	n = MIN(MAX((max - mine)/2,1),maxcount);
+
+	DEBUG("Balancing: pulling %lu from cpu %d (load %lu vs %lu, level %d)\n",n,busiest,max,mine,level);
+
+	*actualcount = lb_pull(busiest,n,level==LB_CORE ? -1ULL : hot_after);
+	ns->lb_pulled[level] += *actualcount;
+
+	if (*actualcount) {
+	    break;
+	}
+    }
+
+    return 0;
+}
+
+#if NAUT_CONFIG_LOAD_BALANCE_PUSH
+// a thread was just woken onto cpu; if cpu is busy and a CPU
+// sharing its core or socket is idle, have that CPU pull
+static void lb_push(struct nk_thread *thread, int cpu)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    rt_thread *t = thread->sched_state;
+    rt_scheduler *s, *o;
+    int i;
+
+    if (cpu<0 || cpu>=sys->num_cpus || thread->bound_cpu>=0 ||
+	thread->is_idle || t->is_intr || t->is_task ||
+	t->constraints.type!=APERIODIC) {
+	return;
+    }
+
+    s = sys->cpus[cpu]->sched_state;
+
+    if (!s->lb_order || lb_load(s)<2) {
+	return;
+    }
+
+    for (i=0; i<s->lb_end[LB_SOCKET]; i++) {
+	o = sys->cpus[s->lb_order[i]]->sched_state;
+	if (!lb_load(o) && __sync_bool_compare_and_swap(&o->lb_pull_from,-1,cpu)) {
+	    nk_sched_kick_cpu(s->lb_order[i]);
+	    return;
+	}
+    }
+}
+#endif
+
+#endif
 
 void    nk_sched_kick_cpu(int cpu)
 {
 #ifdef NAUT_CONFIG_KICK_SCHEDULE
     if (cpu != my_cpu_id()) {
+#if NAUT_CONFIG_WAKEUP_BATCHING
+	rt_scheduler *s = nk_get_nautilus_info()->sys.cpus[cpu]->sched_state;
+	// one kick covers everything queued until the target's next
+	// entry to need_resched, which clears kick_pending
+	if (s->kick_pending || !__sync_bool_compare_and_swap(&s->kick_pending,0,1)) {
+	    __sync_fetch_and_add(&s->kicks_avoided,1);
+	    return;
+	}
+#ifdef NAUT_CONFIG_IDLE_GOVERNOR
+	if (nk_idle_nudge(cpu)) {
+	    // waiting in mwait, so the nudge already woke it
+	    __sync_fetch_and_add(&s->kicks_avoided,1);
+	    return;
+	}
+#endif
+	__sync_fetch_and_add(&s->kicks_sent,1);
+#endif
         apic_ipi(per_cpu_get(apic),
 		 nk_get_nautilus_info()->sys.cpus[cpu]->lapic_id,
 		 APIC_NULL_KICK_VEC);
@@ -3157,6 +4072,12 @@ static void handle_special_switch(rt_status what, int have_lock, uint8_t flags,
 
     ASSERT(what==SLEEPING || what==YIELDING || what==EXITING || what==CHANGING);
 
+    NK_TRACE(NK_TRACE_SCHED,
+	     what==SLEEPING ? NK_TRACE_EV_SLEEP :
+	     what==YIELDING ? NK_TRACE_EV_YIELD :
+	     what==EXITING ? NK_TRACE_EV_EXIT : NK_TRACE_EV_CHANGE,
+	     c->tid, 0);
+
     DEBUG("%sing %llu \"%s\"\n",
 	  what == SLEEPING ? "Sleep" : 
 	  what == YIELDING ? "Yield" : 
@@ -3360,6 +4281,28 @@ static inline void rt_thread_update_aperiodic(rt_thread *t, rt_scheduler *schedu
 	return;
 #endif
 
+#if NAUT_CONFIG_APERIODIC_MULTILEVEL
+	// the level is derived from the priority on enqueue
+	t->demoted = t->cur_run_time >= scheduler->cfg.aperiodic_quantum;
+	return;
+#endif
+
+#if NAUT_CONFIG_APERIODIC_FAIR
+	if (!t->thread->is_idle) {
+	    uint64_t delta = t->run_time - t->vruntime_base;
+	    uint64_t unit = scheduler->cfg.aperiodic_default_priority ? scheduler->cfg.aperiodic_default_priority : 1;
+	    uint64_t prio = t->constraints.aperiodic.priority;
+	    // weights are limited to 1024x either way of the default,
+	    // which also keeps the products below from overflowing
+	    prio = MAX(prio, unit >> 10);
+	    prio = MIN(prio, unit << 10);
+	    prio = MAX(prio, 1);
+	    t->vruntime += (delta / unit) * prio + ((delta % unit) * prio) / unit;
+	}
+	t->vruntime_base = t->run_time;
+	return;
+#endif
+
 #if NAUT_CONFIG_APERIODIC_DYNAMIC_LIFETIME
 	if (t->thread->is_idle) { 
 	    t->deadline = -1ULL; // lowest priority possible;
@@ -3408,6 +4351,9 @@ static void reset_state(rt_thread *thread)
     thread->run_time = 0;
     thread->deadline = 0;
     thread->exit_time = 0;
+#if NAUT_CONFIG_APERIODIC_FAIR
+    thread->vruntime_base = 0;
+#endif
 }
 
 static void reset_stats(rt_thread *thread)
@@ -3424,6 +4370,10 @@ static void reset_stats(rt_thread *thread)
     thread->miss_count=0;
     thread->miss_time_sum=0;
     thread->miss_time_sum2=0;
+    thread->late_count=0;
+    thread->late_sum=0;
+    thread->late_sum2=0;
+    thread->late_max=0;
 }
 
 // RMS schedulability test for a non-harmonic task set
@@ -3766,6 +4716,8 @@ struct nk_task *nk_task_produce(int cpu, uint64_t size_ns, void *(*f)(void*), vo
     }
     TASK_UNLOCK(ti);
 
+    NK_TRACE(NK_TRACE_TASK,NK_TRACE_EV_TASK_PRODUCE,t,placement_cpu);
+
     // kick any waitqueue
     nk_wait_queue_wake_all(ti->waitq);
 
@@ -3838,6 +4790,7 @@ static struct nk_task *_nk_task_consume(int cpu, uint64_t size_ns, uint64_t sear
 
     if (t) {
 	t->stats.dequeue_time_ns = cur_time();
+	NK_TRACE(NK_TRACE_TASK,NK_TRACE_EV_TASK_CONSUME,t,source_cpu);
     }
 	
     return t;
@@ -3949,6 +4902,12 @@ static struct nk_sched_percpu_state *init_local_state(struct nk_sched_config *cf
 	state->runnable.type = RUNNABLE_QUEUE;
         state->pending.type = PENDING_QUEUE;
         state->aperiodic.type = APERIODIC_QUEUE;
+#if NAUT_CONFIG_APERIODIC_MULTILEVEL
+	rt_level_queue_init(&state->aperiodic);
+#endif
+#if NAUT_CONFIG_LOAD_BALANCE
+	state->lb_pull_from = -1;
+#endif
 
     }
     
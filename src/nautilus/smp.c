@@ -37,6 +37,7 @@
 #include <nautilus/mm.h>
 #include <nautilus/fpu.h>
 #include <nautilus/percpu.h>
+#include <nautilus/trace.h>
 #include <dev/ioapic.h>
 #include <dev/apic.h>
 
@@ -498,8 +499,14 @@ xcall_handler (excp_entry_t * e, excp_vec_t v, void *state)
     elm = nk_dequeue_first_atomic(xcq);
     x = container_of(elm, struct nk_xcall, xcall_node);
     if (!x) {
+#ifdef NAUT_CONFIG_IDLE_GOVERNOR
+        // the idle thread may have run it before taking the IPI
+        IRQ_HANDLER_END();
+        return 0;
+#else
         ERROR_PRINT("No XCALL request found on core %u\n", my_cpu_id());
         goto out_err;
+#endif
     }
 
     if (x->fun) {
@@ -508,8 +515,12 @@ xcall_handler (excp_entry_t * e, excp_vec_t v, void *state)
         // because it may end up blocking (e.g. core barrier)
         IRQ_HANDLER_END(); 
 
+        NK_TRACE(NK_TRACE_XCALL,NK_TRACE_EV_XCALL_ENTER,x->fun,0);
+
         x->fun(x->data);
 
+        NK_TRACE(NK_TRACE_XCALL,NK_TRACE_EV_XCALL_EXIT,0,0);
+
         /* we need to notify the waiter we're done */
         if (x->has_waiter) {
             mark_xcall_done(x);
@@ -529,6 +540,49 @@ out_err:
 }
 
 
+#ifdef NAUT_CONFIG_IDLE_GOVERNOR
+int
+smp_xcall_pending (void)
+{
+    nk_queue_t * xcq = per_cpu_get(xcall_q);
+
+    return xcq && !nk_queue_empty_atomic(xcq);
+}
+
+
+/*
+ * The idle governor's counterpart to xcall_handler, for
+ * xcalls that were delivered by a write to the monitored line
+ * instead of an IPI.  Interrupts are off, as in the handler.
+ */
+void
+smp_xcall_poll (void)
+{
+    nk_queue_t * xcq = per_cpu_get(xcall_q);
+    nk_queue_entry_t * elm = NULL;
+    struct nk_xcall * x = NULL;
+
+    if (!xcq) {
+        return;
+    }
+
+    while ((elm = nk_dequeue_first_atomic(xcq))) {
+        x = container_of(elm, struct nk_xcall, xcall_node);
+
+        NK_TRACE(NK_TRACE_XCALL,NK_TRACE_EV_XCALL_ENTER,x->fun,0);
+
+        x->fun(x->data);
+
+        NK_TRACE(NK_TRACE_XCALL,NK_TRACE_EV_XCALL_EXIT,0,0);
+
+        if (x->has_waiter) {
+            mark_xcall_done(x);
+        }
+    }
+}
+#endif
+
+
 /* 
  * smp_xcall
  *
@@ -596,6 +650,15 @@ smp_xcall (cpu_id_t cpu_id,
 
         struct apic_dev * apic = per_cpu_get(apic);
 
+        NK_TRACE(NK_TRACE_XCALL,NK_TRACE_EV_XCALL_SEND,cpu_id,fun);
+
+#ifdef NAUT_CONFIG_IDLE_GOVERNOR
+        // the enqueue is a locked operation, so it is visible
+        // before we look at whether the target is waiting
+        if (nk_idle_nudge(cpu_id)) {
+            __sync_fetch_and_add(&sys->cpus[cpu_id]->idle_state->ipis_avoided, 1);
+        } else
+#endif
         apic_ipi(apic, sys->cpus[cpu_id]->apic->id, IPI_VEC_XCALL);
 
         if (wait) {
@@ -37,11 +37,16 @@
 #include <nautilus/list.h>
 #include <nautilus/errno.h>
 #include <nautilus/mm.h>
+#include <nautilus/shell.h>
 
 #ifdef NAUT_CONFIG_ENABLE_BDWGC
 #include <gc/bdwgc/bdwgc.h>
 #endif
 
+#ifdef NAUT_CONFIG_PMC_VIRT
+#include <nautilus/pmc.h>
+#endif
+
 extern uint8_t malloc_cpus_ready;
 
 
@@ -107,14 +112,20 @@ thread_detach (nk_thread_t * t)
 
 
 
-static void 
-tls_exit (void) 
+/*
+ * Run the destructors of the current thread's TLS values.  A
+ * destructor may set new values, so the keys are swept again, up
+ * to MIN_DESTRUCT_ITER times, until a sweep calls nothing.
+ */
+void
+nk_tls_exit (void) 
 {
     nk_thread_t * t = get_cur_thread();
     unsigned i, j;
-    uint8_t called = 0;
+    uint8_t called;
 
     for (i = 0; i < MIN_DESTRUCT_ITER; i++) {
+        called = 0;
         for (j = 0 ; j < TLS_MAX_KEYS; j++) {
             void * val = (void*)t->tls[j]; 
             if (val && tls_keys[j].destructor) {
@@ -122,10 +133,10 @@ tls_exit (void)
                 t->tls[j] = NULL;
                 tls_keys[j].destructor(val);
             }
+        }
 
-            if (!called) {
-                break;
-            }
+        if (!called) {
+            break;
         }
     }
 }
@@ -280,6 +291,279 @@ thread_setup_init_stack (nk_thread_t * t, nk_thread_fun_t fun, void * arg)
 static void nk_thread_brain_wipe(nk_thread_t *t);
 
 
+#ifdef NAUT_CONFIG_THREAD_CACHE
+
+/*
+ * Per-CPU caches of dead threads and their stacks
+ *
+ * Each CPU has one bin per power-of-two stack size from 4KB to 2MB.
+ * A bin holds threads whose struct and stack were allocated from that
+ * CPU's memory.  nk_thread_create() pops from the bin of the placement
+ * CPU, and nk_thread_destroy() pushes onto the bin of the thread's
+ * original placement CPU, so a recycled thread is always NUMA-local
+ * to where it was first placed.  Like a reanimated thread, a cached
+ * thread keeps its wait queue and timer.
+ */
+
+#define THREAD_CACHE_MIN_ORDER 12  // 4KB
+#define THREAD_CACHE_MAX_ORDER 21  // 2MB
+#define THREAD_CACHE_BINS      (THREAD_CACHE_MAX_ORDER - THREAD_CACHE_MIN_ORDER + 1)
+#define THREAD_CACHE_DEPTH     NAUT_CONFIG_THREAD_CACHE_DEPTH
+#define THREAD_STACK_CANARY    0x5ca1ab1edeadbeefULL
+
+struct thread_cache_bin {
+    spinlock_t   lock;
+    uint64_t     count;
+    nk_thread_t *head;
+};
+
+struct thread_cache {
+    struct thread_cache_bin bins[THREAD_CACHE_BINS];
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t recycled;
+    uint64_t freed;      // bin was full
+    uint64_t corrupted;  // stack canary overwritten
+} __attribute__((aligned(64)));
+
+static struct thread_cache thread_caches[NAUT_CONFIG_MAX_CPUS];
+static int thread_cache_enabled = 0;
+
+// bin for a stack size, or -1 if not cacheable
+static inline int thread_cache_bin(nk_stack_size_t size)
+{
+    int order = THREAD_CACHE_MIN_ORDER;
+
+    while (order <= THREAD_CACHE_MAX_ORDER && (1UL << order) < size) {
+        order++;
+    }
+
+    return order > THREAD_CACHE_MAX_ORDER ? -1 : order - THREAD_CACHE_MIN_ORDER;
+}
+
+// the underlying allocator rounds to a power of two anyway, so allocating
+// the full bin size costs nothing and makes the stack recyclable
+static inline nk_stack_size_t thread_cache_stack_size(nk_stack_size_t size)
+{
+    int bin = thread_cache_bin(size);
+
+    return bin < 0 ? size : (1UL << (bin + THREAD_CACHE_MIN_ORDER));
+}
+
+static inline void thread_cache_set_canary(nk_thread_t *t)
+{
+#ifdef NAUT_CONFIG_THREAD_CACHE_STACK_CANARY
+    *(uint64_t *)t->stack = THREAD_STACK_CANARY;
+#endif
+}
+
+static inline int thread_cache_check_canary(nk_thread_t *t)
+{
+#ifdef NAUT_CONFIG_THREAD_CACHE_STACK_CANARY
+    return *(uint64_t *)t->stack == THREAD_STACK_CANARY;
+#else
+    return 1;
+#endif
+}
+
+static nk_thread_t *thread_cache_get(nk_stack_size_t size, int cpu)
+{
+    struct thread_cache *c;
+    struct thread_cache_bin *b;
+    nk_thread_t *t;
+    int bin;
+    uint8_t flags;
+
+    if (!thread_cache_enabled || cpu < 0 || (bin = thread_cache_bin(size)) < 0) {
+        return 0;
+    }
+
+    c = &thread_caches[cpu];
+    b = &c->bins[bin];
+
+    flags = spin_lock_irq_save(&b->lock);
+    t = b->head;
+    if (t) {
+        b->head = t->cache_next;
+        b->count--;
+        c->hits++;
+    } else {
+        c->misses++;
+    }
+    spin_unlock_irq_restore(&b->lock, flags);
+
+    if (t) {
+        void *stack = t->stack;
+        nk_stack_size_t stack_size = t->stack_size;
+        nk_wait_queue_t *waitq = t->waitq;
+        struct nk_timer *timer = t->timer;
+
+        // fpu_state is overwritten by nk_thread_run(), so only clear up to it
+        memset(t, 0, offsetof(nk_thread_t, fpu_state));
+
+        t->stack = stack;
+        t->stack_size = stack_size;
+        t->waitq = waitq;
+        t->timer = timer;
+
+        THREAD_DEBUG("Thread cache hit on CPU %d for stack size %lu => %p\n", cpu, size, t);
+    }
+
+    return t;
+}
+
+// returns 1 if the thread now belongs to the cache, 0 if caller must free it
+static int thread_cache_put(nk_thread_t *t)
+{
+    struct thread_cache *c;
+    struct thread_cache_bin *b;
+    int bin;
+    int rc = 0;
+    uint8_t flags;
+
+    if (!thread_cache_enabled || t->placement_cpu < 0 || t->placement_cpu >= nk_get_num_cpus()) {
+        return 0;
+    }
+
+    bin = thread_cache_bin(t->stack_size);
+
+    if (bin < 0 || thread_cache_stack_size(t->stack_size) != t->stack_size) {
+        return 0;
+    }
+
+    c = &thread_caches[t->placement_cpu];
+
+    if (!thread_cache_check_canary(t)) {
+        THREAD_ERROR("Thread %p (tid=%lu name=%s) overran its %lu byte stack - not recycling\n",
+                     t, t->tid, t->name, t->stack_size);
+        __sync_fetch_and_add(&c->corrupted, 1);
+        return 0;
+    }
+
+    b = &c->bins[bin];
+
+    flags = spin_lock_irq_save(&b->lock);
+    if (b->count < THREAD_CACHE_DEPTH) {
+        t->cache_next = b->head;
+        b->head = t;
+        b->count++;
+        c->recycled++;
+        rc = 1;
+    } else {
+        c->freed++;
+    }
+    spin_unlock_irq_restore(&b->lock, flags);
+
+    return rc;
+}
+
+int nk_thread_cache_enable(int enable)
+{
+    int old = thread_cache_enabled;
+    thread_cache_enabled = enable;
+    return old;
+}
+
+int nk_thread_cache_init(void)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    nk_stack_size_t size = thread_cache_stack_size(PAGE_SIZE);
+    int cpu, i, j;
+
+    memset(thread_caches, 0, sizeof(thread_caches));
+
+    for (cpu = 0; cpu < NAUT_CONFIG_MAX_CPUS; cpu++) {
+        for (i = 0; i < THREAD_CACHE_BINS; i++) {
+            spinlock_init(&thread_caches[cpu].bins[i].lock);
+        }
+    }
+
+    thread_cache_enabled = 1;
+
+    // prewarm the default stack size bin from each CPU's own memory
+    for (cpu = 0; cpu < sys->num_cpus; cpu++) {
+        for (j = 0; j < NAUT_CONFIG_THREAD_CACHE_PREWARM; j++) {
+            nk_thread_t *t = malloc_specific(sizeof(nk_thread_t), cpu);
+            if (!t) {
+                THREAD_ERROR("Failed to allocate thread to prewarm cache of CPU %d\n", cpu);
+                break;
+            }
+            memset(t, 0, sizeof(nk_thread_t));
+            t->stack_size = size;
+            t->stack = malloc_specific(size, cpu);
+            if (!t->stack) {
+                THREAD_ERROR("Failed to allocate stack to prewarm cache of CPU %d\n", cpu);
+                free(t);
+                break;
+            }
+            thread_cache_set_canary(t);
+            t->placement_cpu = cpu;
+            if (!thread_cache_put(t)) {
+                free(t->stack);
+                free(t);
+                break;
+            }
+        }
+        // prewarming is not a recycle
+        thread_caches[cpu].recycled = 0;
+    }
+
+    THREAD_INFO("Thread caches prewarmed with %d threads of stack size %lu per CPU\n",
+                NAUT_CONFIG_THREAD_CACHE_PREWARM, size);
+
+    return 0;
+}
+
+void nk_thread_cache_dump(void)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    int cpu, i;
+
+    for (cpu = 0; cpu < sys->num_cpus; cpu++) {
+        struct thread_cache *c = &thread_caches[cpu];
+        nk_vc_printf("cpu %d: hits=%lu misses=%lu recycled=%lu freed=%lu corrupted=%lu cached:",
+                     cpu, c->hits, c->misses, c->recycled, c->freed, c->corrupted);
+        for (i = 0; i < THREAD_CACHE_BINS; i++) {
+            if (c->bins[i].count) {
+                nk_vc_printf(" %luK=%lu", (1UL << (i + THREAD_CACHE_MIN_ORDER)) >> 10, c->bins[i].count);
+            }
+        }
+        nk_vc_printf("\n");
+    }
+}
+
+static int
+handle_threadcache (char * buf, void * priv)
+{
+    char what[16];
+
+    if (sscanf(buf,"threadcache %15s",what)==1) {
+        if (!strcmp(what,"on")) {
+            nk_thread_cache_enable(1);
+        } else if (!strcmp(what,"off")) {
+            nk_thread_cache_enable(0);
+        } else {
+            nk_vc_printf("threadcache [on|off]\n");
+            return 0;
+        }
+    }
+
+    nk_vc_printf("thread cache is %s\n", thread_cache_enabled ? "on" : "off");
+    nk_thread_cache_dump();
+
+    return 0;
+}
+
+static struct shell_cmd_impl threadcache_impl = {
+    .cmd      = "threadcache",
+    .help_str = "threadcache [on|off]",
+    .handler  = handle_threadcache,
+};
+nk_register_shell_cmd(threadcache_impl);
+
+#endif
+
+
 /****** EXTERNAL THREAD INTERFACE ******/
 
 
@@ -317,7 +601,13 @@ nk_thread_create (nk_thread_fun_t fun,
     int placement_cpu = bound_cpu<0 ? nk_sched_initial_placement() : bound_cpu;
     nk_stack_size_t required_stack_size = stack_size ? stack_size: PAGE_SIZE;
 
-    // First try to get a thread from the scheduler's pools
+#ifdef NAUT_CONFIG_THREAD_CACHE
+    // First try the placement CPU's cache of ready-to-use threads
+    if ((t=thread_cache_get(required_stack_size, placement_cpu))) {
+	// nothing to do - the thread was fully destroyed before caching
+    } else
+#endif
+    // Then try to get a thread from the scheduler's pools
     if ((t=nk_sched_reanimate(required_stack_size,
 			      placement_cpu))) {
 	// we have succeeded in reanimating a dead thread, so
@@ -341,6 +631,11 @@ nk_thread_create (nk_thread_fun_t fun,
 
 	memset(t, 0, sizeof(nk_thread_t));
 
+#ifdef NAUT_CONFIG_THREAD_CACHE
+	// round up so the thread can go back to a cache bin when destroyed
+	required_stack_size = thread_cache_stack_size(required_stack_size);
+#endif
+
 	t->stack_size = required_stack_size;
 
 	t->stack = (void*)malloc_specific(required_stack_size,placement_cpu);
@@ -351,6 +646,10 @@ nk_thread_create (nk_thread_fun_t fun,
 	    free(t);
 	    return -EINVAL;
 	}
+
+#ifdef NAUT_CONFIG_THREAD_CACHE
+	thread_cache_set_canary(t);
+#endif
 	
     }
     
@@ -566,7 +865,7 @@ void nk_thread_exit (void * retval)
     THREAD_DEBUG("Children joined\n");
 
     /* clear any thread local storage that may have been allocated */
-    tls_exit();
+    nk_tls_exit();
 
     THREAD_DEBUG("TLS exit complete\n");
 
@@ -645,6 +944,28 @@ nk_thread_destroy (nk_thread_id_t t)
 		     thethread, thethread->tid, thethread->name, thethread->num_wait);
     }
 
+    nk_sched_thread_state_deinit(thethread);
+
+#ifdef NAUT_CONFIG_ENABLE_BDWGC
+    nk_gc_bdwgc_thread_state_deinit(thethread);
+#endif
+
+#ifdef NAUT_CONFIG_PMC_VIRT
+    nk_pmc_thread_detach(thethread);
+#endif
+
+#ifdef NAUT_CONFIG_THREAD_CACHE
+    // like a reanimated thread, a cached thread keeps its wait queue
+    // and its (cancelled) timer
+    if (thethread->timer) {
+	nk_timer_cancel(thethread->timer);
+    }
+    if (thread_cache_put(thethread)) {
+	preempt_enable();
+	return;
+    }
+#endif
+
     /* remove its own wait queue 
      * (waiters should already have been notified */
     nk_wait_queue_destroy(thethread->waitq);
@@ -653,12 +974,6 @@ nk_thread_destroy (nk_thread_id_t t)
 	// cancel + destroy the timer if it exists
 	nk_timer_destroy(thethread->timer);
     }
-    
-    nk_sched_thread_state_deinit(thethread);
-
-#ifdef NAUT_CONFIG_ENABLE_BDWGC
-    nk_gc_bdwgc_thread_state_deinit(thethread);
-#endif
 
     free(thethread->stack);
     free(thethread);
@@ -713,6 +1028,10 @@ static void nk_thread_brain_wipe(nk_thread_t *t)
     nk_gc_bdwgc_thread_state_deinit(thethread);
 #endif
 
+#ifdef NAUT_CONFIG_PMC_VIRT
+    nk_pmc_thread_detach(thethread);
+#endif
+
     // nothing else is freed
 
     // do only absolutely minimal cleanup so we don't need to zero the whole thing
@@ -0,0 +1,527 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#include <nautilus/nautilus.h>
+#include <nautilus/cpu.h>
+#include <nautilus/thread.h>
+#include <nautilus/fs.h>
+#include <nautilus/shell.h>
+#include <nautilus/trace.h>
+#include <dev/serial.h>
+
+#define INFO(fmt, args...) INFO_PRINT("trace: " fmt, ##args)
+#define ERROR(fmt, args...) ERROR_PRINT("trace: " fmt, ##args)
+
+#define TRACE_ENTRIES (1UL << NAUT_CONFIG_TRACE_BUFFER_ORDER)
+
+volatile uint32_t nk_trace_mask = 0;
+
+static const struct {
+    char    *name;
+    uint32_t cat;
+} trace_types[NK_TRACE_EV_MAX] = {
+    [NK_TRACE_EV_SWITCH]       = { "switch",  NK_TRACE_SCHED },
+    [NK_TRACE_EV_SLEEP]        = { "sleep",   NK_TRACE_SCHED },
+    [NK_TRACE_EV_YIELD]        = { "yield",   NK_TRACE_SCHED },
+    [NK_TRACE_EV_EXIT]         = { "exit",    NK_TRACE_SCHED },
+    [NK_TRACE_EV_CHANGE]       = { "change",  NK_TRACE_SCHED },
+    [NK_TRACE_EV_IRQ_ENTER]    = { "irq",     NK_TRACE_IRQ },
+    [NK_TRACE_EV_IRQ_EXIT]     = { "irq",     NK_TRACE_IRQ },
+    [NK_TRACE_EV_XCALL_SEND]   = { "xcall send", NK_TRACE_XCALL },
+    [NK_TRACE_EV_XCALL_ENTER]  = { "xcall",   NK_TRACE_XCALL },
+    [NK_TRACE_EV_XCALL_EXIT]   = { "xcall",   NK_TRACE_XCALL },
+    [NK_TRACE_EV_TASK_PRODUCE] = { "task produce", NK_TRACE_TASK },
+    [NK_TRACE_EV_TASK_CONSUME] = { "task consume", NK_TRACE_TASK },
+    [NK_TRACE_EV_WAIT_SLEEP]   = { "wait sleep", NK_TRACE_WAIT },
+    [NK_TRACE_EV_WAIT_WAKE]    = { "wait wake",  NK_TRACE_WAIT },
+    [NK_TRACE_EV_MALLOC]       = { "malloc",  NK_TRACE_KMEM },
+    [NK_TRACE_EV_FREE]         = { "free",    NK_TRACE_KMEM },
+};
+
+static const struct {
+    char    *name;
+    uint32_t mask;
+} trace_cats[] = {
+    { "sched", NK_TRACE_SCHED },
+    { "irq",   NK_TRACE_IRQ },
+    { "xcall", NK_TRACE_XCALL },
+    { "task",  NK_TRACE_TASK },
+    { "wait",  NK_TRACE_WAIT },
+    { "kmem",  NK_TRACE_KMEM },
+    { "all",   NK_TRACE_ALL },
+};
+
+static char *cat_name(uint32_t cat)
+{
+    int i;
+    for (i=0;i<sizeof(trace_cats)/sizeof(trace_cats[0]);i++) {
+	if (trace_cats[i].mask==cat) {
+	    return trace_cats[i].name;
+	}
+    }
+    return "?";
+}
+
+
+void nk_trace_record(uint32_t type, uint64_t a, uint64_t b)
+{
+    struct nk_trace_buf *tb = per_cpu_get(trace_buf);
+    struct nk_thread *t = get_cur_thread();
+    struct nk_trace_event *e;
+
+    if (!tb) {
+	return;
+    }
+
+    // an interrupt on this CPU may record between our reservation
+    // and our commit, so committed only matches head when idle
+    e = &tb->events[__sync_fetch_and_add(&tb->head,1) & tb->mask];
+
+    e->tsc = rdtsc();
+    e->a = a;
+    e->b = b;
+    e->tid = t ? t->tid : 0;
+    e->type = type;
+
+    __sync_fetch_and_add(&tb->committed,1);
+}
+
+
+int nk_trace_init(void)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    int i;
+
+    for (i=0;i<sys->num_cpus;i++) {
+	uint64_t size = sizeof(struct nk_trace_buf) + TRACE_ENTRIES*sizeof(struct nk_trace_event);
+	struct nk_trace_buf *tb = malloc_specific(size,i);
+	if (!tb) {
+	    ERROR("Cannot allocate trace buffer for cpu %d\n",i);
+	    continue;
+	}
+	memset(tb,0,size);
+	tb->mask = TRACE_ENTRIES-1;
+	sys->cpus[i]->trace_buf = tb;
+    }
+
+    INFO("inited (%lu events per cpu)\n", TRACE_ENTRIES);
+
+    return 0;
+}
+
+uint32_t nk_trace_set_mask(uint32_t mask)
+{
+    return __sync_lock_test_and_set(&nk_trace_mask, mask & NK_TRACE_ALL);
+}
+
+// wait for records in flight when the mask was cleared
+static void trace_quiesce(void)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    int i;
+
+    for (i=0;i<sys->num_cpus;i++) {
+	struct nk_trace_buf *tb = sys->cpus[i]->trace_buf;
+	while (tb && tb->committed != tb->head) {
+	    __asm__ __volatile__ ("pause");
+	}
+    }
+}
+
+void nk_trace_clear(void)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    uint32_t old = nk_trace_set_mask(0);
+    int i;
+
+    trace_quiesce();
+
+    for (i=0;i<sys->num_cpus;i++) {
+	struct nk_trace_buf *tb = sys->cpus[i]->trace_buf;
+	if (tb) {
+	    tb->head = tb->committed = 0;
+	}
+    }
+
+    nk_trace_set_mask(old);
+}
+
+
+/*
+  Output goes to a file if one is given and to the serial port otherwise
+*/
+struct trace_out {
+    nk_fs_fd_t fd;
+    int        err;
+    char       line[256];
+};
+
+static void out_write(struct trace_out *o, void *buf, size_t len)
+{
+    if (o->err) {
+	return;
+    }
+    if (o->fd==FS_BAD_FD) {
+	serial_write((const char *)buf);
+    } else if (nk_fs_write(o->fd,buf,len)!=len) {
+	ERROR("Short write of trace\n");
+	o->err = 1;
+    }
+}
+
+static void out_printf(struct trace_out *o, char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap,fmt);
+    n = vsnprintf(o->line,sizeof(o->line),fmt,ap);
+    va_end(ap);
+
+    if (n >= sizeof(o->line)) {
+	n = sizeof(o->line)-1;
+    }
+
+    out_write(o,o->line,n);
+}
+
+// the oldest retained event and the number retained
+static uint64_t trace_range(struct nk_trace_buf *tb, uint64_t *first)
+{
+    uint64_t n = tb->head > tb->mask+1 ? tb->mask+1 : tb->head;
+    *first = tb->head - n;
+    return n;
+}
+
+static uint64_t trace_base_tsc(struct sys_info *sys)
+{
+    uint64_t base = -1ULL, first;
+    int i;
+
+    for (i=0;i<sys->num_cpus;i++) {
+	struct nk_trace_buf *tb = sys->cpus[i]->trace_buf;
+	if (tb && trace_range(tb,&first)) {
+	    uint64_t tsc = tb->events[first & tb->mask].tsc;
+	    if (tsc < base) {
+		base = tsc;
+	    }
+	}
+    }
+
+    return base==-1ULL ? 0 : base;
+}
+
+
+/*
+  Chrome trace event format, which Perfetto also loads.  Each CPU is
+  a pid with two tracks: tid 0 has a slice per thread run and the
+  instant events, and tid 1 has the interrupt and xcall slices.
+  Timestamps are microseconds from the oldest event, derived from
+  the TSC and assumed to be synchronized across CPUs.
+*/
+static void json_event(struct trace_out *o, int *first_event, int cpu, int track,
+		       char ph, char *name, char *cat, uint64_t us, uint64_t ns,
+		       char *args)
+{
+    out_printf(o,"%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%lu.%03lu,\"pid\":%d,\"tid\":%d%s%s}",
+	       *first_event ? "\n" : ",\n", name, cat, ph, us, ns, cpu, track,
+	       ph=='i' ? ",\"s\":\"t\"" : "", args ? args : "");
+    *first_event = 0;
+}
+
+static void trace_dump_json(struct trace_out *o, struct sys_info *sys)
+{
+    uint64_t base = trace_base_tsc(sys);
+    int first_event = 1;
+    char name[32], args[96];
+    int i;
+
+    out_printf(o,"{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    for (i=0;i<sys->num_cpus;i++) {
+	struct nk_trace_buf *tb = sys->cpus[i]->trace_buf;
+	uint64_t khz = sys->cpus[i]->cpu_khz ? sys->cpus[i]->cpu_khz : 1000000;
+	uint64_t first, n, j;
+	int in_thread = 0;
+
+	if (!tb) {
+	    continue;
+	}
+
+	snprintf(args,sizeof(args),",\"args\":{\"name\":\"cpu %d\"}",i);
+	json_event(o,&first_event,i,0,'M',"process_name","__metadata",0,0,args);
+	json_event(o,&first_event,i,1,'M',"thread_name","__metadata",0,0,",\"args\":{\"name\":\"interrupts\"}");
+
+	for (n=trace_range(tb,&first), j=first; j<first+n && !o->err; j++) {
+	    struct nk_trace_event *e = &tb->events[j & tb->mask];
+	    uint64_t t = e->tsc - base;
+	    uint64_t ms = t / khz;
+	    uint64_t rem_ns = ((t % khz) * 1000000) / khz;
+	    uint64_t us = ms*1000 + rem_ns/1000;
+	    uint64_t ns = rem_ns%1000;
+	    char *cat;
+
+	    if (e->type <= NK_TRACE_EV_NONE || e->type >= NK_TRACE_EV_MAX) {
+		continue;
+	    }
+
+	    cat = cat_name(trace_types[e->type].cat);
+
+	    switch (e->type) {
+	    case NK_TRACE_EV_SWITCH:
+		if (in_thread) {
+		    json_event(o,&first_event,i,0,'E',"","sched",us,ns,0);
+		}
+		snprintf(name,sizeof(name),"thread %lu",e->b);
+		snprintf(args,sizeof(args),",\"args\":{\"from\":%lu,\"to\":%lu}",e->a,e->b);
+		json_event(o,&first_event,i,0,'B',name,cat,us,ns,args);
+		in_thread = 1;
+		break;
+	    case NK_TRACE_EV_IRQ_ENTER:
+		snprintf(name,sizeof(name),"irq %lu",e->a);
+		json_event(o,&first_event,i,1,'B',name,cat,us,ns,0);
+		break;
+	    case NK_TRACE_EV_XCALL_ENTER:
+		snprintf(args,sizeof(args),",\"args\":{\"fun\":\"%p\"}",(void*)e->a);
+		json_event(o,&first_event,i,1,'B',"xcall",cat,us,ns,args);
+		break;
+	    case NK_TRACE_EV_IRQ_EXIT:
+	    case NK_TRACE_EV_XCALL_EXIT:
+		json_event(o,&first_event,i,1,'E',"",cat,us,ns,0);
+		break;
+	    default:
+		snprintf(args,sizeof(args),",\"args\":{\"tid\":%u,\"a\":\"0x%lx\",\"b\":\"0x%lx\"}",e->tid,e->a,e->b);
+		json_event(o,&first_event,i,0,'i',trace_types[e->type].name,cat,us,ns,args);
+		break;
+	    }
+	}
+    }
+
+    out_printf(o,"\n]}\n");
+}
+
+
+/*
+  Binary format, all fields little endian:
+
+    struct trace_bin_header, then for each CPU with a buffer
+    struct trace_bin_cpu followed by count struct nk_trace_events,
+    oldest first
+*/
+#define TRACE_BIN_MAGIC 0x0045434152544b4eULL  // "NKTRACE"
+
+struct trace_bin_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t num_cpus;
+    uint32_t event_size;
+    uint32_t mask;     // categories enabled at the dump
+} __packed;
+
+struct trace_bin_cpu {
+    uint32_t cpu;
+    uint32_t cpu_khz;
+    uint64_t count;
+    uint64_t lost;     // events overwritten
+} __packed;
+
+static void trace_dump_bin(struct trace_out *o, struct sys_info *sys, uint32_t mask)
+{
+    struct trace_bin_header h = { TRACE_BIN_MAGIC, 1, 0, sizeof(struct nk_trace_event), mask };
+    int i;
+
+    for (i=0;i<sys->num_cpus;i++) {
+	h.num_cpus += !!sys->cpus[i]->trace_buf;
+    }
+
+    out_write(o,&h,sizeof(h));
+
+    for (i=0;i<sys->num_cpus;i++) {
+	struct nk_trace_buf *tb = sys->cpus[i]->trace_buf;
+	struct trace_bin_cpu c;
+	uint64_t first, n, start;
+
+	if (!tb) {
+	    continue;
+	}
+
+	n = trace_range(tb,&first);
+
+	c.cpu = i;
+	c.cpu_khz = sys->cpus[i]->cpu_khz;
+	c.count = n;
+	c.lost = first;
+
+	out_write(o,&c,sizeof(c));
+
+	// the retained events may wrap around the end of the buffer
+	start = first & tb->mask;
+	if (start + n > tb->mask+1) {
+	    out_write(o,&tb->events[start],(tb->mask+1-start)*sizeof(struct nk_trace_event));
+	    out_write(o,&tb->events[0],(start+n-tb->mask-1)*sizeof(struct nk_trace_event));
+	} else {
+	    out_write(o,&tb->events[start],n*sizeof(struct nk_trace_event));
+	}
+    }
+}
+
+int nk_trace_dump(int format, char *path)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    struct trace_out o = { .fd = FS_BAD_FD, .err = 0 };
+    uint32_t mask;
+
+    if (format==NK_TRACE_FORMAT_BIN && !path) {
+	ERROR("Binary trace dump requires a file\n");
+	return -1;
+    }
+
+    if (path) {
+	o.fd = nk_fs_open(path,O_CREAT|O_TRUNC|O_WRONLY,0);
+	if (FS_FD_ERR(o.fd)) {
+	    ERROR("Cannot open %s\n",path);
+	    return -1;
+	}
+    }
+
+    // the dump itself (serial, fs, wait queues) should not be traced
+    mask = nk_trace_set_mask(0);
+    trace_quiesce();
+
+    if (format==NK_TRACE_FORMAT_BIN) {
+	trace_dump_bin(&o,sys,mask);
+    } else {
+	trace_dump_json(&o,sys);
+    }
+
+    nk_trace_set_mask(mask);
+
+    if (path) {
+	nk_fs_close(o.fd);
+    }
+
+    return o.err ? -1 : 0;
+}
+
+
+static int parse_cats(char *buf, uint32_t *mask)
+{
+    char *tok;
+    int i, found;
+
+    *mask = 0;
+
+    for (tok=strtok(buf," \t");tok;tok=strtok(0," \t")) {
+	for (found=0, i=0;i<sizeof(trace_cats)/sizeof(trace_cats[0]);i++) {
+	    if (!strcmp(tok,trace_cats[i].name)) {
+		*mask |= trace_cats[i].mask;
+		found = 1;
+	    }
+	}
+	if (!found) {
+	    nk_vc_printf("unknown category %s\n",tok);
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+static void trace_status(void)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    uint32_t mask = nk_trace_mask;
+    int i;
+
+    nk_vc_printf("tracing:");
+    for (i=0;i<sizeof(trace_cats)/sizeof(trace_cats[0])-1;i++) {
+	if (mask & trace_cats[i].mask) {
+	    nk_vc_printf(" %s",trace_cats[i].name);
+	}
+    }
+    nk_vc_printf("%s\n", mask ? "" : " off");
+
+    for (i=0;i<sys->num_cpus;i++) {
+	struct nk_trace_buf *tb = sys->cpus[i]->trace_buf;
+	uint64_t first, n;
+	if (tb) {
+	    n = trace_range(tb,&first);
+	    nk_vc_printf("cpu %d: %lu events (%lu overwritten)\n", i, n, first);
+	}
+    }
+}
+
+static int
+handle_trace (char * buf, void * priv)
+{
+    char what[16], fmt[16], path[80];
+    uint32_t mask;
+    int n;
+
+    if (sscanf(buf,"trace %15s",what)!=1 || !strcmp(what,"status")) {
+	trace_status();
+	return 0;
+    }
+
+    if (!strcmp(what,"on")) {
+	buf += strlen("trace on");
+	if (parse_cats(buf,&mask)) {
+	    return 0;
+	}
+	nk_trace_set_mask(mask ? mask : NK_TRACE_ALL);
+	trace_status();
+	return 0;
+    }
+
+    if (!strcmp(what,"off")) {
+	nk_trace_set_mask(0);
+	return 0;
+    }
+
+    if (!strcmp(what,"clear")) {
+	nk_trace_clear();
+	return 0;
+    }
+
+    if (!strcmp(what,"dump")) {
+	n = sscanf(buf,"trace dump %15s %79s",fmt,path);
+	if (n<1) {
+	    strcpy(fmt,"json");
+	}
+	if (strcmp(fmt,"json") && strcmp(fmt,"bin")) {
+	    nk_vc_printf("unknown format %s\n",fmt);
+	    return 0;
+	}
+	if (nk_trace_dump(strcmp(fmt,"bin") ? NK_TRACE_FORMAT_JSON : NK_TRACE_FORMAT_BIN,
+			  n==2 ? path : 0)) {
+	    nk_vc_printf("trace dump failed\n");
+	}
+	return 0;
+    }
+
+    nk_vc_printf("trace [status|on [sched|irq|xcall|task|wait|kmem|all]*|off|clear|dump [json|bin] [file]]\n");
+    return 0;
+}
+
+static struct shell_cmd_impl trace_impl = {
+    .cmd      = "trace",
+    .help_str = "trace [status|on [cat]*|off|clear|dump [json|bin] [file]]",
+    .handler  = handle_trace,
+};
+nk_register_shell_cmd(trace_impl);
@@ -279,6 +279,10 @@ static int _destroy_vc(struct nk_virtual_console *vc, int havelock, uint8_t flag
   list_del(&vc->vc_node);
   STATE_UNLOCK();
 
+#ifdef NAUT_CONFIG_PRINTK_RING
+  nk_printk_ring_release_vc(vc);
+#endif
+
   // release lock early so the following can do output
   nk_wait_queue_destroy(vc->waiting_threads);
 #ifdef NAUT_CONFIG_VIRTUAL_CONSOLE_DISPLAY_NAME
@@ -27,6 +27,7 @@
 #include <nautilus/waitqueue.h>
 #include <nautilus/scheduler.h>
 #include <nautilus/shell.h>
+#include <nautilus/trace.h>
 
 
 /*
@@ -142,6 +143,8 @@ void nk_wait_queue_sleep_extended(nk_wait_queue_t *wq, int (*cond_check)(void *s
 	
 	WQ_DEBUG("Thread %lu (%s) is having the scheduler put itself to sleep on queue %s\n", t->tid, t->name, wq->name);
 
+	NK_TRACE(NK_TRACE_WAIT,NK_TRACE_EV_WAIT_SLEEP,wq,0);
+
 	// We now get the scheduler to do a context switch
 	// and just after it completes its scheduling pass, 
 	// it will release the wait queue lock for us
@@ -270,6 +273,8 @@ void nk_wait_queue_sleep_extended_multiple(int num_wq, nk_wait_queue_t **wq, int
 	
 	WQ_DEBUG("Thread %lu (%s) is having the scheduler put itself to sleep on all the queues\n", t->tid, t->name);
 
+	NK_TRACE(NK_TRACE_WAIT,NK_TRACE_EV_WAIT_SLEEP,wq[0],num_wq);
+
 	// We now get the scheduler to do a context switch
 	// and just after it completes its scheduling pass, 
 	// it will release all of the wait queue locks for us
@@ -343,6 +348,8 @@ void nk_wait_queue_wake_one_extended(nk_wait_queue_t * q, int havelock)
 	    goto out;
 	}
 
+	NK_TRACE(NK_TRACE_WAIT,NK_TRACE_EV_WAIT_WAKE,q,t->tid);
+
 	nk_sched_kick_cpu(t->current_cpu);
 
 	//WQ_DEBUG("Thread queue wake one (q=%p) woke up thread %lu (%s)\n", (void*)q, t->tid, t->name);
@@ -387,6 +394,8 @@ void nk_wait_queue_wake_all_extended(nk_wait_queue_t * q, int havelock)
 		WQ_ERROR("Failed to awaken thread\n");
 		goto out;
 	    }
+
+	    NK_TRACE(NK_TRACE_WAIT,NK_TRACE_EV_WAIT_WAKE,q,t->tid);
 	    
 	    nk_sched_kick_cpu(t->current_cpu);
 
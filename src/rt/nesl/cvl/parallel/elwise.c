@@ -0,0 +1,255 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include "../serial/defins.h"
+#include "par.h"
+
+/* Elementwise functions: each worker calls the serial function on
+ * its part of the vectors.  The arithmetic and bitwise functions
+ * also have AVX2 versions, used for the parts if the CPU has it.
+ */
+
+struct elw_args {
+    cvl_fun_p f;
+    int       nsrc;
+    int       len;
+    char     *d, *s[3];
+    int       dsize, ssize[3];
+};
+
+static void elw_part(void *arg, int p)
+{
+    struct elw_args *a = (struct elw_args *)arg;
+    int r[2];
+
+    if (!cvl_par_range(r, p, a->len)) {
+	return;
+    }
+
+#define _at(_v, _size) ((vec_p)((_v) + (long)r[0] * (_size)))
+    switch (a->nsrc) {
+    case 1:
+	a->f(_at(a->d, a->dsize), _at(a->s[0], a->ssize[0]),
+	     r[1] - r[0], CVL_SCRATCH_NULL);
+	break;
+    case 2:
+	a->f(_at(a->d, a->dsize), _at(a->s[0], a->ssize[0]),
+	     _at(a->s[1], a->ssize[1]), r[1] - r[0], CVL_SCRATCH_NULL);
+	break;
+    case 3:
+	a->f(_at(a->d, a->dsize), _at(a->s[0], a->ssize[0]),
+	     _at(a->s[1], a->ssize[1]), _at(a->s[2], a->ssize[2]),
+	     r[1] - r[0], CVL_SCRATCH_NULL);
+	break;
+    }
+#undef _at
+}
+
+static void elwise(cvl_fun_p f, int nsrc, int len, vec_p d, int dsize,
+		   vec_p s1, int s1size, vec_p s2, int s2size, vec_p s3, int s3size)
+{
+    struct elw_args a = { .f = f, .nsrc = nsrc, .len = len,
+			  .d = (char *)d, .dsize = dsize,
+			  .s = { (char *)s1, (char *)s2, (char *)s3 },
+			  .ssize = { s1size, s2size, s3size } };
+
+    cvl_par_run(elw_part, &a);
+}
+
+/* --------------------AVX2 versions-----------------------------*/
+
+typedef int    v8si __attribute__((vector_size(32), aligned(4)));
+typedef double v4df __attribute__((vector_size(32), aligned(8)));
+
+#define simd_twofun(_name, _funct, _type, _vtype)			\
+    static void __attribute__((target("avx2"), noinline))		\
+    GLUE(simd_block_,_name)(_type *dest, _type *src1, _type *src2, int len) \
+    {									\
+	int i, w = sizeof(_vtype) / sizeof(_type);			\
+									\
+	for (i = 0; i + w <= len; i += w) {				\
+	    *(_vtype *)(dest + i) = _funct(*(_vtype *)(src1 + i),	\
+					   *(_vtype *)(src2 + i));	\
+	}								\
+	for (; i < len; i++) {						\
+	    dest[i] = _funct(src1[i], src2[i]);				\
+	}								\
+    }									\
+									\
+    static void								\
+    GLUE(simd_,_name)(vec_p d, vec_p s1, vec_p s2, int len, vec_p scratch) \
+    {									\
+	_type *dest = (_type *)d;					\
+	_type *src1 = (_type *)s1;					\
+	_type *src2 = (_type *)s2;					\
+	int i, n;							\
+									\
+	for (i = 0; i < len; i += n) {					\
+	    n = len - i < CVL_SIMD_BLOCK ? len - i : CVL_SIMD_BLOCK;	\
+	    preempt_disable();						\
+	    GLUE(simd_block_,_name)(dest + i, src1 + i, src2 + i, n);	\
+	    preempt_enable();						\
+	}								\
+    }
+
+simd_twofun(add_wuz, plus, int, v8si)
+simd_twofun(sub_wuz, minus, int, v8si)
+simd_twofun(mul_wuz, times, int, v8si)
+simd_twofun(and_wuz, band, int, v8si)
+simd_twofun(ior_wuz, bor, int, v8si)
+simd_twofun(xor_wuz, xor, int, v8si)
+
+simd_twofun(add_wud, plus, double, v4df)
+simd_twofun(sub_wud, minus, double, v4df)
+simd_twofun(mul_wud, times, double, v4df)
+simd_twofun(div_wud, divide, double, v4df)
+
+/* --------------Function definition macros --------------------*/
+
+#define par_fun(_name, _kernel, _nsrc, _args, ...)			\
+    static void GLUE(par_,_name) _args					\
+    {									\
+	if (len < CVL_PAR_MIN || !cvl_par_begin()) {			\
+	    _name _call_ ## _nsrc;					\
+	    return;							\
+	}								\
+	elwise((cvl_fun_p)(_kernel), _nsrc, len, __VA_ARGS__);		\
+	cvl_par_end();							\
+    }
+
+#define _call_1 (d, s, len, scratch)
+#define _call_2 (d, s1, s2, len, scratch)
+#define _call_3 (d, s1, s2, s3, len, scratch)
+
+#define onefun(_name, _srctype, _desttype)				\
+    par_fun(_name, _name, 1,						\
+	    (vec_p d, vec_p s, int len, vec_p scratch),			\
+	    d, sizeof(_desttype), s, sizeof(_srctype), 0, 0, 0, 0)
+
+#define twofun_k(_name, _kernel, _srctype, _desttype)			\
+    par_fun(_name, _kernel, 2,						\
+	    (vec_p d, vec_p s1, vec_p s2, int len, vec_p scratch),	\
+	    d, sizeof(_desttype), s1, sizeof(_srctype),			\
+	    s2, sizeof(_srctype), 0, 0)
+
+#define twofun(_name, _srctype, _desttype)				\
+    twofun_k(_name, _name, _srctype, _desttype)
+
+#define twofun_simd(_name, _srctype, _desttype)			\
+    twofun_k(_name, (cvl_par.avx2 ? GLUE(simd_,_name) : _name),	\
+	     _srctype, _desttype)
+
+#define selfun(_name, _type)						\
+    par_fun(_name, _name, 3,						\
+	    (vec_p d, vec_p s1, vec_p s2, vec_p s3, int len, vec_p scratch), \
+	    d, sizeof(_type), s1, sizeof(cvl_bool),			\
+	    s2, sizeof(_type), s3, sizeof(_type))
+
+twofun_simd(add_wuz, int, int)
+twofun_simd(add_wud, double, double)
+twofun_simd(sub_wuz, int, int)
+twofun_simd(sub_wud, double, double)
+twofun_simd(mul_wuz, int, int)
+twofun_simd(mul_wud, double, double)
+twofun(div_wuz, int, int)
+twofun_simd(div_wud, double, double)
+twofun(max_wuz, int, int)
+twofun(max_wud, double, double)
+twofun(min_wuz, int, int)
+twofun(min_wud, double, double)
+
+twofun(grt_wuz, int, cvl_bool)
+twofun(grt_wud, double, cvl_bool)
+twofun(les_wuz, int, cvl_bool)
+twofun(les_wud, double, cvl_bool)
+twofun(geq_wuz, int, cvl_bool)
+twofun(geq_wud, double, cvl_bool)
+twofun(leq_wuz, int, cvl_bool)
+twofun(leq_wud, double, cvl_bool)
+twofun(eql_wuz, int, cvl_bool)
+twofun(eql_wud, double, cvl_bool)
+twofun(eql_wub, cvl_bool, cvl_bool)
+twofun(neq_wuz, int, cvl_bool)
+twofun(neq_wud, double, cvl_bool)
+twofun(neq_wub, cvl_bool, cvl_bool)
+
+twofun(lsh_wuz, int, int)
+twofun(rsh_wuz, int, int)
+twofun(mod_wuz, int, int)
+
+selfun(sel_wuz, int)
+selfun(sel_wub, cvl_bool)
+selfun(sel_wud, double)
+
+onefun(not_wub, cvl_bool, cvl_bool)
+twofun(xor_wub, cvl_bool, cvl_bool)
+twofun(ior_wub, cvl_bool, cvl_bool)
+twofun(and_wub, cvl_bool, cvl_bool)
+
+twofun_simd(ior_wuz, int, int)
+twofun_simd(and_wuz, int, int)
+onefun(not_wuz, int, int)
+twofun_simd(xor_wuz, int, int)
+
+onefun(int_wud, double, int)
+onefun(int_wub, cvl_bool, int)
+onefun(dbl_wuz, int, double)
+onefun(boo_wuz, int, cvl_bool)
+
+onefun(flr_wud, double, int)
+onefun(cei_wud, double, int)
+onefun(trn_wud, double, int)
+onefun(rou_wud, double, int)
+onefun(exp_wud, double, double)
+onefun(log_wud, double, double)
+onefun(sqt_wud, double, double)
+onefun(sin_wud, double, double)
+onefun(cos_wud, double, double)
+onefun(tan_wud, double, double)
+onefun(asn_wud, double, double)
+onefun(acs_wud, double, double)
+onefun(atn_wud, double, double)
+onefun(snh_wud, double, double)
+onefun(csh_wud, double, double)
+onefun(tnh_wud, double, double)
+
+/* rnd_wuz stays serial, random() keeps state */
+
+#define map(_name) { (cvl_fun_p)_name, (cvl_fun_p)GLUE(par_,_name) }
+
+cvl_par_map_t cvl_par_elwise_map[] = {
+    map(add_wuz), map(add_wud), map(sub_wuz), map(sub_wud),
+    map(mul_wuz), map(mul_wud), map(div_wuz), map(div_wud),
+    map(max_wuz), map(max_wud), map(min_wuz), map(min_wud),
+    map(grt_wuz), map(grt_wud), map(les_wuz), map(les_wud),
+    map(geq_wuz), map(geq_wud), map(leq_wuz), map(leq_wud),
+    map(eql_wuz), map(eql_wud), map(eql_wub),
+    map(neq_wuz), map(neq_wud), map(neq_wub),
+    map(lsh_wuz), map(rsh_wuz), map(mod_wuz),
+    map(sel_wuz), map(sel_wub), map(sel_wud),
+    map(not_wub), map(xor_wub), map(ior_wub), map(and_wub),
+    map(ior_wuz), map(and_wuz), map(not_wuz), map(xor_wuz),
+    map(int_wud), map(int_wub), map(dbl_wuz), map(boo_wuz),
+    map(flr_wud), map(cei_wud), map(trn_wud), map(rou_wud),
+    map(exp_wud), map(log_wud), map(sqt_wud), map(sin_wud),
+    map(cos_wud), map(tan_wud), map(asn_wud), map(acs_wud),
+    map(atn_wud), map(snh_wud), map(csh_wud), map(tnh_wud),
+    { 0, 0 }
+};
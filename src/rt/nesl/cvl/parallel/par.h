@@ -0,0 +1,101 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#ifndef _CVL_PAR_H
+#define _CVL_PAR_H
+
+#include <nautilus/nautilus.h>
+#include <cvl.h>
+#include "../serial/parallel.h"
+
+/*
+ * Parallel CVL
+ *
+ * A parallel function splits its vectors into one part per
+ * worker with chunk_range, and the workers, one per CPU with the
+ * caller as part 0, each do their part with the same loop as the
+ * serial function.  Scans and reductions take two passes, one to
+ * sum each part and one to finish each part given the sum of the
+ * parts before it.  Segmented functions give each worker a run of
+ * whole segments, unless there are only a few segments, in which
+ * case they do the segments one at a time, each in parallel.
+ *
+ * Vectors shorter than CVL_PAR_MIN, or calls made while another
+ * parallel function is running, go to the serial function.
+ */
+
+#define CVL_PAR_MIN      16384
+#define CVL_PAR_MAX      NAUT_CONFIG_MAX_CPUS
+#define CVL_PAR_BUCKETS  256            /* radix rank buckets */
+
+/* split segments between the workers when there are at least this
+   many per worker */
+#define CVL_PAR_SEGS     4
+
+/* The thread switch saves vector state with fxsave, which leaves out
+   the upper halves of the AVX registers, so the AVX2 loops run with
+   preemption off, this many elements at a time.  Each block is a
+   call into an AVX function, which clears the upper halves on its
+   way out, so none are live while preemption is on. */
+#define CVL_SIMD_BLOCK   4096
+
+struct cvl_par {
+    int     parts;                      /* workers, including the caller */
+    int     avx2;                       /* AVX2 can be used */
+
+    /* state of the function running, see cvl_par_begin */
+    int     seg[CVL_PAR_MAX + 1];       /* first segment of each part */
+    int     elt[CVL_PAR_MAX + 1];       /* and its first element */
+    int     elt2[CVL_PAR_MAX + 1];      /* in the second descriptor */
+    int     zpart[CVL_PAR_MAX];         /* per part sums */
+    double  dpart[CVL_PAR_MAX];
+    int    *hist;                       /* parts * CVL_PAR_BUCKETS */
+};
+
+extern struct cvl_par cvl_par;
+
+/* Claim the workers, returns zero if the caller must run serially */
+int  cvl_par_begin(void);
+void cvl_par_end(void);
+
+/* Call func(arg, part) for every part, in parallel, and wait */
+void cvl_par_run(void (*func)(void *arg, int part), void *arg);
+
+/* Split m segments into a run per part, filling in seg and elt, and
+   elt2 from segd2 if it is given */
+void cvl_par_split(int *segd, int *segd2, int m);
+
+/* the element range [r[0], r[1]) of part p of len elements,
+   returns zero if it is empty */
+static inline int cvl_par_range(int *r, int p, int len)
+{
+    chunk_range(r, p, len, cvl_par.parts);
+    return r[0] >= 0 && r[1] > r[0];
+}
+
+typedef struct {
+    cvl_fun_p serial;
+    cvl_fun_p parallel;
+} cvl_par_map_t;
+
+extern cvl_par_map_t cvl_par_elwise_map[];
+extern cvl_par_map_t cvl_par_vprims_map[];
+extern cvl_par_map_t cvl_par_rank_map[];
+
+#endif
@@ -0,0 +1,254 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#include <nautilus/nautilus.h>
+#include <nautilus/thread.h>
+#include <nautilus/futex.h>
+#include <nautilus/cpuid.h>
+
+#include "par.h"
+
+#define ERROR(fmt, args...) ERROR_PRINT("cvl: " fmt, ##args)
+#define INFO(fmt, args...)  INFO_PRINT("cvl: " fmt, ##args)
+
+/*
+ * The workers, one bound to each CPU but the first, wait for the
+ * job generation to change, do their part, and count themselves
+ * out.  The caller does part 0 and waits for the count to reach
+ * zero before it returns, so a job is never changed while a worker
+ * can still see it.  Both sides spin for a while before they sleep,
+ * since parallel functions tend to come one after another.
+ */
+
+#define SPIN_LIMIT 4096
+
+struct cvl_par cvl_par;
+
+static struct {
+    void (*func)(void *arg, int part);
+    void  *arg;
+} job;
+
+static volatile uint32_t job_gen;
+static volatile uint32_t job_pending;
+static volatile int      busy;
+
+
+static void wait_change(volatile uint32_t *word, uint32_t val)
+{
+    int i;
+
+    for (i = 0; i < SPIN_LIMIT; i++) {
+        if (*word != val) {
+            return;
+        }
+        __asm__ __volatile__ ("pause");
+    }
+
+    while (*word == val) {
+        nk_futex_wait(word, val, 0);
+    }
+}
+
+
+static void worker(void *in, void **out)
+{
+    int part = (int)(uint64_t)in;
+    uint32_t gen = 0;
+    char name[32];
+
+    snprintf(name, sizeof(name), "(cvl-%d)", part);
+    nk_thread_name(get_cur_thread(), name);
+
+    while (1) {
+        wait_change(&job_gen, gen);
+        gen = job_gen;
+        __sync_synchronize();
+
+        job.func(job.arg, part);
+
+        if (!__sync_sub_and_fetch(&job_pending, 1)) {
+            nk_futex_wake(&job_pending, 1);
+        }
+    }
+}
+
+
+void cvl_par_run(void (*func)(void *arg, int part), void *arg)
+{
+    uint32_t left;
+
+    job.func = func;
+    job.arg = arg;
+    job_pending = cvl_par.parts - 1;
+
+    __sync_synchronize();
+    job_gen++;
+    nk_futex_wake(&job_gen, NK_FUTEX_WAKE_ALL);
+
+    func(arg, 0);
+
+    while ((left = job_pending)) {
+        wait_change(&job_pending, left);
+    }
+
+    __sync_synchronize();
+}
+
+
+int cvl_par_begin(void)
+{
+    return cvl_par.parts > 1 && __sync_bool_compare_and_swap(&busy, 0, 1);
+}
+
+
+void cvl_par_end(void)
+{
+    __sync_synchronize();
+    busy = 0;
+}
+
+
+struct split_args {
+    int *segd;
+    int *segd2;
+    int  m;
+};
+
+static void split_sum(void *arg, int p)
+{
+    struct split_args *a = (struct split_args *)arg;
+    int r[2], i, sum = 0, sum2 = 0;
+
+    if (cvl_par_range(r, p, a->m)) {
+        for (i = r[0]; i < r[1]; i++) {
+            sum += a->segd[i];
+        }
+        if (a->segd2) {
+            for (i = r[0]; i < r[1]; i++) {
+                sum2 += a->segd2[i];
+            }
+        }
+    } else {
+        r[0] = a->m;
+    }
+
+    cvl_par.seg[p] = r[0];
+    cvl_par.elt[p + 1] = sum;
+    cvl_par.elt2[p + 1] = sum2;
+}
+
+void cvl_par_split(int *segd, int *segd2, int m)
+{
+    struct split_args a = { .segd = segd, .segd2 = segd2, .m = m };
+    int p;
+
+    cvl_par_run(split_sum, &a);
+
+    cvl_par.seg[cvl_par.parts] = m;
+    cvl_par.elt[0] = 0;
+    cvl_par.elt2[0] = 0;
+    for (p = 1; p <= cvl_par.parts; p++) {
+        cvl_par.elt[p] += cvl_par.elt[p - 1];
+        cvl_par.elt2[p] += cvl_par.elt2[p - 1];
+    }
+}
+
+
+// AVX2 needs the CPU to have it and the kernel to have turned on the
+// AVX state in XCR0.  Thread switches do not save the upper halves,
+// which the AVX2 loops deal with, see CVL_SIMD_BLOCK
+static int avx2_usable(void)
+{
+    cpuid_ret_t r;
+    uint32_t lo, hi;
+
+    cpuid(1, &r);
+    if (!(r.c & (1 << 27)) || !(r.c & (1 << 28))) {    // OSXSAVE, AVX
+        return 0;
+    }
+
+    cpuid_sub(7, 0, &r);
+    if (!(r.b & (1 << 5))) {                            // AVX2
+        return 0;
+    }
+
+    __asm__ __volatile__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+
+    return (lo & 0x6) == 0x6;
+}
+
+
+int cvl_par_init(void)
+{
+    int n = nk_get_num_cpus();
+    int p;
+
+    if (cvl_par.parts) {
+        return 0;
+    }
+
+    if (n > CVL_PAR_MAX) {
+        n = CVL_PAR_MAX;
+    }
+
+    cvl_par.avx2 = avx2_usable();
+
+    cvl_par.hist = malloc(sizeof(int) * CVL_PAR_BUCKETS * n);
+    if (!cvl_par.hist) {
+        ERROR("Cannot allocate rank histograms\n");
+        return -1;
+    }
+
+    for (p = 1; p < n; p++) {
+        if (nk_thread_start(worker, (void *)(uint64_t)p, 0, 1, 0, 0, p)) {
+            ERROR("Cannot start worker %d, continuing with %d\n", p, p);
+            break;
+        }
+    }
+
+    cvl_par.parts = p;
+
+    INFO("%d workers%s\n", cvl_par.parts, cvl_par.avx2 ? ", using AVX2" : "");
+
+    return 0;
+}
+
+
+static cvl_par_map_t *maps[] = {
+    cvl_par_elwise_map,
+    cvl_par_vprims_map,
+    cvl_par_rank_map,
+    0
+};
+
+cvl_fun_p cvl_par_find(cvl_fun_p serial)
+{
+    cvl_par_map_t **map, *m;
+
+    for (map = maps; *map; map++) {
+        for (m = *map; m->serial; m++) {
+            if (m->serial == serial) {
+                return m->parallel;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,348 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <limits.h>
+#include "par.h"
+
+/* Segmented ranks, with the same algorithm, scratch layout and
+ * results as serial/rank.c.  Each radix pass counts the digits of
+ * every part into its own histogram, scans the histograms digit
+ * major, part minor, so that each part knows where its elements of
+ * each digit go, and then moves the parts' elements in order, which
+ * keeps the rank stable.  The passes alternate between tmp and the
+ * result instead of copying back.
+ */
+
+#define BitsPerWord	(sizeof(int) * CHAR_BIT)
+#define BitsPerPass	8
+#define NumBuckets	(1<<BitsPerPass)
+#define BitsForPassMask	~(~0 << BitsPerPass)
+#define bits(_x,_k) 	((((unsigned)_x) >> _k) & BitsForPassMask)
+#define SIGNBIT (1 << ((BitsPerWord)-1))
+#define IntsInDouble (sizeof(double) / sizeof(unsigned))
+
+#if NumBuckets != CVL_PAR_BUCKETS
+#error "CVL_PAR_BUCKETS must match the rank digit size"
+#endif
+
+/* see serial/rank.c */
+#undef FP_LITTLE_ENDIAN
+#if mips | alpha | __i860 | i386
+#ifndef sgi
+#define FP_LITTLE_ENDIAN 1
+#endif
+#endif
+
+struct rank_args {
+    unsigned *src;              /* keys */
+    double   *dsrc;             /* doubles to take keys from */
+    int      *from, *to;        /* permutation in and out of a pass */
+    unsigned *rank;
+    int      *segd;
+    int       n;
+    int       word;             /* of the double */
+    int       shift;            /* of the digit */
+    unsigned  mask;
+    int       isUp;
+};
+
+#define for_part(_a, _p, _i)					\
+    int _r[2];							\
+    if (!cvl_par_range(_r, _p, (_a)->n)) {			\
+	return;							\
+    }								\
+    for (_i = _r[0]; _i < _r[1]; _i++)
+
+static void hist_part(void *arg, int p)
+{
+    struct rank_args *a = (struct rank_args *)arg;
+    int *hist = cvl_par.hist + p * NumBuckets;
+    int i;
+
+    memset(hist, 0, sizeof(int) * NumBuckets);
+    for_part(a, p, i) {
+	hist[bits(a->src[a->from[i]], a->shift)]++;
+    }
+}
+
+static void move_part(void *arg, int p)
+{
+    struct rank_args *a = (struct rank_args *)arg;
+    int *hist = cvl_par.hist + p * NumBuckets;
+    int i;
+
+    for_part(a, p, i) {
+	a->to[hist[bits(a->src[a->from[i]], a->shift)]++] = a->from[i];
+    }
+}
+
+/* the permutation comes in in tmp, and goes out in tmp, with result
+   used as the other buffer */
+static void field_rank(int *result, unsigned *source, int *tmp, int n)
+{
+    struct rank_args a = { .src = source, .from = tmp, .to = result, .n = n };
+    int *t;
+    int b, p, sum, count;
+
+    for (a.shift = 0; a.shift < BitsPerWord; a.shift += BitsPerPass) {
+	cvl_par_run(hist_part, &a);
+
+	for (sum = 0, b = 0; b < NumBuckets; b++) {
+	    for (p = 0; p < cvl_par.parts; p++) {
+		count = cvl_par.hist[p * NumBuckets + b];
+		cvl_par.hist[p * NumBuckets + b] = sum;
+		sum += count;
+	    }
+	}
+
+	cvl_par_run(move_part, &a);
+
+	t = a.from;
+	a.from = a.to;
+	a.to = t;
+    }
+
+    if (a.from != tmp) {
+	memcpy(tmp, a.from, sizeof(int) * n);
+    }
+}
+
+static void init_part(void *arg, int p)
+{
+    struct rank_args *a = (struct rank_args *)arg;
+    int i;
+
+    for_part(a, p, i) {
+	if (a->src) {
+	    a->src[i] ^= a->mask;
+	}
+	a->to[i] = i;
+    }
+}
+
+static void unxor_part(void *arg, int p)
+{
+    struct rank_args *a = (struct rank_args *)arg;
+    int i;
+
+    for_part(a, p, i) {
+	a->src[i] ^= a->mask;
+    }
+}
+
+static void field_part(void *arg, int p)
+{
+    struct rank_args *a = (struct rank_args *)arg;
+    int i, j = a->word;
+
+    for_part(a, p, i) {
+	unsigned int *u = (unsigned int *)&a->dsrc[i];
+	unsigned int t, sign, fld;
+
+#ifdef FP_LITTLE_ENDIAN
+	t = u[j];
+	sign = u[IntsInDouble-1] & SIGNBIT;
+#else
+	t = u[IntsInDouble - j - 1];
+	sign = u[0] & SIGNBIT;
+#endif
+	if (j != IntsInDouble - 1) {
+	    fld = sign ? ~t : t;
+	} else {
+	    fld = sign ? ~t : t^SIGNBIT;
+	}
+	a->src[i] = a->isUp ? fld : ~fld;
+    }
+}
+
+static void final_part(void *arg, int p)
+{
+    struct rank_args *a = (struct rank_args *)arg;
+    int i;
+
+    for_part(a, p, i) {
+	a->rank[a->from[i]] = i;
+    }
+}
+
+/* label each element with its segment, or rescale the rank of each
+   element to its segment, for the segments of a part */
+static void label_part(void *arg, int p)
+{
+    struct rank_args *a = (struct rank_args *)arg;
+    unsigned *aux = a->src + cvl_par.elt[p];
+    int j, k;
+
+    for (j = cvl_par.seg[p]; j < cvl_par.seg[p + 1]; j++) {
+	for (k = 0; k < a->segd[j]; k++) {
+	    *aux++ = j;
+	}
+    }
+}
+
+static void rescale_part(void *arg, int p)
+{
+    struct rank_args *a = (struct rank_args *)arg;
+    unsigned *auxp = a->rank + cvl_par.elt[p];
+    int offset = cvl_par.elt[p];
+    int j, k;
+
+    for (j = cvl_par.seg[p]; j < cvl_par.seg[p + 1]; j++) {
+	for (k = 0; k < a->segd[j]; k++) {
+	    *auxp++ -= offset;
+	}
+	offset += a->segd[j];
+    }
+}
+
+/* the same, a segment at a time, for a few long segments */
+static void label_seg_part(void *arg, int p)
+{
+    struct rank_args *a = (struct rank_args *)arg;
+    int i;
+
+    for_part(a, p, i) {
+	a->src[i] = a->mask;
+    }
+}
+
+static void rescale_seg_part(void *arg, int p)
+{
+    struct rank_args *a = (struct rank_args *)arg;
+    int i;
+
+    for_part(a, p, i) {
+	a->rank[i] -= a->mask;
+    }
+}
+
+static void each_seg(void (*func)(void *, int), unsigned *v, int *segd, int m,
+		     int isLabel)
+{
+    struct rank_args a;
+    int j, i, off;
+
+    for (j = 0, off = 0; j < m; off += segd[j], j++) {
+	a.src = a.rank = v + off;
+	a.n = segd[j];
+	a.mask = isLabel ? j : off;
+	if (a.n >= CVL_PAR_MIN) {
+	    cvl_par_run(func, &a);
+	} else if (isLabel) {
+	    for (i = 0; i < a.n; i++) {
+		a.src[i] = a.mask;
+	    }
+	} else {
+	    for (i = 0; i < a.n; i++) {
+		a.rank[i] -= a.mask;
+	    }
+	}
+    }
+}
+
+/* the segmented end of both ranks, seg_aux may overlap the keys */
+static void rank_segs(unsigned *rank, unsigned *seg_aux, int *tmp,
+		      int *segd, int n, int m)
+{
+    struct rank_args a = { .src = seg_aux, .rank = rank, .from = tmp,
+			   .segd = segd, .n = n };
+    int split = m >= CVL_PAR_SEGS * cvl_par.parts;
+
+    if (m > 1) {
+	if (split) {
+	    cvl_par_split(segd, 0, m);
+	    cvl_par_run(label_part, &a);
+	} else {
+	    each_seg(label_seg_part, seg_aux, segd, m, 1);
+	}
+	field_rank((int *)rank, seg_aux, tmp, n);
+    }
+
+    cvl_par_run(final_part, &a);
+
+    if (m > 1) {
+	if (split) {
+	    cvl_par_run(rescale_part, &a);
+	} else {
+	    each_seg(rescale_seg_part, rank, segd, m, 0);
+	}
+    }
+}
+
+static void int_rank_sort(vec_p d, vec_p s, vec_p segd, int vec_len,
+			  int seg_count, vec_p scratch, int isUp)
+{
+    unsigned int *src = (unsigned int *)s;
+    unsigned int *rank = (unsigned int *)d;
+    int *tmp = (int *)scratch;
+    unsigned int *seg_aux = (unsigned int *)scratch + vec_len;
+    struct rank_args a = { .src = src, .to = tmp, .n = vec_len,
+			   .mask = isUp ? SIGNBIT : ~SIGNBIT };
+
+    cvl_par_run(init_part, &a);
+    field_rank((int *)rank, src, tmp, vec_len);
+    cvl_par_run(unxor_part, &a);
+
+    rank_segs(rank, seg_aux, tmp, (int *)segd, vec_len, seg_count);
+}
+
+static void double_rank_sort(vec_p d, vec_p s, vec_p segd, int vec_len,
+			     int seg_count, vec_p scratch, int isUp)
+{
+    unsigned int *field = (unsigned int *)scratch;
+    unsigned int *rank = (unsigned int *)d;
+    int *tmp = (int *)scratch + vec_len;
+    struct rank_args a = { .dsrc = (double *)s, .src = field, .to = tmp,
+			   .n = vec_len, .isUp = isUp };
+    struct rank_args init = { .to = tmp, .n = vec_len };
+
+    cvl_par_run(init_part, &init);
+
+    for (a.word = 0; a.word < IntsInDouble; a.word++) {
+	cvl_par_run(field_part, &a);
+	field_rank((int *)rank, field, tmp, vec_len);
+    }
+
+    rank_segs(rank, field, tmp, (int *)segd, vec_len, seg_count);
+}
+
+#define par_rank(_name, _sort, _isUp)					\
+    static void par_ ## _name(vec_p d, vec_p s, vec_p segd, int vec_len, \
+				 int seg_count, vec_p scratch)		\
+    {									\
+	if (vec_len < CVL_PAR_MIN || !cvl_par_begin()) {		\
+	    _name(d, s, segd, vec_len, seg_count, scratch);		\
+	    return;							\
+	}								\
+	_sort(d, s, segd, vec_len, seg_count, scratch, _isUp);		\
+	cvl_par_end();							\
+    }
+
+par_rank(rku_lez, int_rank_sort, 1)
+par_rank(rkd_lez, int_rank_sort, 0)
+par_rank(rku_led, double_rank_sort, 1)
+par_rank(rkd_led, double_rank_sort, 0)
+
+#define map(_name) { (cvl_fun_p)_name, (cvl_fun_p)par_ ## _name }
+
+cvl_par_map_t cvl_par_rank_map[] = {
+    map(rku_lez), map(rkd_lez), map(rku_led), map(rkd_led),
+    { 0, 0 }
+};
@@ -0,0 +1,547 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include "../serial/defins.h"
+#include "par.h"
+
+/* Scans, reductions, distributes and permutes */
+
+struct vec_args {
+    vec_p d, s, i;
+    int  *segd, *segd2;
+    int   n;
+};
+
+/* run each part's segments through a serial loop, or, if there
+   are only a few segments, each segment through the parallel
+   unsegmented version */
+#define split_or_each(_a, _m, _part, _each)			\
+    if ((_m) >= CVL_PAR_SEGS * cvl_par.parts) {			\
+	cvl_par_split((_a)->segd, (_a)->segd2, (_m));		\
+	cvl_par_run(_part, (_a));				\
+    } else {							\
+	int _j, _off = 0, _off2 = 0;				\
+	for (_j = 0; _j < (_m); _off += (_a)->segd[_j], _j++) {	\
+	    _each;						\
+	    if ((_a)->segd2) {					\
+		_off2 += (_a)->segd2[_j];			\
+	    }						\
+	}							\
+    }
+
+/* --------------------AVX2 sums---------------------------------*/
+
+typedef int    v8si __attribute__((vector_size(32), aligned(4)));
+typedef double v4df __attribute__((vector_size(32), aligned(8)));
+
+#define simd_sum(_name, _type, _vtype)					\
+    static _type __attribute__((target("avx2"), noinline))		\
+    GLUE(_name,_block)(_type *src, int len)				\
+    {									\
+	_vtype acc = { 0 };						\
+	_type sum = 0;							\
+	int i, k, w = sizeof(_vtype) / sizeof(_type);			\
+									\
+	for (i = 0; i + w <= len; i += w) {				\
+	    acc += *(_vtype *)(src + i);				\
+	}								\
+	for (k = 0; k < w; k++) {					\
+	    sum += acc[k];						\
+	}								\
+	for (; i < len; i++) {						\
+	    sum += src[i];						\
+	}								\
+	return sum;							\
+    }									\
+									\
+    /* see CVL_SIMD_BLOCK */						\
+    static _type _name(_type *src, int len)				\
+    {									\
+	_type sum = 0;							\
+	int i, n;							\
+									\
+	for (i = 0; i < len; i += n) {					\
+	    n = len - i < CVL_SIMD_BLOCK ? len - i : CVL_SIMD_BLOCK;	\
+	    preempt_disable();						\
+	    sum += GLUE(_name,_block)(src + i, n);			\
+	    preempt_enable();						\
+	}								\
+	return sum;							\
+    }
+
+simd_sum(simd_sum_z, int, v8si)
+simd_sum(simd_sum_d, double, v4df)
+
+/* the sum of a part, with the AVX2 version for adds */
+#define part_sum(_funct, _type, _init, _simd, _src, _len)		\
+    ({									\
+	_type (*_f)(_type *, int) = (_simd);				\
+	_type _sum = _init;						\
+	int _k;								\
+	if (_f && cvl_par.avx2) {					\
+	    _sum = _f(_src, _len);					\
+	} else {							\
+	    for (_k = 0; _k < (_len); _k++) {				\
+		_sum = _funct(_sum, (_src)[_k]);			\
+	    }								\
+	}								\
+	_sum;								\
+    })
+
+/* -----------------------Scans---------------------------------*/
+
+/* A scan sums each part, scans the sums, and then scans each part
+ * starting from the sum of the parts before it.
+ */
+#define parscan(_name, _funct, _type, _init, _unseg, _parts, _simd)	\
+    static void GLUE(_name,_psum)(void *arg, int p)			\
+    {									\
+	struct vec_args *a = (struct vec_args *)arg;			\
+	int r[2];							\
+									\
+	_parts[p] = _init;						\
+	if (cvl_par_range(r, p, a->n)) {				\
+	    _parts[p] = part_sum(_funct, _type, _init, _simd,		\
+				 (_type *)a->s + r[0], r[1] - r[0]);	\
+	}								\
+    }									\
+									\
+    static void GLUE(_name,_pscan)(void *arg, int p)			\
+    {									\
+	struct vec_args *a = (struct vec_args *)arg;			\
+	_type *src, *dest, sum, tmp;					\
+	int r[2], k;							\
+									\
+	if (!cvl_par_range(r, p, a->n)) {				\
+	    return;							\
+	}								\
+	src = (_type *)a->s + r[0];					\
+	dest = (_type *)a->d + r[0];					\
+	sum = _parts[p];						\
+	for (k = 0; k < r[1] - r[0]; k++) {				\
+	    tmp = sum;							\
+	    sum = _funct(sum, src[k]);					\
+	    dest[k] = tmp;						\
+	}								\
+    }									\
+									\
+    static void GLUE(_name,_punseg)(vec_p d, vec_p s, int n)		\
+    {									\
+	struct vec_args a = { .d = d, .s = s, .n = n };			\
+	_type sum = _init, tmp;						\
+	int p;								\
+									\
+	if (n < CVL_PAR_MIN) {						\
+	    _unseg(d, s, n, CVL_SCRATCH_NULL);				\
+	    return;							\
+	}								\
+	cvl_par_run(GLUE(_name,_psum), &a);				\
+	for (p = 0; p < cvl_par.parts; p++) {				\
+	    tmp = _parts[p];						\
+	    _parts[p] = sum;						\
+	    sum = _funct(sum, tmp);					\
+	}								\
+	cvl_par_run(GLUE(_name,_pscan), &a);				\
+    }									\
+									\
+    static void GLUE(_name,_psegs)(void *arg, int p)			\
+    {									\
+	struct vec_args *a = (struct vec_args *)arg;			\
+	_type *src = (_type *)a->s + cvl_par.elt[p];			\
+	_type *dest = (_type *)a->d + cvl_par.elt[p];			\
+	_type *src_end = src;						\
+	_type sum, tmp;							\
+	int j;								\
+									\
+	for (j = cvl_par.seg[p]; j < cvl_par.seg[p + 1]; j++) {		\
+	    src_end += a->segd[j];					\
+	    sum = _init;						\
+	    while (src < src_end) {					\
+		tmp = sum;						\
+		sum = _funct(sum, *src);				\
+		*dest++ = tmp;						\
+		src++;							\
+	    }								\
+	}								\
+    }									\
+									\
+    static void GLUE(par_,_name)(vec_p d, vec_p s, vec_p sd, int n, int m, \
+				 vec_p scratch)				\
+    {									\
+	struct vec_args a = { .d = d, .s = s, .segd = (int *)sd, .n = n }; \
+									\
+	if (n < CVL_PAR_MIN || !cvl_par_begin()) {			\
+	    _name(d, s, sd, n, m, scratch);				\
+	    return;							\
+	}								\
+	if (m == 1) {							\
+	    GLUE(_name,_punseg)(d, s, n);				\
+	} else {							\
+	    split_or_each(&a, m, GLUE(_name,_psegs),			\
+			  GLUE(_name,_punseg)((_type *)d + _off,	\
+					      (_type *)s + _off,	\
+					      a.segd[_j]));		\
+	}								\
+	cvl_par_end();							\
+    }
+
+parscan(add_sez, plus, int, 0, add_suz, cvl_par.zpart, simd_sum_z)
+parscan(add_sed, plus, double, (double) 0.0, add_sud, cvl_par.dpart, simd_sum_d)
+
+parscan(mul_sez, times, int, 1, mul_suz, cvl_par.zpart, 0)
+parscan(mul_sed, times, double, (double) 1.0, mul_sud, cvl_par.dpart, 0)
+
+parscan(min_sez, min, int, MAX_INT, min_suz, cvl_par.zpart, 0)
+parscan(min_sed, min, double, MAX_DOUBLE, min_sud, cvl_par.dpart, 0)
+
+parscan(max_sez, max, int, MIN_INT, max_suz, cvl_par.zpart, 0)
+parscan(max_sed, max, double, MIN_DOUBLE, max_sud, cvl_par.dpart, 0)
+
+parscan(and_seb, and, cvl_bool, 1, and_sub, cvl_par.zpart, 0)
+parscan(and_sez, band, int, ~0, and_suz, cvl_par.zpart, 0)
+
+parscan(ior_seb, or, cvl_bool, 0, ior_sub, cvl_par.zpart, 0)
+parscan(ior_sez, bor, int, 0, ior_suz, cvl_par.zpart, 0)
+
+parscan(xor_seb, lxor, cvl_bool, 0, xor_sub, cvl_par.zpart, 0)
+parscan(xor_sez, xor, int, 0, xor_suz, cvl_par.zpart, 0)
+
+/* --------------------Reduce Functions--------------------------------*/
+
+#define parreduce(_name, _funct, _type, _init, _unseg, _parts, _simd)	\
+    static void GLUE(_name,_psum)(void *arg, int p)			\
+    {									\
+	struct vec_args *a = (struct vec_args *)arg;			\
+	int r[2];							\
+									\
+	_parts[p] = _init;						\
+	if (cvl_par_range(r, p, a->n)) {				\
+	    _parts[p] = part_sum(_funct, _type, _init, _simd,		\
+				 (_type *)a->s + r[0], r[1] - r[0]);	\
+	}								\
+    }									\
+									\
+    static _type GLUE(_name,_punseg)(vec_p s, int n)			\
+    {									\
+	struct vec_args a = { .s = s, .n = n };				\
+	_type sum = _init;						\
+	int p;								\
+									\
+	if (n < CVL_PAR_MIN) {						\
+	    return _unseg(s, n, CVL_SCRATCH_NULL);			\
+	}								\
+	cvl_par_run(GLUE(_name,_psum), &a);				\
+	for (p = 0; p < cvl_par.parts; p++) {				\
+	    sum = _funct(sum, _parts[p]);				\
+	}								\
+	return sum;							\
+    }									\
+									\
+    static void GLUE(_name,_psegs)(void *arg, int p)			\
+    {									\
+	struct vec_args *a = (struct vec_args *)arg;			\
+	_type *src = (_type *)a->s + cvl_par.elt[p];			\
+	_type *dest = (_type *)a->d;					\
+	int j, len;							\
+									\
+	for (j = cvl_par.seg[p]; j < cvl_par.seg[p + 1]; j++) {		\
+	    len = a->segd[j];						\
+	    dest[j] = part_sum(_funct, _type, _init, _simd, src, len);	\
+	    src += len;							\
+	}								\
+    }									\
+									\
+    static void GLUE(par_,_name)(vec_p d, vec_p s, vec_p sd, int n, int m, \
+				 vec_p scratch)				\
+    {									\
+	struct vec_args a = { .d = d, .s = s, .segd = (int *)sd, .n = n }; \
+									\
+	if (n < CVL_PAR_MIN || !cvl_par_begin()) {			\
+	    _name(d, s, sd, n, m, scratch);				\
+	    return;							\
+	}								\
+	if (m == 1) {							\
+	    *(_type *)d = GLUE(_name,_punseg)(s, n);			\
+	} else {							\
+	    split_or_each(&a, m, GLUE(_name,_psegs),			\
+			  ((_type *)d)[_j] =				\
+			  GLUE(_name,_punseg)((_type *)s + _off, a.segd[_j])); \
+	}								\
+	cvl_par_end();							\
+    }
+
+parreduce(add_rez, plus, int, 0, add_ruz, cvl_par.zpart, simd_sum_z)
+parreduce(add_red, plus, double, (double) 0.0, add_rud, cvl_par.dpart, simd_sum_d)
+
+parreduce(mul_rez, times, int, 1, mul_ruz, cvl_par.zpart, 0)
+parreduce(mul_red, times, double, (double) 1.0, mul_rud, cvl_par.dpart, 0)
+
+parreduce(min_rez, min, int, MAX_INT, min_ruz, cvl_par.zpart, 0)
+parreduce(min_red, min, double, MAX_DOUBLE, min_rud, cvl_par.dpart, 0)
+
+parreduce(max_rez, max, int, MIN_INT, max_ruz, cvl_par.zpart, 0)
+parreduce(max_red, max, double, MIN_DOUBLE, max_rud, cvl_par.dpart, 0)
+
+parreduce(and_reb, and, cvl_bool, TRUE, and_rub, cvl_par.zpart, 0)
+parreduce(and_rez, band, int, (~0), and_ruz, cvl_par.zpart, 0)
+
+parreduce(ior_reb, or, cvl_bool, FALSE, ior_rub, cvl_par.zpart, 0)
+parreduce(ior_rez, bor, int, 0, ior_ruz, cvl_par.zpart, 0)
+
+parreduce(xor_reb, lxor, cvl_bool, 0, xor_rub, cvl_par.zpart, 0)
+parreduce(xor_rez, xor, int, 0, xor_ruz, cvl_par.zpart, 0)
+
+/* ----------------Distribute-----------------------------------*/
+
+#define pardistribute(_name, _type)					\
+    static void GLUE(_name,_pfill)(void *arg, int p)			\
+    {									\
+	struct vec_args *a = (struct vec_args *)arg;			\
+	_type *dest = (_type *)a->d, val = *(_type *)a->s;		\
+	int r[2], k;							\
+									\
+	if (cvl_par_range(r, p, a->n)) {				\
+	    for (k = r[0]; k < r[1]; k++) {				\
+		dest[k] = val;						\
+	    }								\
+	}								\
+    }									\
+									\
+    static void GLUE(_name,_punseg)(vec_p d, _type *v, int n)		\
+    {									\
+	struct vec_args a = { .d = d, .s = v, .n = n };			\
+	_type *dest = (_type *)d;					\
+	int k;								\
+									\
+	if (n < CVL_PAR_MIN) {						\
+	    for (k = 0; k < n; k++) {					\
+		dest[k] = *v;						\
+	    }								\
+	    return;							\
+	}								\
+	cvl_par_run(GLUE(_name,_pfill), &a);				\
+    }									\
+									\
+    static void GLUE(_name,_psegs)(void *arg, int p)			\
+    {									\
+	struct vec_args *a = (struct vec_args *)arg;			\
+	_type *dest = (_type *)a->d + cvl_par.elt[p];			\
+	_type *val = (_type *)a->s;					\
+	int j, k;							\
+									\
+	for (j = cvl_par.seg[p]; j < cvl_par.seg[p + 1]; j++) {		\
+	    for (k = 0; k < a->segd[j]; k++) {				\
+		*dest++ = val[j];					\
+	    }								\
+	}								\
+    }									\
+									\
+    static void GLUE(par_,_name)(vec_p d, vec_p v, vec_p sd, int n, int m, \
+				 vec_p scratch)				\
+    {									\
+	struct vec_args a = { .d = d, .s = v, .segd = (int *)sd, .n = n }; \
+									\
+	if (n < CVL_PAR_MIN || !cvl_par_begin()) {			\
+	    _name(d, v, sd, n, m, scratch);				\
+	    return;							\
+	}								\
+	if (m == 1) {							\
+	    GLUE(_name,_punseg)(d, (_type *)v, n);			\
+	} else {							\
+	    split_or_each(&a, m, GLUE(_name,_psegs),			\
+			  GLUE(_name,_punseg)((_type *)d + _off,	\
+					      (_type *)v + _j,		\
+					      a.segd[_j]));		\
+	}								\
+	cvl_par_end();							\
+    }
+
+pardistribute(dis_vez, int)
+pardistribute(dis_veb, cvl_bool)
+pardistribute(dis_ved, double)
+
+/* --------------Permute---------------------------------------*/
+
+/* simple permute, the index is within the segment */
+#define parsmpper(_name, _type)						\
+    static void GLUE(_name,_ppart)(void *arg, int p)			\
+    {									\
+	struct vec_args *a = (struct vec_args *)arg;			\
+	_type *dest = (_type *)a->d, *src = (_type *)a->s;		\
+	int *index = (int *)a->i;					\
+	int r[2], k;							\
+									\
+	if (cvl_par_range(r, p, a->n)) {				\
+	    for (k = r[0]; k < r[1]; k++) {				\
+		dest[index[k]] = src[k];				\
+	    }								\
+	}								\
+    }									\
+									\
+    static void GLUE(_name,_punseg)(_type *d, _type *s, int *i, int n)	\
+    {									\
+	struct vec_args a = { .d = d, .s = s, .i = i, .n = n };		\
+	int k;								\
+									\
+	if (n < CVL_PAR_MIN) {						\
+	    for (k = 0; k < n; k++) {					\
+		d[i[k]] = s[k];						\
+	    }								\
+	    return;							\
+	}								\
+	cvl_par_run(GLUE(_name,_ppart), &a);				\
+    }									\
+									\
+    static void GLUE(_name,_psegs)(void *arg, int p)			\
+    {									\
+	struct vec_args *a = (struct vec_args *)arg;			\
+	_type *dest = (_type *)a->d + cvl_par.elt[p];			\
+	_type *src = (_type *)a->s + cvl_par.elt[p];			\
+	int *index = (int *)a->i + cvl_par.elt[p];			\
+	int j, k;							\
+									\
+	for (j = cvl_par.seg[p]; j < cvl_par.seg[p + 1]; j++) {		\
+	    for (k = 0; k < a->segd[j]; k++) {				\
+		dest[index[k]] = src[k];				\
+	    }								\
+	    dest += a->segd[j];						\
+	    src += a->segd[j];						\
+	    index += a->segd[j];					\
+	}								\
+    }									\
+									\
+    static void GLUE(par_,_name)(vec_p d, vec_p s, vec_p i, vec_p sd,	\
+				 int n, int m, vec_p scratch)		\
+    {									\
+	struct vec_args a = { .d = d, .s = s, .i = i,			\
+			      .segd = (int *)sd, .n = n };		\
+									\
+	if (n < CVL_PAR_MIN || !cvl_par_begin()) {			\
+	    _name(d, s, i, sd, n, m, scratch);				\
+	    return;							\
+	}								\
+	if (m == 1) {							\
+	    GLUE(_name,_punseg)((_type *)d, (_type *)s, (int *)i, n);	\
+	} else {							\
+	    split_or_each(&a, m, GLUE(_name,_psegs),			\
+			  GLUE(_name,_punseg)((_type *)d + _off,	\
+					      (_type *)s + _off,	\
+					      (int *)i + _off,		\
+					      a.segd[_j]));		\
+	}								\
+	cvl_par_end();							\
+    }
+
+parsmpper(smp_pez, int)
+parsmpper(smp_peb, cvl_bool)
+parsmpper(smp_ped, double)
+
+/* back permute, split by the destination segments, with segd2
+   giving the source segments */
+#define parbckper(_name, _type)						\
+    static void GLUE(_name,_ppart)(void *arg, int p)			\
+    {									\
+	struct vec_args *a = (struct vec_args *)arg;			\
+	_type *dest = (_type *)a->d, *src = (_type *)a->s;		\
+	int *index = (int *)a->i;					\
+	int r[2], k;							\
+									\
+	if (cvl_par_range(r, p, a->n)) {				\
+	    for (k = r[0]; k < r[1]; k++) {				\
+		dest[k] = src[index[k]];				\
+	    }								\
+	}								\
+    }									\
+									\
+    static void GLUE(_name,_punseg)(_type *d, _type *s, int *i, int n)	\
+    {									\
+	struct vec_args a = { .d = d, .s = s, .i = i, .n = n };		\
+	int k;								\
+									\
+	if (n < CVL_PAR_MIN) {						\
+	    for (k = 0; k < n; k++) {					\
+		d[k] = s[i[k]];						\
+	    }								\
+	    return;							\
+	}								\
+	cvl_par_run(GLUE(_name,_ppart), &a);				\
+    }									\
+									\
+    static void GLUE(_name,_psegs)(void *arg, int p)			\
+    {									\
+	struct vec_args *a = (struct vec_args *)arg;			\
+	_type *dest = (_type *)a->d + cvl_par.elt[p];			\
+	_type *src = (_type *)a->s + cvl_par.elt2[p];			\
+	int *index = (int *)a->i + cvl_par.elt[p];			\
+	int j, k;							\
+									\
+	for (j = cvl_par.seg[p]; j < cvl_par.seg[p + 1]; j++) {		\
+	    for (k = 0; k < a->segd[j]; k++) {				\
+		*dest++ = src[*index++];				\
+	    }								\
+	    src += a->segd2[j];						\
+	}								\
+    }									\
+									\
+    static void GLUE(par_,_name)(vec_p d, vec_p s, vec_p i,		\
+				 vec_p sd_s, int n_s, int m_s,		\
+				 vec_p sd_d, int n_d, int m_d,		\
+				 vec_p scratch)				\
+    {									\
+	struct vec_args a = { .d = d, .s = s, .i = i,			\
+			      .segd = (int *)sd_d, .segd2 = (int *)sd_s, \
+			      .n = n_d };				\
+									\
+	if (n_d < CVL_PAR_MIN || !cvl_par_begin()) {			\
+	    _name(d, s, i, sd_s, n_s, m_s, sd_d, n_d, m_d, scratch);	\
+	    return;							\
+	}								\
+	if (m_s == 1) {							\
+	    GLUE(_name,_punseg)((_type *)d, (_type *)s, (int *)i, n_d);	\
+	} else {							\
+	    split_or_each(&a, m_d, GLUE(_name,_psegs),			\
+			  GLUE(_name,_punseg)((_type *)d + _off,	\
+					      (_type *)s + _off2,	\
+					      (int *)i + _off,		\
+					      a.segd[_j]));		\
+	}								\
+	cvl_par_end();							\
+    }
+
+parbckper(bck_pez, int)
+parbckper(bck_peb, cvl_bool)
+parbckper(bck_ped, double)
+
+#define map(_name) { (cvl_fun_p)_name, (cvl_fun_p)GLUE(par_,_name) }
+
+cvl_par_map_t cvl_par_vprims_map[] = {
+    map(add_sez), map(add_sed), map(mul_sez), map(mul_sed),
+    map(max_sez), map(max_sed), map(min_sez), map(min_sed),
+    map(and_sez), map(and_seb), map(ior_sez), map(ior_seb),
+    map(xor_sez), map(xor_seb),
+    map(add_rez), map(add_red), map(mul_rez), map(mul_red),
+    map(max_rez), map(max_red), map(min_rez), map(min_red),
+    map(and_rez), map(and_reb), map(ior_rez), map(ior_reb),
+    map(xor_rez), map(xor_reb),
+    map(dis_vez), map(dis_veb), map(dis_ved),
+    map(smp_pez), map(smp_peb), map(smp_ped),
+    map(bck_pez), map(bck_peb), map(bck_ped),
+    { 0, 0 }
+};
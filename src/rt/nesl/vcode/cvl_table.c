@@ -226,3 +226,36 @@ cvl_triple_t cvl_fun_list[] =
       { (void (*)())pk2_leb, (int (*)())pk2_leb_scratch, (unsigned (*)())pk2_leb_inplace },
     },
 };
+
+#ifdef NAUT_CONFIG_NESL_RT_CVL_PARALLEL
+/* Switch the functions in the table between the serial CVL and the
+ * parallel versions of them, where there are any.  The scratch and
+ * inplace functions stay the same.
+ */
+#define CVL_FUN_COUNT (sizeof(cvl_fun_list) / sizeof(cvl_fun_list[0]))
+
+static cvl_triple_t cvl_serial_list[CVL_FUN_COUNT];
+static int cvl_serial_saved = 0;
+
+void cvl_table_parallel(on)
+int on;
+{
+    cvl_funct_t *f = (cvl_funct_t *)cvl_fun_list;
+    cvl_funct_t *s = (cvl_funct_t *)cvl_serial_list;
+    cvl_fun_p par;
+    int i;
+
+    if (!cvl_serial_saved) {
+	memcpy(cvl_serial_list, cvl_fun_list, sizeof(cvl_fun_list));
+	cvl_serial_saved = 1;
+    }
+
+    for (i = 0; i < CVL_FUN_COUNT * 3; i++) {
+	if (on && s[i].function && (par = cvl_par_find(s[i].function))) {
+	    f[i].function = par;
+	} else {
+	    f[i].function = s[i].function;
+	}
+    }
+}
+#endif
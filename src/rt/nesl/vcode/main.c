@@ -41,6 +41,7 @@
 #include "rtstack.h"
 #include "constant.h"
 #include "io.h"
+#include <rt/nesl/nesl.h>
 
 
 
@@ -60,7 +61,8 @@ int runtime_trace = 0;
 int program_dump = 1;
 int link_trace = 0;
 int timer = 0;
-unsigned int vstack_size_init = 1000000;
+#define VSTACK_SIZE_DEFAULT 1000000
+unsigned int vstack_size_init = VSTACK_SIZE_DEFAULT;
 int garbage_notify = 1;
 int check_args = 0;
 int debug_flag = 1;
@@ -83,6 +85,42 @@ static void deinitialize_parse PROTO_((void))
 
 void CVL_init();
 
+/* first element of the vector the program left on top of the stack */
+static TYPE   result_type = None;
+static int    result_int;
+static double result_float;
+
+static void save_result PROTO_((void))
+{
+    vb_t *vb;
+
+    result_type = None;
+
+    if (stack_size < 1) {
+	return;
+    }
+
+    vb = se_vb(TOS);
+    if (vb->len < 1) {
+	return;
+    }
+
+    switch (vb->type) {
+	case Int:
+	    assert_mem_size(ext_vuz_scratch(vb->len));
+	    result_int = ext_vuz(vb->vector, 0, vb->len, SCRATCH);
+	    result_type = Int;
+	    break;
+	case Float:
+	    assert_mem_size(ext_vud_scratch(vb->len));
+	    result_float = ext_vud(vb->vector, 0, vb->len, SCRATCH);
+	    result_type = Float;
+	    break;
+	default:
+	    break;
+    }
+}
+
 static int nesl_exec(void *vcode_blob)
 {
 
@@ -131,6 +169,10 @@ static int nesl_exec(void *vcode_blob)
 
     DEBUG("main loop done\n");
 
+    save_result();
+
+    vstack_deinit();
+
     return 0;
 }
 
@@ -832,32 +874,60 @@ void debug_show_stack ()
 int nk_nesl_init()
 {
     INFO("init\n");
+#ifdef NAUT_CONFIG_NESL_RT_CVL_PARALLEL
+    if (cvl_par_init()) {
+	ERROR("Cannot start parallel CVL, using serial CVL\n");
+    } else {
+	cvl_table_parallel(1);
+    }
+#endif
+    return 0;
+}
+
+
+int nk_nesl_set_parallel(int on)
+{
+#ifdef NAUT_CONFIG_NESL_RT_CVL_PARALLEL
+    cvl_table_parallel(on);
     return 0;
+#else
+    return on ? -1 : 0;
+#endif
 }
 
 
 int nk_nesl_exec(void *vcode)
 {
-    INFO("execute program at %p\n",vcode);
+    return nk_nesl_exec_opts(vcode, 0, 0);
+}
+
+
+int nk_nesl_exec_opts(void *vcode, int flags, unsigned vmem)
+{
+    if (!(flags & NK_NESL_QUIET)) {
+	INFO("execute program at %p\n",vcode);
+    }
     if (vcode==0) {
 	INFO("Using built-in test\n");
 	vcode = programstr;
     }
 
+    result_type = None;
+
     // flag config
     check_args   = 0;
     debug_flag   = 1;
     lex_trace    = 0;
     stack_trace  = 0;
-    command_trace= 1;
+    command_trace= !(flags & NK_NESL_QUIET);
     value_trace  = 0;
     runtime_trace= 0;
-    program_dump = 1;
+    program_dump = !(flags & NK_NESL_QUIET);
     link_trace   = 0;
     heap_trace   = 0;
     abort_on_error = 0;
     timer        = 0;
-    // vstack_size_init = ...
+    vstack_size_init = vmem ? vmem : VSTACK_SIZE_DEFAULT;
 
     uint64_t size = strlen(vcode);
     void *tmp = malloc(size+1);
@@ -874,6 +944,26 @@ int nk_nesl_exec(void *vcode)
     return 0;
 }
 
+
+int nk_nesl_result_int(int *val)
+{
+    if (result_type != Int) {
+	return -1;
+    }
+    *val = result_int;
+    return 0;
+}
+
+
+int nk_nesl_result_float(double *val)
+{
+    if (result_type != Float) {
+	return -1;
+    }
+    *val = result_float;
+    return 0;
+}
+
 void nk_nesl_deinit()
 {
     INFO("deinit\n");
@@ -90,6 +90,11 @@ typedef struct {
 
 extern cvl_triple_t cvl_fun_list[];
 
+#ifdef NAUT_CONFIG_NESL_RT_CVL_PARALLEL
+/* use the parallel CVL functions in cvl_fun_list, or not */
+extern void cvl_table_parallel PROTO_((int on));
+#endif
+
 /* this should be the token for PLUS */
 #define vop_min PLUS
 #define vop_table_look(vop) (vopdes_table + ( (vop) - vop_min))
@@ -183,6 +183,17 @@ unsigned int vmemlen;
     find_scratch();
 }
 
+/* Free the vector memory, which vstack_init allocates for each run.
+ */
+void vstack_deinit()
+{
+    if (cvl_mem != (vec_p) NULL) {
+	fre_fov(cvl_mem);
+	cvl_mem = (vec_p) NULL;
+	cvl_mem_size = 0;
+    }
+}
+
 /* ----------------- free list stuff -------------------------------------*/
 
 /* the free list is an array of buckets, each of which is a doubly linked 
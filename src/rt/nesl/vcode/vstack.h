@@ -23,6 +23,7 @@ typedef struct vblock_t {
 } vb_t;
 
 extern void vstack_init PROTO_((unsigned));
+extern void vstack_deinit PROTO_((void));
 extern vb_t *new_vector PROTO_((int, TYPE, int));
 extern vb_t *new_pair PROTO_((vb_t*, vb_t*));
 extern void vb_unpair PROTO_((vb_t*, vb_t**, vb_t**));
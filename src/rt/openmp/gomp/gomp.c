@@ -22,8 +22,11 @@
  */
 #include <nautilus/nautilus.h>
 #include <nautilus/spinlock.h>
+#include <nautilus/list.h>
 #include <nautilus/scheduler.h>
 #include <nautilus/smp.h>
+#include <nautilus/waitqueue.h>
+#include <nautilus/futex.h>
 #include <rt/openmp/gomp/gomp.h>
 
 
@@ -36,6 +39,140 @@
 #define ERROR(fmt, args...) ERROR_PRINT("gomp: " fmt, ##args)
 #define INFO(fmt, args...) INFO_PRINT("gomp: " fmt, ##args)
 
+#ifdef NAUT_CONFIG_OPENMP_RT_GOMP_HOT_TEAMS
+// a thread keeps a hot team for each nesting depth up to this one;
+// regions nested deeper get a team that is torn down at region end
+#define OMP_MAX_HOT_DEPTH 4
+// number of polls of the team's generation or pending count before
+// a worker or master goes to sleep on the team's wait queue
+#define OMP_TEAM_SPIN     4096
+
+struct omp_team;
+#endif
+
+// Work-sharing loops
+//
+// Each loop construct a team encounters is described by a slot in a
+// small ring.  A thread counts the loops it has entered in the current
+// region, and loop k of the region lives in slot k % OMP_WS_SLOTS.  The
+// first thread to arrive sets the slot up; the others wait until it
+// is ready.  This lets threads leaving a nowait loop run ahead into
+// later loops.  A slot is reused only once every thread has left the
+// loop that held it.
+//
+// Loops are handed out in iteration-number space [0,n), with
+// dynamic and guided schedules claiming chunks from the slot's
+// counter using atomics.  Ordered loops pass a token (the first
+// iteration not yet done) from chunk to chunk in iteration order.
+#define OMP_WS_SLOTS 8
+// polls before a waiting thread starts yielding
+#define OMP_WS_SPIN  4096
+
+struct omp_ws {
+    volatile long gen;        // loop number the slot was last claimed for
+    volatile long ready;      // loop number whose setup is complete
+    volatile int  left;       // threads that have not left the loop
+    int           nthreads;
+    int           sched;      // omp_sched_*
+    int           ordered;
+    long          start;
+    long          incr;
+    long          n;          // iteration count
+    long          chunk;
+    volatile long next;       // next unclaimed iteration (dynamic/guided)
+    volatile long ord;        // ordered token
+} __attribute__((aligned(64)));
+
+// a thread's position in its team's work-sharing loops
+struct omp_ws_cursor {
+    long           count;     // loops entered in the current region
+    struct omp_ws *ws;        // loop we are in, if any
+    long           trip;      // static: chunks taken so far
+    long           lo, hi;    // current chunk, in iterations
+};
+
+// Tasks
+//
+// An explicit task is queued on the slot of the team thread that
+// created it, and is run by team threads only: the creator pops its
+// newest task, and threads that run dry (in a barrier, taskwait or
+// taskgroup end) steal the oldest task from another slot.  Running
+// tasks only on team threads keeps omp_get_thread_num() unique among
+// concurrently running tasks, which task reductions rely on.
+//
+// Dependences are tracked per generating task: its dependence table
+// maps each address named in a depend clause of one of its children
+// to the last child writing it and the children reading it since.
+// A new child gets an edge from each of those it must follow, and is
+// queued once all of them are done.
+struct omp_task;
+
+struct omp_task_edge {
+    struct omp_task      *task;
+    struct omp_task_edge *next;
+};
+
+#define OMP_DEP_BUCKETS 64
+
+struct omp_dep {
+    void                 *addr;
+    struct omp_task      *out;        // last child writing addr
+    struct omp_task_edge *in;         // children reading addr since
+    struct omp_dep       *next;
+};
+
+struct omp_taskgroup {
+    struct omp_taskgroup *prev;       // task's previous innermost taskgroup
+    struct omp_taskgroup *outer;      // enclosing taskgroup
+    volatile long         pending;    // member tasks not yet done
+    uintptr_t            *reductions; // registered task reductions
+};
+
+struct omp_task {
+    struct list_head      node;       // on a slot's ready list
+    void                (*fn)(void *);
+    void                 *data;
+    struct omp_task      *parent;
+    struct omp_taskgroup *group;      // taskgroup we are a member of
+    struct omp_taskgroup *taskgroup;  // innermost taskgroup we opened
+    struct omp_region    *region;
+    volatile long         refs;       // self, children and dep table entries
+    volatile long         children;   // children not yet done
+    volatile long         npred;      // predecessors not yet done
+    int                   final;
+    int                   undeferred;
+    int                   done;       // protected by parent->dep_lock
+    struct omp_task_edge *succ;       // protected by parent->dep_lock
+    spinlock_t            dep_lock;   // protects deps and children's succ
+    struct omp_dep      **deps;       // dependence table of our children
+};
+
+// per thread state of a region
+struct omp_slot {
+    spinlock_t            lock;
+    struct list_head      ready;      // our queued tasks, newest first
+    struct omp_task       itask;      // our implicit task
+} __attribute__((aligned(64)));
+
+// A region is a team executing a parallel region (or a lone thread
+// executing the sequential part of a program)
+struct omp_region {
+    struct omp_thread    *master;
+    int                   nthreads;
+    int                   nslots;
+    struct omp_slot      *slots;      // one per thread
+    volatile long         tasks;      // explicit tasks not yet done
+    struct omp_ws         ws[OMP_WS_SLOTS];
+    // master's state outside of the region
+    struct omp_region    *outer;
+    struct omp_task      *saved_task;
+    struct omp_ws_cursor  saved_wsc;
+    int                   saved_num_threads_in_team;
+    int                   saved_num_threads_in_level;
+    int                   saved_thread_num_in_team;
+    int                   saved_thread_num;
+    struct omp_thread    *saved_team_leader;
+};
 
 // this is hanging off the "input" argument
 // for a nautilus thread and it supplies the metadata
@@ -57,8 +194,20 @@ struct omp_thread
     struct omp_thread *team_leader;
     nk_counting_barrier_t team_barrier;
     struct nk_thread  *thread;
+    struct omp_ws_cursor wsc;
+    struct omp_region *region;     // region we are running in
+    struct omp_task   *cur_task;   // explicit task we are running, if any
+#ifdef NAUT_CONFIG_OPENMP_RT_GOMP_HOT_TEAMS
+    struct omp_team   *pool;       // team we are a worker in, if any
+    uint64_t           pool_gen;   // last generation of pool we ran
+    int                depth;      // regions we are currently master of
+    struct omp_team   *cur_team;   // innermost of those regions
+    struct omp_team   *hot[OMP_MAX_HOT_DEPTH];
+#endif
 };
 
+static inline struct omp_task *cur_task(struct omp_thread *o);
+
 
 // nesting level for the active parallel blocks, 
 // which enclose the calling call
@@ -234,11 +383,16 @@ omp_proc_bind_t omp_get_proc_bind(void)
 //  set to the value omp_sched_static, omp_sched_dynamic,
 //  omp_sched_guided or omp_sched_auto. The second argument,
 //  chunk_size, is set to the chunk size.
+//
+// This is global rather than per data environment
+static int  runtime_sched = omp_sched_static;
+static long runtime_chunk = 0;
+
 void omp_get_schedule(omp_sched_t *kind, int *chunk_size)
 {
-    DEBUG("comp_get_schedule()=sched_static?, chunk_size=1?\n");
-    *kind = 0;
-    *chunk_size = 1 ; //?
+    DEBUG("omp_get_schedule()=%d, chunk_size=%ld\n", runtime_sched, runtime_chunk);
+    *kind = runtime_sched;
+    *chunk_size = runtime_chunk;
 }
 
 // Returns the team number of the calling thread.
@@ -299,8 +453,11 @@ int omp_in_parallel(void)
 // what is the "final" abstraction here?   
 int omp_in_final(void)
 {
-    DEBUG("omp_in_final()=0 UNIMPLMENTED\n");
-    return 0;
+    struct omp_thread *o = (struct omp_thread *) (get_cur_thread()->input);
+    int rc = o && o->region ? cur_task(o)->final : 0;
+
+    DEBUG("omp_in_final()=%d\n", rc);
+    return rc;
 }
 
 // This function returns true if currently running on the host device,
@@ -376,25 +533,36 @@ void omp_set_num_threads(int num_threads)
 // the value of chunk_size if positive, or to the default value if
 // zero or negative. For omp_sched_auto the chunk_size argument is
 // ignored.
+//
+// The monotonic modifier is accepted and ignored - all of our
+// schedules hand out chunks in increasing order anyway.
 void omp_set_schedule(omp_sched_t kind, int chunk_size)
 {
-    DEBUG("omp_set_schedule(kind=%d, chunk_size=%d) => IGNORED FOR NOW\n", kind, chunk_size);
+    int k = kind & ~omp_sched_monotonic;
+
+    DEBUG("omp_set_schedule(kind=%d, chunk_size=%d)\n", kind, chunk_size);
+
+    if (k < omp_sched_static || k > omp_sched_auto) {
+	ERROR("unknown schedule kind %d - ignoring\n", kind);
+	return;
+    }
+
+    runtime_sched = k;
+    runtime_chunk = chunk_size > 0 ? chunk_size : 0;
 }
 
 
 // Initialize a simple lock. After initialization, the lock is in an
 // unlocked state.
+//
+// The lock word itself is a futex mutex, so a lock needs no
+// allocation, and a thread that finds it held sleeps instead of
+// spinning.  Only the first 4 bytes are used, which also fits
+// libgomp's own omp_lock_t.
 void omp_init_lock(omp_lock_t *lock)
 {
-    spinlock_t *s = malloc(sizeof(spinlock_t));
-    if (!s) { 
-	ERROR("Failed to allocate OMP lock\n");
-	*lock = 0;
-    } else {
-	spinlock_init(s);
-	DEBUG("omp_init_lock()-> %p\n",s);
-	*lock = s;
-    }
+    DEBUG("omp_init_lock(%p)\n",lock);
+    *(volatile uint32_t *)lock = 0;
 }
 
 
@@ -404,9 +572,9 @@ void omp_init_lock(omp_lock_t *lock)
 //   thread, a deadlock occurs.
 void omp_set_lock(omp_lock_t *lock)
 {
-    DEBUG("omp_set_lock(%p)\n");
-    spin_lock(*lock);
-    DEBUG("omp_set_lock(%p) - lock acquired\n");
+    DEBUG("omp_set_lock(%p)\n",lock);
+    nk_futex_mutex_lock((volatile uint32_t *)lock);
+    DEBUG("omp_set_lock(%p) - lock acquired\n",lock);
 }
 
 // Before setting a simple lock, the lock variable must be initialized
@@ -417,7 +585,7 @@ void omp_set_lock(omp_lock_t *lock)
 //
 int omp_test_lock(omp_lock_t *lock)
 {
-    int rc = spin_try_lock(*lock) == 0;
+    int rc = nk_futex_mutex_trylock((volatile uint32_t *)lock) == 0;
     
     DEBUG("omp_test_lock(%p) => %d\n", lock, rc);
     return rc;
@@ -431,16 +599,14 @@ int omp_test_lock(omp_lock_t *lock)
 void omp_unset_lock(omp_lock_t *lock)
 {
     DEBUG("omp_unset_lock(%p)\n", lock);
-    spin_unlock(*lock);
+    nk_futex_mutex_unlock((volatile uint32_t *)lock);
 }
 
 // Destroy a simple lock. In order to be destroyed, a simple lock must
 // be in the unlocked state.
 void omp_destroy_lock(omp_lock_t *lock)
 {
-    DEBUG("omp_destroy_lock(%p)\n");
-    spinlock_deinit(*lock);
-    free(*lock);
+    DEBUG("omp_destroy_lock(%p)\n",lock);
 }
 
 //    Initialize a nested lock. After initialization, the lock is in
@@ -529,283 +695,1680 @@ double omp_get_wtime(void)
 // https://github.com/rose-compiler/rose-develop/tree/master/src/midend/programTransformation/ompLowering
 //
 
-static void parallel_start_wrapper(void *in, void **out)
+static inline void ws_wait_spin(int *i)
 {
-    struct omp_thread *o = (struct omp_thread *)in;
-    char buf[32];
+    if (++(*i) < OMP_WS_SPIN) {
+	__asm__ __volatile__ ("pause");
+    } else {
+	nk_yield();
+    }
+}
 
-    o->thread = get_cur_thread();
-    
-    o->thread->vc = o->thread->parent->vc;
+static void ws_reset(struct omp_ws *ring)
+{
+    int i;
 
-    snprintf(buf,32,"omp-%d-%d-%d",o->team,o->level,o->thread_num_in_team);
+    for (i=0;i<OMP_WS_SLOTS;i++) {
+	ring[i].gen = ring[i].ready = i - OMP_WS_SLOTS;
+	ring[i].left = 0;
+    }
+}
 
-    nk_thread_name(o->thread,buf);
-    
+static void task_clear_deps(struct omp_task *t);
 
-    DEBUG("Launch - thread cookie=%lx, team=%d, num_threads_in_team=%d, thread_num_in_team=%d, level=%d, num_threads_in_level=%d,f=%p, in=%p, thread_num=%d, thread=%p\n", o->cookie, o->team, o->num_threads_in_team, o->thread_num_in_team, o->level, o->num_threads_in_level, o->f, o->in, o->thread_num, o->thread);
+// make sure the region has slots for n threads, only while
+// no team is running in it
+static int region_slots(struct omp_region *r, int n)
+{
+    struct omp_slot *s;
 
-    o->f(o->in);
+    if (r->nslots >= n) {
+	return 0;
+    }
 
-    DEBUG("Finish - thread cookie=%lx, team=%d, num_threads_in_team=%d, thread_num_in_team=%d, level=%d, num_threads_in_level=%d,f=%p, in=%p, thread_num=%d, thread=%p\n", o->cookie, o->team, o->num_threads_in_team, o->thread_num_in_team, o->level, o->num_threads_in_level, o->f, o->in, o->thread_num, o->thread);
+    s = (struct omp_slot *) malloc(sizeof(*s)*n);
 
-    free(o);
+    if (!s) {
+	ERROR("Failed to allocate slots for %d threads\n", n);
+	return -1;
+    }
+
+    // slots hold no state between uses of the region
+    if (r->slots) {
+	free(r->slots);
+    }
+    r->slots = s;
+    r->nslots = n;
+
+    return 0;
 }
 
-void GOMP_parallel_start(void (*f)(void*), void *d, unsigned numthreads)
+static struct omp_region *region_create(int nthreads)
 {
-    DEBUG("GOMP_parallel_start(f=%p,d=%p,numthreads=%u)\n", f, d, numthreads);
-
-    struct omp_thread *p = (struct omp_thread*)(get_cur_thread()->input);
+    struct omp_region *r = (struct omp_region *) malloc(sizeof(*r));
 
-    
-    if (!p || (p->cookie != OMP_COOKIE)) {
-	ERROR("GOMP_parallel_start() from thread that is not an OMP thread\n");
-	return;
+    if (!r) {
+	ERROR("Failed to allocate region\n");
+	return 0;
     }
 
-    unsigned i;
+    memset(r,0,sizeof(*r));
 
-    if (!numthreads) { 
-	if (p->max_threads_in_team) {
-	    numthreads = p->max_threads_in_team;
-	} else {
-	    numthreads = nk_get_num_cpus();
-	}
+    if (region_slots(r,nthreads)) {
+	free(r);
+	return 0;
     }
 
-    // configure myself
-
-    p->num_threads_in_team = numthreads;
-    p->num_threads_in_level = numthreads; // wrong
-    p->thread_num_in_team = 0; // wrong
-    p->thread_num = 0; //wrong?
-    p->team_leader = p;
-
-    nk_counting_barrier_init(&p->team_barrier,p->num_threads_in_team);
+    return r;
+}
 
+static void region_destroy(struct omp_region *r)
+{
+    free(r->slots);
+    free(r);
+}
 
-    for (i=1;i<numthreads;i++) { 
-	struct omp_thread *c = (struct omp_thread *) malloc(sizeof(*c));
-	if (!c) { 
-	    ERROR("Failed to allocate block - running as function\n");
-	    f(d);
-	} else {
-	    memset(c,0,sizeof(*c));
-	    c->cookie=OMP_COOKIE;
-	    c->team = p->team;
-	    c->level = p->level+1;
-	    c->num_threads_in_team = numthreads; // wrong
-	    c->num_threads_in_level = numthreads; // wrong
-	    c->thread_num_in_team = i; // wrong
-	    c->thread_num = i; // wrong
-	    c->f=f;
-	    c->in=d;
-	    c->team_leader = p;
-	    DEBUG("thread %d: cookie=%lx, team=%d, num_threads_in_team=%d, thread_num_in_team=%d, level=%d, num_threads_in_level=%d,f=%p, in=%p, thread_num=%d, thread=%p\n", i, c->cookie, c->team, c->num_threads_in_team, c->thread_num_in_team, c->level, c->num_threads_in_level, c->f, c->in, c->thread_num, c->thread);
-	    if (nk_thread_start(parallel_start_wrapper,
-				c,0,0,TSTACK_DEFAULT,0,-1)) {
-		DEBUG("failed to launch as thread, running as function\n");
-		free(c);
-		f(d);
-	    }
-	}
+static void region_begin(struct omp_region *r, struct omp_thread *master, int nthreads)
+{
+    int i;
+
+    r->master = master;
+    r->nthreads = nthreads;
+    r->tasks = 0;
+
+    ws_reset(r->ws);
+
+    for (i=0;i<nthreads;i++) {
+	struct omp_slot *s = &r->slots[i];
+	spinlock_init(&s->lock);
+	INIT_LIST_HEAD(&s->ready);
+	memset(&s->itask,0,sizeof(s->itask));
+	s->itask.region = r;
+	s->itask.refs = 1;  // never freed
+	spinlock_init(&s->itask.dep_lock);
     }
 }
 
-void GOMP_parallel_end()
+static inline struct omp_slot *my_slot(struct omp_thread *o)
 {
-    DEBUG("GOMP_parallel_end()\n");
-    nk_join_all_children(0);
-    DEBUG("GOMP_parallel_end() complete\n");
+    return &o->region->slots[o->thread_num_in_team];
 }
 
+static inline struct omp_task *cur_task(struct omp_thread *o)
+{
+    return o->cur_task ? o->cur_task : &my_slot(o)->itask;
+}
 
-// this is "any" - we will make it simply be the first thread in the team
-int GOMP_single_start()
+static inline void task_get(struct omp_task *t)
 {
-    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+    __sync_fetch_and_add(&t->refs,1);
+}
 
-    if (o->thread_num_in_team==0) { 
-	DEBUG("GOMP_single_start() => 1 (first thread in team)\n");
-	return 1;
-    } else {
-	DEBUG("GOMP_single_start() => 0 (not first thread in team)\n");
-	return 0;
+static inline void task_put(struct omp_task *t)
+{
+    if (!__sync_sub_and_fetch(&t->refs,1)) {
+	task_clear_deps(t);
+	free(t);
     }
 }
 
-void GOMP_parallel(void (*f)(void*), void *d, unsigned numthreads, unsigned flags)
+static void task_enqueue(struct omp_thread *o, struct omp_task *t)
 {
-    DEBUG("GOMP_parallel(f=%p, d=%p, numthreads=%u, flags=%x)\n",
-	  f,d,numthreads,flags);
-    GOMP_parallel_start(f,d,numthreads);
-    f(d);
-    GOMP_parallel_end();
-}
+    struct omp_slot *s = my_slot(o);
 
+    spin_lock(&s->lock);
+    list_add(&t->node,&s->ready);
+    spin_unlock(&s->lock);
+}
 
-// this is "any" - we will make it simply be the first thread in the team
-// other threads wait
-void *GOMP_single_copy_start()
+// our newest task, or else the oldest task of someone else
+static struct omp_task *task_dequeue(struct omp_thread *o)
 {
-    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+    struct omp_region *r = o->region;
+    struct omp_slot *s = my_slot(o);
+    struct omp_task *t = 0;
+    int i;
+
+    if (!list_empty(&s->ready)) {
+	spin_lock(&s->lock);
+	if (!list_empty(&s->ready)) {
+	    t = list_first_entry(&s->ready,struct omp_task,node);
+	    list_del_init(&t->node);
+	}
+	spin_unlock(&s->lock);
+	if (t) {
+	    return t;
+	}
+    }
 
-    if (o->thread_num_in_team==0) { 
-	o->cur_single=0;
-	DEBUG("GOMP_single_copy_start() => 0 (first thread in team)\n");
-	return 0;
-    } else {
-	DEBUG("GOMP_single_copy_start() [Waiting]\n");
-        nk_counting_barrier(&o->team_leader->team_barrier);
-	DEBUG("GOMP_single_copy_start() [Done]\n");
-        return o->team_leader->cur_single;
+    for (i=1;i<r->nthreads;i++) {
+	s = &r->slots[(o->thread_num_in_team+i) % r->nthreads];
+	if (list_empty(&s->ready)) {
+	    continue;
+	}
+	spin_lock(&s->lock);
+	if (!list_empty(&s->ready)) {
+	    t = list_entry(s->ready.prev,struct omp_task,node);
+	    list_del_init(&t->node);
+	}
+	spin_unlock(&s->lock);
+	if (t) {
+	    return t;
+	}
     }
+
+    return 0;
 }
 
-void GOMP_single_copy_end(void *data)
+static void task_complete(struct omp_thread *o, struct omp_task *t)
 {
-    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
-    DEBUG("GOMP_single_copy_end(%p) (start)\n",data);
-    o->cur_single = data;
-    nk_counting_barrier(&o->team_barrier);
-    DEBUG("GOMP_single_copy_end(%p) (end)\n",data);
-}
-    
-void GOMP_barrier()
-{ 
-    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
-    DEBUG("GOMP_barrier (start)\n");
-    nk_counting_barrier(&o->team_leader->team_barrier);
-    DEBUG("GOMP_barrier (end)\n");
-}
+    struct omp_task *p = t->parent;
+    struct omp_region *r = t->region;
+    struct omp_task_edge *e, *n;
+
+    spin_lock(&p->dep_lock);
+    t->done = 1;
+    e = t->succ;
+    t->succ = 0;
+    spin_unlock(&p->dep_lock);
+
+    for (;e;e=n) {
+	struct omp_task *s = e->task;
+	int undeferred = s->undeferred;  // s may be gone once released
+	n = e->next;
+	free(e);
+	if (!__sync_sub_and_fetch(&s->npred,1) && !undeferred) {
+	    task_enqueue(o,s);
+	}
+    }
 
+    if (t->group) {
+	__sync_fetch_and_sub(&t->group->pending,1);
+    }
 
-static spinlock_t gomp_global_lock=0;
+    __sync_fetch_and_sub(&p->children,1);
+    task_put(p);
 
-void GOMP_critical_start(void)
-{
-    DEBUG("GOMP_critical_start (start)\n");
-    spin_lock(&gomp_global_lock);
-    DEBUG("GOMP_critical_start (end)\n");
+    __sync_fetch_and_sub(&r->tasks,1);
+    task_put(t);
 }
 
-void GOMP_critical_end(void)
+static void task_execute(struct omp_thread *o, struct omp_task *t)
 {
-    DEBUG("GOMP_critical_end\n");
-    spin_unlock(&gomp_global_lock);
-}
+    struct omp_task *prev = o->cur_task;
 
+    o->cur_task = t;
+    t->fn(t->data);
+    o->cur_task = prev;
 
-/*
-SYNCBENCH
-
-/home/pdinda/test/nautilus/src/test/ompbench/syncbench.c:212: undefined reference to `GOMP_loop_ordered_static_start'
-/home/pdinda/test/nautilus/src/test/ompbench/syncbench.c:212: undefined reference to `GOMP_ordered_start'
-/home/pdinda/test/nautilus/src/test/ompbench/syncbench.c:212: undefined reference to `GOMP_ordered_end'
-/home/pdinda/test/nautilus/src/test/ompbench/syncbench.c:214: undefined reference to `GOMP_loop_ordered_static_next'
-/home/pdinda/test/nautilus/src/test/ompbench/syncbench.c:214: undefined reference to `GOMP_loop_end_nowait'
-make: *** [nautilus.bin] Error 1
-*/
+    task_complete(o,t);
+}
 
-/*
-   TASKBENCH
-src/built-in.o: In function `testParallelTaskGeneration._omp_fn.0':
-/home/pdinda/test/nautilus/src/test/ompbench/taskbench.c:116: undefined reference to `GOMP_task'
-ence to `GOMP_taskwait'
-*/
+static int task_run_one(struct omp_thread *o)
+{
+    struct omp_task *t = task_dequeue(o);
 
+    if (t) {
+	task_execute(o,t);
+	return 1;
+    } else {
+	return 0;
+    }
+}
 
-void GOMP_task (void (*fn) (void *), 
-		void *data, 
-		void (*cpyfn) (void *, void *),
-		long arg_size, 
-		long arg_align, 
-		int if_clause,
-		unsigned flags,
-		void **depend, 
-		int priority)
+// run tasks until the count drops to zero
+static void task_wait_until(struct omp_thread *o, volatile long *count)
 {
-    struct omp_thread *p = (struct omp_thread*)(get_cur_thread()->input);
-    DEBUG("GOMP_task(fn=%p, data=%p, cpy=%p, arg_size=%ld arg_align=%ld if=%d flags=0x%x depend=%p priority=%d\n",
-	  fn, data, cpyfn, arg_size, arg_align, if_clause, flags, depend, priority);
+    int i = 0;
 
-    struct omp_thread *c = (struct omp_thread *) malloc(sizeof(*c));
-    if (!c) { 
-	ERROR("Failed to allocate block\n");
-    } else {
-	memset(c,0,sizeof(*c));
-	
-	c->cookie=OMP_COOKIE;
-	c->team = p->team;
-	c->level = p->level+1;
-	c->num_threads_in_team = 1; // wrong
-	c->num_threads_in_level = 1; // wrong
-	c->thread_num_in_team = 0; // wrong
-	c->thread_num = 0; // wrong
-	c->f=fn;
-	c->in=data;
-	c->team_leader = p;
-	
-	DEBUG("thread: cookie=%lx, team=%d, num_threads_in_team=%d, thread_num_in_team=%d, level=%d, num_threads_in_level=%d,f=%p, in=%p, thread_num=%d, thread=%p\n", c->cookie, c->team, c->num_threads_in_team, c->thread_num_in_team, c->level, c->num_threads_in_level, c->f, c->in, c->thread_num, c->thread);
-	if (nk_thread_start(parallel_start_wrapper,
-			    c,0,0,TSTACK_DEFAULT,0,-1)) {
-	    ERROR("Failed to start thread for task, running as function\n");
-	    fn(data);
+    while (*count) {
+	if (task_run_one(o)) {
+	    i = 0;
+	} else {
+	    ws_wait_spin(&i);
 	}
     }
 }
 
-void GOMP_taskwait()
+// end of our part in a region: all of the team's tasks are done
+// before anyone leaves
+static void region_finish(struct omp_thread *o)
 {
-    DEBUG("GOMP_taskwait() [begin]\n");
-    nk_join_all_children(0);
-    DEBUG("GOMP_taskwait() [end]\n");
+    task_wait_until(o,&o->region->tasks);
+    task_clear_deps(&my_slot(o)->itask);
 }
 
-/*
-  SCHEDBENCH
-src/built-in.o: In function `testdynamicn._omp_fn.2':
-/home/pdinda/test/nautilus/src/test/ompbench/schedbench.c:118: undefined reference to `GOMP_loop_dynamic_next'
-/home/pdinda/test/nautilus/src/test/ompbench/schedbench.c:118: undefined reference to `GOMP_loop_end'
-/home/pdinda/test/nautilus/src/test/ompbench/schedbench.c:122: undefined reference to `GOMP_loop_dynamic_start'
-src/built-in.o: In function `testguidedn._omp_fn.3':
-/home/pdinda/test/nautilus/src/test/ompbench/schedbench.c:131: undefined reference to `GOMP_loop_guided_next'
-/home/pdinda/test/nautilus/src/test/ompbench/schedbench.c:131: undefined reference to `GOMP_loop_end'
-/home/pdinda/test/nautilus/src/test/ompbench/schedbench.c:135: undefined reference to `GOMP_loop_guided_start'
-make: *** [nautilus.bin] Error 1
-*/
-
-
-int nk_openmp_thread_init()
+static void parallel_start_wrapper(void *in, void **out)
 {
-    struct nk_thread *t = get_cur_thread();
+    struct omp_thread *o = (struct omp_thread *)in;
+    char buf[32];
+
+    o->thread = get_cur_thread();
     
-    DEBUG("nk_openmp_thread_init() of thread %p\n", t);
+    o->thread->vc = o->thread->parent->vc;
 
-    if (t->input) { 
-	DEBUG("Overriding current thread input...\n");
-    }
+    snprintf(buf,32,"omp-%d-%d-%d",o->team,o->level,o->thread_num_in_team);
 
-    struct omp_thread *o = (struct omp_thread *)malloc(sizeof(*o));
+    nk_thread_name(o->thread,buf);
+    
 
-    if (!o) { 
-	ERROR("Cannot allocate space\n");
-	return -1;
-    }
+    DEBUG("Launch - thread cookie=%lx, team=%d, num_threads_in_team=%d, thread_num_in_team=%d, level=%d, num_threads_in_level=%d,f=%p, in=%p, thread_num=%d, thread=%p\n", o->cookie, o->team, o->num_threads_in_team, o->thread_num_in_team, o->level, o->num_threads_in_level, o->f, o->in, o->thread_num, o->thread);
 
-    memset(o,0,sizeof(*o));
+    o->f(o->in);
 
-    o->cookie=OMP_COOKIE;
+    region_finish(o);
 
-    o->team = 0;
-    o->level = 0;
-    o->num_threads_in_team = 1;
-    o->num_threads_in_level = 1;
-    o->thread_num_in_team = 0; 
-    o->thread_num = 0;
-    o->f=0;
-    o->in=t->input; // stash
+    DEBUG("Finish - thread cookie=%lx, team=%d, num_threads_in_team=%d, thread_num_in_team=%d, level=%d, num_threads_in_level=%d,f=%p, in=%p, thread_num=%d, thread=%p\n", o->cookie, o->team, o->num_threads_in_team, o->thread_num_in_team, o->level, o->num_threads_in_level, o->f, o->in, o->thread_num, o->thread);
+
+    free(o);
+}
+
+#ifdef NAUT_CONFIG_OPENMP_RT_GOMP_HOT_TEAMS
+
+// A team is the set of worker threads that a thread (the master)
+// uses to run the parallel regions it encounters.  Workers are
+// launched the first time they are needed and are then kept parked
+// on the team between regions, so entering a region costs a single
+// broadcast rather than a thread launch per worker (libgomp calls
+// these "hot teams").  A worker that is not needed for a smaller
+// region simply goes back to sleep.
+//
+// Parking is futex-like: a worker polls the team's generation word
+// for a while and then sleeps on the dock wait queue with the
+// generation change as its wakeup condition.  The master bumps the
+// generation and wakes the dock once.
+struct omp_team {
+    struct omp_thread *master;
+    int                depth;      // master's depth when using this team
+    int                size;       // workers launched, thread nums 1..size
+    volatile int       live;       // workers that have not yet exited
+    volatile uint64_t  gen;        // bumped by master to release workers
+    volatile int       shutdown;
+    // current region
+    int                nthreads;   // including the master
+    void             (*f)(void *);
+    void              *in;
+    volatile int       pending;    // participating workers not yet done
+    struct omp_team   *outer;      // master's enclosing team, if any
+    nk_wait_queue_t   *dock;       // parked workers sleep here
+    nk_wait_queue_t   *done;       // master sleeps here at region end
+    struct omp_region  region;
+};
+
+static int team_released(void *state)
+{
+    struct omp_thread *o = (struct omp_thread *)state;
+    return o->pool->gen != o->pool_gen;
+}
+
+static int team_finished(void *state)
+{
+    struct omp_team *t = (struct omp_team *)state;
+    return t->pending == 0;
+}
+
+static void team_destroy(struct omp_team *t);
+
+static void team_worker(void *in, void **out)
+{
+    struct omp_thread *o = (struct omp_thread *)in;
+    struct omp_team *t = o->pool;
+    char buf[32];
+    int i;
+
+    o->thread = get_cur_thread();
+    
+    o->thread->vc = o->thread->parent->vc;
+
+    snprintf(buf,32,"omp-%d-%d-%d",o->team,o->level,o->thread_num_in_team);
+
+    nk_thread_name(o->thread,buf);
+
+    while (1) {
+	for (i=0;i<OMP_TEAM_SPIN && !team_released(o);i++) {
+	    __asm__ __volatile__ ("pause");
+	}
+	while (!team_released(o)) {
+	    nk_wait_queue_sleep_extended(t->dock, team_released, o);
+	}
+	o->pool_gen = t->gen;
+
+	if (t->shutdown) {
+	    break;
+	}
+
+	if (o->thread_num_in_team >= t->nthreads) {
+	    // not needed for this region
+	    continue;
+	}
+
+	o->num_threads_in_team = t->nthreads;
+	o->num_threads_in_level = t->nthreads;
+	o->f = t->f;
+	o->in = t->in;
+	o->region = &t->region;
+	o->cur_task = 0;
+	memset(&o->wsc,0,sizeof(o->wsc));
+
+	DEBUG("Launch - thread cookie=%lx, team=%d, num_threads_in_team=%d, thread_num_in_team=%d, level=%d, num_threads_in_level=%d,f=%p, in=%p, thread_num=%d, thread=%p\n", o->cookie, o->team, o->num_threads_in_team, o->thread_num_in_team, o->level, o->num_threads_in_level, o->f, o->in, o->thread_num, o->thread);
+
+	o->f(o->in);
+
+	region_finish(o);
+
+	DEBUG("Finish - thread cookie=%lx, team=%d, num_threads_in_team=%d, thread_num_in_team=%d, level=%d, num_threads_in_level=%d,f=%p, in=%p, thread_num=%d, thread=%p\n", o->cookie, o->team, o->num_threads_in_team, o->thread_num_in_team, o->level, o->num_threads_in_level, o->f, o->in, o->thread_num, o->thread);
+
+	if (!__sync_sub_and_fetch(&t->pending,1)) {
+	    nk_wait_queue_wake_all(t->done);
+	}
+    }
+
+    // tear down the teams we were master of
+    for (i=0;i<OMP_MAX_HOT_DEPTH;i++) {
+	if (o->hot[i]) {
+	    team_destroy(o->hot[i]);
+	}
+    }
+
+    free(o);
+
+    // last touch of the team - the master may free it after this
+    __sync_fetch_and_sub(&t->live,1);
+}
+
+static struct omp_team *team_create(struct omp_thread *master, int depth)
+{
+    struct omp_team *t = (struct omp_team *)malloc(sizeof(*t));
+
+    if (!t) {
+	ERROR("Failed to allocate team\n");
+	return 0;
+    }
+
+    memset(t,0,sizeof(*t));
+
+    t->master = master;
+    t->depth = depth;
+    t->dock = nk_wait_queue_create(0);
+    t->done = nk_wait_queue_create(0);
+
+    if (!t->dock || !t->done || region_slots(&t->region,1)) {
+	ERROR("Failed to allocate team wait queues or slots\n");
+	if (t->dock) {
+	    nk_wait_queue_destroy(t->dock);
+	}
+	if (t->done) {
+	    nk_wait_queue_destroy(t->done);
+	}
+	free(t->region.slots);
+	free(t);
+	return 0;
+    }
+
+    return t;
+}
+
+static void team_destroy(struct omp_team *t)
+{
+    DEBUG("team_destroy(%p) with %d workers\n", t, t->size);
+
+    t->shutdown = 1;
+    __sync_fetch_and_add(&t->gen,1);
+    nk_wait_queue_wake_all(t->dock);
+
+    while (t->live) {
+	nk_yield();
+    }
+
+    nk_wait_queue_destroy(t->dock);
+    nk_wait_queue_destroy(t->done);
+    free(t->region.slots);
+    free(t);
+}
+
+// make sure the team has workers for a numthreads region, 
+// returns the number of threads that the region can actually have
+static int team_grow(struct omp_team *t, int numthreads)
+{
+    struct omp_thread *p = t->master;
+
+    while (t->size < numthreads-1) {
+	struct omp_thread *c = (struct omp_thread *) malloc(sizeof(*c));
+	if (!c) { 
+	    ERROR("Failed to allocate block - shrinking team to %d\n", t->size+1);
+	    break;
+	}
+	memset(c,0,sizeof(*c));
+	c->cookie=OMP_COOKIE;
+	c->team = p->team;
+	c->level = p->level+1;
+	c->thread_num_in_team = t->size+1;
+	c->thread_num = t->size+1;
+	c->team_leader = p;
+	c->pool = t;
+	c->pool_gen = t->gen;
+	__sync_fetch_and_add(&t->live,1);
+	if (nk_thread_start(team_worker,c,0,1,TSTACK_DEFAULT,0,-1)) {
+	    ERROR("Failed to launch worker - shrinking team to %d\n", t->size+1);
+	    __sync_fetch_and_sub(&t->live,1);
+	    free(c);
+	    break;
+	}
+	t->size++;
+    }
+
+    if (t->size+1 < numthreads) {
+	numthreads = t->size+1;
+    }
+
+    if (region_slots(&t->region,numthreads)) {
+	numthreads = t->region.nslots;
+    }
+
+    return numthreads;
+}
+
+// returns the team to use for a region entered by p
+static struct omp_team *team_enter(struct omp_thread *p)
+{
+    struct omp_team *t;
+    int depth = p->depth;
+
+    if (depth < OMP_MAX_HOT_DEPTH) {
+	if (!p->hot[depth]) {
+	    p->hot[depth] = team_create(p,depth);
+	}
+	t = p->hot[depth];
+    } else {
+	t = team_create(p,depth);
+    }
+
+    if (t) {
+	t->outer = p->cur_team;
+	p->cur_team = t;
+	p->depth++;
+    }
+
+    return t;
+}
+
+static void team_release(struct omp_team *t, void (*f)(void*), void *d, int numthreads)
+{
+    t->nthreads = numthreads;
+    t->f = f;
+    t->in = d;
+    t->pending = numthreads-1;
+
+    // the increment orders the region setup before the release
+    __sync_fetch_and_add(&t->gen,1);
+    nk_wait_queue_wake_all(t->dock);
+}
+
+static void team_wait(struct omp_team *t)
+{
+    int i;
+
+    for (i=0;i<OMP_TEAM_SPIN && !team_finished(t);i++) {
+	__asm__ __volatile__ ("pause");
+    }
+    while (!team_finished(t)) {
+	nk_wait_queue_sleep_extended(t->done, team_finished, t);
+    }
+}
+
+#endif
+
+static void ws_setup(struct omp_ws *w, int sched, int ordered,
+		     long start, long end, long incr, long chunk);
+
+// loop is the work-sharing loop of a combined parallel loop construct,
+// which is set up as the first loop of the region before any worker runs
+static void parallel_start(void (*f)(void*), void *d, unsigned numthreads, struct omp_ws *loop)
+{
+    struct omp_thread *p = (struct omp_thread*)(get_cur_thread()->input);
+    struct omp_region *r = 0;
+
+    
+    if (!p || (p->cookie != OMP_COOKIE)) {
+	ERROR("GOMP_parallel_start() from thread that is not an OMP thread\n");
+	return;
+    }
+
+    if (!numthreads) { 
+	if (p->max_threads_in_team) {
+	    numthreads = p->max_threads_in_team;
+	} else {
+	    numthreads = nk_get_num_cpus();
+	}
+    }
+
+#ifdef NAUT_CONFIG_OPENMP_RT_GOMP_HOT_TEAMS
+    struct omp_team *t = team_enter(p);
+
+    if (!t) {
+	ERROR("No team available - running region serially\n");
+	numthreads = 1;
+    } else {
+	numthreads = team_grow(t,numthreads);
+	r = &t->region;
+    }
+#endif
+
+    if (!r) {
+	r = region_create(numthreads);
+	if (!r) {
+	    panic("gomp: cannot allocate parallel region\n");
+	    return;
+	}
+    }
+
+    region_begin(r,p,numthreads);
+
+    // stash my state outside of the region
+
+    r->outer = p->region;
+    r->saved_task = p->cur_task;
+    r->saved_wsc = p->wsc;
+    r->saved_num_threads_in_team = p->num_threads_in_team;
+    r->saved_num_threads_in_level = p->num_threads_in_level;
+    r->saved_thread_num_in_team = p->thread_num_in_team;
+    r->saved_thread_num = p->thread_num;
+    r->saved_team_leader = p->team_leader;
+
+    // configure myself
+
+    p->num_threads_in_team = numthreads;
+    p->num_threads_in_level = numthreads; // wrong
+    p->thread_num_in_team = 0; // wrong
+    p->thread_num = 0; //wrong?
+    p->team_leader = p;
+    p->region = r;
+    p->cur_task = 0;
+    memset(&p->wsc,0,sizeof(p->wsc));
+
+    nk_counting_barrier_init(&p->team_barrier,p->num_threads_in_team);
+
+    if (loop) {
+	r->ws[0] = *loop;
+	r->ws[0].nthreads = r->ws[0].left = numthreads;
+	r->ws[0].gen = r->ws[0].ready = 0;
+    }
+
+#ifdef NAUT_CONFIG_OPENMP_RT_GOMP_HOT_TEAMS
+    if (t) {
+	DEBUG("releasing team %p (depth %d) of %d workers for %u threads\n", t, t->depth, t->size, numthreads);
+	team_release(t,f,d,numthreads);
+    }
+#else
+    unsigned i;
+
+    for (i=1;i<numthreads;i++) { 
+	struct omp_thread *c = (struct omp_thread *) malloc(sizeof(*c));
+	if (!c) { 
+	    ERROR("Failed to allocate block - running as function\n");
+	    f(d);
+	} else {
+	    memset(c,0,sizeof(*c));
+	    c->cookie=OMP_COOKIE;
+	    c->team = p->team;
+	    c->level = p->level+1;
+	    c->num_threads_in_team = numthreads; // wrong
+	    c->num_threads_in_level = numthreads; // wrong
+	    c->thread_num_in_team = i; // wrong
+	    c->thread_num = i; // wrong
+	    c->f=f;
+	    c->in=d;
+	    c->team_leader = p;
+	    c->region = r;
+	    DEBUG("thread %d: cookie=%lx, team=%d, num_threads_in_team=%d, thread_num_in_team=%d, level=%d, num_threads_in_level=%d,f=%p, in=%p, thread_num=%d, thread=%p\n", i, c->cookie, c->team, c->num_threads_in_team, c->thread_num_in_team, c->level, c->num_threads_in_level, c->f, c->in, c->thread_num, c->thread);
+	    if (nk_thread_start(parallel_start_wrapper,
+				c,0,0,TSTACK_DEFAULT,0,-1)) {
+		DEBUG("failed to launch as thread, running as function\n");
+		free(c);
+		f(d);
+	    }
+	}
+    }
+#endif
+}
+
+void GOMP_parallel_start(void (*f)(void*), void *d, unsigned numthreads)
+{
+    DEBUG("GOMP_parallel_start(f=%p,d=%p,numthreads=%u)\n", f, d, numthreads);
+    parallel_start(f,d,numthreads,0);
+}
+
+void GOMP_parallel_end()
+{
+    struct omp_thread *p = (struct omp_thread*)(get_cur_thread()->input);
+    struct omp_region *r;
+    int own = 1;
+
+    DEBUG("GOMP_parallel_end()\n");
+
+    if (!p || p->cookie != OMP_COOKIE || !p->region ||
+	p->region->master != p || !p->region->outer) {
+	ERROR("GOMP_parallel_end() without matching start\n");
+	return;
+    }
+
+    r = p->region;
+
+    region_finish(p);
+
+#ifdef NAUT_CONFIG_OPENMP_RT_GOMP_HOT_TEAMS
+    struct omp_team *t = p->cur_team;
+
+    if (t && r == &t->region) {
+	own = 0;
+	team_wait(t);
+    }
+#else
+    nk_join_all_children(0);
+#endif
+
+    p->region = r->outer;
+    p->cur_task = r->saved_task;
+    p->wsc = r->saved_wsc;
+    p->num_threads_in_team = r->saved_num_threads_in_team;
+    p->num_threads_in_level = r->saved_num_threads_in_level;
+    p->thread_num_in_team = r->saved_thread_num_in_team;
+    p->thread_num = r->saved_thread_num;
+    p->team_leader = r->saved_team_leader;
+    nk_counting_barrier_init(&p->team_barrier,p->num_threads_in_team);
+
+#ifdef NAUT_CONFIG_OPENMP_RT_GOMP_HOT_TEAMS
+    if (!own) {
+	p->cur_team = t->outer;
+	p->depth--;
+	if (t->depth >= OMP_MAX_HOT_DEPTH) {
+	    team_destroy(t);
+	}
+    }
+#endif
+
+    if (own) {
+	region_destroy(r);
+    }
+
+    DEBUG("GOMP_parallel_end() complete\n");
+}
+
+
+// this is "any" - we will make it simply be the first thread in the team
+int GOMP_single_start()
+{
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+
+    if (o->thread_num_in_team==0) { 
+	DEBUG("GOMP_single_start() => 1 (first thread in team)\n");
+	return 1;
+    } else {
+	DEBUG("GOMP_single_start() => 0 (not first thread in team)\n");
+	return 0;
+    }
+}
+
+void GOMP_parallel(void (*f)(void*), void *d, unsigned numthreads, unsigned flags)
+{
+    DEBUG("GOMP_parallel(f=%p, d=%p, numthreads=%u, flags=%x)\n",
+	  f,d,numthreads,flags);
+    GOMP_parallel_start(f,d,numthreads);
+    f(d);
+    GOMP_parallel_end();
+}
+
+
+// this is "any" - we will make it simply be the first thread in the team
+// other threads wait
+void *GOMP_single_copy_start()
+{
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+
+    if (o->thread_num_in_team==0) { 
+	o->cur_single=0;
+	DEBUG("GOMP_single_copy_start() => 0 (first thread in team)\n");
+	return 0;
+    } else {
+	DEBUG("GOMP_single_copy_start() [Waiting]\n");
+        nk_counting_barrier(&o->team_leader->team_barrier);
+	DEBUG("GOMP_single_copy_start() [Done]\n");
+        return o->team_leader->cur_single;
+    }
+}
+
+void GOMP_single_copy_end(void *data)
+{
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+    DEBUG("GOMP_single_copy_end(%p) (start)\n",data);
+    o->cur_single = data;
+    nk_counting_barrier(&o->team_barrier);
+    DEBUG("GOMP_single_copy_end(%p) (end)\n",data);
+}
+    
+void GOMP_barrier()
+{ 
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+    DEBUG("GOMP_barrier (start)\n");
+    // the team's tasks are done before anyone passes
+    task_wait_until(o,&o->region->tasks);
+    nk_counting_barrier(&o->team_leader->team_barrier);
+    DEBUG("GOMP_barrier (end)\n");
+}
+
+
+static volatile uint32_t gomp_global_lock=0;
+
+void GOMP_critical_start(void)
+{
+    DEBUG("GOMP_critical_start (start)\n");
+    nk_futex_mutex_lock(&gomp_global_lock);
+    DEBUG("GOMP_critical_start (end)\n");
+}
+
+void GOMP_critical_end(void)
+{
+    DEBUG("GOMP_critical_end\n");
+    nk_futex_mutex_unlock(&gomp_global_lock);
+}
+
+
+// Work-sharing loops - see the comment at struct omp_ws
+//
+// The entry points follow the libgomp "long" ABI: the loop runs
+// from start up to (not including) end by incr, and each successful
+// start/next call hands the caller the iterations [*istart,*iend).
+
+static void ws_setup(struct omp_ws *w, int sched, int ordered,
+		     long start, long end, long incr, long chunk)
+{
+    if (sched == omp_sched_auto) {
+	sched = omp_sched_static;
+    }
+    if (chunk < 1 && sched != omp_sched_static) {
+	chunk = 1;
+    }
+
+    w->sched = sched;
+    w->ordered = ordered;
+    w->start = start;
+    w->incr = incr;
+    w->chunk = chunk;
+    if (incr > 0) {
+	w->n = start < end ? (end - start + incr - 1) / incr : 0;
+    } else {
+	w->n = start > end ? (start - end - incr - 1) / -incr : 0;
+    }
+    w->next = 0;
+    w->ord = 0;
+}
+
+// find (and if we are first, set up) the slot of the next loop of
+// the region; a null sched means the loop is already set up
+static struct omp_ws *ws_enter(struct omp_thread *o, int sched, int ordered,
+			       long start, long end, long incr, long chunk)
+{
+    struct omp_ws *ring = o->region->ws;
+    long k = o->wsc.count++;
+    struct omp_ws *w = &ring[k % OMP_WS_SLOTS];
+    int i = 0;
+
+    while (w->ready != k) {
+	if (sched && w->gen == k - OMP_WS_SLOTS && !w->left &&
+	    __sync_bool_compare_and_swap(&w->gen, k - OMP_WS_SLOTS, k)) {
+	    ws_setup(w,sched,ordered,start,end,incr,chunk);
+	    w->nthreads = w->left = o->num_threads_in_team;
+	    __sync_synchronize();
+	    w->ready = k;
+	    break;
+	}
+	ws_wait_spin(&i);
+    }
+
+    DEBUG("ws_enter loop %ld: sched=%d ordered=%d n=%ld chunk=%ld nthreads=%d\n",
+	  k, w->sched, w->ordered, w->n, w->chunk, w->nthreads);
+
+    o->wsc.ws = w;
+    o->wsc.trip = 0;
+    o->wsc.lo = o->wsc.hi = 0;
+
+    return w;
+}
+
+static void ws_leave(struct omp_thread *o)
+{
+    if (o->wsc.ws) {
+	__sync_fetch_and_sub(&o->wsc.ws->left,1);
+	o->wsc.ws = 0;
+    }
+}
+
+// in ordered loops, a chunk hands the token on once it is done
+static inline void ws_ordered_pass(struct omp_ws *w, struct omp_ws_cursor *c)
+{
+    int i = 0;
+
+    if (c->hi > c->lo) {
+	while (w->ord != c->lo) {
+	    ws_wait_spin(&i);
+	}
+	w->ord = c->hi;
+    }
+}
+
+static int ws_next(struct omp_thread *o, long *istart, long *iend)
+{
+    struct omp_ws *w = o->wsc.ws;
+    struct omp_ws_cursor *c = &o->wsc;
+    long lo, hi, q;
+
+    if (!w) {
+	// first call in a combined parallel loop
+	w = ws_enter(o,0,0,0,0,0,0);
+    }
+
+    if (w->ordered) {
+	ws_ordered_pass(w,c);
+    }
+
+    switch (w->sched) {
+    case omp_sched_static:
+	if (!w->chunk) {
+	    // one contiguous block per thread
+	    if (c->trip++) {
+		goto none;
+	    }
+	    q = w->n / w->nthreads;
+	    lo = w->n % w->nthreads;
+	    if (o->thread_num_in_team < lo) {
+		q++;
+		lo = q * o->thread_num_in_team;
+	    } else {
+		lo = q * o->thread_num_in_team + lo;
+	    }
+	    hi = lo + q;
+	    if (lo >= hi) {
+		goto none;
+	    }
+	} else {
+	    // chunks dealt round robin
+	    lo = (c->trip++ * w->nthreads + o->thread_num_in_team) * w->chunk;
+	    if (lo >= w->n) {
+		goto none;
+	    }
+	    hi = lo + w->chunk;
+	}
+	break;
+    case omp_sched_dynamic:
+	lo = __sync_fetch_and_add(&w->next,w->chunk);
+	if (lo >= w->n) {
+	    goto none;
+	}
+	hi = lo + w->chunk;
+	break;
+    case omp_sched_guided:
+	do {
+	    lo = w->next;
+	    if (lo >= w->n) {
+		goto none;
+	    }
+	    q = (w->n - lo + w->nthreads - 1) / w->nthreads;
+	    if (q < w->chunk) {
+		q = w->chunk;
+	    }
+	    hi = lo + q;
+	} while (!__sync_bool_compare_and_swap(&w->next,lo,hi));
+	break;
+    default:
+	ERROR("unknown loop schedule %d\n", w->sched);
+	goto none;
+    }
+
+    if (hi > w->n) {
+	hi = w->n;
+    }
+
+    c->lo = lo;
+    c->hi = hi;
+    *istart = w->start + lo * w->incr;
+    *iend = w->start + hi * w->incr;
+
+    return 1;
+
+ none:
+    c->lo = c->hi = 0;
+    return 0;
+}
+
+static int loop_start(int sched, int ordered, long start, long end, long incr,
+		      long chunk, long *istart, long *iend)
+{
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+
+    ws_enter(o,sched,ordered,start,end,incr,chunk);
+
+    return ws_next(o,istart,iend);
+}
+
+static int loop_next(long *istart, long *iend)
+{
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+
+    return ws_next(o,istart,iend);
+}
+
+static void parallel_loop(void (*fn)(void *), void *data, unsigned num_threads,
+			  int sched, long start, long end, long incr, long chunk)
+{
+    struct omp_ws loop;
+
+    ws_setup(&loop,sched,0,start,end,incr,chunk);
+
+    parallel_start(fn,data,num_threads,&loop);
+}
+
+static inline void runtime_schedule(int *sched, long *chunk)
+{
+    *sched = runtime_sched;
+    *chunk = runtime_chunk;
+}
+
+#define GOMP_LOOP(name, sched, ordered)					\
+int GOMP_loop_##name##_start(long start, long end, long incr, long chunk, \
+			     long *istart, long *iend)			\
+{									\
+    DEBUG("GOMP_loop_" #name "_start(%ld,%ld,%ld,%ld)\n",start,end,incr,chunk); \
+    return loop_start(sched,ordered,start,end,incr,chunk,istart,iend);	\
+}									\
+int GOMP_loop_##name##_next(long *istart, long *iend)			\
+{									\
+    return loop_next(istart,iend);					\
+}
+
+#define GOMP_LOOP_RUNTIME(name, ordered)				\
+int GOMP_loop_##name##_start(long start, long end, long incr,		\
+			     long *istart, long *iend)			\
+{									\
+    int sched; long chunk;						\
+    runtime_schedule(&sched,&chunk);					\
+    DEBUG("GOMP_loop_" #name "_start(%ld,%ld,%ld) sched=%d chunk=%ld\n",start,end,incr,sched,chunk); \
+    return loop_start(sched,ordered,start,end,incr,chunk,istart,iend);	\
+}									\
+int GOMP_loop_##name##_next(long *istart, long *iend)			\
+{									\
+    return loop_next(istart,iend);					\
+}
+
+GOMP_LOOP(static, omp_sched_static, 0)
+GOMP_LOOP(dynamic, omp_sched_dynamic, 0)
+GOMP_LOOP(guided, omp_sched_guided, 0)
+GOMP_LOOP(nonmonotonic_dynamic, omp_sched_dynamic, 0)
+GOMP_LOOP(nonmonotonic_guided, omp_sched_guided, 0)
+GOMP_LOOP(ordered_static, omp_sched_static, 1)
+GOMP_LOOP(ordered_dynamic, omp_sched_dynamic, 1)
+GOMP_LOOP(ordered_guided, omp_sched_guided, 1)
+GOMP_LOOP_RUNTIME(runtime, 0)
+GOMP_LOOP_RUNTIME(nonmonotonic_runtime, 0)
+GOMP_LOOP_RUNTIME(maybe_nonmonotonic_runtime, 0)
+GOMP_LOOP_RUNTIME(ordered_runtime, 1)
+
+// combined parallel loop constructs - the workers go straight to
+// GOMP_loop_*_next, so the loop is set up before the team starts
+#define GOMP_PARALLEL_LOOP(name, sched)					\
+void GOMP_parallel_loop_##name(void (*fn)(void *), void *data,		\
+			       unsigned num_threads, long start, long end, \
+			       long incr, long chunk, unsigned flags)	\
+{									\
+    DEBUG("GOMP_parallel_loop_" #name "(fn=%p,data=%p,num_threads=%u,%ld,%ld,%ld,%ld)\n", \
+	  fn,data,num_threads,start,end,incr,chunk);			\
+    parallel_loop(fn,data,num_threads,sched,start,end,incr,chunk);	\
+    fn(data);								\
+    GOMP_parallel_end();						\
+}									\
+void GOMP_parallel_loop_##name##_start(void (*fn)(void *), void *data,	\
+				       unsigned num_threads, long start, \
+				       long end, long incr, long chunk)	\
+{									\
+    DEBUG("GOMP_parallel_loop_" #name "_start(fn=%p,data=%p,num_threads=%u,%ld,%ld,%ld,%ld)\n", \
+	  fn,data,num_threads,start,end,incr,chunk);			\
+    parallel_loop(fn,data,num_threads,sched,start,end,incr,chunk);	\
+}
+
+#define GOMP_PARALLEL_LOOP_RUNTIME(name)				\
+void GOMP_parallel_loop_##name(void (*fn)(void *), void *data,		\
+			       unsigned num_threads, long start, long end, \
+			       long incr, unsigned flags)		\
+{									\
+    int sched; long chunk;						\
+    runtime_schedule(&sched,&chunk);					\
+    parallel_loop(fn,data,num_threads,sched,start,end,incr,chunk);	\
+    fn(data);								\
+    GOMP_parallel_end();						\
+}									\
+void GOMP_parallel_loop_##name##_start(void (*fn)(void *), void *data,	\
+				       unsigned num_threads, long start, \
+				       long end, long incr)		\
+{									\
+    int sched; long chunk;						\
+    runtime_schedule(&sched,&chunk);					\
+    parallel_loop(fn,data,num_threads,sched,start,end,incr,chunk);	\
+}
+
+GOMP_PARALLEL_LOOP(static, omp_sched_static)
+GOMP_PARALLEL_LOOP(dynamic, omp_sched_dynamic)
+GOMP_PARALLEL_LOOP(guided, omp_sched_guided)
+GOMP_PARALLEL_LOOP(nonmonotonic_dynamic, omp_sched_dynamic)
+GOMP_PARALLEL_LOOP(nonmonotonic_guided, omp_sched_guided)
+GOMP_PARALLEL_LOOP_RUNTIME(runtime)
+GOMP_PARALLEL_LOOP_RUNTIME(nonmonotonic_runtime)
+GOMP_PARALLEL_LOOP_RUNTIME(maybe_nonmonotonic_runtime)
+
+void GOMP_loop_end()
+{
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+    DEBUG("GOMP_loop_end()\n");
+    ws_leave(o);
+    GOMP_barrier();
+}
+
+void GOMP_loop_end_nowait()
+{
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+    DEBUG("GOMP_loop_end_nowait()\n");
+    ws_leave(o);
+}
+
+// the ordered token is passed per chunk, so a thread that holds it
+// keeps it until its chunk is done
+void GOMP_ordered_start()
+{
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+    struct omp_ws *w = o->wsc.ws;
+    int i = 0;
+
+    if (!w || !w->ordered) {
+	return;
+    }
+    
+    while (w->ord != o->wsc.lo) {
+	ws_wait_spin(&i);
+    }
+}
+
+void GOMP_ordered_end()
+{
+}
+
+
+// Tasks - see the comment at struct omp_task
+
+#define GOMP_TASK_FLAG_FINAL      (1 << 1)
+#define GOMP_TASK_FLAG_GRAINSIZE  (1 << 9)
+#define GOMP_TASK_FLAG_IF         (1 << 10)
+#define GOMP_TASK_FLAG_NOGROUP    (1 << 11)
+#define GOMP_TASK_FLAG_REDUCTION  (1 << 12)
+
+#define GOMP_DEPEND_IN            1
+
+static inline struct omp_dep **dep_bucket(struct omp_task *p, void *addr)
+{
+    uintptr_t a = (uintptr_t)addr;
+    return &p->deps[((a >> 4) ^ (a >> 12)) % OMP_DEP_BUCKETS];
+}
+
+// add an edge so that t runs after pred, under parent's dep_lock
+static void task_edge(struct omp_task *pred, struct omp_task *t)
+{
+    struct omp_task_edge *e;
+
+    if (pred == t || pred->done) {
+	return;
+    }
+
+    e = (struct omp_task_edge *) malloc(sizeof(*e));
+    if (!e) {
+	ERROR("Failed to allocate dependence edge - ignoring dependence\n");
+	return;
+    }
+    e->task = t;
+    e->next = pred->succ;
+    pred->succ = e;
+    __sync_fetch_and_add(&t->npred,1);
+}
+
+// t, a new child of p, depends on addr, under p's dep_lock
+static void task_depend_one(struct omp_task *p, struct omp_task *t, void *addr, int out)
+{
+    struct omp_dep **b, *d;
+    struct omp_task_edge *e, **ep;
+
+    if (!p->deps) {
+	p->deps = (struct omp_dep **) malloc(sizeof(struct omp_dep *)*OMP_DEP_BUCKETS);
+	if (!p->deps) {
+	    ERROR("Failed to allocate dependence table - ignoring dependence\n");
+	    return;
+	}
+	memset(p->deps,0,sizeof(struct omp_dep *)*OMP_DEP_BUCKETS);
+    }
+
+    b = dep_bucket(p,addr);
+    for (d=*b; d && d->addr!=addr; d=d->next) {
+    }
+
+    if (!d) {
+	d = (struct omp_dep *) malloc(sizeof(*d));
+	if (!d) {
+	    ERROR("Failed to allocate dependence - ignoring dependence\n");
+	    return;
+	}
+	memset(d,0,sizeof(*d));
+	d->addr = addr;
+	d->next = *b;
+	*b = d;
+    }
+
+    if (d->out) {
+	task_edge(d->out,t);
+    }
+
+    if (out) {
+	// follow all readers since the last writer, and become the writer
+	while ((e=d->in)) {
+	    d->in = e->next;
+	    task_edge(e->task,t);
+	    task_put(e->task);
+	    free(e);
+	}
+	if (d->out) {
+	    task_put(d->out);
+	}
+	task_get(t);
+	d->out = t;
+    } else {
+	// drop readers that are done as we go
+	ep = &d->in;
+	while ((e=*ep)) {
+	    if (e->task->done) {
+		*ep = e->next;
+		task_put(e->task);
+		free(e);
+	    } else {
+		ep = &e->next;
+	    }
+	}
+	e = (struct omp_task_edge *) malloc(sizeof(*e));
+	if (!e) {
+	    ERROR("Failed to allocate dependence - ignoring dependence\n");
+	    return;
+	}
+	task_get(t);
+	e->task = t;
+	e->next = d->in;
+	d->in = e;
+    }
+}
+
+// depend is in either the old (count, out count, addresses) or the
+// new (0, count, out count, mutexinoutset count, in count, addresses,
+// depobjs) format.  mutexinoutset is treated as inout.
+static void task_depend(struct omp_task *p, struct omp_task *t, void **depend)
+{
+    uintptr_t n, nout, nin, i;
+    void **addrs;
+
+    if ((uintptr_t)depend[0]) {
+	n = (uintptr_t)depend[0];
+	nout = (uintptr_t)depend[1];
+	nin = n - nout;
+	addrs = &depend[2];
+    } else {
+	n = (uintptr_t)depend[1];
+	nout = (uintptr_t)depend[2] + (uintptr_t)depend[3];
+	nin = (uintptr_t)depend[4];
+	addrs = &depend[5];
+    }
+
+    spin_lock(&p->dep_lock);
+    for (i=0;i<n;i++) {
+	if (i < nout) {
+	    task_depend_one(p,t,addrs[i],1);
+	} else if (i < nout + nin) {
+	    task_depend_one(p,t,addrs[i],0);
+	} else {
+	    // depobj: address and kind
+	    void **obj = (void **)addrs[i];
+	    task_depend_one(p,t,obj[0],(uintptr_t)obj[1] != GOMP_DEPEND_IN);
+	}
+    }
+    spin_unlock(&p->dep_lock);
+}
+
+// drop the dependence table of a task whose children are all done
+static void task_clear_deps(struct omp_task *t)
+{
+    struct omp_dep *d, *dn;
+    struct omp_task_edge *e, *en;
+    int i;
+
+    if (!t->deps) {
+	return;
+    }
+
+    for (i=0;i<OMP_DEP_BUCKETS;i++) {
+	for (d=t->deps[i];d;d=dn) {
+	    dn = d->next;
+	    for (e=d->in;e;e=en) {
+		en = e->next;
+		task_put(e->task);
+		free(e);
+	    }
+	    if (d->out) {
+		task_put(d->out);
+	    }
+	    free(d);
+	}
+    }
+
+    free(t->deps);
+    t->deps = 0;
+}
+
+// create a child of our current task, holding it back from running
+// until task_launch
+static struct omp_task *task_create(struct omp_thread *o, 
+				    void (*fn)(void *), void *data,
+				    void (*cpyfn)(void *, void *),
+				    long arg_size, long arg_align, 
+				    unsigned flags, void **depend, int undeferred)
+{
+    struct omp_task *p = cur_task(o);
+    struct omp_task *t;
+
+    if (arg_align < 1) {
+	arg_align = 1;
+    }
+
+    t = (struct omp_task *) malloc(sizeof(*t) + arg_size + arg_align);
+
+    if (!t) {
+	ERROR("Failed to allocate task\n");
+	return 0;
+    }
+
+    memset(t,0,sizeof(*t));
+
+    t->data = (void*)(((uintptr_t)(t+1) + arg_align - 1) & ~(uintptr_t)(arg_align - 1));
+    if (cpyfn) {
+	cpyfn(t->data,data);
+    } else {
+	memcpy(t->data,data,arg_size);
+    }
+
+    t->fn = fn;
+    t->parent = p;
+    t->group = p->taskgroup ? p->taskgroup : p->group;
+    t->region = o->region;
+    t->refs = 1;
+    t->npred = 1;  // held until task_launch
+    t->final = p->final || (flags & GOMP_TASK_FLAG_FINAL);
+    // tasks of a lone thread, and all tasks in a final task, are included
+    t->undeferred = undeferred || p->final || o->region->nthreads == 1;
+    spinlock_init(&t->dep_lock);
+
+    task_get(p);
+    __sync_fetch_and_add(&p->children,1);
+    if (t->group) {
+	__sync_fetch_and_add(&t->group->pending,1);
+    }
+    __sync_fetch_and_add(&o->region->tasks,1);
+
+    if (depend) {
+	task_depend(p,t,depend);
+    }
+
+    return t;
+}
+
+static void task_launch(struct omp_thread *o, struct omp_task *t)
+{
+    int i = 0;
+
+    if (!t->undeferred) {
+	if (!__sync_sub_and_fetch(&t->npred,1)) {
+	    task_enqueue(o,t);
+	}
+	return;
+    }
+
+    // run it here once its predecessors are done
+    __sync_fetch_and_sub(&t->npred,1);
+    while (t->npred) {
+	if (task_run_one(o)) {
+	    i = 0;
+	} else {
+	    ws_wait_spin(&i);
+	}
+    }
+
+    task_execute(o,t);
+}
+
+void GOMP_task (void (*fn) (void *), 
+		void *data, 
+		void (*cpyfn) (void *, void *),
+		long arg_size, 
+		long arg_align, 
+		int if_clause,
+		unsigned flags,
+		void **depend, 
+		int priority)
+{
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+    struct omp_task *t;
+
+    DEBUG("GOMP_task(fn=%p, data=%p, cpy=%p, arg_size=%ld arg_align=%ld if=%d flags=0x%x depend=%p priority=%d\n",
+	  fn, data, cpyfn, arg_size, arg_align, if_clause, flags, depend, priority);
+
+    t = task_create(o,fn,data,cpyfn,arg_size,arg_align,flags,depend,!if_clause);
+
+    if (!t) { 
+	ERROR("Failed to create task, running as function\n");
+	fn(data);
+	return;
+    }
+
+    task_launch(o,t);
+}
+
+void GOMP_taskwait()
+{
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+    struct omp_task *c = cur_task(o);
+
+    DEBUG("GOMP_taskwait() [begin]\n");
+    task_wait_until(o,&c->children);
+    task_clear_deps(c);
+    DEBUG("GOMP_taskwait() [end]\n");
+}
+
+void GOMP_taskyield()
+{
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+
+    task_run_one(o);
+}
+
+void GOMP_taskgroup_start()
+{
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+    struct omp_task *c = cur_task(o);
+    struct omp_taskgroup *g = (struct omp_taskgroup *) malloc(sizeof(*g));
+
+    DEBUG("GOMP_taskgroup_start()\n");
+
+    if (!g) {
+	// degrade to a taskwait at the end
+	ERROR("Failed to allocate taskgroup\n");
+	return;
+    }
+
+    memset(g,0,sizeof(*g));
+    g->prev = c->taskgroup;
+    g->outer = c->taskgroup ? c->taskgroup : c->group;
+    c->taskgroup = g;
+}
+
+void GOMP_taskgroup_end()
+{
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+    struct omp_task *c = cur_task(o);
+    struct omp_taskgroup *g = c->taskgroup;
+
+    DEBUG("GOMP_taskgroup_end() [begin]\n");
+
+    if (!g) {
+	task_wait_until(o,&c->children);
+	return;
+    }
+
+    task_wait_until(o,&g->pending);
+    c->taskgroup = g->prev;
+    free(g);
+
+    DEBUG("GOMP_taskgroup_end() [end]\n");
+}
+
+// Task reductions
+//
+// The compiler describes the reductions of a taskgroup in an array:
+// data[0] = number of variables, data[1] = size of the per-thread
+// block holding private copies of all of them, data[2] = alignment
+// of the block, and data[7+3*i] and data[8+3*i] = address of
+// variable i and offset of its private copy within a block.  There
+// may be several such arrays (for example, one per element type),
+// chained through data[4], which is 0 in the last.  For each we
+// allocate a zeroed block per team thread and hand the base back in
+// data[2].  The compiler merges the blocks itself after the
+// taskgroup ends.  As in libgomp, the last array's data[4] is then
+// linked to the reductions already registered with the taskgroup,
+// data[5] is set only in the first array of each registration, to
+// mark where its chain starts, and data[6] is the end of the blocks.
+// The allocation itself is stashed just below the aligned base.
+void GOMP_taskgroup_reduction_register(uintptr_t *data)
+{
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+    struct omp_taskgroup *g = cur_task(o)->taskgroup;
+    uintptr_t *d = data;
+    uintptr_t size, align;
+    void *raw;
+
+    DEBUG("GOMP_taskgroup_reduction_register(%p)\n", data);
+
+    while (1) {
+	size = d[1] * o->region->nthreads;
+	align = d[2] > sizeof(void*) ? d[2] : sizeof(void*);
+	raw = malloc(size + align + sizeof(void*));
+
+	DEBUG("registering %p, %lu variables\n", d, d[0]);
+
+	if (!raw) {
+	    panic("gomp: cannot allocate task reduction\n");
+	    return;
+	}
+
+	d[2] = ((uintptr_t)raw + sizeof(void*) + align - 1) & ~(align - 1);
+	((void**)d[2])[-1] = raw;
+	memset((void*)d[2],0,size);
+	d[5] = d == data;
+	d[6] = d[2] + size;
+
+	if (!d[4]) {
+	    break;
+	}
+	d = (uintptr_t*)d[4];
+    }
+
+    if (!g) {
+	ERROR("task reduction outside of taskgroup\n");
+	return;
+    }
+
+    d[4] = (uintptr_t)g->reductions;
+    g->reductions = data;
+}
+
+void GOMP_taskgroup_reduction_unregister(uintptr_t *data)
+{
+    uintptr_t *d = data;
+
+    DEBUG("GOMP_taskgroup_reduction_unregister(%p)\n", data);
+
+    // up to the start of the previous registration, if any
+    do {
+	free(((void**)d[2])[-1]);
+	d = (uintptr_t*)d[4];
+    } while (d && !d[5]);
+}
+
+// Map each address in ptrs to our private copy.  An address is
+// either an original variable, or a location within some thread's
+// private block (an array section, or a copy handed down by an
+// enclosing in_reduction).  For the first cntorig entries the
+// original variable is also returned in ptrs[cnt+i].
+void GOMP_task_reduction_remap(size_t cnt, size_t cntorig, void **ptrs)
+{
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+    struct omp_task *c = cur_task(o);
+    struct omp_taskgroup *first = c->taskgroup ? c->taskgroup : c->group;
+    struct omp_taskgroup *g;
+    uintptr_t *d;
+    uintptr_t p, off;
+    size_t i, j;
+
+    for (i=0;i<cnt;i++) {
+	p = (uintptr_t)ptrs[i];
+	for (g=first; g; g=g->outer) {
+	    for (d=g->reductions; d; d=(uintptr_t*)d[4]) {
+		for (j=0;j<d[0];j++) {
+		    if (d[7+3*j] == p) {
+			ptrs[i] = (void*)(d[2] + o->thread_num_in_team*d[1] + d[8+3*j]);
+			if (i < cntorig) {
+			    ptrs[cnt+i] = (void*)p;
+			}
+			goto next;
+		    }
+		}
+	    }
+	}
+	for (g=first; g; g=g->outer) {
+	    for (d=g->reductions; d; d=(uintptr_t*)d[4]) {
+		if (p >= d[2] && p < d[6]) {
+		    off = (p - d[2]) % d[1];
+		    ptrs[i] = (void*)(d[2] + o->thread_num_in_team*d[1] + off);
+		    if (i < cntorig) {
+			// the variable whose copy contains off
+			for (j=0;j+1<d[0] && d[8+3*(j+1)]<=off;j++) { }
+			ptrs[cnt+i] = (void*)d[7+3*j];
+		    }
+		    goto next;
+		}
+	    }
+	}
+	ERROR("task reduction of %p not found\n", ptrs[i]);
+    next:
+	;
+    }
+}
+
+// The leading fields of the data block of a taskloop are the bounds
+// of the iterations the task is to run, followed by the reduction
+// descriptor if there is one
+struct omp_taskloop_data {
+    long      start;
+    long      end;
+    uintptr_t *reductions;
+};
+
+void GOMP_taskloop(void (*fn)(void *), void *data,
+		   void (*cpyfn)(void *, void *),
+		   long arg_size, long arg_align, unsigned flags,
+		   unsigned long num_tasks, int priority,
+		   long start, long end, long step)
+{
+    struct omp_thread *o = (struct omp_thread*)(get_cur_thread()->input);
+    struct omp_taskloop_data *head = (struct omp_taskloop_data *)data;
+    long n, q, r, i, lo;
+
+    DEBUG("GOMP_taskloop(fn=%p, data=%p, flags=0x%x, num_tasks=%lu, start=%ld, end=%ld, step=%ld)\n",
+	  fn, data, flags, num_tasks, start, end, step);
+
+    if (step > 0) {
+	n = start < end ? (end - start + step - 1) / step : 0;
+    } else {
+	n = start > end ? (start - end - step - 1) / -step : 0;
+    }
+
+    if (flags & GOMP_TASK_FLAG_GRAINSIZE) {
+	// num_tasks is the grainsize
+	q = num_tasks ? n / (long)num_tasks : n;
+	num_tasks = q ? q : 1;
+    } else if (!num_tasks) {
+	num_tasks = o->region->nthreads;
+    }
+    if ((long)num_tasks > n) {
+	num_tasks = n ? n : 1;
+    }
+
+    if (!(flags & GOMP_TASK_FLAG_NOGROUP)) {
+	GOMP_taskgroup_start();
+	if (flags & GOMP_TASK_FLAG_REDUCTION) {
+	    GOMP_taskgroup_reduction_register(head->reductions);
+	}
+    }
+
+    q = n / num_tasks;
+    r = n % num_tasks;
+
+    for (i=0, lo=0; n && i<(long)num_tasks; i++) {
+	long cnt = q + (i < r);
+	struct omp_task *t = task_create(o,fn,data,cpyfn,arg_size,arg_align,flags,0,
+					 !(flags & GOMP_TASK_FLAG_IF));
+	struct omp_taskloop_data *th;
+
+	if (!t) {
+	    ERROR("Failed to create task, running as function\n");
+	    head->start = start + lo*step;
+	    head->end = start + (lo+cnt)*step;
+	    fn(data);
+	} else {
+	    th = (struct omp_taskloop_data *)t->data;
+	    th->start = start + lo*step;
+	    th->end = start + (lo+cnt)*step;
+	    task_launch(o,t);
+	}
+	lo += cnt;
+    }
+
+    if (!(flags & GOMP_TASK_FLAG_NOGROUP)) {
+	GOMP_taskgroup_end();
+    }
+}
+
+
+int nk_openmp_thread_init()
+{
+    struct nk_thread *t = get_cur_thread();
+    
+    DEBUG("nk_openmp_thread_init() of thread %p\n", t);
+
+    if (t->input) { 
+	DEBUG("Overriding current thread input...\n");
+    }
+
+    struct omp_thread *o = (struct omp_thread *)malloc(sizeof(*o));
+    struct omp_region *r = region_create(1);
+
+    if (!o || !r) { 
+	ERROR("Cannot allocate space\n");
+	free(o);
+	if (r) {
+	    region_destroy(r);
+	}
+	return -1;
+    }
+
+    memset(o,0,sizeof(*o));
+
+    o->cookie=OMP_COOKIE;
+
+    o->team = 0;
+    o->level = 0;
+    o->num_threads_in_team = 1;
+    o->num_threads_in_level = 1;
+    o->thread_num_in_team = 0; 
+    o->thread_num = 0;
+    o->f=0;
+    o->in=t->input; // stash
 
     t->input = o;
 
@@ -813,6 +2376,10 @@ int nk_openmp_thread_init()
 
     nk_counting_barrier_init(&o->team_barrier,1);
 
+    // the sequential part of the program is a region of one
+    region_begin(r,o,1);
+    o->region = r;
+
     DEBUG("nk_openmp_init(): cookie=%lx, team=%d, num_threads_in_team=%d, thread_num_in_team=%d, level=%d, num_threads_in_level=%d,f=%p, in=%p, thread_num=%d, thread=%p\n", o->cookie, o->team, o->num_threads_in_team, o->thread_num_in_team, o->level, o->num_threads_in_level, o->f, o->in, o->thread_num, o->thread);
 
 
@@ -829,6 +2396,18 @@ int nk_openmp_thread_deinit()
 
     struct omp_thread *o = (struct omp_thread *)t->input;
 
+#ifdef NAUT_CONFIG_OPENMP_RT_GOMP_HOT_TEAMS
+    int i;
+    for (i=0;i<OMP_MAX_HOT_DEPTH;i++) {
+	if (o->hot[i]) {
+	    team_destroy(o->hot[i]);
+	}
+    }
+#endif
+
+    region_finish(o);
+    region_destroy(o->region);
+
     t->input = o->in; // restore
 
     free(o);
@@ -193,17 +193,23 @@ typedef struct container {
 	MUTEX_T lock;
 } container_t;
 
+typedef struct waiter {
+	container_t * cont;
+	uint32_t id;
+} waiter_t;
+
 
 static FUNC_TYPE
 waitonit FUNC_HDR
 {
-	container_t * cont = (container_t*)in;
+	waiter_t * w = (waiter_t*)in;
+	container_t * cont = w->cont;
 	COND_T * c = (COND_T*)cont->cvar;
 	BARRIER_T * b = (BARRIER_T*)cont->barrier;
 	uint32_t my_id;
 
 /* BARRIER */
-	my_id = GETCPU();
+	my_id = w->id;
 
 	/* wait at the barrier */
 	BARRIER_WAIT(b);
@@ -235,15 +241,23 @@ waitonit FUNC_HDR
 #define BSP_CORE 0
 
 static inline void
-cores_wait(void)
+cores_wait(int n)
 {
-    while (core_recvd[0] != 0xfffffffffffffffe);
+    uint64_t want = (n >= 64 ? ~0ULL : (1ULL << n) - 1) & ~1ULL;
+
+    while (core_recvd[0] != want);
 }
 
 #define REM_CORE 1
 
-void time_cvar_bcast (void);
-void time_cvar_bcast (void)
+/* 
+ * Broadcast to nthreads-1 waiters (slot 0 is us) and time how long
+ * each takes to wake.  Waiter j runs on core j, or in Nautilus, on
+ * the cores other than ours in turn, so with more waiters than cores
+ * several are woken on the same core by one broadcast.
+ */
+static void
+cvar_bcast_run (int nthreads, int loops, int verbose)
 {
 	int i, j;
 	unsigned my_id;
@@ -251,6 +265,8 @@ void time_cvar_bcast (void)
 	BARRIER_T * b = malloc(sizeof(BARRIER_T));
 	container_t * cont = malloc(sizeof(container_t));
 	THREAD_T t[NUM_THREADS];
+	waiter_t w[NUM_THREADS];
+	uint64_t lat, last, sum = 0, sum_last = 0, worst = 0;
 	
     udelay(100);
 
@@ -273,26 +289,30 @@ void time_cvar_bcast (void)
 	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cp);
 #endif
 
-	for (i = 0; i < CONDVAR_LOOPS; i++) {
+	for (i = 0; i < loops; i++) {
 		uint64_t start = 0;
 
 		COND_INIT(cont->cvar);
 		MUTEX_INIT(&(cont->lock));
 
-		BARRIER_INIT(cont->barrier, NUM_THREADS);
+		BARRIER_INIT(cont->barrier, nthreads);
 
-		for (j = 0; j < NUM_THREADS; j++) { 
+		for (j = 0; j < nthreads; j++) { 
 
 			if (j == BSP_CORE) continue;
 
+			w[j].cont = cont;
+			w[j].id   = j;
+
 #ifdef __USER
 			cpu_set_t cpuset;
 			CPU_ZERO(&cpuset);
 			CPU_SET(j, &cpuset);
-			pthread_create(&t[j], NULL, waitonit, cont);
+			pthread_create(&t[j], NULL, waitonit, &w[j]);
 			pthread_setaffinity_np(t[j], sizeof(cpu_set_t), &cpuset);
 #else
-			nk_thread_start(waitonit, cont, NULL, 0, TSTACK_DEFAULT, &t[j], j);
+			nk_thread_start(waitonit, &w[j], NULL, 0, TSTACK_DEFAULT, &t[j],
+					nk_get_num_cpus() > 1 ? 1 + (j - 1) % (nk_get_num_cpus() - 1) : 0);
 #endif
 		
 		}
@@ -308,20 +328,34 @@ void time_cvar_bcast (void)
 		COND_BCAST(cont->cvar);
 
 		/* wait on everyone to finish waking up */
-		cores_wait();
+		cores_wait(nthreads);
 
 		/* join all the threads and print the trial */
-		for (j = 0; j < NUM_THREADS; j++) {
+		last = 0;
+		for (j = 0; j < nthreads; j++) {
 			if (j == BSP_CORE) continue;
 
 			if (start > core_counters[j]) {
 				PRINT("STRANGENESS OCCURED IN CYCLE COUNT - start=%llu, end=%llu\n", start, core_counters[j]);
 			}
 
-			PRINT("TRIAL %u RC: %u %llu cycles\n", i, j, core_counters[j] - start);
+			lat = core_counters[j] - start;
+			sum += lat;
+			if (lat > last) {
+				last = lat;
+			}
+
+			if (verbose) {
+				PRINT("TRIAL %u RC: %u %llu cycles\n", i, j, lat);
+			}
 			JOIN_FUNC(t[j], NULL);
 		}
 
+		sum_last += last;
+		if (last > worst) {
+			worst = last;
+		}
+
 		/* clear timing info */
 		memset((void*)core_counters, 0, sizeof(core_counters));
 		memset((void*)core_recvd, 0, sizeof(core_recvd));
@@ -337,6 +371,19 @@ void time_cvar_bcast (void)
 		MUTEX_DEINIT(&(cont->lock));
 	}
 
+	PRINT("cvar bcast: %d waiters, %d trials: mean wake %llu cycles, mean last %llu cycles, worst %llu cycles\n",
+	      nthreads - 1, loops,
+	      sum / (loops * (nthreads - 1)), sum_last / loops, worst);
+
+	free(cont);
+	free(b);
+	free(c);
+}
+
+void time_cvar_bcast (void);
+void time_cvar_bcast (void)
+{
+	cvar_bcast_run(NUM_THREADS, CONDVAR_LOOPS, 1);
 }
 
 
@@ -560,14 +607,39 @@ void time_threads_long(void)
 }
 
 
+/*
+ * With the thread cache, the create benchmarks run once with the cache
+ * off (every create allocates a struct and stack) and once with it on.
+ * Dead threads are reaped outside of the timed region in both cases, so
+ * the cache-off run never reanimates and the cache-on run recycles.
+ */
+#if !defined(__USER) && defined(NAUT_CONFIG_THREAD_CACHE)
+#define THREAD_CACHE_MODES      2
+#define THREAD_CACHE_SET(m)     nk_thread_cache_enable(m)
+#define THREAD_CACHE_NAME(m)    ((m) ? "thread cache on" : "thread cache off")
+#define THREAD_CACHE_REAP()     nk_sched_reap(1)
+#else
+#define THREAD_CACHE_MODES      1
+#define THREAD_CACHE_SET(m)
+#define THREAD_CACHE_NAME(m)    "default"
+#define THREAD_CACHE_REAP()
+#endif
+
 void time_thread_create(void);
 void
 time_thread_create (void)
 {
     THREAD_T t;
 
-    int i;
+    int i, mode;
 	uint64_t start,end;
+	uint64_t sum, min, max;
+
+    for (mode = 0; mode < THREAD_CACHE_MODES; mode++) {
+
+		THREAD_CACHE_SET(mode);
+		sum = max = 0;
+		min = ULLONG_MAX;
 
     for (i = 0; i < THR_CREATE_LOOPS; i++) {
         rdtscll(start);
@@ -588,8 +660,17 @@ time_thread_create (void)
 		DELAY(10000);
 		PRINT("Trial %u %llu \n", i, end-start);
 
+		sum += end-start;
+		min = (end-start) < min ? (end-start) : min;
+		max = (end-start) > max ? (end-start) : max;
+
         JOIN_FUNC(t, NULL);
 
+		THREAD_CACHE_REAP();
+    }
+
+		PRINT("Thread create (%s): min %llu avg %llu max %llu cycles\n",
+			  THREAD_CACHE_NAME(mode), min, sum/THR_CREATE_LOOPS, max);
     }
 }
 
@@ -650,7 +731,15 @@ time_thread_both (void)
 {
 	THREAD_T t;
 	unsigned i;
+	int mode;
 	uint64_t start, end;
+	uint64_t sum, min, max;
+
+	for (mode = 0; mode < THREAD_CACHE_MODES; mode++) {
+
+	THREAD_CACHE_SET(mode);
+	sum = max = 0;
+	min = ULLONG_MAX;
 
 	for (i = 0; i < RUN_TRIALS; i++) {
 
@@ -676,10 +765,20 @@ time_thread_both (void)
 	
 		JOIN_FUNC(t, NULL);
 
+		THREAD_CACHE_REAP();
+
 		thread_run_done = 0;
 
+		sum += end-start;
+		min = (end-start) < min ? (end-start) : min;
+		max = (end-start) > max ? (end-start) : max;
+
 		PRINT("TRIAL %u %llu cycles\n", i, end-start);
 	}
+
+	PRINT("Thread create+run (%s): min %llu avg %llu max %llu cycles\n",
+		  THREAD_CACHE_NAME(mode), min, sum/RUN_TRIALS, max);
+	}
 }
 
 
@@ -968,7 +1067,7 @@ time_nemo_bcast (void)
 
         nemo_event_broadcast(id);
 
-        cores_wait();
+        cores_wait(NUM_THREADS);
 
         int j;
         for (j = 0; j < NUM_THREADS; j++) {
@@ -1102,6 +1201,35 @@ malloc_test (void)
 
 #endif
 
+#ifndef __USER
+static int
+handle_cvbench (char * buf, void * priv)
+{
+    int n = nk_get_num_cpus() - 1;
+
+    sscanf(buf, "cvbench %d", &n);
+
+    // slot 0 is the broadcaster
+    n = n + 1;
+
+    if (n < 2 || n > NUM_THREADS) {
+        nk_vc_printf("cvbench [waiters], at most %d waiters\n", NUM_THREADS - 1);
+        return 0;
+    }
+
+    cvar_bcast_run(n, CONDVAR_LOOPS, 0);
+
+    return 0;
+}
+
+static struct shell_cmd_impl cvbench_impl = {
+    .cmd      = "cvbench",
+    .help_str = "cvbench [waiters]",
+    .handler  = handle_cvbench,
+};
+nk_register_shell_cmd(cvbench_impl);
+#endif
+
 void run_benchmarks(void);
 void 
 run_benchmarks(void)
@@ -28,6 +28,7 @@
 #include <nautilus/nautilus.h>
 #include <nautilus/thread.h>
 #include <nautilus/fiber.h>
+#include <nautilus/fiber_sync.h>
 #include <nautilus/scheduler.h>
 #include <nautilus/shell.h>
 #include <nautilus/vc.h>
@@ -406,6 +407,97 @@ void new_yield_2(void *i, void **o)
   nk_vc_printf("new_yield_2 finished.\n");
 }
 
+/* Pipeline of fibers connected by blocking primitives:
+ *   producer --chan--> SYNC_WORKERS workers --mutex/condvar--> coordinator
+ * Workers also pass through a semaphore-limited section, and the
+ * coordinator waits on a waitgroup for all of them to finish
+ */
+#define SYNC_WORKERS 16
+#define SYNC_ITEMS   1000
+#define SYNC_SLOTS   4
+
+struct sync_test_state {
+  nk_fiber_channel_t   chan;
+  nk_fiber_mutex_t     mutex;
+  nk_fiber_condvar_t   cond;
+  nk_fiber_semaphore_t sem;
+  nk_fiber_waitgroup_t wg;
+  uint64_t             sum;
+  uint64_t             done_items;
+  int                  in_section;
+  int                  max_in_section;
+};
+
+void sync_producer(void *i, void **o)
+{
+  struct sync_test_state *s = (struct sync_test_state *)i;
+  uint64_t n;
+  for (n = 1; n <= SYNC_ITEMS; n++) {
+    nk_fiber_channel_send(&s->chan, (void*)n);
+  }
+  nk_fiber_channel_close(&s->chan);
+}
+
+void sync_worker(void *i, void **o)
+{
+  struct sync_test_state *s = (struct sync_test_state *)i;
+  void *val;
+  while (!nk_fiber_channel_recv(&s->chan, &val)) {
+    nk_fiber_semaphore_down(&s->sem);
+    nk_fiber_mutex_lock(&s->mutex);
+    s->in_section++;
+    if (s->in_section > s->max_in_section) {
+      s->max_in_section = s->in_section;
+    }
+    nk_fiber_mutex_unlock(&s->mutex);
+    nk_fiber_yield();
+    nk_fiber_mutex_lock(&s->mutex);
+    s->in_section--;
+    s->sum += (uint64_t)val;
+    s->done_items++;
+    nk_fiber_condvar_signal(&s->cond);
+    nk_fiber_mutex_unlock(&s->mutex);
+    nk_fiber_semaphore_up(&s->sem);
+  }
+  nk_fiber_waitgroup_done(&s->wg);
+}
+
+void sync_coordinator(void *i, void **o)
+{
+  struct sync_test_state *s = (struct sync_test_state *)i;
+  nk_fiber_t *f;
+  int n;
+
+  nk_fiber_set_vc(vc);
+
+  nk_fiber_waitgroup_add(&s->wg, SYNC_WORKERS);
+  for (n = 0; n < SYNC_WORKERS; n++) {
+    nk_fiber_start(sync_worker, s, 0, 0, F_RAND_CPU, &f);
+  }
+  nk_fiber_start(sync_producer, s, 0, 0, F_RAND_CPU, &f);
+
+  nk_fiber_mutex_lock(&s->mutex);
+  while (s->done_items < SYNC_ITEMS) {
+    nk_fiber_condvar_wait(&s->cond, &s->mutex);
+  }
+  nk_fiber_mutex_unlock(&s->mutex);
+
+  nk_fiber_waitgroup_wait(&s->wg);
+
+  nk_vc_printf("fibersync: sum=%lu (expected %lu), max in section=%d (limit %d) => %s\n",
+               s->sum, (uint64_t)SYNC_ITEMS*(SYNC_ITEMS+1)/2,
+               s->max_in_section, SYNC_SLOTS,
+               (s->sum == (uint64_t)SYNC_ITEMS*(SYNC_ITEMS+1)/2 &&
+                s->max_in_section <= SYNC_SLOTS) ? "PASS" : "FAIL");
+
+  nk_fiber_channel_destroy(&s->chan);
+  nk_fiber_mutex_destroy(&s->mutex);
+  nk_fiber_condvar_destroy(&s->cond);
+  nk_fiber_semaphore_destroy(&s->sem);
+  nk_fiber_waitgroup_destroy(&s->wg);
+  free(s);
+}
+
 
 /******************* Test Wrappers *******************/
 
@@ -611,6 +703,31 @@ int test_new_yield(){
   return 0;
 }
 
+int test_fiber_sync(){
+  nk_fiber_t *coord;
+  struct sync_test_state *s = malloc(sizeof(*s));
+  if (!s) {
+    nk_vc_printf("test_fiber_sync() : Failed to allocate state\n");
+    return -1;
+  }
+  memset(s, 0, sizeof(*s));
+  vc = get_cur_thread()->vc;
+  if (nk_fiber_channel_init(&s->chan, SYNC_SLOTS)) {
+    nk_vc_printf("test_fiber_sync() : Failed to create channel\n");
+    free(s);
+    return -1;
+  }
+  nk_fiber_mutex_init(&s->mutex);
+  nk_fiber_condvar_init(&s->cond);
+  nk_fiber_semaphore_init(&s->sem, SYNC_SLOTS);
+  nk_fiber_waitgroup_init(&s->wg);
+  if (nk_fiber_start(sync_coordinator, s, 0, 0, F_CURR_CPU, &coord) < 0) {
+    nk_vc_printf("test_fiber_sync() : Fiber failed to start\n");
+    return -1;
+  }
+  return 0;
+}
+
 
 /******************* Test Handlers *******************/
 
@@ -748,6 +865,12 @@ static int handle_fibers12 (char *buf, void *priv)
   return 0;
 }
 
+static int handle_fibers13 (char *buf, void *priv)
+{
+  test_fiber_sync();
+  return 0;
+}
+
   
 /******************* Shell Structs ********************/
 
@@ -841,6 +964,12 @@ static struct shell_cmd_impl fibers_impl_new_yield = {
   .handler  = handle_fibers12,
 };
 
+static struct shell_cmd_impl fibers_impl_sync = {
+  .cmd      = "fibersync",
+  .help_str = "test fiber mutex/condvar/semaphore/waitgroup/channel",
+  .handler  = handle_fibers13,
+};
+
 /******************* Shell Commands *******************/
 
 nk_register_shell_cmd(fibers_impl1);
@@ -858,3 +987,4 @@ nk_register_shell_cmd(fibers_impl_all);
 nk_register_shell_cmd(fibers_impl_all_1);
 nk_register_shell_cmd(fibers_impl_all_2);
 nk_register_shell_cmd(fibers_impl_new_yield);
+nk_register_shell_cmd(fibers_impl_sync);
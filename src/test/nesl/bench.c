@@ -0,0 +1,161 @@
+#include <nautilus/nautilus.h>
+#include <nautilus/shell.h>
+#include <nautilus/scheduler.h>
+#include <rt/nesl/nesl.h>
+
+/*
+ * VCODE benchmark for serial vs parallel CVL
+ *
+ * Each op gets a program that builds an index vector of n elements
+ * in segs segments, and its keys and rank, and then does the op
+ * reps times.  The time of the same program with no reps, which is
+ * just the set up, is taken off.  The program leaves the sum of the
+ * result of the last rep, which is checked to be the same for the
+ * serial and parallel CVL.  The ops are all INT, so the sums must
+ * match exactly.
+ */
+
+#define DEFAULT_N     (1 << 22)
+#define DEFAULT_REPS  10
+
+static struct {
+    char *name;
+    char *code;                 // one rep, stack is [sd v keys perm]
+} ops[] = {
+    { "+",        "COPY 1 2\nCOPY 1 3\n+ INT\n" },
+    { "*",        "COPY 1 2\nCOPY 1 2\n* INT\n" },
+    { "+_SCAN",   "COPY 1 2\nCOPY 1 4\n+_SCAN INT\n" },
+    { "+_REDUCE", "COPY 1 2\nCOPY 1 4\n+_REDUCE INT\n" },
+    { "MAX_SCAN", "COPY 1 1\nCOPY 1 4\nMAX_SCAN INT\n" },
+    { "PERMUTE",  "COPY 1 2\nCOPY 1 1\nCOPY 1 5\nPERMUTE INT\n" },
+    { "RANK_UP",  "COPY 1 1\nCOPY 1 4\nRANK_UP INT\n" },
+};
+
+#define NUM_OPS (sizeof(ops) / sizeof(ops[0]))
+
+static char *make_program(int len, int segs, int op, int reps)
+{
+    int size = 2048 + reps * (strlen(ops[op].code) + 16);
+    char *p = malloc(size), *c = p;
+    int i;
+
+    if (!p) {
+        return 0;
+    }
+
+#define emit(fmt, args...) c += snprintf(c, size - (c - p), fmt, ##args)
+
+    emit("FUNC MAIN\n");
+    // segment descriptor of segs segments of len
+    emit("CONST INT %d\nCONST INT %d\nMAKE_SEGDES\nDIST INT\nMAKE_SEGDES\n", len, segs);
+    // index vector 0, 1, ... in each segment
+    emit("CONST INT 0\nCONST INT %d\nMAKE_SEGDES\nDIST INT\n", segs);
+    emit("CONST INT 1\nCONST INT %d\nMAKE_SEGDES\nDIST INT\n", segs);
+    emit("COPY 1 2\nINDEX\n");
+    // keys are a multiplicative hash of the index, perm sorts them
+    emit("CONST INT 40503\nCONST INT %d\nMAKE_SEGDES\nDIST INT\n", segs);
+    emit("COPY 1 2\nDIST INT\nCOPY 1 1\n* INT\n");
+    emit("COPY 1 0\nCOPY 1 3\nRANK_UP INT\n");
+
+    for (i = 0; i < reps; i++) {
+        emit("%s%s", ops[op].code, i < reps - 1 ? "POP 1 0\n" : "");
+    }
+    if (!reps) {
+        emit("COPY 1 0\n");    // stands in for the result
+    }
+
+    // sum of the result
+    emit("COPY 1 0\nLENGTH INT\nMAKE_SEGDES\n+_REDUCE INT\n");
+    emit("POP 4 1\nRET\n");
+
+#undef emit
+
+    return p;
+}
+
+static int run(char *code, unsigned vmem, uint64_t *ns, int *sum)
+{
+    uint64_t start = nk_sched_get_realtime();
+
+    if (nk_nesl_exec_opts(code, NK_NESL_QUIET, vmem)) {
+        return -1;
+    }
+
+    *ns = nk_sched_get_realtime() - start;
+
+    return nk_nesl_result_int(sum);
+}
+
+// time of reps of op, less the set up, and the sum it leaves
+static int time_op(int len, int segs, int op, int reps, unsigned vmem, uint64_t *ns, int *sum)
+{
+    char *base = make_program(len, segs, op, 0);
+    char *full = make_program(len, segs, op, reps);
+    uint64_t tb = 0, tf = 0;
+    int bsum, rc = -1;
+
+    if (base && full && !run(base, vmem, &tb, &bsum) && !run(full, vmem, &tf, sum)) {
+        *ns = tf > tb ? tf - tb : 0;
+        rc = 0;
+    }
+
+    free(base);
+    free(full);
+
+    return rc;
+}
+
+static int
+handle_neslbench (char * buf, void * priv)
+{
+    int n = DEFAULT_N, reps = DEFAULT_REPS, segs = 1;
+    uint64_t ser, par;
+    int ssum, psum;
+    unsigned vmem;
+    int i;
+
+    sscanf(buf, "neslbench %d %d %d", &n, &reps, &segs);
+
+    if (n < 1 || reps < 1 || segs < 1 || segs > n) {
+        nk_vc_printf("neslbench [n] [reps] [segs]\n");
+        return 0;
+    }
+
+    // vectors and scratch, in doubles
+    vmem = 8 * (unsigned)n + 1000000;
+
+    nk_vc_printf("neslbench: %d elements in %d segments, %d reps\n", n - n % segs, segs, reps);
+    nk_vc_printf("%-10s %12s %12s %8s\n", "op", "serial us", "parallel us", "speedup");
+
+    for (i = 0; i < NUM_OPS; i++) {
+        nk_nesl_set_parallel(0);
+        if (time_op(n / segs, segs, i, reps, vmem, &ser, &ssum)) {
+            nk_vc_printf("%s: failed\n", ops[i].name);
+            break;
+        }
+        if (nk_nesl_set_parallel(1)) {
+            nk_vc_printf("%-10s %12lu %12s\n", ops[i].name, ser / 1000, "-");
+            continue;
+        }
+        if (time_op(n / segs, segs, i, reps, vmem, &par, &psum)) {
+            nk_vc_printf("%s: failed\n", ops[i].name);
+            break;
+        }
+        nk_vc_printf("%-10s %12lu %12lu %5lu.%02lu\n", ops[i].name,
+                     ser / 1000, par / 1000,
+                     par ? ser / par : 0, par ? (ser * 100 / par) % 100 : 0);
+        if (ssum != psum) {
+            nk_vc_printf("%s: MISMATCH, serial sum %d, parallel sum %d\n",
+                         ops[i].name, ssum, psum);
+        }
+    }
+
+    return 0;
+}
+
+static struct shell_cmd_impl neslbench_impl = {
+    .cmd      = "neslbench",
+    .help_str = "neslbench [n] [reps] [segs]",
+    .handler  = handle_neslbench,
+};
+nk_register_shell_cmd(neslbench_impl);
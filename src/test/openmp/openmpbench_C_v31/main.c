@@ -11,7 +11,7 @@ int taskbench_main(int argc, char **argv);
 int syncbench_main(int argc, char **argv);
 
 
-int test_ompbench()
+int test_ompbench(char *which)
 {
     char *args[2];
 
@@ -19,21 +19,27 @@ int test_ompbench()
 
     args[1] = 0;
 
-#if 0
-    args[0]="arraybench";
-    arraybench_main(1, args);
-#endif
+    // arraybench is dominated by parallel region entry/exit cost
+    if (!strcmp(which,"array") || !strcmp(which,"all")) {
+	args[0]="arraybench";
+	arraybench_main(1, args);
+    }
 
-    args[0]="taskbench";
-    taskbench_main(1, args);
+    if (!strcmp(which,"task") || !strcmp(which,"all")) {
+	args[0]="taskbench";
+	taskbench_main(1, args);
+    }
 
 
-#if 0
-    args[0]="schedbench";
-    schedbench_main(1, args);
-    args[0]="syncbench";
-    syncbench_main(1, args);
-#endif
+    if (!strcmp(which,"sched") || !strcmp(which,"all")) {
+	args[0]="schedbench";
+	schedbench_main(1, args);
+    }
+
+    if (!strcmp(which,"sync") || !strcmp(which,"all")) {
+	args[0]="syncbench";
+	syncbench_main(1, args);
+    }
 
     nk_openmp_thread_deinit();
 
@@ -43,13 +49,25 @@ int test_ompbench()
 static int
 handle_ompb (char * buf, void * priv)
 {
-    test_ompbench();
+    char which[16];
+
+    if (sscanf(buf,"ompb %15s",which)!=1) {
+	strcpy(which,"task");
+    }
+
+    if (strcmp(which,"array") && strcmp(which,"task") && strcmp(which,"sched") &&
+	strcmp(which,"sync") && strcmp(which,"all")) {
+	nk_vc_printf("unknown benchmark %s\n",which);
+	return 0;
+    }
+
+    test_ompbench(which);
     return 0;
 }
 
 static struct shell_cmd_impl ompb_impl = {
     .cmd      = "ompb",
-    .help_str = "ompb",
+    .help_str = "ompb [task|array|sched|sync|all]",
     .handler  = handle_ompb,
 };
 nk_register_shell_cmd(ompb_impl);
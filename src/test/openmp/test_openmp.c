@@ -63,6 +63,70 @@ omp_nested (void)
 }
 
 
+static long fib(int n)
+{
+    long x, y;
+
+    if (n<2) {
+	return n;
+    }
+
+#pragma omp task shared(x) if(n>10)
+    x = fib(n-1);
+#pragma omp task shared(y) if(n>10)
+    y = fib(n-2);
+#pragma omp taskwait
+
+    return x+y;
+}
+
+static int
+omp_tasks (void)
+{
+    long f=0, sum=0, red=0;
+    int i, x=0, order=0;
+
+#pragma omp parallel num_threads(4)
+#pragma omp single
+    f = fib(20);
+    nk_vc_printf("fib(20)=%ld (%s)\n", f, f==6765 ? "ok" : "WRONG");
+
+#pragma omp parallel num_threads(4)
+#pragma omp single
+    for (i=0;i<100;i++) {
+#pragma omp task depend(inout:x) shared(x,order) firstprivate(i)
+	{
+	    if (x!=i) {
+		order++;
+	    }
+	    x++;
+	}
+    }
+    nk_vc_printf("dependence chain: %d tasks, %d out of order (%s)\n", x, order, x==100 && !order ? "ok" : "WRONG");
+
+#pragma omp parallel num_threads(4)
+#pragma omp single
+    {
+#pragma omp taskgroup task_reduction(+:sum)
+	for (i=1;i<=1000;i++) {
+#pragma omp task in_reduction(+:sum) firstprivate(i)
+	    sum += i;
+	}
+    }
+    nk_vc_printf("taskgroup reduction: %ld (%s)\n", sum, sum==500500 ? "ok" : "WRONG");
+
+#pragma omp parallel num_threads(4)
+#pragma omp single
+#pragma omp taskloop reduction(+:red) grainsize(10)
+    for (i=0;i<1000;i++) {
+	red += i;
+    }
+    nk_vc_printf("taskloop reduction: %ld (%s)\n", red, red==499500 ? "ok" : "WRONG");
+
+    return 0;
+}
+
+
 int 
 test_omp (void)
 {
@@ -72,6 +136,8 @@ test_omp (void)
     //     goto out;
     nk_vc_printf("Starting nested test\n");
     omp_nested();
+    nk_vc_printf("Starting task test\n");
+    omp_tasks();
 //out:
     nk_vc_printf("OMP test finished\n");
     nk_openmp_thread_deinit();
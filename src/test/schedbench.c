@@ -0,0 +1,164 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2020, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/thread.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/shell.h>
+#include <nautilus/vc.h>
+
+/*
+  Scheduler microbenchmark
+
+  For each runnable thread count n (1, 2, 4, ... max), n threads
+  bound to one CPU yield to each other in a loop while a driver
+  thread on the same CPU times a number of its own yields.  Every
+  yield is one pass through nk_sched_need_resched() and a context
+  switch, so cycles per switch against n shows how the aperiodic
+  run queue scales.
+*/
+
+#define DEFAULT_MAX    512
+#define DEFAULT_ROUNDS 200
+
+#define STACK_SIZE (PAGE_SIZE_4KB*4)
+
+static volatile int      bench_go;
+static volatile int      bench_stop;
+static volatile uint64_t bench_ready;
+static volatile uint64_t bench_switches;
+
+struct bench_arg {
+    uint64_t max;
+    uint64_t rounds;
+};
+
+static void spinner(void *in, void **out)
+{
+    __sync_fetch_and_add(&bench_ready,1);
+
+    while (!bench_go) {
+	nk_yield();
+    }
+
+    while (!bench_stop) {
+	nk_yield();
+	__sync_fetch_and_add(&bench_switches,1);
+    }
+}
+
+static int run_one(uint64_t n, uint64_t rounds)
+{
+    nk_thread_id_t tids[n];
+    uint64_t i, started, start, end, before, after;
+
+    bench_go = 0;
+    bench_stop = 0;
+    bench_ready = 0;
+    bench_switches = 0;
+
+    for (started=0;started<n;started++) {
+	if (nk_thread_start(spinner,0,0,0,STACK_SIZE,&tids[started],my_cpu_id())) {
+	    nk_vc_printf("schedbench: could only start %lu threads\n",started);
+	    break;
+	}
+    }
+
+    while (bench_ready<started) {
+	nk_yield();
+    }
+
+    bench_go = 1;
+
+    // let everyone get into the steady-state loop
+    for (i=0;i<rounds/10+1;i++) {
+	nk_yield();
+    }
+
+    before = bench_switches;
+    start = rdtsc();
+    for (i=0;i<rounds;i++) {
+	nk_yield();
+    }
+    end = rdtsc();
+    after = bench_switches;
+
+    bench_stop = 1;
+
+    for (i=0;i<started;i++) {
+	nk_join(tids[i],0);
+    }
+
+    // our own yields are switches too
+    after = after - before + rounds;
+
+    nk_vc_printf("%8lu %12lu %12lu\n", started, after, (end-start)/after);
+
+    return started==n ? 0 : -1;
+}
+
+static void driver(void *in, void **out)
+{
+    struct bench_arg *a = (struct bench_arg *)in;
+    uint64_t n;
+
+    nk_vc_printf("schedbench on cpu %d: %lu rounds per point\n", my_cpu_id(), a->rounds);
+    nk_vc_printf("%8s %12s %12s\n", "threads", "switches", "cycles/sw");
+
+    for (n=1;n<=a->max;n*=2) {
+	if (run_one(n,a->rounds)) {
+	    break;
+	}
+    }
+}
+
+static int
+handle_schedbench (char * buf, void * priv)
+{
+    struct bench_arg a = { .max = DEFAULT_MAX, .rounds = DEFAULT_ROUNDS };
+    nk_thread_id_t tid;
+    int cpu;
+
+    sscanf(buf,"schedbench %lu %lu",&a.max,&a.rounds);
+
+    if (!a.max || !a.rounds) {
+	nk_vc_printf("schedbench [maxthreads] [rounds]\n");
+	return 0;
+    }
+
+    // stay off the boot CPU if we can
+    cpu = nk_get_num_cpus()>1 ? 1 : 0;
+
+    if (nk_thread_start(driver,&a,0,0,0,&tid,cpu)) {
+	nk_vc_printf("schedbench: failed to start driver\n");
+	return 0;
+    }
+
+    nk_join(tid,0);
+
+    return 0;
+}
+
+static struct shell_cmd_impl schedbench_impl = {
+    .cmd      = "schedbench",
+    .help_str = "schedbench [maxthreads] [rounds]",
+    .handler  = handle_schedbench,
+};
+nk_register_shell_cmd(schedbench_impl);